@@ -8,7 +8,7 @@ fn bench_page_cache_init() -> u64 {
 }
 
 fn bench_page_cache_hash(strings: &[PathBuf]) -> u64 {
-    let mut page_cache = black_box(PageCache::new(black_box(100)));
+    let page_cache = black_box(PageCache::new(black_box(100)));
     let mut res = 0;
 
     for path in strings {
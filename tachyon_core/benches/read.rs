@@ -4,16 +4,12 @@ use pprof::{
     criterion::{Output, PProfProfiler},
     flamegraph::Options,
 };
-use std::{cell::RefCell, hint::black_box, iter::zip, rc::Rc};
-use tachyon_core::{tachyon_benchmarks::*, StreamId, ValueType, Version};
+use std::{hint::black_box, iter::zip, sync::Arc};
+use tachyon_core::{tachyon_benchmarks::*, StreamId, ValueType, CURRENT_VERSION};
 
 const NUM_ITEMS: u64 = 100000;
 
-fn bench_read_sequential_timestamps(
-    start: u64,
-    end: u64,
-    page_cache: Rc<RefCell<PageCache>>,
-) -> u64 {
+fn bench_read_sequential_timestamps(start: u64, end: u64, page_cache: Arc<PageCache>) -> u64 {
     let file_paths = vec!["../tmp/bench_sequential_read.ty".into()];
     let cursor = black_box(
         Cursor::new(
@@ -33,7 +29,7 @@ fn bench_read_sequential_timestamps(
     res
 }
 
-fn bench_read_voltage_dataset(page_cache: Rc<RefCell<PageCache>>) -> u128 {
+fn bench_read_voltage_dataset(page_cache: Arc<PageCache>) -> u128 {
     let file_paths = vec!["../tmp/bench_voltage_read.ty".into()];
     let cursor = black_box(
         Cursor::new(
@@ -71,12 +67,12 @@ fn read_from_csv(path: &str) -> (Vec<u64>, Vec<u64>) {
 
 fn sequential_benchmark(c: &mut Criterion) {
     // setup tachyon benchmark
-    let mut model = TimeDataFile::new(Version(0), StreamId(0), ValueType::UInteger64);
+    let mut model = TimeDataFile::new(CURRENT_VERSION, StreamId(0), ValueType::UInteger64);
     for i in 0..NUM_ITEMS {
         model.write_data_to_file_in_mem(i, (i + (i % 100)).into());
     }
     model.write("../tmp/bench_sequential_read.ty".into());
-    let page_cache = Rc::new(RefCell::new(PageCache::new(256)));
+    let page_cache = Arc::new(PageCache::new(256));
     c.bench_function(&format!("tachyon: read sequential 0-{}", NUM_ITEMS), |b| {
         b.iter(|| bench_read_sequential_timestamps(0, NUM_ITEMS, page_cache.clone()))
     });
@@ -84,11 +80,11 @@ fn sequential_benchmark(c: &mut Criterion) {
 }
 
 fn voltage_benchmark(c: &mut Criterion) {
-    let page_cache = Rc::new(RefCell::new(PageCache::new(256)));
+    let page_cache = Arc::new(PageCache::new(256));
 
     // set up voltage benchmark
     let (timestamps, values) = read_from_csv("../data/voltage_dataset.csv");
-    let mut model = TimeDataFile::new(Version(0), StreamId(0), ValueType::UInteger64);
+    let mut model = TimeDataFile::new(CURRENT_VERSION, StreamId(0), ValueType::UInteger64);
     for (ts, v) in zip(&timestamps, &values) {
         model.write_data_to_file_in_mem(*ts, (*v).into());
     }
@@ -3,15 +3,15 @@ use pprof::{
     criterion::{Output, PProfProfiler},
     flamegraph::Options,
 };
-use std::{cell::RefCell, hint::black_box, path::PathBuf, rc::Rc};
-use tachyon_core::{tachyon_benchmarks::*, StreamId, ValueType, Version};
+use std::{hint::black_box, path::PathBuf, sync::Arc};
+use tachyon_core::{tachyon_benchmarks::*, StreamId, ValueType, CURRENT_VERSION};
 
 const NUM_ITEMS: u64 = 10000000;
 
 fn bench_sum_sequential_timestamps(
     start: u64,
     end: u64,
-    page_cache: Rc<RefCell<PageCache>>,
+    page_cache: Arc<PageCache>,
     file_paths: Vec<PathBuf>,
 ) -> u64 {
     let mut cursor = black_box(
@@ -39,7 +39,7 @@ fn bench_sum_sequential_timestamps(
 fn bench_sum_sequential_timestamps_with_hint(
     start: u64,
     end: u64,
-    page_cache: Rc<RefCell<PageCache>>,
+    page_cache: Arc<PageCache>,
     file_paths: Vec<PathBuf>,
 ) -> u64 {
     let mut cursor = black_box(
@@ -67,25 +67,25 @@ fn bench_sum_sequential_timestamps_with_hint(
 
 fn criterion_benchmark(c: &mut Criterion) {
     // setup tachyon benchmark
-    let mut model = TimeDataFile::new(Version(0), StreamId(0), ValueType::UInteger64);
+    let mut model = TimeDataFile::new(CURRENT_VERSION, StreamId(0), ValueType::UInteger64);
     for i in 0..NUM_ITEMS / 3 {
         model.write_data_to_file_in_mem(i, (i + (i % 100)).into());
     }
     model.write("../tmp/bench_sequential_sum.ty".into());
 
-    let mut model = TimeDataFile::new(Version(0), StreamId(0), ValueType::UInteger64);
+    let mut model = TimeDataFile::new(CURRENT_VERSION, StreamId(0), ValueType::UInteger64);
     for i in NUM_ITEMS / 3..2 * NUM_ITEMS / 3 {
         model.write_data_to_file_in_mem(i, (100000 - i + (i % 10)).into());
     }
     model.write("../tmp/bench_sequential_sum_2.ty".into());
 
-    let mut model = TimeDataFile::new(Version(0), StreamId(0), ValueType::UInteger64);
+    let mut model = TimeDataFile::new(CURRENT_VERSION, StreamId(0), ValueType::UInteger64);
     for i in 2 * NUM_ITEMS / 3..NUM_ITEMS {
         model.write_data_to_file_in_mem(i, (9000 - i + (i % 10)).into());
     }
     model.write("../tmp/bench_sequential_sum_3.ty".into());
 
-    let page_cache = Rc::new(RefCell::new(PageCache::new(512)));
+    let page_cache = Arc::new(PageCache::new(512));
     let file_paths = vec![
         "../tmp/bench_sequential_sum.ty".into(),
         "../tmp/bench_sequential_sum_2.ty".into(),
@@ -5,13 +5,13 @@ use pprof::{
     flamegraph::Options,
 };
 use std::{hint::black_box, iter::zip, path::Path};
-use tachyon_core::{tachyon_benchmarks::*, StreamId, ValueType, Version};
+use tachyon_core::{tachyon_benchmarks::*, StreamId, ValueType, CURRENT_VERSION};
 
 const NUM_ITEMS: u64 = 100000;
 
 fn bench_write_sequential_timestamps(start: u64, end: u64) {
     let mut model = black_box(TimeDataFile::new(
-        black_box(Version(0)),
+        black_box(CURRENT_VERSION),
         black_box(StreamId(0)),
         black_box(ValueType::UInteger64),
     ));
@@ -24,7 +24,7 @@ fn bench_write_sequential_timestamps(start: u64, end: u64) {
 
 fn bench_write_dataset(timestamps: &[u64], values: &[u64], file: impl AsRef<Path>) {
     let mut model = black_box(TimeDataFile::new(
-        black_box(Version(0)),
+        black_box(CURRENT_VERSION),
         black_box(StreamId(0)),
         black_box(ValueType::UInteger64),
     ));
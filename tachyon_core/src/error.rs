@@ -52,4 +52,12 @@ pub enum ConnectionErr {
     StreamCreationErr { stream: String },
     #[error("Failed to get all streams.")]
     GetStreamsErr,
+    #[error("Expected exactly one stream to match: {stream}.")]
+    StreamResolutionErr { stream: String },
+    #[error("Failed to open the write-ahead log, the database may be in use: {db_dir}.")]
+    WalOpenErr { db_dir: PathBuf },
+    #[error("Only Float64 streams can have a tolerance, which must be positive: {stream}.")]
+    InvalidToleranceErr { stream: String },
+    #[error("Value cannot be stored within the tolerance of stream: {stream}.")]
+    ValueOutOfToleranceErr { stream: String },
 }
@@ -7,6 +7,7 @@ use crate::{Connection, ReturnType, Timestamp, ValueType, Vector};
 use promql_parser::label::Matchers;
 use std::cell::RefCell;
 use std::rc::Rc;
+use std::sync::Arc;
 use uuid::Uuid;
 
 pub struct VectorSelectNode {
@@ -14,7 +15,7 @@ pub struct VectorSelectNode {
     stream_idx: usize,
     cursor: Cursor,
     indexer: Rc<RefCell<Indexer>>,
-    page_cache: Rc<RefCell<PageCache>>,
+    page_cache: Arc<PageCache>,
     start: Timestamp,
     end: Timestamp,
     hint: ScanHint,
@@ -45,18 +46,19 @@ impl VectorSelectNode {
             });
         }
 
-        let stream_id = stream_ids[0];
-        // TODO: get rid of unwrap
-        let file_paths = conn
-            .indexer
-            .borrow()
-            .get_required_files(stream_id, start, end)
-            .unwrap();
+        let cursor = Self::create_cursor(
+            &conn.indexer.borrow(),
+            conn.page_cache.clone(),
+            stream_ids[0],
+            start,
+            end,
+            hint,
+        );
 
         Ok(Self {
             stream_ids,
             stream_idx: 0,
-            cursor: Cursor::new(file_paths, start, end, conn.page_cache.clone(), hint).unwrap(),
+            cursor,
             indexer: conn.indexer.clone(),
             page_cache: conn.page_cache.clone(),
             start,
@@ -64,6 +66,26 @@ impl VectorSelectNode {
             hint,
         })
     }
+
+    /// Creates a cursor over the files of a stream, telling it which one its writer may
+    /// still continue
+    fn create_cursor(
+        indexer: &Indexer,
+        page_cache: Arc<PageCache>,
+        stream_id: Uuid,
+        start: Timestamp,
+        end: Timestamp,
+        hint: ScanHint,
+    ) -> Cursor {
+        // TODO: get rid of unwrap
+        let file_paths = indexer.get_required_files(stream_id, start, end).unwrap();
+        let open_file = indexer
+            .get_open_files_for_stream_id(stream_id)
+            .unwrap()
+            .pop();
+
+        Cursor::new_with_open_file(file_paths, open_file, start, end, page_cache, hint).unwrap()
+    }
 }
 
 impl ExecutorNode for VectorSelectNode {
@@ -82,22 +104,14 @@ impl ExecutorNode for VectorSelectNode {
                 return None;
             }
 
-            let stream_id = self.stream_ids[self.stream_idx];
-            // TODO: get rid of unwrap
-            let file_paths = self
-                .indexer
-                .borrow()
-                .get_required_files(stream_id, self.start, self.end)
-                .unwrap();
-
-            self.cursor = Cursor::new(
-                file_paths,
+            self.cursor = Self::create_cursor(
+                &self.indexer.borrow(),
+                self.page_cache.clone(),
+                self.stream_ids[self.stream_idx],
                 self.start,
                 self.end,
-                self.page_cache.clone(),
                 self.hint,
-            )
-            .unwrap();
+            );
         }
         let res = self.cursor.fetch();
         self.cursor.next();
@@ -1,6 +1,7 @@
 use crate::{
     error::{print_error, TachyonErr},
-    Connection, Inserter, Query, ReturnType, Timestamp, Value, ValueType, Vector,
+    Connection, ConnectionOptions, Inserter, Query, ReturnType, Timestamp, Value, ValueType,
+    Vector,
 };
 use std::ffi::{c_char, c_void, CStr};
 
@@ -37,14 +38,37 @@ pub unsafe extern "C" fn tachyon_error_free(code: u8, ptr: *mut c_void) {
 /// Error data can be freed by using the function `tachyon_error_free`.
 #[no_mangle]
 pub unsafe extern "C" fn tachyon_open(db_dir: *const c_char, out: *mut *mut c_void) -> u8 {
+    tachyon_open_with_options(db_dir, &ConnectionOptions::default(), out)
+}
+
+#[no_mangle]
+pub extern "C" fn tachyon_connection_options_default() -> ConnectionOptions {
+    ConnectionOptions::default()
+}
+
+/// SAFETY: Same as `tachyon_open`. `options` must either be NULL, which uses the default options,
+/// or point to valid options, which can be initialized using the function
+/// `tachyon_connection_options_default`.
+#[no_mangle]
+pub unsafe extern "C" fn tachyon_open_with_options(
+    db_dir: *const c_char,
+    options: *const ConnectionOptions,
+    out: *mut *mut c_void,
+) -> u8 {
     let db_dir_res = CStr::from_ptr(db_dir)
         .to_str()
         .map_err(|err| TachyonErr::MiscErr {
             inner: Box::new(err),
         });
 
+    let options = if options.is_null() {
+        ConnectionOptions::default()
+    } else {
+        *options
+    };
+
     match db_dir_res {
-        Ok(db_dir) => match Connection::new(db_dir) {
+        Ok(db_dir) => match Connection::new_with_options(db_dir, options) {
             Ok(connection) => {
                 *out = Box::into_raw(Box::new(connection)) as *mut c_void;
                 0u8
@@ -169,11 +193,126 @@ pub unsafe extern "C" fn tachyon_inserter_insert_float64(
     (*inserter).insert_float64(timestamp, value);
 }
 
+/// SAFETY: `timestamps` and `values` must each point to `len` entries, unless `len` is 0.
+/// The caller is responsible for calling `tachyon_inserter_flush` after finishing all insertions.
+#[no_mangle]
+pub unsafe extern "C" fn tachyon_inserter_insert_batch_integer64(
+    inserter: *mut Inserter,
+    timestamps: *const Timestamp,
+    values: *const i64,
+    len: usize,
+) {
+    if len == 0 {
+        return;
+    }
+    (*inserter).insert_batch_integer64(
+        std::slice::from_raw_parts(timestamps, len),
+        std::slice::from_raw_parts(values, len),
+    );
+}
+
+/// SAFETY: `timestamps` and `values` must each point to `len` entries, unless `len` is 0.
+/// The caller is responsible for calling `tachyon_inserter_flush` after finishing all insertions.
+#[no_mangle]
+pub unsafe extern "C" fn tachyon_inserter_insert_batch_uinteger64(
+    inserter: *mut Inserter,
+    timestamps: *const Timestamp,
+    values: *const u64,
+    len: usize,
+) {
+    if len == 0 {
+        return;
+    }
+    (*inserter).insert_batch_uinteger64(
+        std::slice::from_raw_parts(timestamps, len),
+        std::slice::from_raw_parts(values, len),
+    );
+}
+
+/// SAFETY: `timestamps` and `values` must each point to `len` entries, unless `len` is 0.
+/// The caller is responsible for calling `tachyon_inserter_flush` after finishing all insertions.
+#[no_mangle]
+pub unsafe extern "C" fn tachyon_inserter_insert_batch_float64(
+    inserter: *mut Inserter,
+    timestamps: *const Timestamp,
+    values: *const f64,
+    len: usize,
+) {
+    if len == 0 {
+        return;
+    }
+    (*inserter).insert_batch_float64(
+        std::slice::from_raw_parts(timestamps, len),
+        std::slice::from_raw_parts(values, len),
+    );
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn tachyon_inserter_commit(inserter: *mut Inserter) {
+    (*inserter).commit();
+}
+
 #[no_mangle]
 pub unsafe extern "C" fn tachyon_inserter_flush(inserter: *mut Inserter) {
     (*inserter).flush();
 }
 
+/// Entries of one stream for `tachyon_insert_bulk`, each entry being `(timestamps[i], values[i])`
+#[repr(C)]
+pub struct StreamBatch {
+    pub stream: *const c_char,
+    pub timestamps: *const Timestamp,
+    pub values: *const Value,
+    pub len: usize,
+}
+
+/// SAFETY: `batches` must point to `len` batches, each with a valid `stream` and, unless its `len`
+/// is 0, `timestamps` and `values` pointing to `len` entries.
+/// On error (not code 0), this returns an error in the `out` parameter.
+/// The caller is responsible for freeing the returned pointer in `out`.
+/// Error data can be freed by using the function `tachyon_error_free`.
+#[no_mangle]
+pub unsafe extern "C" fn tachyon_insert_bulk(
+    connection: *mut Connection,
+    batches: *const StreamBatch,
+    len: usize,
+    out: *mut *mut c_void,
+) -> u8 {
+    let batches = if len == 0 {
+        &[]
+    } else {
+        std::slice::from_raw_parts(batches, len)
+    };
+    let batches_res: Result<Vec<(&str, &[Timestamp], &[Value])>, TachyonErr> = batches
+        .iter()
+        .map(|batch| {
+            let stream =
+                CStr::from_ptr(batch.stream)
+                    .to_str()
+                    .map_err(|err| TachyonErr::MiscErr {
+                        inner: Box::new(err),
+                    })?;
+            if batch.len == 0 {
+                return Ok((stream, &[][..], &[][..]));
+            }
+            Ok((
+                stream,
+                std::slice::from_raw_parts(batch.timestamps, batch.len),
+                std::slice::from_raw_parts(batch.values, batch.len),
+            ))
+        })
+        .collect();
+
+    match batches_res.and_then(|batches| (*connection).insert_bulk(&batches)) {
+        Ok(()) => 0u8,
+        Err(tachyon_err) => {
+            let return_value = get_error_code(&tachyon_err);
+            *out = Box::into_raw(Box::new(tachyon_err)) as *mut c_void;
+            return_value
+        }
+    }
+}
+
 /// SAFETY: On success (code 0), this returns a `Query *` in the `out` parameter. Otherwise, it returns an error.
 /// The caller is responsible for freeing the returned pointer in `out`.
 /// Success data can be freed using the function `tachyon_query_close`.
@@ -3,18 +3,21 @@
 use crate::execution::node::{ExecutorNode, TNode};
 use crate::query::indexer::Indexer;
 use crate::query::planner::QueryPlanner;
-use crate::storage::page_cache::PageCache;
+use crate::storage::file::Header;
+use crate::storage::page_cache::{PageCache, PAGE_SIZE};
 use crate::storage::writer::Writer;
-use error::{ConnectionErr, QueryErr, TachyonErr};
+use error::{ConnectionErr, IndexerErr, QueryErr, TachyonErr};
 use promql_parser::parser;
 use std::cell::RefCell;
 use std::cmp::Ordering;
-use std::collections::HashSet;
+use std::collections::{HashMap, HashSet};
 use std::fmt::{Debug, Display};
 use std::fs;
 use std::ops::{Add, Div, Mul, Rem, Sub};
 use std::path::Path;
 use std::rc::Rc;
+use std::sync::Arc;
+use std::time::Duration;
 use storage::writer::persistent_writer::PersistentWriter;
 use uuid::Uuid;
 
@@ -27,13 +30,20 @@ mod query;
 mod storage;
 mod utils;
 
+pub use storage::compression::{Codec, CodecPolicy};
+pub use storage::fields::{Field, FieldCursor};
+pub use storage::page_cache::{PageCache, PageCacheStats};
+pub use storage::wal::SyncPolicy;
+
 pub const FILE_EXTENSION: &str = "ty";
 
 #[derive(Clone, Copy, PartialEq, Eq, PartialOrd, Ord, Debug)]
 #[repr(transparent)]
 pub struct Version(pub u16);
 
-pub const CURRENT_VERSION: Version = Version(2);
+/// Version of the files written. Version 3 added the seek table offset, the codec and the
+/// tolerance to the header of .ty files, which older files are still read without.
+pub const CURRENT_VERSION: Version = Version(3);
 
 /// Encoded as a 128-bit UUID
 #[derive(Clone, Copy, PartialEq, Eq, Debug)]
@@ -372,16 +382,130 @@ pub struct Vector {
     pub value: Value,
 }
 
+/// Options for opening a connection
+#[derive(Clone, Copy, Debug)]
+#[repr(C)]
+pub struct ConnectionOptions {
+    /// Memory budget of the page cache in bytes, 0 for no byte limit
+    pub page_cache_bytes: usize,
+    /// Maximum number of page cache frames, 0 for no frame limit
+    pub page_cache_frames: usize,
+    /// Read sealed files through memory mappings instead of the page cache
+    pub mmap_reads: bool,
+    /// Memory budget in bytes for decoded blocks of sealed files, 0 to disable caching them
+    pub chunk_cache_bytes: usize,
+    /// How new files choose their codec
+    pub codec_policy: CodecPolicy,
+    /// When the entries logged to the write-ahead log are synced to disk
+    pub sync_policy: SyncPolicy,
+    /// Milliseconds between syncs with `SyncPolicy::Interval`
+    pub sync_interval_ms: u64,
+    /// Open the database only for queries, see `Connection::new_read_only_with_page_cache`
+    pub read_only: bool,
+}
+
+impl Default for ConnectionOptions {
+    fn default() -> Self {
+        Self {
+            page_cache_bytes: 64 * 1024 * 1024,
+            page_cache_frames: 0,
+            mmap_reads: true,
+            chunk_cache_bytes: 0,
+            codec_policy: CodecPolicy::Default,
+            sync_policy: SyncPolicy::PerBatch,
+            sync_interval_ms: 1000,
+            read_only: false,
+        }
+    }
+}
+
+impl ConnectionOptions {
+    /// Gets the number of page cache frames that fit in both limits (at least one)
+    fn page_cache_num_frames(&self) -> usize {
+        let budget_frames = match self.page_cache_bytes {
+            0 => usize::MAX,
+            bytes => bytes / PAGE_SIZE,
+        };
+        let max_frames = match self.page_cache_frames {
+            0 => usize::MAX,
+            frames => frames,
+        };
+
+        match budget_frames.min(max_frames) {
+            usize::MAX => Self::default().page_cache_num_frames(),
+            num_frames => num_frames.max(1),
+        }
+    }
+
+    /// Creates a page cache with these options that can be shared by several connections
+    pub fn create_page_cache(&self) -> Arc<PageCache> {
+        let page_cache = PageCache::new(self.page_cache_num_frames());
+        page_cache.set_mmap_reads(self.mmap_reads);
+        page_cache.set_chunk_cache_bytes(self.chunk_cache_bytes);
+        Arc::new(page_cache)
+    }
+}
+
 /// SAFETY: A connection is only single-threaded
 pub struct Connection {
-    page_cache: Rc<RefCell<PageCache>>,
+    page_cache: Arc<PageCache>,
     indexer: Rc<RefCell<Indexer>>,
     writer: Rc<RefCell<PersistentWriter>>,
+
+    insert_targets: HashMap<String, (Uuid, ValueType, f64)>, // Stream to ID, type, tolerance
 }
 
 impl Connection {
     /// Recursively creates the directories to `db_dir` if they do not exist
     pub fn new(db_dir: impl AsRef<Path>) -> Result<Self, TachyonErr> {
+        Self::new_with_options(db_dir, ConnectionOptions::default())
+    }
+
+    /// Recursively creates the directories to `db_dir` if they do not exist
+    pub fn new_with_options(
+        db_dir: impl AsRef<Path>,
+        options: ConnectionOptions,
+    ) -> Result<Self, TachyonErr> {
+        let page_cache = options.create_page_cache();
+        let connection = if options.read_only {
+            Self::new_read_only_with_page_cache(db_dir, page_cache)?
+        } else {
+            Self::new_with_page_cache(db_dir, page_cache)?
+        };
+        connection.set_codec_policy(options.codec_policy);
+        connection.set_sync_policy(
+            options.sync_policy,
+            Duration::from_millis(options.sync_interval_ms),
+        );
+        Ok(connection)
+    }
+
+    /// Recursively creates the directories to `db_dir` if they do not exist.
+    /// Reads go through `page_cache`, which may be shared with other connections and threads.
+    /// Entries a previous connection inserted without flushing are recovered from the
+    /// write-ahead log, which only one connection at a time may hold.
+    pub fn new_with_page_cache(
+        db_dir: impl AsRef<Path>,
+        page_cache: Arc<PageCache>,
+    ) -> Result<Self, TachyonErr> {
+        Self::open(db_dir, page_cache, false)
+    }
+
+    /// Opens the database only for queries, which may be done while another connection writes
+    /// to it. The write-ahead log is left to that connection, so the entries it has not written
+    /// to their files yet are not visible. Inserting through this connection panics.
+    pub fn new_read_only_with_page_cache(
+        db_dir: impl AsRef<Path>,
+        page_cache: Arc<PageCache>,
+    ) -> Result<Self, TachyonErr> {
+        Self::open(db_dir, page_cache, true)
+    }
+
+    fn open(
+        db_dir: impl AsRef<Path>,
+        page_cache: Arc<PageCache>,
+        read_only: bool,
+    ) -> Result<Self, TachyonErr> {
         fs::create_dir_all(&db_dir).map_err(|_| {
             TachyonErr::ConnectionErr(ConnectionErr::DatabaseCreationErr {
                 db_dir: db_dir.as_ref().to_path_buf(),
@@ -397,14 +521,25 @@ impl Connection {
             .create_store()
             .map_err(|err| TachyonErr::ConnectionErr(ConnectionErr::IndexerErr(err)))?;
 
+        let writer = if read_only {
+            PersistentWriter::new_read_only(db_dir, indexer.clone(), CURRENT_VERSION)
+        } else {
+            let mut writer = PersistentWriter::open(&db_dir, indexer.clone(), CURRENT_VERSION)
+                .map_err(|_| {
+                    TachyonErr::ConnectionErr(ConnectionErr::WalOpenErr {
+                        db_dir: db_dir.as_ref().to_path_buf(),
+                    })
+                })?;
+            writer.replay_wal();
+            writer
+        };
+
         Ok(Self {
-            page_cache: Rc::new(RefCell::new(PageCache::new(10))),
-            indexer: indexer.clone(),
-            writer: Rc::new(RefCell::new(PersistentWriter::new(
-                db_dir,
-                indexer,
-                CURRENT_VERSION,
-            ))),
+            page_cache,
+            indexer,
+            writer: Rc::new(RefCell::new(writer)),
+
+            insert_targets: HashMap::new(),
         })
     }
 
@@ -431,14 +566,88 @@ impl Connection {
         stream: impl AsRef<str>,
         value_type: ValueType,
     ) -> Result<(), TachyonErr> {
+        self.create_stream_with_tolerance(stream, value_type, 0.0)
+    }
+
+    /// Creates a stream whose `Float64` values are stored lossily, each within `tolerance` of
+    /// the value inserted, so that they compress as small integers. A `tolerance` of 0 stores
+    /// values exactly. Aggregates over n entries are within n * `tolerance` for sums and
+    /// `tolerance` for the other aggregates, see `get_stream_tolerance`. Inserting a value
+    /// whose quantization steps are not exact, such as NaN or infinity, fails.
+    pub fn create_stream_with_tolerance(
+        &mut self,
+        stream: impl AsRef<str>,
+        value_type: ValueType,
+        tolerance: f64,
+    ) -> Result<(), TachyonErr> {
+        if tolerance != 0.0
+            && (value_type != ValueType::Float64 || !tolerance.is_finite() || tolerance < 0.0)
+        {
+            return Err(TachyonErr::ConnectionErr(
+                ConnectionErr::InvalidToleranceErr {
+                    stream: stream.as_ref().to_string(),
+                },
+            ));
+        }
+
+        let stream_id = self.insert_stream_id(&stream, value_type)?;
+        if tolerance != 0.0 {
+            self.indexer
+                .borrow_mut()
+                .insert_stream_tolerance(stream_id, tolerance)
+                .map_err(|_| {
+                    TachyonErr::ConnectionErr(ConnectionErr::StreamCreationErr {
+                        stream: stream.as_ref().to_string(),
+                    })
+                })?;
+        }
+        self.writer.borrow_mut().create_stream(stream_id);
+
+        Ok(())
+    }
+
+    /// Creates a multi-field stream, whose entries have a value for each of `fields` and share
+    /// one timestamp column. Its value type is the value type of its first field.
+    pub fn create_field_stream(
+        &mut self,
+        stream: impl AsRef<str>,
+        fields: &[Field],
+    ) -> Result<(), TachyonErr> {
+        let mut names: Vec<&str> = fields.iter().map(|field| field.name.as_str()).collect();
+        names.sort_unstable();
+        names.dedup();
+        if fields.is_empty() || fields.len() > u8::MAX as usize || names.len() != fields.len() {
+            panic!("Multi-field streams must have between 1 and 255 uniquely named fields!");
+        }
+
+        let stream_id = self.insert_stream_id(&stream, fields[0].value_type)?;
+        self.indexer
+            .borrow_mut()
+            .insert_stream_fields(stream_id, fields)
+            .map_err(|_| {
+                TachyonErr::ConnectionErr(ConnectionErr::StreamCreationErr {
+                    stream: stream.as_ref().to_string(),
+                })
+            })?;
+        self.writer.borrow_mut().create_stream(stream_id);
+
+        Ok(())
+    }
+
+    fn insert_stream_id(
+        &mut self,
+        stream: impl AsRef<str>,
+        value_type: ValueType,
+    ) -> Result<Uuid, TachyonErr> {
         let selector = self.parse_stream(&stream);
 
         if !self.get_stream_ids_for_selector(&selector).is_empty() {
             panic!("Attempting to create a stream that already exists!");
         }
 
-        let stream_id = self
-            .indexer
+        // A new stream can match the selectors of the remembered insert targets
+        self.insert_targets.clear();
+        self.indexer
             .borrow_mut()
             .insert_new_id(
                 selector.name.as_ref().unwrap(),
@@ -449,10 +658,7 @@ impl Connection {
                 TachyonErr::ConnectionErr(ConnectionErr::StreamCreationErr {
                     stream: stream.as_ref().to_string(),
                 })
-            })?;
-        self.writer.borrow_mut().create_stream(stream_id);
-
-        Ok(())
+            })
     }
 
     pub fn delete_stream(&mut self, stream: impl AsRef<str>) {
@@ -472,14 +678,106 @@ impl Connection {
             .map_err(|_| TachyonErr::ConnectionErr(ConnectionErr::GetStreamsErr))
     }
 
-    pub fn prepare_insert(&mut self, stream: impl AsRef<str>) -> Inserter {
+    fn get_single_stream_id(&self, stream: impl AsRef<str>) -> Uuid {
         let stream_ids = self.get_stream_ids_for_selector(&self.parse_stream(stream.as_ref()));
 
         if stream_ids.len() != 1 {
             panic!("Invalid number of streams found in the database!");
         }
 
-        let stream_id = stream_ids.into_iter().next().unwrap();
+        stream_ids.into_iter().next().unwrap()
+    }
+
+    /// Sets how new files of streams without their own policy choose their codec
+    pub fn set_codec_policy(&self, policy: CodecPolicy) {
+        self.writer.borrow_mut().set_codec_policy(policy);
+    }
+
+    /// Sets when the entries logged to the write-ahead log are synced to disk, `interval` is only
+    /// used by `SyncPolicy::Interval`
+    pub fn set_sync_policy(&self, policy: SyncPolicy, interval: Duration) {
+        self.writer.borrow_mut().set_sync_policy(policy, interval);
+    }
+
+    /// Sets how new files of `stream` choose their codec, e.g. `CodecPolicy::Smallest` for
+    /// sparse events whose shape differs from the other streams. The policy is stored in the
+    /// indexer, so it applies to every later connection.
+    pub fn set_stream_codec_policy(
+        &self,
+        stream: impl AsRef<str>,
+        policy: CodecPolicy,
+    ) -> Result<(), TachyonErr> {
+        let stream_id = self.get_single_stream_id(stream);
+        self.indexer
+            .borrow_mut()
+            .insert_stream_codec_policy(stream_id, policy)
+            .map_err(ConnectionErr::from)?;
+
+        Ok(())
+    }
+
+    /// Gets the maximum absolute error of the values stored for `stream`, 0 if they are exact
+    pub fn get_stream_tolerance(&self, stream: impl AsRef<str>) -> f64 {
+        let stream_id = self.get_single_stream_id(stream);
+        self.indexer.borrow().get_stream_tolerance(stream_id)
+    }
+
+    /// Gets the fields of `stream`, None if it is not a multi-field stream
+    pub fn get_stream_fields(&self, stream: impl AsRef<str>) -> Option<Vec<Field>> {
+        let stream_id = self.get_single_stream_id(stream);
+        self.indexer.borrow().get_stream_fields(stream_id)
+    }
+
+    pub fn prepare_field_insert(&mut self, stream: impl AsRef<str>) -> FieldInserter {
+        let stream_id = self.get_single_stream_id(stream);
+
+        FieldInserter {
+            fields: self
+                .indexer
+                .borrow()
+                .get_stream_fields(stream_id)
+                .expect("Expected a multi-field stream!"),
+            stream_id,
+            writer: self.writer.clone(),
+        }
+    }
+
+    /// Prepares a cursor over the entries of a multi-field stream from `start` to `end`, which
+    /// only decodes the values of `fields`
+    pub fn prepare_field_query(
+        &mut self,
+        stream: impl AsRef<str>,
+        fields: &[impl AsRef<str>],
+        start: Option<Timestamp>,
+        end: Option<Timestamp>,
+    ) -> Result<FieldCursor, TachyonErr> {
+        let selector = self.parse_stream(&stream);
+        let stream_id = self.get_single_stream_id(&stream);
+        let (start, end) = (start.unwrap_or(0), end.unwrap_or(Timestamp::MAX));
+
+        let file_paths = self
+            .indexer
+            .borrow()
+            .get_required_files(stream_id, start, end)
+            .map_err(ConnectionErr::from)?;
+        if file_paths.is_empty() {
+            return Err(TachyonErr::QueryErr(QueryErr::NoStreamsMatchedErr {
+                name: selector.name.unwrap(),
+                matchers: selector.matchers,
+                start,
+                end,
+            }));
+        }
+
+        FieldCursor::new(file_paths, fields, start, end, self.page_cache.clone()).map_err(|err| {
+            TachyonErr::MiscErr {
+                inner: Box::new(err),
+            }
+        })
+    }
+
+    pub fn prepare_insert(&mut self, stream: impl AsRef<str>) -> Inserter {
+        let stream_id = self.get_single_stream_id(stream);
 
         Inserter {
             value_type: self
@@ -487,11 +785,103 @@ impl Connection {
                 .borrow()
                 .get_stream_value_type(stream_id)
                 .unwrap(),
+            tolerance: self.indexer.borrow().get_stream_tolerance(stream_id),
             stream_id,
             writer: self.writer.clone(),
         }
     }
 
+    /// Gets the ID, value type and tolerance of the single stream matching `stream`. Like an
+    /// `Inserter` keeps its stream, the connection remembers it for the following bulk inserts,
+    /// until a stream is created.
+    fn get_insert_target(&mut self, stream: &str) -> Result<(Uuid, ValueType, f64), TachyonErr> {
+        if let Some(target) = self.insert_targets.get(stream) {
+            return Ok(*target);
+        }
+
+        let stream_ids = self.get_stream_ids_for_selector(&self.parse_stream(stream));
+        if stream_ids.len() != 1 {
+            return Err(TachyonErr::ConnectionErr(
+                ConnectionErr::StreamResolutionErr {
+                    stream: stream.to_string(),
+                },
+            ));
+        }
+
+        let stream_id = stream_ids.into_iter().next().unwrap();
+        let value_type = self
+            .indexer
+            .borrow()
+            .get_stream_value_type(stream_id)
+            .unwrap();
+        let tolerance = self.indexer.borrow().get_stream_tolerance(stream_id);
+        self.insert_targets
+            .insert(stream.to_string(), (stream_id, value_type, tolerance));
+        Ok((stream_id, value_type, tolerance))
+    }
+
+    /// Inserts the `(stream, timestamps, values)` groups, each entry being
+    /// `(timestamps[i], values[i])`, with the values of the stream's value type.
+    /// The streams are all resolved and the values of streams with a tolerance are all checked
+    /// before anything is inserted, and the index updates of the files started and sealed are
+    /// committed in one transaction. The inserted entries are committed to the write-ahead log
+    /// together, like with `Inserter::commit`.
+    pub fn insert_bulk<S: AsRef<str>>(
+        &mut self,
+        batches: &[(S, &[Timestamp], &[Value])],
+    ) -> Result<(), TachyonErr> {
+        if batches
+            .iter()
+            .any(|(_, timestamps, values)| timestamps.len() != values.len())
+        {
+            panic!("Mismatched number of timestamps and values on insert!");
+        }
+
+        let indexer_err = |err| TachyonErr::ConnectionErr(ConnectionErr::IndexerErr(err));
+        let transaction = IndexerTransaction::begin(&self.indexer).map_err(indexer_err)?;
+
+        let targets: Result<Vec<_>, _> = batches
+            .iter()
+            .map(|(stream, _, values)| {
+                let target = self.get_insert_target(stream.as_ref())?;
+                let (_, value_type, tolerance) = target;
+                if value_type == ValueType::Float64
+                    && !values
+                        .iter()
+                        .all(|value| Header::can_quantize(tolerance, value.get_float64()))
+                {
+                    return Err(TachyonErr::ConnectionErr(
+                        ConnectionErr::ValueOutOfToleranceErr {
+                            stream: stream.as_ref().to_string(),
+                        },
+                    ));
+                }
+                Ok(target)
+            })
+            .collect();
+        if let Ok(targets) = &targets {
+            let mut writer = self.writer.borrow_mut();
+            for ((_, timestamps, values), (stream_id, value_type, _)) in batches.iter().zip(targets)
+            {
+                writer.write_batch(*stream_id, timestamps, values, *value_type);
+            }
+            writer.commit();
+        }
+
+        transaction.commit().map_err(indexer_err)?;
+        targets.map(|_| ())
+    }
+
+    /// Gets the hit, miss and eviction counters of the connection's page cache
+    pub fn page_cache_stats(&self) -> PageCacheStats {
+        self.page_cache.stats()
+    }
+
+    /// Gets the page cache of the connection, to share it with other connections
+    pub fn page_cache(&self) -> Arc<PageCache> {
+        self.page_cache.clone()
+    }
+
     pub fn prepare_query(
         &mut self,
         query: impl AsRef<str>,
@@ -510,8 +900,42 @@ impl Connection {
     }
 }
 
+/// A transaction of the indexer that is rolled back when dropped without being committed, so that
+/// a panic while it is open does not leave it open on the connection
+struct IndexerTransaction {
+    indexer: Rc<RefCell<Indexer>>,
+    committed: bool,
+}
+
+impl IndexerTransaction {
+    fn begin(indexer: &Rc<RefCell<Indexer>>) -> Result<Self, IndexerErr> {
+        indexer.borrow_mut().begin_transaction()?;
+        Ok(Self {
+            indexer: indexer.clone(),
+            committed: false,
+        })
+    }
+
+    fn commit(mut self) -> Result<(), IndexerErr> {
+        let result = self.indexer.borrow_mut().commit_transaction();
+        self.committed = result.is_ok();
+        result
+    }
+}
+
+impl Drop for IndexerTransaction {
+    fn drop(&mut self) {
+        if !self.committed {
+            if let Ok(mut indexer) = self.indexer.try_borrow_mut() {
+                let _ = indexer.rollback_transaction();
+            }
+        }
+    }
+}
+
 pub struct Inserter {
     value_type: ValueType,
+    tolerance: f64,
     stream_id: Uuid,
     writer: Rc<RefCell<PersistentWriter>>,
 }
@@ -533,12 +957,39 @@ macro_rules! create_inserter_insert {
     };
 }
 
+macro_rules! create_inserter_insert_batch {
+    ($function_name: ident, $type: ty, $value_type: expr) => {
+        /// Inserts the entries `(timestamps[i], values[i])` in order.
+        /// Precondition: `timestamps` and `values` have the same length
+        pub fn $function_name(&mut self, timestamps: &[crate::Timestamp], values: &[$type]) {
+            if self.value_type != $value_type {
+                panic!("Invalid value type on insert!");
+            }
+            if timestamps.len() != values.len() {
+                panic!("Mismatched number of timestamps and values on insert!");
+            }
+
+            // SAFETY: Value is a #[repr(C)] union of 8 byte primitives, with the layout of each
+            let values = unsafe {
+                std::slice::from_raw_parts(values.as_ptr() as *const crate::Value, values.len())
+            };
+            self.insert_batch(timestamps, values);
+        }
+    };
+}
+
 impl Inserter {
     pub fn value_type(&self) -> ValueType {
         self.value_type
     }
 
     fn insert(&mut self, timestamp: Timestamp, value: Value) {
+        if self.value_type == ValueType::Float64
+            && !Header::can_quantize(self.tolerance, value.get_float64())
+        {
+            panic!("Value cannot be stored within the stream's tolerance on insert!");
+        }
+
         self.writer
             .borrow_mut()
             .write(self.stream_id, timestamp, value, self.value_type);
@@ -548,6 +999,63 @@ impl Inserter {
     create_inserter_insert!(insert_uinteger64, u64, ValueType::UInteger64, uinteger64);
     create_inserter_insert!(insert_float64, f64, ValueType::Float64, float64);
 
+    fn insert_batch(&mut self, timestamps: &[Timestamp], values: &[Value]) {
+        if self.value_type == ValueType::Float64
+            && !values
+                .iter()
+                .all(|value| Header::can_quantize(self.tolerance, value.get_float64()))
+        {
+            panic!("Value cannot be stored within the stream's tolerance on insert!");
+        }
+
+        self.writer
+            .borrow_mut()
+            .write_batch(self.stream_id, timestamps, values, self.value_type);
+    }
+
+    create_inserter_insert_batch!(insert_batch_integer64, i64, ValueType::Integer64);
+    create_inserter_insert_batch!(insert_batch_uinteger64, u64, ValueType::UInteger64);
+    create_inserter_insert_batch!(insert_batch_float64, f64, ValueType::Float64);
+
+    /// Makes the entries inserted so far survive a crash as the connection's sync policy allows.
+    /// Unlike `flush`, this does not seal and reindex the open files.
+    pub fn commit(&mut self) {
+        self.writer.borrow_mut().commit();
+    }
+
+    pub fn flush(&mut self) {
+        self.writer.borrow_mut().flush_all();
+    }
+}
+
+pub struct FieldInserter {
+    fields: Vec<Field>,
+    stream_id: Uuid,
+    writer: Rc<RefCell<PersistentWriter>>,
+}
+
+impl FieldInserter {
+    pub fn fields(&self) -> &[Field] {
+        &self.fields
+    }
+
+    /// Inserts an entry with a value for every field, in the order of `fields`
+    pub fn insert(&mut self, timestamp: Timestamp, values: &[Value]) {
+        if values.len() != self.fields.len() {
+            panic!("Invalid number of values on insert!");
+        }
+
+        self.writer
+            .borrow_mut()
+            .write_fields(self.stream_id, timestamp, values, &self.fields);
+    }
+
+    /// Makes the entries inserted so far survive a crash as the connection's sync policy allows.
+    /// Unlike `flush`, this does not seal and index the open file.
+    pub fn commit(&mut self) {
+        self.writer.borrow_mut().commit();
+    }
+
     pub fn flush(&mut self) {
         self.writer.borrow_mut().flush_all();
     }
@@ -585,7 +1093,9 @@ pub mod tachyon_benchmarks {
 #[cfg(test)]
 mod tests {
     use crate::{
-        utils::test::set_up_dirs, Connection, Inserter, Query, ReturnType, Timestamp, Value,
+        error::{ConnectionErr, TachyonErr},
+        utils::test::set_up_dirs,
+        Connection, ConnectionOptions, Field, Inserter, Query, ReturnType, Timestamp, Value,
         ValueType,
     };
     use std::{borrow::Borrow, collections::HashSet, iter::zip, path::PathBuf};
@@ -1805,4 +2315,303 @@ mod tests {
             assert!(avgquery.next_scalar().is_none());
         }
     }
+
+    #[test]
+    fn test_connection_options_page_cache_frames() {
+        let options = |page_cache_bytes, page_cache_frames| ConnectionOptions {
+            page_cache_bytes,
+            page_cache_frames,
+            ..Default::default()
+        };
+
+        assert_eq!(options(40960, 0).page_cache_num_frames(), 10);
+        assert_eq!(options(0, 100).page_cache_num_frames(), 100);
+        assert_eq!(options(40960, 5).page_cache_num_frames(), 5);
+        assert_eq!(options(100, 0).page_cache_num_frames(), 1);
+        assert_eq!(
+            options(0, 0).page_cache_num_frames(),
+            ConnectionOptions::default().page_cache_num_frames()
+        );
+
+        set_up_dirs!(dirs, "db");
+        let conn = Connection::new_with_options(dirs[0].clone(), options(0, 100)).unwrap();
+        assert_eq!(conn.page_cache.capacity(), 100);
+    }
+
+    #[test]
+    fn test_shared_page_cache() {
+        set_up_dirs!(dirs, "db1", "db2");
+        let page_cache = ConnectionOptions::default().create_page_cache();
+        let mut conns = [
+            Connection::new_with_page_cache(dirs[0].clone(), page_cache.clone()).unwrap(),
+            Connection::new_with_page_cache(dirs[1].clone(), page_cache.clone()).unwrap(),
+        ];
+
+        for (i, conn) in conns.iter_mut().enumerate() {
+            let mut inserter = create_stream_helper(conn, r#"m{i = "0"}"#, ValueType::UInteger64);
+            inserter.insert(10, (i as u64).into());
+            inserter.flush();
+        }
+
+        for (i, conn) in conns.iter_mut().enumerate() {
+            let mut stmt = conn.prepare_query(r#"m{i = "0"}"#, None, None).unwrap();
+            let vector = stmt.next_vector().unwrap();
+            assert_eq!(vector.value.get_uinteger64(), i as u64);
+            assert!(stmt.next_vector().is_none());
+        }
+
+        assert!(std::sync::Arc::ptr_eq(&conns[0].page_cache(), &page_cache));
+        assert_eq!(conns[0].page_cache_stats(), conns[1].page_cache_stats());
+    }
+
+    #[test]
+    fn test_stream_with_tolerance() {
+        set_up_dirs!(dirs, "db");
+        let mut conn = Connection::new(dirs[0].clone()).unwrap();
+        conn.create_stream_with_tolerance("temperature", ValueType::Float64, 0.01)
+            .unwrap();
+        assert_eq!(conn.get_stream_tolerance("temperature"), 0.01);
+
+        let values: Vec<f64> = (0..1000).map(|i| 20.0 + (i as f64 / 30.0).sin()).collect();
+        let mut inserter = conn.prepare_insert("temperature");
+        for (t, v) in values.iter().enumerate() {
+            inserter.insert(t as Timestamp, (*v).into());
+        }
+        inserter.flush();
+
+        let mut stmt = conn.prepare_query("temperature", None, None).unwrap();
+        for v in &values {
+            let vector = stmt.next_vector().unwrap();
+            assert!((vector.value.get_float64() - v).abs() <= 0.01 + 1e-9);
+        }
+        assert!(stmt.next_vector().is_none());
+
+        let mut stmt = conn.prepare_query("sum(temperature)", None, None).unwrap();
+        let sum = stmt.next_scalar().unwrap().get_float64();
+        assert!((sum - values.iter().sum::<f64>()).abs() <= 0.01 * values.len() as f64);
+
+        // Invalid tolerances and values that cannot be stored within the tolerance are rejected
+        assert!(matches!(
+            conn.create_stream_with_tolerance("load", ValueType::UInteger64, 0.01),
+            Err(TachyonErr::ConnectionErr(
+                ConnectionErr::InvalidToleranceErr { .. }
+            ))
+        ));
+        assert!(conn
+            .create_stream_with_tolerance("load", ValueType::Float64, f64::NAN)
+            .is_err());
+        assert!(!conn.check_stream_exists("load"));
+        assert!(matches!(
+            conn.insert_bulk(&[(
+                "temperature",
+                &[1000, 1001][..],
+                &[20.0.into(), f64::NAN.into()][..]
+            )]),
+            Err(TachyonErr::ConnectionErr(
+                ConnectionErr::ValueOutOfToleranceErr { .. }
+            ))
+        ));
+    }
+
+    #[test]
+    fn test_recover_from_wal() {
+        set_up_dirs!(dirs, "db");
+        {
+            let mut conn = Connection::new(dirs[0].clone()).unwrap();
+            let mut inserter = create_stream_helper(
+                &mut conn,
+                r#"http_requests_total{service = "web"}"#,
+                ValueType::UInteger64,
+            );
+            for t in 0..1000u64 {
+                inserter.insert(t, (t * 3).into());
+            }
+            inserter.commit();
+            // The process crashes without flushing or dropping the connection
+            conn.writer.borrow_mut().crash();
+        }
+
+        let mut conn = Connection::new(dirs[0].clone()).unwrap();
+        let mut stmt = conn
+            .prepare_query(r#"http_requests_total{service = "web"}"#, None, None)
+            .unwrap();
+        for t in 0..1000u64 {
+            let vector = stmt.next_vector().unwrap();
+            assert_eq!(vector.timestamp, t);
+            assert_eq!(vector.value.get_uinteger64(), t * 3);
+        }
+        assert!(stmt.next_vector().is_none());
+    }
+
+    #[test]
+    fn test_read_only_connection() {
+        set_up_dirs!(dirs, "db");
+        let mut conn = Connection::new(dirs[0].clone()).unwrap();
+        let mut inserter = create_stream_helper(
+            &mut conn,
+            r#"http_requests_total{service = "web"}"#,
+            ValueType::UInteger64,
+        );
+        for t in 0..1000u64 {
+            inserter.insert(t, (t * 3).into());
+        }
+        inserter.flush();
+
+        // Only one connection may write while others query
+        assert!(matches!(
+            Connection::new(dirs[0].clone()),
+            Err(TachyonErr::ConnectionErr(ConnectionErr::WalOpenErr { .. }))
+        ));
+        let mut reader =
+            Connection::new_read_only_with_page_cache(dirs[0].clone(), conn.page_cache()).unwrap();
+        let mut stmt = reader
+            .prepare_query(r#"http_requests_total{service = "web"}"#, None, None)
+            .unwrap();
+        for t in 0..1000u64 {
+            let vector = stmt.next_vector().unwrap();
+            assert_eq!(vector.timestamp, t);
+            assert_eq!(vector.value.get_uinteger64(), t * 3);
+        }
+        assert!(stmt.next_vector().is_none());
+    }
+
+    #[test]
+    fn test_insert_batch() {
+        set_up_dirs!(dirs, "db");
+        let mut conn = Connection::new(dirs[0].clone()).unwrap();
+        let mut inserter = create_stream_helper(
+            &mut conn,
+            r#"temperature{room = "kitchen"}"#,
+            ValueType::Float64,
+        );
+
+        let timestamps: Vec<Timestamp> = (0..5000).collect();
+        let values: Vec<f64> = timestamps.iter().map(|t| *t as f64 * 0.25).collect();
+        inserter.insert_batch_float64(&timestamps[..1], &values[..1]);
+        inserter.insert_batch_float64(&timestamps[1..], &values[1..]);
+        inserter.flush();
+
+        let mut stmt = conn
+            .prepare_query(r#"temperature{room = "kitchen"}"#, None, None)
+            .unwrap();
+        for (t, v) in timestamps.iter().zip(&values) {
+            let vector = stmt.next_vector().unwrap();
+            assert_eq!(vector.timestamp, *t);
+            assert_eq!(vector.value.get_float64(), *v);
+        }
+        assert!(stmt.next_vector().is_none());
+    }
+
+    #[test]
+    fn test_insert_bulk() {
+        set_up_dirs!(dirs, "db");
+        let mut conn = Connection::new(dirs[0].clone()).unwrap();
+        let streams = [
+            r#"http_requests_total{service = "web"}"#,
+            r#"http_requests_total{service = "api"}"#,
+            r#"cpu_usage{host = "a"}"#,
+        ];
+        conn.create_stream(streams[0], ValueType::UInteger64)
+            .unwrap();
+        conn.create_stream(streams[1], ValueType::UInteger64)
+            .unwrap();
+        conn.create_stream(streams[2], ValueType::Float64).unwrap();
+
+        let timestamps: Vec<Timestamp> = (0..2000).collect();
+        let web: Vec<Value> = timestamps.iter().map(|t| (t * 2).into()).collect();
+        let api: Vec<Value> = timestamps.iter().map(|t| (t * 3).into()).collect();
+        let cpu: Vec<Value> = timestamps
+            .iter()
+            .map(|t| (*t as f64 / 8.0).into())
+            .collect();
+
+        // A scrape with a stream that does not exist inserts nothing
+        assert!(conn
+            .insert_bulk(&[
+                (streams[0], &timestamps[..1000], &web[..1000]),
+                (
+                    r#"http_requests_total{service = "db"}"#,
+                    &timestamps[..1000],
+                    &api[..1000]
+                ),
+            ])
+            .is_err());
+
+        for i in [0, 1000] {
+            conn.insert_bulk(&[
+                (streams[0], &timestamps[i..i + 1000], &web[i..i + 1000]),
+                (streams[1], &timestamps[i..i + 1000], &api[i..i + 1000]),
+                (streams[2], &timestamps[i..i + 1000], &cpu[i..i + 1000]),
+            ])
+            .unwrap();
+        }
+        drop(conn);
+
+        let mut conn = Connection::new(dirs[0].clone()).unwrap();
+        for (stream, values) in zip(streams, [&web, &api, &cpu]) {
+            let mut stmt = conn.prepare_query(stream, None, None).unwrap();
+            let value_type = stmt.value_type();
+            for (t, v) in zip(&timestamps, values) {
+                let vector = stmt.next_vector().unwrap();
+                assert_eq!(vector.timestamp, *t);
+                assert!(vector.value.eq_same(value_type, v));
+            }
+            assert!(stmt.next_vector().is_none());
+        }
+
+        // A stream created after a bulk insert can make its stream ambiguous
+        let (timestamp, value) = ([2000], [Value::from(0.5)]);
+        conn.insert_bulk(&[("cpu_usage", &timestamp[..], &value[..])])
+            .unwrap();
+        conn.create_stream(r#"cpu_usage{host = "b"}"#, ValueType::Float64)
+            .unwrap();
+        assert!(conn
+            .insert_bulk(&[("cpu_usage", &timestamp[..], &value[..])])
+            .is_err());
+    }
+
+    #[test]
+    fn test_field_stream() {
+        set_up_dirs!(dirs, "db");
+        let mut conn = Connection::new(dirs[0].clone()).unwrap();
+        let fields = [
+            Field::new("temperature", ValueType::Float64),
+            Field::new("humidity", ValueType::Float64),
+            Field::new("errors", ValueType::UInteger64),
+        ];
+        conn.create_field_stream(r#"device{id = "7"}"#, &fields)
+            .unwrap();
+        assert_eq!(
+            conn.get_stream_fields(r#"device{id = "7"}"#).unwrap(),
+            fields
+        );
+
+        let mut inserter = conn.prepare_field_insert(r#"device{id = "7"}"#);
+        for t in 0..1000u64 {
+            let values = [
+                (20.0 + (t % 7) as f64 * 0.5).into(),
+                (40.0 + (t % 3) as f64).into(),
+                (t / 100).into(),
+            ];
+            inserter.insert(t * 1000, &values);
+        }
+        inserter.flush();
+
+        let mut cursor = conn
+            .prepare_field_query(
+                r#"device{id = "7"}"#,
+                &["errors", "temperature"],
+                Some(500_000),
+                None,
+            )
+            .unwrap();
+        let mut t = 500;
+        while let Some((timestamp, values)) = cursor.next_row() {
+            assert_eq!(timestamp, t * 1000);
+            assert_eq!(values[0].get_uinteger64(), t / 100);
+            assert_eq!(values[1].get_float64(), 20.0 + (t % 7) as f64 * 0.5);
+            t += 1;
+        }
+        assert_eq!(t, 1000);
+    }
 }
@@ -1,5 +1,6 @@
 use crate::error::IndexerErr;
-use crate::{StreamSummaryType, Timestamp, ValueType};
+use crate::storage::fields::Field;
+use crate::{CodecPolicy, StreamSummaryType, Timestamp, ValueType};
 use promql_parser::label::Matchers;
 use std::collections::HashSet;
 use std::path::{Path, PathBuf};
@@ -9,8 +10,15 @@ trait IndexerStore {
     fn create_store(&mut self) -> Result<(), IndexerErr>;
     fn drop_store(&mut self) -> Result<(), IndexerErr>;
 
+    fn begin_transaction(&mut self) -> Result<(), IndexerErr>;
+    fn commit_transaction(&mut self) -> Result<(), IndexerErr>;
+    fn rollback_transaction(&mut self) -> Result<(), IndexerErr>;
+
     fn get_all_streams(&self) -> Result<Vec<StreamSummaryType>, IndexerErr>;
     fn get_value_type_for_stream_id(&self, stream_id: Uuid) -> Option<ValueType>;
+    fn get_tolerance_for_stream_id(&self, stream_id: Uuid) -> f64;
+    fn get_codec_policy_for_stream_id(&self, stream_id: Uuid) -> Option<CodecPolicy>;
+    fn get_fields_for_stream_id(&self, stream_id: Uuid) -> Option<Vec<Field>>;
 
     fn insert_new_id(
         &mut self,
@@ -18,6 +26,9 @@ trait IndexerStore {
         matchers: &Matchers,
         value_type: ValueType,
     ) -> Result<Uuid, IndexerErr>;
+    fn insert_tolerance(&mut self, id: Uuid, tolerance: f64) -> Result<(), IndexerErr>;
+    fn insert_codec_policy(&mut self, id: Uuid, policy: CodecPolicy) -> Result<(), IndexerErr>;
+    fn insert_fields(&mut self, id: Uuid, fields: &[Field]) -> Result<(), IndexerErr>;
     fn insert_new_file(
         &mut self,
         id: Uuid,
@@ -59,6 +70,9 @@ mod sqlite {
         const SQLITE_STREAM_TO_IDS_TABLE: &str = "stream_to_ids";
         const SQLITE_ID_TO_FILENAME_TABLE: &str = "id_to_file";
         const SQLITE_ID_TO_VALUE_TYPE_TABLE: &str = "id_to_value_type";
+        const SQLITE_ID_TO_TOLERANCE_TABLE: &str = "id_to_tolerance";
+        const SQLITE_ID_TO_CODEC_POLICY_TABLE: &str = "id_to_codec_policy";
+        const SQLITE_ID_TO_FIELDS_TABLE: &str = "id_to_fields";
 
         const SQLITE_STREAM_NAME_COLUMN: &str = "__name";
 
@@ -178,6 +192,48 @@ mod sqlite {
                 (),
             )?;
 
+            transaction.execute(
+                &format!(
+                    "
+                        CREATE TABLE IF NOT EXISTS {} (
+                            id TEXT,
+                            tolerance REAL,
+                            PRIMARY KEY (id)
+                        )
+                    ",
+                    Self::SQLITE_ID_TO_TOLERANCE_TABLE
+                ),
+                (),
+            )?;
+
+            transaction.execute(
+                &format!(
+                    "
+                        CREATE TABLE IF NOT EXISTS {} (
+                            id TEXT,
+                            codec_policy INTEGER,
+                            PRIMARY KEY (id)
+                        )
+                    ",
+                    Self::SQLITE_ID_TO_CODEC_POLICY_TABLE
+                ),
+                (),
+            )?;
+
+            transaction.execute(
+                &format!(
+                    "
+                        CREATE TABLE IF NOT EXISTS {} (
+                            id TEXT,
+                            fields TEXT,
+                            PRIMARY KEY (id)
+                        )
+                    ",
+                    Self::SQLITE_ID_TO_FIELDS_TABLE
+                ),
+                (),
+            )?;
+
             transaction.commit()?;
 
             Ok(())
@@ -204,11 +260,106 @@ mod sqlite {
                 (),
             )?;
 
+            transaction.execute(
+                &format!(
+                    "DROP TABLE IF EXISTS {}",
+                    Self::SQLITE_ID_TO_TOLERANCE_TABLE
+                ),
+                (),
+            )?;
+
+            transaction.execute(
+                &format!(
+                    "DROP TABLE IF EXISTS {}",
+                    Self::SQLITE_ID_TO_CODEC_POLICY_TABLE
+                ),
+                (),
+            )?;
+
+            transaction.execute(
+                &format!("DROP TABLE IF EXISTS {}", Self::SQLITE_ID_TO_FIELDS_TABLE),
+                (),
+            )?;
+
             transaction.commit()?;
 
             Ok(())
         }
 
+        fn begin_transaction(&mut self) -> Result<(), IndexerErr> {
+            self.conn.execute_batch("BEGIN")?;
+            Ok(())
+        }
+
+        fn commit_transaction(&mut self) -> Result<(), IndexerErr> {
+            self.conn.execute_batch("COMMIT")?;
+            Ok(())
+        }
+
+        fn rollback_transaction(&mut self) -> Result<(), IndexerErr> {
+            self.conn.execute_batch("ROLLBACK")?;
+            Ok(())
+        }
+
+        fn insert_tolerance(&mut self, id: Uuid, tolerance: f64) -> Result<(), IndexerErr> {
+            self.conn.execute(
+                &format!(
+                    "INSERT OR REPLACE INTO {} (id, tolerance) VALUES (?, ?)",
+                    Self::SQLITE_ID_TO_TOLERANCE_TABLE
+                ),
+                // SAFETY: should always be able to convert Uuid to String
+                (
+                    serde_json::to_string(&id).expect("Failed to serialize id."),
+                    tolerance,
+                ),
+            )?;
+
+            Ok(())
+        }
+
+        fn insert_codec_policy(&mut self, id: Uuid, policy: CodecPolicy) -> Result<(), IndexerErr> {
+            self.conn.execute(
+                &format!(
+                    "INSERT OR REPLACE INTO {} (id, codec_policy) VALUES (?, ?)",
+                    Self::SQLITE_ID_TO_CODEC_POLICY_TABLE
+                ),
+                // SAFETY: should always be able to convert Uuid to String
+                (
+                    serde_json::to_string(&id).expect("Failed to serialize id."),
+                    policy as u8,
+                ),
+            )?;
+
+            Ok(())
+        }
+
+        fn insert_fields(&mut self, id: Uuid, fields: &[Field]) -> Result<(), IndexerErr> {
+            let fields: Vec<(&str, u8, u8)> = fields
+                .iter()
+                .map(|field| {
+                    (
+                        field.name.as_str(),
+                        field.value_type as u8,
+                        field.codec as u8,
+                    )
+                })
+                .collect();
+
+            self.conn.execute(
+                &format!(
+                    "INSERT OR REPLACE INTO {} (id, fields) VALUES (?, ?)",
+                    Self::SQLITE_ID_TO_FIELDS_TABLE
+                ),
+                // SAFETY: should always be able to convert Uuid and fields to String
+                (
+                    serde_json::to_string(&id).expect("Failed to serialize id."),
+                    serde_json::to_string(&fields).expect("Failed to serialize fields."),
+                ),
+            )?;
+
+            Ok(())
+        }
+
         fn insert_new_id(
             &mut self,
             stream: &str,
@@ -366,6 +517,73 @@ mod sqlite {
                 )
         }
 
+        fn get_tolerance_for_stream_id(&self, stream_id: Uuid) -> f64 {
+            self.conn
+                .query_row(
+                    &format!(
+                        "SELECT tolerance FROM {} WHERE id = ?",
+                        Self::SQLITE_ID_TO_TOLERANCE_TABLE
+                    ),
+                    // SAFETY: should always be able to convert UUID to string
+                    [serde_json::to_string(&stream_id).expect("Failed to serialize stream_id")],
+                    |row| row.get::<usize, f64>(0),
+                )
+                .unwrap_or(0.0)
+        }
+
+        fn get_codec_policy_for_stream_id(&self, stream_id: Uuid) -> Option<CodecPolicy> {
+            self.conn
+                .query_row(
+                    &format!(
+                        "SELECT codec_policy FROM {} WHERE id = ?",
+                        Self::SQLITE_ID_TO_CODEC_POLICY_TABLE
+                    ),
+                    // SAFETY: should always be able to convert UUID to string
+                    [serde_json::to_string(&stream_id).expect("Failed to serialize stream_id")],
+                    |row| row.get::<usize, u8>(0),
+                )
+                .ok()
+                // SAFETY: codec_policy should convert into CodecPolicy, if it doesn't we stored it wrong
+                .map(|policy| {
+                    policy
+                        .try_into()
+                        .expect("Value in codec_policy column is invalid")
+                })
+        }
+
+        fn get_fields_for_stream_id(&self, stream_id: Uuid) -> Option<Vec<Field>> {
+            let fields = self
+                .conn
+                .query_row(
+                    &format!(
+                        "SELECT fields FROM {} WHERE id = ?",
+                        Self::SQLITE_ID_TO_FIELDS_TABLE
+                    ),
+                    // SAFETY: should always be able to convert UUID to string
+                    [serde_json::to_string(&stream_id).expect("Failed to serialize stream_id")],
+                    |row| row.get::<usize, String>(0),
+                )
+                .ok()?;
+
+            // SAFETY: the fields column should always be valid JSON, if it isn't we stored it wrong
+            let fields: Vec<(String, u8, u8)> =
+                serde_json::from_str(&fields).expect("Value in fields column is invalid");
+            Some(
+                fields
+                    .into_iter()
+                    .map(|(name, value_type, codec)| {
+                        Field::with_codec(
+                            name,
+                            value_type
+                                .try_into()
+                                .expect("Value in fields column is invalid"),
+                            codec.try_into().expect("Value in fields column is invalid"),
+                        )
+                    })
+                    .collect(),
+            )
+        }
+
         fn get_all_streams(&self) -> Result<Vec<StreamSummaryType>, IndexerErr> {
             let mut stmt = self.conn.prepare_cached(&format!(
                 "SELECT id, value_type FROM {}",
@@ -451,6 +669,21 @@ impl Indexer {
         self.store.drop_store()
     }
 
+    /// Groups the statements run until `commit_transaction` into one transaction, so that they
+    /// are committed together with a single sync instead of one sync each
+    pub fn begin_transaction(&mut self) -> Result<(), IndexerErr> {
+        self.store.begin_transaction()
+    }
+
+    pub fn commit_transaction(&mut self) -> Result<(), IndexerErr> {
+        self.store.commit_transaction()
+    }
+
+    /// Discards the statements run since `begin_transaction`
+    pub fn rollback_transaction(&mut self) -> Result<(), IndexerErr> {
+        self.store.rollback_transaction()
+    }
+
     pub fn insert_new_id(
         &mut self,
         stream: &str,
@@ -464,6 +697,40 @@ impl Indexer {
         self.store.get_value_type_for_stream_id(id)
     }
 
+    /// Sets the maximum absolute error of the float values stored for a stream
+    pub fn insert_stream_tolerance(&mut self, id: Uuid, tolerance: f64) -> Result<(), IndexerErr> {
+        self.store.insert_tolerance(id, tolerance)
+    }
+
+    /// Gets the maximum absolute error of the float values stored for a stream, 0 if exact
+    pub fn get_stream_tolerance(&self, id: Uuid) -> f64 {
+        self.store.get_tolerance_for_stream_id(id)
+    }
+
+    /// Sets how new files of a stream choose their codec, overriding the writer's default
+    pub fn insert_stream_codec_policy(
+        &mut self,
+        id: Uuid,
+        policy: CodecPolicy,
+    ) -> Result<(), IndexerErr> {
+        self.store.insert_codec_policy(id, policy)
+    }
+
+    /// Gets how new files of a stream choose their codec, None if the stream has no policy
+    pub fn get_stream_codec_policy(&self, id: Uuid) -> Option<CodecPolicy> {
+        self.store.get_codec_policy_for_stream_id(id)
+    }
+
+    /// Sets the value columns of a multi-field stream
+    pub fn insert_stream_fields(&mut self, id: Uuid, fields: &[Field]) -> Result<(), IndexerErr> {
+        self.store.insert_fields(id, fields)
+    }
+
+    /// Gets the value columns of a stream, None if it is not a multi-field stream
+    pub fn get_stream_fields(&self, id: Uuid) -> Option<Vec<Field>> {
+        self.store.get_fields_for_stream_id(id)
+    }
+
     pub fn insert_new_file(
         &mut self,
         id: Uuid,
@@ -535,8 +802,9 @@ impl Indexer {
 #[cfg(test)]
 mod tests {
     use super::Indexer;
+    use crate::storage::fields::Field;
     use crate::utils::test::set_up_dirs;
-    use crate::ValueType;
+    use crate::{CodecPolicy, ValueType};
     use promql_parser::label::{MatchOp, Matcher, Matchers};
     use std::collections::HashSet;
     use std::path::PathBuf;
@@ -690,6 +958,27 @@ mod tests {
             indexer.get_stream_value_type(s3id),
             Some(ValueType::Float64)
         );
+
+        indexer.insert_stream_tolerance(s3id, 0.01).unwrap();
+        assert_eq!(indexer.get_stream_tolerance(s1id), 0.0);
+        assert_eq!(indexer.get_stream_tolerance(s3id), 0.01);
+
+        indexer
+            .insert_stream_codec_policy(s2id, CodecPolicy::Smallest)
+            .unwrap();
+        assert_eq!(indexer.get_stream_codec_policy(s1id), None);
+        assert_eq!(
+            indexer.get_stream_codec_policy(s2id),
+            Some(CodecPolicy::Smallest)
+        );
+
+        let fields = [
+            Field::new("a", ValueType::Float64),
+            Field::new("b", ValueType::UInteger64),
+        ];
+        indexer.insert_stream_fields(s3id, &fields).unwrap();
+        assert_eq!(indexer.get_stream_fields(s1id), None);
+        assert_eq!(indexer.get_stream_fields(s3id).unwrap(), fields);
     }
 
     #[test]
@@ -746,4 +1035,66 @@ mod tests {
         assert_eq!(all_streams[1].2, ValueType::Integer64);
         assert_eq!(all_streams[2].2, ValueType::Float64);
     }
+
+    #[test]
+    fn test_transaction() {
+        set_up_dirs!(dirs, "db");
+
+        let mut indexer = Indexer::new(dirs[0].clone()).unwrap();
+        indexer.drop_store().unwrap();
+        indexer.create_store().unwrap();
+
+        let matchers = Matchers::new(vec![Matcher::new(MatchOp::Equal, "a", "b")]);
+        let id = indexer
+            .insert_new_id("str", &matchers, ValueType::UInteger64)
+            .unwrap();
+
+        let file1 = PathBuf::from(format!("{}/{}/file1.ty", dirs[0].to_str().unwrap(), id));
+        let file2 = PathBuf::from(format!("{}/{}/file2.ty", dirs[0].to_str().unwrap(), id));
+        indexer.begin_transaction().unwrap();
+        indexer.insert_new_file(id, &file1, 1, None).unwrap();
+        indexer.insert_or_replace_file(id, &file1, 1, 4).unwrap();
+        indexer.insert_new_file(id, &file2, 5, None).unwrap();
+        // Reads within the transaction see its writes
+        assert_eq!(
+            indexer.get_open_files_for_stream_id(id).unwrap(),
+            Vec::from([file2.clone()])
+        );
+        indexer.commit_transaction().unwrap();
+
+        // The transaction is committed for other connections
+        let indexer = Indexer::new(dirs[0].clone()).unwrap();
+        let mut filenames = indexer.get_required_files(id, 0, 10).unwrap();
+        filenames.sort();
+        assert_eq!(filenames, Vec::from([file1, file2]));
+    }
+
+    #[test]
+    fn test_rollback_transaction() {
+        set_up_dirs!(dirs, "db");
+
+        let mut indexer = Indexer::new(dirs[0].clone()).unwrap();
+        indexer.drop_store().unwrap();
+        indexer.create_store().unwrap();
+
+        let matchers = Matchers::new(vec![Matcher::new(MatchOp::Equal, "a", "b")]);
+        let id = indexer
+            .insert_new_id("str", &matchers, ValueType::UInteger64)
+            .unwrap();
+
+        let file = PathBuf::from(format!("{}/{}/file1.ty", dirs[0].to_str().unwrap(), id));
+        indexer.begin_transaction().unwrap();
+        indexer.insert_new_file(id, &file, 1, None).unwrap();
+        indexer.rollback_transaction().unwrap();
+        assert!(indexer.get_open_files_for_stream_id(id).unwrap().is_empty());
+
+        // The connection can start a new transaction
+        indexer.begin_transaction().unwrap();
+        indexer.insert_new_file(id, &file, 1, None).unwrap();
+        indexer.commit_transaction().unwrap();
+        assert_eq!(
+            indexer.get_open_files_for_stream_id(id).unwrap(),
+            Vec::from([file])
+        );
+    }
 }
@@ -0,0 +1,166 @@
+use super::page_cache::FileId;
+use crate::Timestamp;
+use rustc_hash::FxHashMap;
+use std::collections::BTreeMap;
+use std::mem::size_of;
+use std::sync::{Arc, Mutex};
+
+/// Decoded entries of one block of a sealed file, between two seek table entries.
+/// Values are the raw 64 bits of a `Value`.
+pub struct DecodedChunk {
+    pub timestamps: Vec<Timestamp>,
+    pub values: Vec<u64>,
+}
+
+impl DecodedChunk {
+    pub fn len(&self) -> usize {
+        self.timestamps.len()
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.timestamps.is_empty()
+    }
+
+    fn size_bytes(&self) -> usize {
+        size_of::<Self>() + self.len() * (size_of::<Timestamp>() + size_of::<u64>())
+    }
+}
+
+struct ChunkCacheInner {
+    capacity_bytes: usize,
+    size_bytes: usize,
+
+    /// Chunk and the sequence number of its last use
+    chunks: FxHashMap<(FileId, u32), (Arc<DecodedChunk>, u64)>,
+    /// Chunks by the sequence number of their last use, least recently used first
+    lru: BTreeMap<u64, (FileId, u32)>,
+    seq: u64,
+}
+
+/// LRU cache of decoded blocks of sealed files, keyed by file id and block ordinal.
+/// Blocks of frequently queried streams are then decompressed once instead of on every query.
+/// A capacity of 0 disables the cache.
+pub struct ChunkCache {
+    inner: Mutex<ChunkCacheInner>,
+}
+
+impl ChunkCache {
+    pub fn new(capacity_bytes: usize) -> Self {
+        Self {
+            inner: Mutex::new(ChunkCacheInner {
+                capacity_bytes,
+                size_bytes: 0,
+                chunks: FxHashMap::default(),
+                lru: BTreeMap::new(),
+                seq: 0,
+            }),
+        }
+    }
+
+    pub fn is_enabled(&self) -> bool {
+        self.inner.lock().unwrap().capacity_bytes > 0
+    }
+
+    pub fn set_capacity(&self, capacity_bytes: usize) {
+        let mut inner = self.inner.lock().unwrap();
+        inner.capacity_bytes = capacity_bytes;
+        inner.evict_to(capacity_bytes);
+    }
+
+    pub fn get(&self, file_id: FileId, block: u32) -> Option<Arc<DecodedChunk>> {
+        let mut inner = self.inner.lock().unwrap();
+        inner.seq += 1;
+        let seq = inner.seq;
+
+        let (chunk, last_use) = inner.chunks.get_mut(&(file_id, block))?;
+        let chunk = chunk.clone();
+        let old_seq = std::mem::replace(last_use, seq);
+        inner.lru.remove(&old_seq);
+        inner.lru.insert(seq, (file_id, block));
+
+        Some(chunk)
+    }
+
+    /// Inserts a chunk, evicting the least recently used chunks to stay within the capacity
+    pub fn insert(&self, file_id: FileId, block: u32, chunk: Arc<DecodedChunk>) {
+        let mut inner = self.inner.lock().unwrap();
+        let chunk_size = chunk.size_bytes();
+        if chunk_size > inner.capacity_bytes || inner.chunks.contains_key(&(file_id, block)) {
+            return;
+        }
+
+        let capacity_bytes = inner.capacity_bytes;
+        inner.evict_to(capacity_bytes - chunk_size);
+
+        inner.seq += 1;
+        let seq = inner.seq;
+        inner.chunks.insert((file_id, block), (chunk, seq));
+        inner.lru.insert(seq, (file_id, block));
+        inner.size_bytes += chunk_size;
+    }
+
+    /// Number of chunks held by the cache
+    pub fn len(&self) -> usize {
+        self.inner.lock().unwrap().chunks.len()
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.len() == 0
+    }
+}
+
+impl ChunkCacheInner {
+    fn evict_to(&mut self, size_bytes: usize) {
+        while self.size_bytes > size_bytes {
+            let (_, key) = self.lru.pop_first().unwrap();
+            let (chunk, _) = self.chunks.remove(&key).unwrap();
+            self.size_bytes -= chunk.size_bytes();
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::{ChunkCache, DecodedChunk};
+    use std::sync::Arc;
+
+    fn chunk(len: u64) -> Arc<DecodedChunk> {
+        Arc::new(DecodedChunk {
+            timestamps: (0..len).collect(),
+            values: (0..len).map(|i| i * 2).collect(),
+        })
+    }
+
+    #[test]
+    fn test_lru_eviction() {
+        let chunk_size = chunk(100).size_bytes();
+        let cache = ChunkCache::new(3 * chunk_size);
+
+        for block in 0..3 {
+            cache.insert(0, block, chunk(100));
+        }
+        assert_eq!(cache.len(), 3);
+
+        // Block 0 becomes the most recently used, so block 1 is evicted first
+        assert_eq!(cache.get(0, 0).unwrap().values[10], 20);
+        cache.insert(1, 0, chunk(100));
+        assert_eq!(cache.len(), 3);
+        assert!(cache.get(0, 1).is_none());
+        assert!(cache.get(0, 0).is_some());
+        assert!(cache.get(0, 2).is_some());
+        assert!(cache.get(1, 0).is_some());
+
+        // Chunks larger than the whole cache are not cached
+        cache.insert(2, 0, chunk(1000));
+        assert!(cache.get(2, 0).is_none());
+        assert_eq!(cache.len(), 3);
+
+        cache.set_capacity(chunk_size);
+        assert_eq!(cache.len(), 1);
+        assert!(cache.get(1, 0).is_some());
+
+        cache.set_capacity(0);
+        assert!(cache.is_empty());
+        assert!(!cache.is_enabled());
+    }
+}
@@ -0,0 +1,439 @@
+/*
+    Adaptive lossless floating-point compression:
+    https://dl.acm.org/doi/10.1145/3626717
+
+    Floats that were decimals with a few fractional digits become integers when multiplied by
+    a power of ten, so they are stored as those integers and bit-packed with frame-of-reference.
+
+    Entries are encoded in blocks of V3_BLOCK_SIZE entries:
+
+    | body length (u16 LE) | timestamp stream | value stream |
+
+    The timestamp stream is a V3 stream of the zig-zag encoded double deltas. The value stream
+    holds the values of the block:
+
+    | exponent (u8) | number of exceptions (u8) | integer stream | exceptions |
+
+    - Every value v is stored as the integer n = round(v * 10^exponent), mapped to u64 while
+      keeping its order, in a V3 stream, and is decoded as n / 10^exponent.
+    - The exponent is chosen to minimize the size of the stream, trading the values that fail
+      to decode exactly against the width of the integers.
+    - Values that fail are exceptions, stored as (index u8, bits u64 LE). Their integer is
+      replaced by a neighbour so they do not widen the packed integers.
+
+    Decoding a block only unpacks, converts and divides, with no dependency between entries.
+    A partially filled last block is padded with its last value.
+*/
+
+use std::io::{Read, Write};
+
+use crate::{
+    storage::{
+        compression::{
+            int::{IntCompressionUtils, V3Utils, V3_BLOCK_SIZE},
+            CompressionEngine, DecoderState, DecompressionEngine,
+        },
+        file::{Header, TimeDataFile},
+    },
+    Timestamp,
+};
+
+const ALP_MAX_EXPONENT: usize = 18;
+const ALP_POW10: [f64; ALP_MAX_EXPONENT + 1] = [
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16,
+    1e17, 1e18,
+];
+
+/// Maps integers to u64 while keeping their order, so frame-of-reference works across zero
+const ALP_SIGN: u64 = 1 << 63;
+
+/// Value stream encoding of ALP blocks, also used by the columns of multi-field files
+pub struct AlpUtils;
+
+impl AlpUtils {
+    #[inline]
+    fn encode_value(value: f64, exponent: usize) -> Option<u64> {
+        let n = (value * ALP_POW10[exponent]).round() as i64;
+        (Self::decode_value(n as u64 ^ ALP_SIGN, exponent).to_bits() == value.to_bits())
+            .then_some(n as u64 ^ ALP_SIGN)
+    }
+
+    #[inline(always)]
+    fn decode_value(n: u64, exponent: usize) -> f64 {
+        (n ^ ALP_SIGN) as i64 as f64 / ALP_POW10[exponent]
+    }
+
+    /// Chooses the exponent with the smallest estimated encoding. Larger exponents decode more
+    /// values exactly but need wider integers.
+    fn choose_exponent(values: &[f64; V3_BLOCK_SIZE]) -> usize {
+        let mut best = (usize::MAX, 0);
+        for exponent in 0..=ALP_MAX_EXPONENT {
+            let mut num_exceptions = 0;
+            let (mut min, mut max) = (u64::MAX, 0);
+            for value in values {
+                match Self::encode_value(*value, exponent) {
+                    Some(n) => (min, max) = (min.min(n), max.max(n)),
+                    None => num_exceptions += 1,
+                }
+            }
+
+            let bit_width = IntCompressionUtils::bits_needed_u64(max.saturating_sub(min)) as usize;
+            let size = num_exceptions * 9 + V3_BLOCK_SIZE * bit_width / 8;
+            if size < best.0 {
+                best = (size, exponent);
+            }
+            if num_exceptions == 0 {
+                break;
+            }
+        }
+        best.1
+    }
+
+    pub fn encode_stream(values: &[f64; V3_BLOCK_SIZE], out: &mut Vec<u8>) {
+        let exponent = Self::choose_exponent(values);
+        let encoded = values.map(|value| Self::encode_value(value, exponent));
+
+        // Exceptions take the integer of the last value before them that has one
+        let mut filler = encoded.iter().flatten().next().copied().unwrap_or(ALP_SIGN);
+        let mut ints = [0u64; V3_BLOCK_SIZE];
+        for (int, n) in ints.iter_mut().zip(encoded) {
+            filler = n.unwrap_or(filler);
+            *int = filler;
+        }
+
+        let num_exceptions = encoded.iter().filter(|n| n.is_none()).count();
+        out.push(exponent as u8);
+        out.push(num_exceptions as u8);
+        V3Utils::encode_stream(&ints, out);
+        for (i, n) in encoded.iter().enumerate() {
+            if n.is_none() {
+                out.push(i as u8);
+                out.extend_from_slice(&values[i].to_bits().to_le_bytes());
+            }
+        }
+    }
+
+    pub fn decode_stream(buf: &[u8], pos: &mut usize, out: &mut [f64; V3_BLOCK_SIZE]) {
+        let exponent = buf[*pos] as usize;
+        let num_exceptions = buf[*pos + 1] as usize;
+        *pos += 2;
+
+        let mut ints = [0u64; V3_BLOCK_SIZE];
+        V3Utils::decode_stream(buf, pos, &mut ints);
+        for (x, n) in out.iter_mut().zip(ints) {
+            *x = Self::decode_value(n, exponent);
+        }
+
+        for _ in 0..num_exceptions {
+            let i = buf[*pos] as usize;
+            let bits = u64::from_le_bytes(buf[*pos + 1..*pos + 9].try_into().unwrap());
+            out[i] = f64::from_bits(bits);
+            *pos += 9;
+        }
+    }
+}
+
+pub struct CompressionEngineAlp<T: Write> {
+    writer: T,
+    last_timestamp: Timestamp,
+    last_value: f64,
+    last_ts_delta: i64,
+
+    ts_d_deltas: [u64; V3_BLOCK_SIZE],
+    values: [f64; V3_BLOCK_SIZE],
+    buffer_idx: usize,
+
+    result: Vec<u8>,
+}
+
+impl<T: Write> CompressionEngine<T> for CompressionEngineAlp<T> {
+    type PhysicalType = f64;
+
+    fn new(writer: T, header: &Header) -> Self {
+        Self {
+            writer,
+            last_timestamp: header.min_timestamp,
+            last_value: header.first_value.get_float64(),
+            last_ts_delta: 0,
+
+            ts_d_deltas: [0; V3_BLOCK_SIZE],
+            values: [0.0; V3_BLOCK_SIZE],
+            buffer_idx: 0,
+
+            result: Vec::new(),
+        }
+    }
+
+    fn new_from_partial(writer: T, data_file: TimeDataFile) -> Self {
+        let num_entries = data_file.num_entries();
+        Self {
+            last_timestamp: data_file.timestamps[num_entries - 1],
+            last_value: data_file.values[num_entries - 1].get_float64(),
+            last_ts_delta: if num_entries < 2 {
+                0
+            } else {
+                (data_file.timestamps[num_entries - 1] as i64)
+                    .wrapping_sub(data_file.timestamps[num_entries - 2] as i64)
+            },
+            ..Self::new(writer, &data_file.header)
+        }
+    }
+
+    fn new_from_state(writer: T, header: &Header, state: &DecoderState) -> Self {
+        Self {
+            last_timestamp: state.timestamp,
+            last_value: f64::from_bits(state.value),
+            last_ts_delta: state.deltas.0,
+            ..Self::new(writer, header)
+        }
+    }
+
+    fn consume(&mut self, timestamp: Timestamp, value: f64) -> usize {
+        let ts_delta = timestamp.wrapping_sub(self.last_timestamp) as i64;
+        self.ts_d_deltas[self.buffer_idx] =
+            IntCompressionUtils::zig_zag_encode(ts_delta.wrapping_sub(self.last_ts_delta));
+        self.values[self.buffer_idx] = value;
+
+        self.last_timestamp = timestamp;
+        self.last_value = value;
+        self.last_ts_delta = ts_delta;
+
+        self.buffer_idx += 1;
+        if self.buffer_idx >= V3_BLOCK_SIZE {
+            self.flush()
+        } else {
+            0
+        }
+    }
+
+    fn flush_all(&mut self) -> usize {
+        self.flush()
+    }
+
+    fn restart_state(&self) -> Option<DecoderState> {
+        // Every block can be decoded on its own from the state before it
+        if self.buffer_idx != 0 {
+            return None;
+        }
+
+        Some(DecoderState {
+            timestamp: self.last_timestamp,
+            value: self.last_value.to_bits(),
+            deltas: (self.last_ts_delta, 0),
+        })
+    }
+}
+
+impl<T: Write> CompressionEngineAlp<T> {
+    fn flush(&mut self) -> usize {
+        if self.buffer_idx == 0 {
+            return 0;
+        }
+
+        // Handle partially-filled blocks
+        self.ts_d_deltas[self.buffer_idx..].fill(0);
+        self.values[self.buffer_idx..].fill(self.last_value);
+
+        self.result.clear();
+        self.result.extend_from_slice(&[0, 0]);
+        V3Utils::encode_stream(&self.ts_d_deltas, &mut self.result);
+        AlpUtils::encode_stream(&self.values, &mut self.result);
+        let body_length = (self.result.len() - 2) as u16;
+        self.result[..2].copy_from_slice(&body_length.to_le_bytes());
+
+        self.writer.write_all(&self.result).unwrap();
+        self.buffer_idx = 0;
+        self.result.len()
+    }
+}
+
+pub struct DecompressionEngineAlp<T: Read> {
+    reader: T,
+
+    buffer_idx: usize,
+    body: Vec<u8>,
+
+    current_timestamp: Timestamp,
+    last_ts_delta: i64,
+
+    /// Decoded entries of the current block
+    timestamps: [Timestamp; V3_BLOCK_SIZE],
+    values: [f64; V3_BLOCK_SIZE],
+}
+
+impl<T: Read> DecompressionEngine<T> for DecompressionEngineAlp<T> {
+    type PhysicalType = f64;
+
+    fn new(reader: T, header: &Header) -> Self {
+        Self::new_from_state(
+            reader,
+            header,
+            &DecoderState {
+                timestamp: header.min_timestamp,
+                value: header.first_value.get_uinteger64(),
+                deltas: (0, 0),
+            },
+        )
+    }
+
+    fn new_from_state(reader: T, _: &Header, state: &DecoderState) -> Self {
+        Self {
+            reader,
+
+            buffer_idx: V3_BLOCK_SIZE,
+            body: Vec::new(),
+
+            current_timestamp: state.timestamp,
+            last_ts_delta: state.deltas.0,
+
+            timestamps: [0; V3_BLOCK_SIZE],
+            values: [0.0; V3_BLOCK_SIZE],
+        }
+    }
+
+    fn next(&mut self) -> (Timestamp, f64) {
+        if self.buffer_idx >= V3_BLOCK_SIZE {
+            self.decode_block();
+        }
+
+        let entry = (
+            self.timestamps[self.buffer_idx],
+            self.values[self.buffer_idx],
+        );
+        self.buffer_idx += 1;
+
+        entry
+    }
+
+    fn next_batch(&mut self, timestamps: &mut [Timestamp], values: &mut [f64]) -> usize {
+        let len = timestamps.len().min(values.len());
+        let mut num_decoded = 0;
+        while num_decoded < len {
+            if self.buffer_idx >= V3_BLOCK_SIZE {
+                self.decode_block();
+            }
+
+            let idx = self.buffer_idx;
+            let num_copied = (V3_BLOCK_SIZE - idx).min(len - num_decoded);
+            timestamps[num_decoded..num_decoded + num_copied]
+                .copy_from_slice(&self.timestamps[idx..idx + num_copied]);
+            values[num_decoded..num_decoded + num_copied]
+                .copy_from_slice(&self.values[idx..idx + num_copied]);
+
+            self.buffer_idx += num_copied;
+            num_decoded += num_copied;
+        }
+
+        len
+    }
+}
+
+impl<T: Read> DecompressionEngineAlp<T> {
+    /// Reads the next block with two reads and decodes all of its entries at once
+    fn decode_block(&mut self) {
+        let mut length = [0u8; 2];
+        self.reader.read_exact(&mut length).unwrap();
+        self.body.resize(u16::from_le_bytes(length) as usize, 0);
+        self.reader.read_exact(&mut self.body).unwrap();
+
+        let mut pos = 0;
+        V3Utils::decode_entries(
+            &self.body,
+            &mut pos,
+            &mut self.last_ts_delta,
+            &mut self.current_timestamp,
+            &mut self.timestamps,
+        );
+        AlpUtils::decode_stream(&self.body, &mut pos, &mut self.values);
+
+        self.buffer_idx = 0;
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::{
+        AlpUtils, CompressionEngine, CompressionEngineAlp, DecompressionEngine,
+        DecompressionEngineAlp, V3_BLOCK_SIZE,
+    };
+    use crate::storage::compression::float::v1::CompressionEngineV1;
+    use crate::storage::file::Header;
+    use crate::{StreamId, ValueType, Version};
+
+    #[test]
+    fn test_alp_stream_round_trip() {
+        let mut values = [0f64; V3_BLOCK_SIZE];
+        for (i, value) in values.iter_mut().enumerate() {
+            *value = (-1250 + (i as i64 * 37 % 301)) as f64 / 100.0;
+        }
+        // Exceptions
+        values[5] = f64::NAN;
+        values[6] = -0.0;
+        values[7] = std::f64::consts::PI;
+        values[8] = 1e300;
+
+        let mut encoded = Vec::new();
+        AlpUtils::encode_stream(&values, &mut encoded);
+        assert_eq!(encoded[0], 2);
+        assert_eq!(encoded[1], 4);
+
+        let mut decoded = [0f64; V3_BLOCK_SIZE];
+        let mut pos = 0;
+        AlpUtils::decode_stream(&encoded, &mut pos, &mut decoded);
+        assert_eq!(pos, encoded.len());
+        for (decoded, value) in decoded.iter().zip(values) {
+            assert_eq!(decoded.to_bits(), value.to_bits());
+        }
+    }
+
+    #[test]
+    fn test_compression_alp_read_back() {
+        let header = Header {
+            min_timestamp: 0,
+            first_value: 230.0.into(),
+            ..Header::new(Version(0), StreamId(0), ValueType::Float64)
+        };
+
+        // Voltages with two fractional digits
+        let timestamps: Vec<u64> = (1..1000u64).map(|i| i * 1000 + i % 7).collect();
+        let values: Vec<f64> = (1..1000u64)
+            .map(|i| 230.0 + ((i * 7919) % 200) as f64 / 100.0)
+            .collect();
+
+        let mut res: Vec<u8> = Vec::new();
+        let mut engine = CompressionEngineAlp::<&mut Vec<u8>>::new(&mut res, &header);
+        let mut bytes_written = 0;
+        let mut restart = None;
+        for (i, (t, v)) in timestamps.iter().zip(&values).enumerate() {
+            bytes_written += engine.consume(*t, *v);
+            if i + 1 == 2 * V3_BLOCK_SIZE {
+                restart = Some((bytes_written, engine.restart_state().unwrap()));
+            }
+        }
+        bytes_written += engine.flush_all();
+        assert_eq!(bytes_written, res.len());
+
+        let mut decomp = DecompressionEngineAlp::<&[u8]>::new(&res, &header);
+        for (t, v) in timestamps.iter().zip(&values) {
+            assert_eq!(decomp.next(), (*t, *v));
+        }
+
+        let (offset, state) = restart.unwrap();
+        let mut decomp =
+            DecompressionEngineAlp::<&[u8]>::new_from_state(&res[offset..], &header, &state);
+        let mut batch_timestamps = vec![0; timestamps.len() - 2 * V3_BLOCK_SIZE];
+        let mut batch_values = vec![0.0; batch_timestamps.len()];
+        decomp.next_batch(&mut batch_timestamps, &mut batch_values);
+        assert_eq!(&batch_timestamps[..], &timestamps[2 * V3_BLOCK_SIZE..]);
+        assert_eq!(&batch_values[..], &values[2 * V3_BLOCK_SIZE..]);
+
+        // Much smaller than XOR compression, which only finds a few equal bytes
+        let mut v1_res: Vec<u8> = Vec::new();
+        let mut v1_engine = CompressionEngineV1::<&mut Vec<u8>>::new(&mut v1_res, &header);
+        for (t, v) in timestamps.iter().zip(&values) {
+            v1_engine.consume(*t, *v);
+        }
+        v1_engine.flush_all();
+        assert!(2 * res.len() < v1_res.len());
+    }
+}
@@ -1,8 +1,149 @@
-use std::io::Write;
+use std::io::{Read, Write};
 
+use crate::{storage::file::Header, Timestamp};
+
+use super::{Codec, CompressionEngine, DecoderState, DecompressionEngine, TimeDataFile};
+
+mod alp;
+mod quantized;
 mod v1;
 
+pub(crate) use alp::AlpUtils;
+
+#[allow(clippy::large_enum_variant)]
+pub enum FloatDecompressor<R: Read> {
+    V1(v1::DecompressionEngineV1<R>),
+    Alp(alp::DecompressionEngineAlp<R>),
+    Quantized(quantized::QuantizedDecompressor<R>),
+}
+
+impl<R: Read> DecompressionEngine<R> for FloatDecompressor<R> {
+    type PhysicalType = f64;
+
+    fn new(reader: R, header: &Header) -> Self {
+        match header.codec {
+            _ if header.is_quantized() => {
+                Self::Quantized(quantized::QuantizedDecompressor::new(reader, header))
+            }
+            Codec::FloatAlp => Self::Alp(alp::DecompressionEngineAlp::new(reader, header)),
+            _ => Self::V1(v1::DecompressionEngineV1::new(reader, header)),
+        }
+    }
+
+    fn new_from_state(reader: R, header: &Header, state: &DecoderState) -> Self {
+        match header.codec {
+            _ if header.is_quantized() => Self::Quantized(
+                quantized::QuantizedDecompressor::new_from_state(reader, header, state),
+            ),
+            Codec::FloatAlp => Self::Alp(alp::DecompressionEngineAlp::new_from_state(
+                reader, header, state,
+            )),
+            _ => Self::V1(v1::DecompressionEngineV1::new_from_state(
+                reader, header, state,
+            )),
+        }
+    }
+
+    fn next(&mut self) -> (Timestamp, f64) {
+        match self {
+            Self::V1(engine) => engine.next(),
+            Self::Alp(engine) => engine.next(),
+            Self::Quantized(engine) => engine.next(),
+        }
+    }
+
+    fn next_batch(&mut self, timestamps: &mut [Timestamp], values: &mut [f64]) -> usize {
+        match self {
+            Self::V1(engine) => engine.next_batch(timestamps, values),
+            Self::Alp(engine) => engine.next_batch(timestamps, values),
+            Self::Quantized(engine) => engine.next_batch(timestamps, values),
+        }
+    }
+
+    fn next_run(&mut self, max_len: usize, end: Timestamp) -> (Timestamp, f64, usize) {
+        match self {
+            Self::V1(engine) => engine.next_run(max_len, end),
+            Self::Alp(engine) => engine.next_run(max_len, end),
+            Self::Quantized(engine) => engine.next_run(max_len, end),
+        }
+    }
+
+    fn next_values(&mut self, values: &mut [f64]) -> usize {
+        match self {
+            Self::V1(engine) => engine.next_values(values),
+            Self::Alp(engine) => engine.next_values(values),
+            Self::Quantized(engine) => engine.next_values(values),
+        }
+    }
+}
+
 #[allow(clippy::large_enum_variant)]
 pub enum FloatCompressor<W: Write> {
     V1(v1::CompressionEngineV1<W>),
+    Alp(alp::CompressionEngineAlp<W>),
+    Quantized(quantized::QuantizedCompressor<W>),
+}
+
+impl<W: Write> CompressionEngine<W> for FloatCompressor<W> {
+    type PhysicalType = f64;
+
+    fn new(writer: W, header: &Header) -> Self {
+        match header.codec {
+            _ if header.is_quantized() => {
+                Self::Quantized(quantized::QuantizedCompressor::new(writer, header))
+            }
+            Codec::FloatAlp => Self::Alp(alp::CompressionEngineAlp::new(writer, header)),
+            _ => Self::V1(v1::CompressionEngineV1::new(writer, header)),
+        }
+    }
+
+    fn new_from_partial(writer: W, data_file: TimeDataFile) -> Self {
+        match data_file.header.codec {
+            _ if data_file.header.is_quantized() => Self::Quantized(
+                quantized::QuantizedCompressor::new_from_partial(writer, data_file),
+            ),
+            Codec::FloatAlp => Self::Alp(alp::CompressionEngineAlp::new_from_partial(
+                writer, data_file,
+            )),
+            _ => Self::V1(v1::CompressionEngineV1::new_from_partial(writer, data_file)),
+        }
+    }
+
+    fn new_from_state(writer: W, header: &Header, state: &DecoderState) -> Self {
+        match header.codec {
+            _ if header.is_quantized() => Self::Quantized(
+                quantized::QuantizedCompressor::new_from_state(writer, header, state),
+            ),
+            Codec::FloatAlp => Self::Alp(alp::CompressionEngineAlp::new_from_state(
+                writer, header, state,
+            )),
+            _ => Self::V1(v1::CompressionEngineV1::new_from_state(
+                writer, header, state,
+            )),
+        }
+    }
+
+    fn consume(&mut self, timestamp: Timestamp, value: Self::PhysicalType) -> usize {
+        match self {
+            Self::V1(engine) => engine.consume(timestamp, value),
+            Self::Alp(engine) => engine.consume(timestamp, value),
+            Self::Quantized(engine) => engine.consume(timestamp, value),
+        }
+    }
+
+    fn flush_all(&mut self) -> usize {
+        match self {
+            Self::V1(engine) => engine.flush_all(),
+            Self::Alp(engine) => engine.flush_all(),
+            Self::Quantized(engine) => engine.flush_all(),
+        }
+    }
+
+    fn restart_state(&self) -> Option<DecoderState> {
+        match self {
+            Self::V1(engine) => engine.restart_state(),
+            Self::Alp(engine) => engine.restart_state(),
+            Self::Quantized(engine) => engine.restart_state(),
+        }
+    }
 }
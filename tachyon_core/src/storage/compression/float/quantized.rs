@@ -0,0 +1,177 @@
+/*
+    Bounded-error lossy float compression:
+
+    Every value v of a stream with a tolerance t is rounded to the closest multiple of the
+    quantization step 2t, which is within t of v. The file stores the quantized values, so its
+    header and seek table aggregate what is read back. Sums over n entries are within n * t of
+    the sum of the values written, and minimums, maximums and averages within t.
+
+    The multiples are encoded as i64 step counts by the integer codec in the header, where
+    slowly changing values become small deltas, and are decoded by multiplying back the step.
+*/
+
+use std::io::{Read, Write};
+
+use crate::{
+    storage::{
+        compression::{
+            int::{IntCompressor, IntDecompressor},
+            CompressionEngine, DecoderState, DecompressionEngine,
+        },
+        file::{Header, TimeDataFile},
+    },
+    Timestamp, Value,
+};
+
+/// Gets the header seen by the integer codec, whose values are step counts
+fn steps_header(header: &Header) -> Header {
+    Header {
+        first_value: header.to_steps(header.first_value.get_float64()).into(),
+        ..header.clone()
+    }
+}
+
+pub struct QuantizedCompressor<T: Write> {
+    engine: IntCompressor<T>,
+    header: Header,
+}
+
+impl<T: Write> CompressionEngine<T> for QuantizedCompressor<T> {
+    type PhysicalType = f64;
+
+    fn new(writer: T, header: &Header) -> Self {
+        Self {
+            engine: IntCompressor::new(writer, &steps_header(header)),
+            header: header.clone(),
+        }
+    }
+
+    fn new_from_partial(writer: T, data_file: TimeDataFile) -> Self {
+        let header = data_file.header.clone();
+        let steps_file = TimeDataFile {
+            header: steps_header(&header),
+            values: data_file
+                .values
+                .iter()
+                .map(|value| Value::from(header.to_steps(value.get_float64())))
+                .collect(),
+            ..data_file
+        };
+        Self {
+            engine: IntCompressor::new_from_partial(writer, steps_file),
+            header,
+        }
+    }
+
+    fn new_from_state(writer: T, header: &Header, state: &DecoderState) -> Self {
+        Self {
+            engine: IntCompressor::new_from_state(writer, &steps_header(header), state),
+            header: header.clone(),
+        }
+    }
+
+    fn consume(&mut self, timestamp: Timestamp, value: f64) -> usize {
+        self.engine.consume(timestamp, self.header.to_steps(value))
+    }
+
+    fn flush_all(&mut self) -> usize {
+        self.engine.flush_all()
+    }
+
+    fn restart_state(&self) -> Option<DecoderState> {
+        self.engine.restart_state()
+    }
+}
+
+pub struct QuantizedDecompressor<T: Read> {
+    engine: IntDecompressor<T>,
+    header: Header,
+}
+
+impl<T: Read> DecompressionEngine<T> for QuantizedDecompressor<T> {
+    type PhysicalType = f64;
+
+    fn new(reader: T, header: &Header) -> Self {
+        Self {
+            engine: IntDecompressor::new(reader, &steps_header(header)),
+            header: header.clone(),
+        }
+    }
+
+    fn new_from_state(reader: T, header: &Header, state: &DecoderState) -> Self {
+        Self {
+            engine: IntDecompressor::new_from_state(reader, &steps_header(header), state),
+            header: header.clone(),
+        }
+    }
+
+    fn next(&mut self) -> (Timestamp, f64) {
+        let (timestamp, steps) = self.engine.next();
+        (timestamp, self.header.from_steps(steps))
+    }
+
+    fn next_batch(&mut self, timestamps: &mut [Timestamp], values: &mut [f64]) -> usize {
+        let mut steps = vec![0u64; values.len()];
+        let n = self.engine.next_batch(timestamps, &mut steps);
+        for (value, steps) in values.iter_mut().zip(steps) {
+            *value = self.header.from_steps(steps);
+        }
+        n
+    }
+
+    fn next_run(&mut self, max_len: usize, end: Timestamp) -> (Timestamp, f64, usize) {
+        let (timestamp, steps, len) = self.engine.next_run(max_len, end);
+        (timestamp, self.header.from_steps(steps), len)
+    }
+
+    fn next_values(&mut self, values: &mut [f64]) -> usize {
+        let mut steps = vec![0u64; values.len()];
+        let n = self.engine.next_values(&mut steps);
+        for (value, steps) in values.iter_mut().zip(steps) {
+            *value = self.header.from_steps(steps);
+        }
+        n
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::{storage::compression::Codec, StreamId, ValueType, Version};
+
+    #[test]
+    fn test_quantized_round_trip() {
+        let mut header = Header::new(Version(0), StreamId(0), ValueType::Float64);
+        header.set_tolerance(0.005);
+        assert_eq!(header.codec, Codec::IntV3);
+
+        let values: Vec<f64> = (0..1000)
+            .map(|i| 20.0 + (i as f64 * 0.37).sin() * 3.14159)
+            .collect();
+        header.first_value = header.quantize(values[0].into());
+
+        let mut buf = Vec::new();
+        let mut compressor = QuantizedCompressor::new(&mut buf, &header);
+        for (i, &value) in values.iter().enumerate().skip(1) {
+            compressor.consume(i as Timestamp, value);
+        }
+        compressor.flush_all();
+        drop(compressor);
+        assert!(buf.len() < values.len() * 2);
+
+        let mut decompressor = QuantizedDecompressor::new(buf.as_slice(), &header);
+        for (i, &value) in values.iter().enumerate().skip(1) {
+            let (timestamp, decoded) = decompressor.next();
+            assert_eq!(timestamp, i as Timestamp);
+            assert!((decoded - value).abs() <= 0.005 + f64::EPSILON * value.abs());
+            assert_eq!(decoded, header.quantize(value.into()).get_float64());
+        }
+
+        // Values whose steps are not exact cannot be stored within the tolerance
+        assert!(Header::can_quantize(0.005, 1e13));
+        assert!(!Header::can_quantize(0.005, 1e15));
+        assert!(!Header::can_quantize(0.005, f64::NAN));
+        assert!(!Header::can_quantize(0.005, f64::NEG_INFINITY));
+        assert!(Header::can_quantize(0.0, f64::NAN));
+    }
+}
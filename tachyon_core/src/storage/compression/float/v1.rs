@@ -26,8 +26,10 @@ use std::io::{Read, Write};
 
 use crate::{
     storage::{
-        compression::{int::IntCompressionUtils, CompressionEngine, DecompressionEngine},
-        file::Header,
+        compression::{
+            int::IntCompressionUtils, CompressionEngine, DecoderState, DecompressionEngine,
+        },
+        file::{Header, TimeDataFile},
         FileReaderUtils,
     },
     utils::static_assert,
@@ -96,8 +98,17 @@ impl<T: Write> CompressionEngine<T> for CompressionEngineV1<T> {
         }
     }
 
+    fn new_from_state(writer: T, header: &Header, state: &DecoderState) -> Self {
+        Self {
+            last_timestamp: state.timestamp,
+            last_value: state.value,
+            last_ts_delta: state.deltas.0,
+            ..Self::new(writer, header)
+        }
+    }
+
     fn consume(&mut self, timestamp: Timestamp, value: Self::PhysicalType) -> usize {
-        let ts_delta = (timestamp - self.last_timestamp) as i64;
+        let ts_delta = timestamp.wrapping_sub(self.last_timestamp) as i64;
         let double_ts_delta = ts_delta - self.last_ts_delta;
         self.ts_d_deltas[self.buffer_idx] = IntCompressionUtils::zig_zag_encode(double_ts_delta);
 
@@ -105,9 +116,10 @@ impl<T: Write> CompressionEngine<T> for CompressionEngineV1<T> {
         let value_xored = self.last_value ^ value;
         self.v_xors[self.buffer_idx] = value_xored;
 
+        let mut bytes_written = 0;
         self.buffer_idx += 1;
         if self.buffer_idx >= V1_CHUNK_SIZE {
-            self.flush();
+            bytes_written += self.flush();
         }
 
         self.entries_written += 1;
@@ -115,29 +127,62 @@ impl<T: Write> CompressionEngine<T> for CompressionEngineV1<T> {
         self.last_ts_delta = ts_delta;
         self.last_value = value;
 
-        0
+        bytes_written
     }
 
     fn flush_all(&mut self) -> usize {
-        self.flush();
-        self.flush_chunk();
-        self.writer.write_all(&self.result).unwrap();
-        self.result.len()
+        self.flush() + self.flush_chunk()
     }
 
-    fn new_from_partial(_writer: T, _data_file: crate::tachyon_benchmarks::TimeDataFile) -> Self
+    fn new_from_partial(writer: T, data_file: TimeDataFile) -> Self
     where
         Self: Sized,
     {
-        todo!()
+        let num_entries = data_file.num_entries();
+        Self {
+            writer,
+            last_timestamp: data_file.timestamps[num_entries - 1],
+            last_value: data_file.values[num_entries - 1].get_float64().to_bits(),
+
+            last_ts_delta: if num_entries < 2 {
+                0
+            } else {
+                data_file.timestamps[num_entries - 1] as i64
+                    - data_file.timestamps[num_entries - 2] as i64
+            },
+            entries_written: 0,
+
+            ts_d_deltas: [0; V1_CHUNK_SIZE],
+            v_xors: [0; V1_CHUNK_SIZE],
+            buffer_idx: 0,
+            chunk_idx: 0,
+            encoded_length_header: 0,
+            encoded_xor_info_header: 0,
+
+            result: Vec::new(),
+            temp_buffer: Vec::new(),
+        }
+    }
+
+    fn restart_state(&self) -> Option<DecoderState> {
+        // A new length header starts the next group
+        if self.buffer_idx != 0 || self.chunk_idx != 0 {
+            return None;
+        }
+
+        Some(DecoderState {
+            timestamp: self.last_timestamp,
+            value: self.last_value,
+            deltas: (self.last_ts_delta, 0),
+        })
     }
 }
 
 impl<T: Write> CompressionEngineV1<T> {
-    fn flush(&mut self) {
+    fn flush(&mut self) -> usize {
         // nothing to write
         if self.buffer_idx == 0 {
-            return;
+            return 0;
         }
         // Handle partially-filled buffers (should technically never be read)
         for i in self.buffer_idx..self.ts_d_deltas.len() {
@@ -200,16 +245,17 @@ impl<T: Write> CompressionEngineV1<T> {
         }
 
         self.chunk_idx += 1;
+        self.buffer_idx = 0;
 
         if self.chunk_idx >= V1_NUM_CHUNKS_PER_LENGTH {
-            self.flush_chunk();
+            return self.flush_chunk();
         }
-        self.buffer_idx = 0;
+        0
     }
 
-    fn flush_chunk(&mut self) {
+    fn flush_chunk(&mut self) -> usize {
         if self.chunk_idx == 0 {
-            return;
+            return 0;
         }
         self.result.push(self.encoded_length_header);
         self.result
@@ -218,6 +264,11 @@ impl<T: Write> CompressionEngineV1<T> {
         self.chunk_idx = 0;
         self.encoded_length_header = 0;
         self.encoded_xor_info_header = 0;
+
+        self.writer.write_all(&self.result).unwrap();
+        let bytes_written = self.result.len();
+        self.result.clear();
+        bytes_written
     }
 }
 
@@ -266,6 +317,26 @@ impl<T: Read> DecompressionEngine<T> for DecompressionEngineV1<T> {
         }
     }
 
+    fn new_from_state(reader: T, _: &Header, state: &DecoderState) -> Self {
+        Self {
+            reader,
+            values_read: 0,
+            cur_encoded_length_header: 0,
+            cur_encoded_xor_info_header: 0,
+
+            chunk_idx: V1_NUM_CHUNKS_PER_LENGTH as u32,
+            buffer_idx: V1_CHUNK_SIZE as u32,
+
+            current_timestamp: state.timestamp,
+            current_value: state.value,
+
+            last_ts_delta: state.deltas.0,
+
+            ts_d_deltas: [0; V1_CHUNK_SIZE],
+            v_xors: [0; V1_CHUNK_SIZE],
+        }
+    }
+
     fn next(&mut self) -> (Timestamp, Self::PhysicalType) {
         if self.buffer_idx >= V1_CHUNK_SIZE as u32 {
             if self.chunk_idx >= V1_NUM_CHUNKS_PER_LENGTH as u32 {
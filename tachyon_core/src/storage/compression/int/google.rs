@@ -2,7 +2,7 @@ use std::io::{Read, Write};
 
 use crate::{
     storage::{
-        compression::{CompressionEngine, DecompressionEngine},
+        compression::{CompressionEngine, DecoderState, DecompressionEngine},
         file::Header,
     },
     Timestamp,
@@ -13,6 +13,9 @@ use super::TimeDataFile;
 
 const CHUNK_SIZE: usize = 16;
 
+/// Encoded bytes are handed to the writer once this many are buffered
+const WRITE_SIZE: usize = 256;
+
 pub struct GoogleCompressionEngine<T: Write> {
     writer: T,
 
@@ -47,11 +50,11 @@ impl<T: Write> CompressionEngine<T> for GoogleCompressionEngine<T> {
             (value.wrapping_sub(self.last_value)) as i64,
         );
 
-        let double_delta = curr_deltas.0 - self.last_deltas.0;
+        let double_delta = curr_deltas.0.wrapping_sub(self.last_deltas.0);
         let ts_delta = IntCompressionUtils::zig_zag_encode(double_delta);
         bytes_written += self.encode(ts_delta);
 
-        let double_delta = curr_deltas.1 - self.last_deltas.1;
+        let double_delta = curr_deltas.1.wrapping_sub(self.last_deltas.1);
         let v_delta = IntCompressionUtils::zig_zag_encode(double_delta);
         bytes_written += self.encode(v_delta);
 
@@ -59,19 +62,62 @@ impl<T: Write> CompressionEngine<T> for GoogleCompressionEngine<T> {
         self.last_timestamp = timestamp;
         self.last_value = value;
         self.last_deltas = curr_deltas;
+
+        if self.result.len() >= WRITE_SIZE {
+            self.flush_all();
+        }
         bytes_written
     }
 
     fn flush_all(&mut self) -> usize {
         self.writer.write_all(&self.result).unwrap();
-        self.result.len()
+        self.result.clear();
+        0
     }
 
-    fn new_from_partial(_: T, _: TimeDataFile) -> Self
+    fn new_from_partial(writer: T, data_file: TimeDataFile) -> Self
     where
         Self: Sized,
     {
-        todo!()
+        let num_entries = data_file.num_entries();
+        Self {
+            last_timestamp: data_file.timestamps[num_entries - 1],
+            last_value: data_file.values[num_entries - 1].get_uinteger64(),
+            last_deltas: if num_entries < 2 {
+                (0, 0)
+            } else {
+                (
+                    (data_file.timestamps[num_entries - 1] as i64)
+                        .wrapping_sub(data_file.timestamps[num_entries - 2] as i64),
+                    data_file.values[num_entries - 1]
+                        .get_integer64()
+                        .wrapping_sub(data_file.values[num_entries - 2].get_integer64()),
+                )
+            },
+            ..Self::new(writer, &data_file.header)
+        }
+    }
+
+    fn new_from_state(writer: T, header: &Header, state: &DecoderState) -> Self {
+        Self {
+            last_timestamp: state.timestamp,
+            last_value: state.value,
+            last_deltas: state.deltas,
+            ..Self::new(writer, header)
+        }
+    }
+
+    fn restart_state(&self) -> Option<DecoderState> {
+        // Every entry starts on a byte boundary, so any point the buffer was written out at works
+        if !self.result.is_empty() {
+            return None;
+        }
+
+        Some(DecoderState {
+            timestamp: self.last_timestamp,
+            value: self.last_value,
+            deltas: self.last_deltas,
+        })
     }
 }
 
@@ -110,6 +156,7 @@ pub struct GoogleDecompressionEngine<T: Read> {
 
     buf: [u8; CHUNK_SIZE],
     buf_idx: usize,
+    buf_len: usize,
 }
 
 impl<T: Read> DecompressionEngine<T> for GoogleDecompressionEngine<T> {
@@ -127,6 +174,21 @@ impl<T: Read> DecompressionEngine<T> for GoogleDecompressionEngine<T> {
 
             buf: [0; CHUNK_SIZE],
             buf_idx: CHUNK_SIZE,
+            buf_len: CHUNK_SIZE,
+        }
+    }
+
+    fn new_from_state(reader: T, _: &Header, state: &DecoderState) -> Self {
+        Self {
+            reader,
+            values_read: 0,
+            current_timestamp: state.timestamp,
+            current_value: state.value,
+            last_deltas: state.deltas,
+
+            buf: [0; CHUNK_SIZE],
+            buf_idx: CHUNK_SIZE,
+            buf_len: CHUNK_SIZE,
         }
     }
 
@@ -134,12 +196,12 @@ impl<T: Read> DecompressionEngine<T> for GoogleDecompressionEngine<T> {
         let decoded_delta_ts = self.decode();
         let decoded_delta_v = self.decode();
 
-        self.last_deltas.0 += decoded_delta_ts;
+        self.last_deltas.0 = self.last_deltas.0.wrapping_add(decoded_delta_ts);
         self.current_timestamp = self
             .current_timestamp
             .wrapping_add_signed(self.last_deltas.0);
 
-        self.last_deltas.1 += decoded_delta_v;
+        self.last_deltas.1 = self.last_deltas.1.wrapping_add(decoded_delta_v);
         self.current_value = self.current_value.wrapping_add_signed(self.last_deltas.1);
 
         (self.current_timestamp, self.current_value)
@@ -152,8 +214,9 @@ impl<T: Read> GoogleDecompressionEngine<T> {
         let mut temp: u64 = 0;
         let mut offset: u64 = 0;
         loop {
-            if self.buf_idx >= CHUNK_SIZE {
-                let _ = self.reader.read(&mut self.buf).unwrap();
+            if self.buf_idx >= self.buf_len {
+                self.buf_len = self.reader.read(&mut self.buf).unwrap();
+                assert!(self.buf_len > 0, "Unexpected end of stream!");
                 self.buf_idx = 0;
             }
             let byte = self.buf[self.buf_idx];
@@ -163,7 +226,8 @@ impl<T: Read> GoogleDecompressionEngine<T> {
             if byte & (1 << 7) == 0 {
                 break;
             }
-            assert!(offset < 63);
+            // A 64-bit integer takes at most 10 bytes
+            assert!(offset < 70);
         }
 
         IntCompressionUtils::zig_zag_decode(temp)
@@ -176,11 +240,13 @@ mod tests {
         GoogleCompressionEngine, GoogleDecompressionEngine,
     };
     use crate::storage::{
-        compression::{CompressionEngine, DecompressionEngine},
+        compression::{CompressionEngine, DecoderState, DecompressionEngine},
         file::Header,
     };
     use crate::{StreamId, ValueType, Version};
 
+    use super::WRITE_SIZE;
+
     #[test]
     fn test_google_compression() {
         let header = Header::new(Version(0), StreamId(0), ValueType::UInteger64);
@@ -200,4 +266,44 @@ mod tests {
         assert_eq!(t, 5);
         assert_eq!(v, 130);
     }
+
+    #[test]
+    fn test_google_compression_restart_state() {
+        let header = Header {
+            min_timestamp: 0,
+            first_value: 0u64.into(),
+            ..Header::new(Version(0), StreamId(0), ValueType::UInteger64)
+        };
+
+        // Deltas that overflow i64 must wrap instead of panicking
+        let timestamps: Vec<u64> = (1..2000u64).map(|i| i * 15).collect();
+        let values: Vec<u64> = (1..2000u64)
+            .map(|i| if i % 7 == 0 { u64::MAX - i } else { i % 5 })
+            .collect();
+
+        let mut res: Vec<u8> = Vec::new();
+        let mut engine = GoogleCompressionEngine::<&mut Vec<u8>>::new(&mut res, &header);
+        let mut bytes_written = 0;
+        let mut restart = None;
+        for (i, (t, v)) in timestamps.iter().zip(&values).enumerate() {
+            bytes_written += engine.consume(*t, *v);
+            if restart.is_none() && bytes_written >= WRITE_SIZE {
+                restart = Some((i + 1, bytes_written, engine.restart_state().unwrap()));
+            }
+        }
+        bytes_written += engine.flush_all();
+        assert_eq!(bytes_written, res.len());
+
+        let mut decomp = GoogleDecompressionEngine::<&[u8]>::new(&res, &header);
+        for (t, v) in timestamps.iter().zip(&values) {
+            assert_eq!(decomp.next(), (*t, *v));
+        }
+
+        let (entries, offset, state) = restart.unwrap();
+        let mut decomp =
+            GoogleDecompressionEngine::<&[u8]>::new_from_state(&res[offset..], &header, &state);
+        for (t, v) in timestamps.iter().zip(&values).skip(entries) {
+            assert_eq!(decomp.next(), (*t, *v));
+        }
+    }
 }
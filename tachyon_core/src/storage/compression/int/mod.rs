@@ -2,12 +2,15 @@ use std::io::{Read, Write};
 
 use crate::{storage::file::Header, Timestamp};
 
-use super::{CompressionEngine, DecompressionEngine, TimeDataFile};
+use super::{Codec, CompressionEngine, DecoderState, DecompressionEngine, TimeDataFile};
 
 mod google;
 #[deprecated]
 mod v1;
 mod v2;
+mod v3;
+
+pub(crate) use v3::{V3Utils, V3_BLOCK_SIZE};
 
 pub(super) struct IntCompressionUtils;
 impl IntCompressionUtils {
@@ -42,19 +45,70 @@ impl IntCompressionUtils {
 pub enum IntDecompressor<R: Read> {
     V1(v1::DecompressionEngineV1<R>),
     V2(v2::DecompressionEngineV2<R>),
+    V3(v3::DecompressionEngineV3<R>),
+    Google(google::GoogleDecompressionEngine<R>),
 }
 
 impl<R: Read> DecompressionEngine<R> for IntDecompressor<R> {
     type PhysicalType = u64;
 
     fn new(reader: R, header: &Header) -> Self {
-        Self::V2(v2::DecompressionEngineV2::new(reader, header))
+        match header.codec {
+            Codec::IntV3 => Self::V3(v3::DecompressionEngineV3::new(reader, header)),
+            Codec::IntGoogle => {
+                Self::Google(google::GoogleDecompressionEngine::new(reader, header))
+            }
+            _ => Self::V2(v2::DecompressionEngineV2::new(reader, header)),
+        }
+    }
+
+    fn new_from_state(reader: R, header: &Header, state: &DecoderState) -> Self {
+        match header.codec {
+            Codec::IntV3 => Self::V3(v3::DecompressionEngineV3::new_from_state(
+                reader, header, state,
+            )),
+            Codec::IntGoogle => Self::Google(google::GoogleDecompressionEngine::new_from_state(
+                reader, header, state,
+            )),
+            _ => Self::V2(v2::DecompressionEngineV2::new_from_state(
+                reader, header, state,
+            )),
+        }
     }
 
     fn next(&mut self) -> (Timestamp, u64) {
         match self {
             Self::V1(engine) => engine.next(),
             Self::V2(engine) => engine.next(),
+            Self::V3(engine) => engine.next(),
+            Self::Google(engine) => engine.next(),
+        }
+    }
+
+    fn next_batch(&mut self, timestamps: &mut [Timestamp], values: &mut [u64]) -> usize {
+        match self {
+            Self::V1(engine) => engine.next_batch(timestamps, values),
+            Self::V2(engine) => engine.next_batch(timestamps, values),
+            Self::V3(engine) => engine.next_batch(timestamps, values),
+            Self::Google(engine) => engine.next_batch(timestamps, values),
+        }
+    }
+
+    fn next_run(&mut self, max_len: usize, end: Timestamp) -> (Timestamp, u64, usize) {
+        match self {
+            Self::V1(engine) => engine.next_run(max_len, end),
+            Self::V2(engine) => engine.next_run(max_len, end),
+            Self::V3(engine) => engine.next_run(max_len, end),
+            Self::Google(engine) => engine.next_run(max_len, end),
+        }
+    }
+
+    fn next_values(&mut self, values: &mut [u64]) -> usize {
+        match self {
+            Self::V1(engine) => engine.next_values(values),
+            Self::V2(engine) => engine.next_values(values),
+            Self::V3(engine) => engine.next_values(values),
+            Self::Google(engine) => engine.next_values(values),
         }
     }
 }
@@ -64,23 +118,51 @@ impl<R: Read> DecompressionEngine<R> for IntDecompressor<R> {
 pub enum IntCompressor<W: Write> {
     V1(v1::CompressionEngineV1<W>),
     V2(v2::CompressionEngineV2<W>),
+    V3(v3::CompressionEngineV3<W>),
+    Google(google::GoogleCompressionEngine<W>),
 }
 
 impl<W: Write> CompressionEngine<W> for IntCompressor<W> {
     type PhysicalType = u64;
 
     fn new(writer: W, header: &Header) -> Self {
-        Self::V2(v2::CompressionEngineV2::new(writer, header))
+        match header.codec {
+            Codec::IntV3 => Self::V3(v3::CompressionEngineV3::new(writer, header)),
+            Codec::IntGoogle => Self::Google(google::GoogleCompressionEngine::new(writer, header)),
+            _ => Self::V2(v2::CompressionEngineV2::new(writer, header)),
+        }
     }
 
     fn new_from_partial(writer: W, data_file: TimeDataFile) -> Self {
-        Self::V2(v2::CompressionEngineV2::new_from_partial(writer, data_file))
+        match data_file.header.codec {
+            Codec::IntV3 => Self::V3(v3::CompressionEngineV3::new_from_partial(writer, data_file)),
+            Codec::IntGoogle => Self::Google(google::GoogleCompressionEngine::new_from_partial(
+                writer, data_file,
+            )),
+            _ => Self::V2(v2::CompressionEngineV2::new_from_partial(writer, data_file)),
+        }
+    }
+
+    fn new_from_state(writer: W, header: &Header, state: &DecoderState) -> Self {
+        match header.codec {
+            Codec::IntV3 => Self::V3(v3::CompressionEngineV3::new_from_state(
+                writer, header, state,
+            )),
+            Codec::IntGoogle => Self::Google(google::GoogleCompressionEngine::new_from_state(
+                writer, header, state,
+            )),
+            _ => Self::V2(v2::CompressionEngineV2::new_from_state(
+                writer, header, state,
+            )),
+        }
     }
 
     fn consume(&mut self, timestamp: Timestamp, value: Self::PhysicalType) -> usize {
         match self {
             Self::V1(engine) => engine.consume(timestamp, value),
             Self::V2(engine) => engine.consume(timestamp, value),
+            Self::V3(engine) => engine.consume(timestamp, value),
+            Self::Google(engine) => engine.consume(timestamp, value),
         }
     }
 
@@ -88,6 +170,17 @@ impl<W: Write> CompressionEngine<W> for IntCompressor<W> {
         match self {
             Self::V1(engine) => engine.flush_all(),
             Self::V2(engine) => engine.flush_all(),
+            Self::V3(engine) => engine.flush_all(),
+            Self::Google(engine) => engine.flush_all(),
+        }
+    }
+
+    fn restart_state(&self) -> Option<DecoderState> {
+        match self {
+            Self::V1(engine) => engine.restart_state(),
+            Self::V2(engine) => engine.restart_state(),
+            Self::V3(engine) => engine.restart_state(),
+            Self::Google(engine) => engine.restart_state(),
         }
     }
 }
@@ -159,3 +252,56 @@ fn test_zig_zag() {
         IntCompressionUtils::zig_zag_decode(IntCompressionUtils::zig_zag_encode(i64::MIN))
     );
 }
+
+#[test]
+#[allow(deprecated)]
+fn test_v1_from_state() {
+    use crate::{StreamId, ValueType, CURRENT_VERSION};
+
+    let timestamps: Vec<Timestamp> = (0..101).map(|i| 10 * i + i % 3).collect();
+    let values: Vec<u64> = (0..101).map(|i| 3 * i + i % 2).collect();
+    let header = Header {
+        min_timestamp: timestamps[0],
+        first_value: values[0].into(),
+        count: 101,
+        ..Header::new(CURRENT_VERSION, StreamId(0), ValueType::UInteger64)
+    };
+
+    let mut buf = Vec::new();
+    let mut engine = v1::CompressionEngineV1::new(&mut buf, &header);
+    for i in 1..101 {
+        engine.consume(timestamps[i], values[i]);
+    }
+    engine.flush_all();
+
+    // A group starts after every second entry
+    let mut prefix = Vec::new();
+    let mut engine = v1::CompressionEngineV1::new(&mut prefix, &header);
+    for i in 1..51 {
+        engine.consume(timestamps[i], values[i]);
+    }
+    engine.flush_all();
+    let state = DecoderState {
+        timestamp: timestamps[50],
+        value: values[50],
+        deltas: (
+            (timestamps[50] - timestamps[49]) as i64,
+            (values[50] - values[49]) as i64,
+        ),
+    };
+
+    let mut tail = Vec::new();
+    let mut engine = v1::CompressionEngineV1::new_from_state(&mut tail, &header, &state);
+    for i in 51..101 {
+        engine.consume(timestamps[i], values[i]);
+    }
+    engine.flush_all();
+    assert_eq!(tail, buf[prefix.len()..]);
+
+    // The decoder reads the length byte after each group, which is past the last group
+    tail.push(0);
+    let mut decomp = v1::DecompressionEngineV1::new_from_state(tail.as_slice(), &header, &state);
+    for i in 51..101 {
+        assert_eq!(decomp.next(), (timestamps[i], values[i]));
+    }
+}
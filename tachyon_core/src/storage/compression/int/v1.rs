@@ -123,6 +123,17 @@ impl<T: Write> CompressionEngine<T> for CompressionEngineV1<T> {
     fn new_from_partial(_: T, _: TimeDataFile) -> Self {
         todo!()
     }
+
+    /// Precondition: `state` is the state after an even number of consumed entries, where a
+    /// group starts
+    fn new_from_state(writer: T, header: &Header, state: &DecoderState) -> Self {
+        Self {
+            last_timestamp: state.timestamp,
+            last_value: state.value,
+            last_deltas: state.deltas,
+            ..Self::new(writer, header)
+        }
+    }
 }
 
 impl<T: Write> CompressionEngineV1<T> {
@@ -225,6 +236,26 @@ impl<T: Read> DecompressionEngine<T> for DecompressionEngineV1<T> {
         }
     }
 
+    /// Precondition: `reader` is at the length byte of a group, which is followed by entries
+    fn new_from_state(mut reader: T, _: &Header, state: &DecoderState) -> Self {
+        let mut l_buf = [0u8; 1];
+        reader.read_exact(&mut l_buf).unwrap();
+
+        Self {
+            reader,
+
+            values_read: 1,
+            cur_length_byte: l_buf[0],
+
+            current_timestamp: state.timestamp,
+            current_value: state.value,
+            last_deltas: state.deltas,
+
+            next_timestamp: 0,
+            next_value: 0,
+        }
+    }
+
     fn next(&mut self) -> (Timestamp, PhysicalType) {
         if self.values_read % 2 == 0 {
             self.current_timestamp = self.next_timestamp;
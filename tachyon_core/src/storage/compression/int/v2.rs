@@ -3,8 +3,7 @@ use std::io::{Read, Write};
 use crate::{
     storage::{
         compression::Header,
-        compression::{CompressionEngine, DecompressionEngine},
-        FileReaderUtils,
+        compression::{CompressionEngine, DecoderState, DecompressionEngine},
     },
     utils::static_assert,
     Timestamp,
@@ -61,13 +60,26 @@ const V2_LENGTH_LOOKUP: [u8; 65] = [
     7,
 ];
 
-const V2_INT_READERS: [fn(&[u8]) -> u64; 5] = [
-    FileReaderUtils::read_u64_1,
-    FileReaderUtils::read_u64_2,
-    FileReaderUtils::read_u64_3,
-    FileReaderUtils::read_u64_4,
-    FileReaderUtils::read_u64_8,
-];
+/// Unpacks a chunk of bitpacked integers.
+/// A chunk of at most 4-bit integers fits in one big-endian word, with the first integer in the
+/// most significant bits, so every integer is extracted with an independent shift and mask.
+#[inline(always)]
+fn unpack_bits<const BITS: usize>(buf: &[u8], out: &mut [u64; V2_CHUNK_SIZE]) {
+    let word = u64::from_be_bytes(buf[..8].try_into().unwrap());
+    for (i, x) in out.iter_mut().enumerate() {
+        *x = (word >> (64 - BITS * (i + 1))) & ((1 << BITS) - 1);
+    }
+}
+
+/// Unpacks a chunk of little-endian integers of `BYTES` bytes each
+#[inline(always)]
+fn unpack_bytes<const BYTES: usize>(buf: &[u8], out: &mut [u64; V2_CHUNK_SIZE]) {
+    for (x, bytes) in out.iter_mut().zip(buf.chunks_exact(BYTES)) {
+        let mut le_bytes = [0u8; 8];
+        le_bytes[..BYTES].copy_from_slice(bytes);
+        *x = u64::from_le_bytes(le_bytes);
+    }
+}
 
 pub struct CompressionEngineV2<T: Write> {
     writer: T,
@@ -117,10 +129,13 @@ impl<T: Write> CompressionEngine<T> for CompressionEngineV2<T> {
                 (0, 0)
             } else {
                 (
-                    data_file.timestamps[data_file.num_entries() - 1] as i64
-                        - data_file.timestamps[data_file.num_entries() - 2] as i64,
-                    data_file.values[data_file.num_entries() - 1].get_integer64()
-                        - data_file.values[data_file.num_entries() - 2].get_integer64(),
+                    (data_file.timestamps[data_file.num_entries() - 1] as i64)
+                        .wrapping_sub(data_file.timestamps[data_file.num_entries() - 2] as i64),
+                    data_file.values[data_file.num_entries() - 1]
+                        .get_integer64()
+                        .wrapping_sub(
+                            data_file.values[data_file.num_entries() - 2].get_integer64(),
+                        ),
                 )
             },
             entries_written: 0,
@@ -136,6 +151,15 @@ impl<T: Write> CompressionEngine<T> for CompressionEngineV2<T> {
         }
     }
 
+    fn new_from_state(writer: T, header: &Header, state: &DecoderState) -> Self {
+        Self {
+            last_timestamp: state.timestamp,
+            last_value: state.value,
+            last_deltas: state.deltas,
+            ..Self::new(writer, header)
+        }
+    }
+
     fn consume(&mut self, timestamp: Timestamp, value: PhysicalType) -> usize {
         // TODO: Check wrapping logic here
         let mut bytes_written = 0;
@@ -144,10 +168,10 @@ impl<T: Write> CompressionEngine<T> for CompressionEngineV2<T> {
             (value.wrapping_sub(self.last_value)) as i64,
         );
 
-        let double_delta = curr_deltas.0 - (self.last_deltas.0);
+        let double_delta = curr_deltas.0.wrapping_sub(self.last_deltas.0);
         self.ts_d_deltas[self.buffer_idx] = IntCompressionUtils::zig_zag_encode(double_delta);
 
-        let double_delta = curr_deltas.1 - (self.last_deltas.1);
+        let double_delta = curr_deltas.1.wrapping_sub(self.last_deltas.1);
         self.v_d_deltas[self.buffer_idx] = IntCompressionUtils::zig_zag_encode(double_delta);
 
         self.buffer_idx += 1;
@@ -163,9 +187,20 @@ impl<T: Write> CompressionEngine<T> for CompressionEngineV2<T> {
     }
 
     fn flush_all(&mut self) -> usize {
-        self.flush();
-        self.flush_chunk();
-        self.writer.write(&self.result).unwrap()
+        self.flush() + self.flush_chunk()
+    }
+
+    fn restart_state(&self) -> Option<DecoderState> {
+        // A new length header starts the next group
+        if self.buffer_idx != 0 || self.chunk_idx != 0 {
+            return None;
+        }
+
+        Some(DecoderState {
+            timestamp: self.last_timestamp,
+            value: self.last_value,
+            deltas: self.last_deltas,
+        })
     }
 }
 
@@ -263,8 +298,9 @@ pub struct DecompressionEngineV2<T: Read> {
     current_value: PhysicalType,
     last_deltas: (i64, i64),
 
-    ts_d_deltas: [i64; V2_CHUNK_SIZE],
-    v_d_deltas: [i64; V2_CHUNK_SIZE],
+    /// Decoded entries of the current chunk
+    timestamps: [Timestamp; V2_CHUNK_SIZE],
+    values: [PhysicalType; V2_CHUNK_SIZE],
 }
 
 impl<T: Read> DecompressionEngine<T> for DecompressionEngineV2<T> {
@@ -284,67 +320,125 @@ impl<T: Read> DecompressionEngine<T> for DecompressionEngineV2<T> {
             current_value: header.first_value.get_uinteger64(),
             last_deltas: (0, 0),
 
-            ts_d_deltas: [0; V2_CHUNK_SIZE],
-            v_d_deltas: [0; V2_CHUNK_SIZE],
+            timestamps: [0; V2_CHUNK_SIZE],
+            values: [0; V2_CHUNK_SIZE],
+        }
+    }
+
+    fn new_from_state(reader: T, _: &Header, state: &DecoderState) -> Self {
+        Self {
+            reader,
+
+            values_read: 0,
+            cur_length: 0,
+
+            chunk_idx: V2_NUM_CHUNKS_PER_LENGTH as u32,
+            buffer_idx: V2_CHUNK_SIZE as u32,
+
+            current_timestamp: state.timestamp,
+            current_value: state.value,
+            last_deltas: state.deltas,
+
+            timestamps: [0; V2_CHUNK_SIZE],
+            values: [0; V2_CHUNK_SIZE],
         }
     }
 
     fn next(&mut self) -> (Timestamp, PhysicalType) {
         if self.buffer_idx >= V2_CHUNK_SIZE as u32 {
-            // Read the next chunk
-            if self.chunk_idx >= V2_NUM_CHUNKS_PER_LENGTH as u32 {
-                let mut buf = [0u8; 4];
-                self.reader.read_exact(&mut buf[1..]).unwrap();
-                self.cur_length = u32::from_be_bytes(buf);
-                self.chunk_idx = 0;
+            self.decode_chunk();
+        }
+
+        let entry = (
+            self.timestamps[self.buffer_idx as usize],
+            self.values[self.buffer_idx as usize],
+        );
+        self.values_read += 1;
+        self.buffer_idx += 1;
+
+        entry
+    }
+
+    fn next_batch(&mut self, timestamps: &mut [Timestamp], values: &mut [PhysicalType]) -> usize {
+        let len = timestamps.len().min(values.len());
+        let mut num_decoded = 0;
+        while num_decoded < len {
+            if self.buffer_idx >= V2_CHUNK_SIZE as u32 {
+                self.decode_chunk();
             }
 
-            for arr in [&mut self.ts_d_deltas, &mut self.v_d_deltas] {
-                let length_code = (self.cur_length >> (21 - 3 * (self.chunk_idx))) & 0b111;
-                let num_bits = V2_CODE_TO_BITS[length_code as usize];
+            let idx = self.buffer_idx as usize;
+            let num_copied = (V2_CHUNK_SIZE - idx).min(len - num_decoded);
+            timestamps[num_decoded..num_decoded + num_copied]
+                .copy_from_slice(&self.timestamps[idx..idx + num_copied]);
+            values[num_decoded..num_decoded + num_copied]
+                .copy_from_slice(&self.values[idx..idx + num_copied]);
 
-                let num_bytes = (num_bits as usize) * V2_CHUNK_SIZE / 8;
-                let mut buf = [0u8; V2_CHUNK_SIZE * 8];
-                self.reader.read_exact(&mut buf[..num_bytes]).unwrap();
+            self.values_read += num_copied as u32;
+            self.buffer_idx += num_copied as u32;
+            num_decoded += num_copied;
+        }
 
-                // Decode timestamp deltas
-                if num_bits < 8 {
-                    for (i, x) in arr.iter_mut().enumerate().take(V2_CHUNK_SIZE) {
-                        let byte_idx = (num_bits as usize) * i / 8;
-                        let bit_idx = ((num_bits as usize) * i) % 8;
-                        let shift = 8 - num_bits as usize - bit_idx;
+        len
+    }
+}
 
-                        let encoded = ((buf[byte_idx] >> shift) & ((1 << num_bits) - 1)) as u64;
-                        *x = IntCompressionUtils::zig_zag_decode(encoded);
-                    }
-                } else {
-                    for (i, x) in arr.iter_mut().enumerate().take(V2_CHUNK_SIZE) {
-                        let byte_idx = (num_bits as usize) / 8 * i;
-                        let val = V2_INT_READERS[length_code as usize - 3](
-                            &buf[byte_idx..byte_idx + num_bits as usize / 8],
-                        );
-                        *x = IntCompressionUtils::zig_zag_decode(val);
-                    }
-                }
-                self.chunk_idx += 1;
+impl<T: Read> DecompressionEngineV2<T> {
+    /// Decodes all entries of the next chunk at once.
+    /// Every step is a fixed-length loop over the chunk without data-dependent branches, so it
+    /// is compiled to vector shifts, masks and shuffles. Entries past the end of the stream
+    /// decode from zero padding and are never returned.
+    fn decode_chunk(&mut self) {
+        if self.chunk_idx >= V2_NUM_CHUNKS_PER_LENGTH as u32 {
+            let mut buf = [0u8; 4];
+            self.reader.read_exact(&mut buf[1..]).unwrap();
+            self.cur_length = u32::from_be_bytes(buf);
+            self.chunk_idx = 0;
+        }
+
+        let mut d_deltas = [[0i64; V2_CHUNK_SIZE]; 2];
+        for arr in d_deltas.iter_mut() {
+            let length_code = (self.cur_length >> (21 - 3 * (self.chunk_idx))) & 0b111;
+            let num_bits = V2_CODE_TO_BITS[length_code as usize];
+
+            let num_bytes = (num_bits as usize) * V2_CHUNK_SIZE / 8;
+            let mut buf = [0u8; V2_CHUNK_SIZE * 8];
+            self.reader.read_exact(&mut buf[..num_bytes]).unwrap();
+
+            let mut encoded = [0u64; V2_CHUNK_SIZE];
+            match num_bits {
+                1 => unpack_bits::<1>(&buf, &mut encoded),
+                2 => unpack_bits::<2>(&buf, &mut encoded),
+                4 => unpack_bits::<4>(&buf, &mut encoded),
+                8 => unpack_bytes::<1>(&buf, &mut encoded),
+                16 => unpack_bytes::<2>(&buf, &mut encoded),
+                24 => unpack_bytes::<3>(&buf, &mut encoded),
+                32 => unpack_bytes::<4>(&buf, &mut encoded),
+                _ => unpack_bytes::<8>(&buf, &mut encoded),
             }
 
-            self.buffer_idx = 0;
+            for (x, encoded) in arr.iter_mut().zip(encoded) {
+                *x = IntCompressionUtils::zig_zag_decode(encoded);
+            }
+            self.chunk_idx += 1;
         }
 
-        self.last_deltas.0 += self.ts_d_deltas[self.buffer_idx as usize];
-        self.last_deltas.1 += self.v_d_deltas[self.buffer_idx as usize];
+        // Prefix sums of the double deltas give the deltas, and their prefix sums the entries
+        for i in 0..V2_CHUNK_SIZE {
+            self.last_deltas.0 = self.last_deltas.0.wrapping_add(d_deltas[0][i]);
+            self.last_deltas.1 = self.last_deltas.1.wrapping_add(d_deltas[1][i]);
 
-        // TODO: Check wrapping logic here
-        self.current_timestamp = self
-            .current_timestamp
-            .wrapping_add_signed(self.last_deltas.0);
-        self.current_value = self.current_value.wrapping_add_signed(self.last_deltas.1);
+            // TODO: Check wrapping logic here
+            self.current_timestamp = self
+                .current_timestamp
+                .wrapping_add_signed(self.last_deltas.0);
+            self.current_value = self.current_value.wrapping_add_signed(self.last_deltas.1);
 
-        self.values_read += 1;
-        self.buffer_idx += 1;
+            self.timestamps[i] = self.current_timestamp;
+            self.values[i] = self.current_value;
+        }
 
-        (self.current_timestamp, self.current_value)
+        self.buffer_idx = 0;
     }
 }
 
@@ -352,7 +446,7 @@ impl<T: Read> DecompressionEngine<T> for DecompressionEngineV2<T> {
 mod tests {
     use super::{
         CompressionEngine, CompressionEngineV2, DecompressionEngine, DecompressionEngineV2,
-        V2_CHUNK_SIZE,
+        V2_CHUNK_SIZE, V2_NUM_CHUNKS_PER_LENGTH,
     };
     use crate::storage::file::Header;
     use crate::{StreamId, ValueType, Version};
@@ -504,4 +598,101 @@ mod tests {
             assert_eq!(v, values[i]);
         }
     }
+
+    #[test]
+    fn test_compression_v2_restart_state() {
+        let header = Header {
+            min_timestamp: 0,
+            first_value: 0u64.into(),
+            ..Header::new(Version(0), StreamId(0), ValueType::UInteger64)
+        };
+        let group_size = V2_CHUNK_SIZE * V2_NUM_CHUNKS_PER_LENGTH / 2;
+
+        let mut res: Vec<u8> = Vec::new();
+        let mut engine = CompressionEngineV2::<&mut Vec<u8>>::new(&mut res, &header);
+        let mut bytes_written = 0;
+        let mut restart = None;
+        for i in 1..(3 * group_size as u64) {
+            bytes_written += engine.consume(i * 10, i * i);
+            if i as usize == group_size {
+                assert!(engine.restart_state().is_some());
+                restart = Some((bytes_written, engine.restart_state().unwrap()));
+            } else if (i as usize) % group_size != 0 {
+                assert!(engine.restart_state().is_none());
+            }
+        }
+        engine.flush_all();
+
+        let (offset, state) = restart.unwrap();
+        let mut decomp =
+            DecompressionEngineV2::<&[u8]>::new_from_state(&res[offset..], &header, &state);
+        for i in (group_size as u64 + 1)..(3 * group_size as u64) {
+            let (t, v) = decomp.next();
+            assert_eq!(t, i * 10);
+            assert_eq!(v, i * i);
+        }
+    }
+
+    #[test]
+    fn test_decompression_v2_all_lengths() {
+        let header = Header {
+            min_timestamp: 0,
+            first_value: 0u64.into(),
+            ..Header::new(Version(0), StreamId(0), ValueType::UInteger64)
+        };
+
+        // Each chunk uses larger double deltas, covering every length code
+        let mut timestamps = Vec::new();
+        let mut values = Vec::new();
+        let (mut timestamp, mut value) = (0u64, 0u64);
+        for bits in [0u32, 1, 2, 3, 7, 15, 23, 31, 40] {
+            for i in 0..V2_CHUNK_SIZE as u64 {
+                let jitter = if bits == 0 {
+                    0
+                } else {
+                    (i * 7919) % (1 << bits)
+                };
+                timestamp += 1000 + jitter;
+                value = value.wrapping_add(jitter * 3 + i % 2);
+                timestamps.push(timestamp);
+                values.push(value);
+            }
+        }
+        timestamps.truncate(timestamps.len() - 5);
+
+        let mut res: Vec<u8> = Vec::new();
+        let mut engine = CompressionEngineV2::<&mut Vec<u8>>::new(&mut res, &header);
+        for (t, v) in timestamps.iter().zip(&values) {
+            engine.consume(*t, *v);
+        }
+        engine.flush_all();
+
+        let mut decomp = DecompressionEngineV2::<&[u8]>::new(&res, &header);
+        for (t, v) in timestamps.iter().zip(&values) {
+            assert_eq!(decomp.next(), (*t, *v));
+        }
+
+        // Batches that start and end inside chunks
+        let mut decomp = DecompressionEngineV2::<&[u8]>::new(&res, &header);
+        assert_eq!(decomp.next(), (timestamps[0], values[0]));
+
+        let mut batch_timestamps = vec![0; timestamps.len()];
+        let mut batch_values = vec![0; timestamps.len()];
+        let mut offset = 1;
+        for batch_size in [5, 16, 1, 40].into_iter().cycle() {
+            let end = (offset + batch_size).min(timestamps.len());
+            let num_decoded = decomp.next_batch(
+                &mut batch_timestamps[offset..end],
+                &mut batch_values[offset..end],
+            );
+            assert_eq!(num_decoded, end - offset);
+
+            offset = end;
+            if offset == timestamps.len() {
+                break;
+            }
+        }
+        assert_eq!(&batch_timestamps[1..], &timestamps[1..]);
+        assert_eq!(&batch_values[1..], &values[1..timestamps.len()]);
+    }
 }
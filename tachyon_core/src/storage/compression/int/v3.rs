@@ -0,0 +1,998 @@
+use std::io::{Read, Write};
+
+use crate::{
+    storage::{
+        compression::Header,
+        compression::{run_length, CompressionEngine, DecoderState, DecompressionEngine},
+    },
+    utils::static_assert,
+    Timestamp,
+};
+
+use super::IntCompressionUtils;
+use super::TimeDataFile;
+
+/*
+    Compression Scheme V3:
+--------------------------------------------------------
+    Entries are encoded in blocks of V3_BLOCK_SIZE entries:
+
+    | body length (u16 LE) | timestamp stream length (u16 LE) | timestamp stream | value stream |
+
+    The length of the timestamp stream gives the offset of the value stream, so the values of
+    a block can be decoded without its timestamps.
+
+    Each stream holds the zig-zag encoded double deltas of the block, stored with
+    frame-of-reference bit packing and patched exceptions:
+
+    | bit width (u8) | number of exceptions (u8) | reference (LEB128) |
+    | packed offsets (V3_BLOCK_SIZE * bit width bits) | exceptions |
+
+    - Every double delta is stored as its offset from the reference, the smallest double delta
+      of the block.
+    - The offsets are packed LSB-first into little-endian u64 words using exactly `bit width`
+      bits each.
+    - Offsets that need more bits are exceptions: their low bits are packed as usual, and the
+      remaining high bits follow the packed offsets as (index u8, high bits LEB128).
+    - The bit width is chosen to minimize the size of the stream, so a few outliers no longer
+      widen the whole block.
+
+    A stream with a bit width and reference of 0 is a run of constant steps, such as the
+    timestamps of a fixed-interval stream, where only the exceptions break the step. It takes
+    3 bytes plus its exceptions, and its entries are generated arithmetically when decoding.
+
+    The value stream may instead hold the values themselves when that is smaller, which suits
+    flags, enum-like gauges and idle counters. Its first byte is then a marker instead of a
+    bit width:
+
+    - V3_RUNS: | marker | number of runs - 1 (u8) | runs |
+      Each run is the zig-zag encoded difference to the value of the previous run (LEB128),
+      followed by its length - 1 (u8). The first run follows the last value of the previous
+      block.
+    - V3_DICTIONARY: | marker | dictionary size - 1 (u8) | dictionary | packed indices |
+      The distinct values of the block in ascending order, as the difference to the previous
+      one (LEB128), then the index of every value packed like the offsets above, using the
+      fewest bits that fit the largest index.
+
+    A partially filled last block is padded with zeros.
+*/
+pub type PhysicalType = u64;
+
+pub const V3_BLOCK_SIZE: usize = 128;
+static_assert!(V3_BLOCK_SIZE % 64 == 0);
+static_assert!(V3_BLOCK_SIZE <= u8::MAX as usize + 1);
+
+/// Largest size of an encoded stream: two header bytes, the reference, the packed offsets and
+/// no exceptions, as the width of 64 bits never needs any
+const V3_MAX_STREAM_SIZE: usize = 2 + 10 + V3_BLOCK_SIZE * 8;
+static_assert!(2 + 2 * V3_MAX_STREAM_SIZE <= u16::MAX as usize);
+
+/// Markers of value streams holding the values of the block
+const V3_RUNS: u8 = 0x80;
+const V3_DICTIONARY: u8 = 0x81;
+const V3_MAX_DICTIONARY_SIZE: usize = 16;
+
+/// Stream encodings of V3 blocks, also used by float codecs with the same block layout
+pub struct V3Utils;
+
+impl V3Utils {
+    fn write_leb128(mut n: u64, out: &mut Vec<u8>) {
+        while n >= 0x80 {
+            out.push((n as u8) | 0x80);
+            n >>= 7;
+        }
+        out.push(n as u8);
+    }
+
+    fn read_leb128(buf: &[u8], pos: &mut usize) -> u64 {
+        let mut n = 0u64;
+        let mut shift = 0;
+        loop {
+            let byte = buf[*pos];
+            *pos += 1;
+            n |= ((byte & 0x7F) as u64) << shift;
+            if byte < 0x80 {
+                return n;
+            }
+            shift += 7;
+        }
+    }
+
+    fn leb128_len(num_bits: usize) -> usize {
+        num_bits.max(1).div_ceil(7)
+    }
+
+    /// Chooses the bit width with the smallest encoding, given the number of offsets needing
+    /// each number of bits
+    fn choose_bit_width(num_with_bits: &[usize; 65]) -> usize {
+        (0..=64)
+            .min_by_key(|&bit_width| {
+                let exceptions_size: usize = (bit_width + 1..=64)
+                    .map(|bits| num_with_bits[bits] * (1 + Self::leb128_len(bits - bit_width)))
+                    .sum();
+                V3_BLOCK_SIZE * bit_width / 8 + exceptions_size
+            })
+            .unwrap()
+    }
+
+    /// Packs the low `bit_width` bits of every offset LSB-first into little-endian u64 words
+    fn pack(offsets: [u64; V3_BLOCK_SIZE], bit_width: usize, out: &mut Vec<u8>) {
+        if bit_width == 0 {
+            return;
+        }
+
+        let mut words = [0u64; V3_BLOCK_SIZE];
+        let mask = u64::MAX >> (64 - bit_width);
+        for (i, offset) in offsets.iter().enumerate() {
+            let offset = offset & mask;
+            let bit = i * bit_width;
+            words[bit / 64] |= offset << (bit % 64);
+            if bit % 64 + bit_width > 64 {
+                words[bit / 64 + 1] |= offset >> (64 - bit % 64);
+            }
+        }
+        for word in &words[..V3_BLOCK_SIZE * bit_width / 64] {
+            out.extend_from_slice(&word.to_le_bytes());
+        }
+    }
+
+    fn unpack(buf: &[u8], pos: &mut usize, bit_width: usize, out: &mut [u64; V3_BLOCK_SIZE]) {
+        let num_words = V3_BLOCK_SIZE * bit_width / 64;
+        let mut words = [0u64; V3_BLOCK_SIZE];
+        for (word, bytes) in words[..num_words]
+            .iter_mut()
+            .zip(buf[*pos..*pos + num_words * 8].chunks_exact(8))
+        {
+            *word = u64::from_le_bytes(bytes.try_into().unwrap());
+        }
+        *pos += num_words * 8;
+
+        V3_UNPACKERS[bit_width](&words, out);
+    }
+
+    pub fn encode_stream(values: &[u64; V3_BLOCK_SIZE], out: &mut Vec<u8>) {
+        let reference = *values.iter().min().unwrap();
+
+        let mut num_with_bits = [0usize; 65];
+        for value in values {
+            num_with_bits[IntCompressionUtils::bits_needed_u64(value - reference) as usize] += 1;
+        }
+        let bit_width = Self::choose_bit_width(&num_with_bits);
+        let num_exceptions: usize = num_with_bits[bit_width + 1..].iter().sum();
+
+        out.push(bit_width as u8);
+        out.push(num_exceptions as u8);
+        Self::write_leb128(reference, out);
+
+        Self::pack(values.map(|value| value - reference), bit_width, out);
+
+        if num_exceptions > 0 {
+            for (i, value) in values.iter().enumerate() {
+                let offset = value - reference;
+                if IntCompressionUtils::bits_needed_u64(offset) as usize > bit_width {
+                    out.push(i as u8);
+                    Self::write_leb128(offset >> bit_width, out);
+                }
+            }
+        }
+    }
+
+    pub fn decode_stream(buf: &[u8], pos: &mut usize, out: &mut [u64; V3_BLOCK_SIZE]) {
+        let bit_width = buf[*pos] as usize;
+        let num_exceptions = buf[*pos + 1] as usize;
+        *pos += 2;
+        let reference = Self::read_leb128(buf, pos);
+
+        Self::unpack(buf, pos, bit_width, out);
+
+        for _ in 0..num_exceptions {
+            let i = buf[*pos] as usize;
+            *pos += 1;
+            out[i] |= Self::read_leb128(buf, pos) << bit_width;
+        }
+
+        for x in out.iter_mut() {
+            *x = x.wrapping_add(reference);
+        }
+    }
+
+    /// Decodes a stream and integrates its double deltas into entries, continuing from `delta`
+    /// and `current`
+    pub fn decode_entries(
+        buf: &[u8],
+        pos: &mut usize,
+        delta: &mut i64,
+        current: &mut u64,
+        out: &mut [u64; V3_BLOCK_SIZE],
+    ) {
+        // A width and reference of 0 is a run of constant steps patched by the exceptions
+        if buf[*pos] == 0 && buf[*pos + 2] == 0 {
+            let num_exceptions = buf[*pos + 1] as usize;
+            *pos += 3;
+
+            let mut start = 0;
+            for _ in 0..num_exceptions {
+                let i = buf[*pos] as usize;
+                *pos += 1;
+                let d_delta = IntCompressionUtils::zig_zag_decode(Self::read_leb128(buf, pos));
+
+                Self::fill_run(&mut out[start..i], *delta, current);
+                *delta = delta.wrapping_add(d_delta);
+                *current = current.wrapping_add_signed(*delta);
+                out[i] = *current;
+                start = i + 1;
+            }
+            Self::fill_run(&mut out[start..], *delta, current);
+            return;
+        }
+
+        let mut d_deltas = [0u64; V3_BLOCK_SIZE];
+        Self::decode_stream(buf, pos, &mut d_deltas);
+
+        // Prefix sums of the double deltas give the deltas, and their prefix sums the entries
+        for (x, d_delta) in out.iter_mut().zip(d_deltas) {
+            *delta = delta.wrapping_add(IntCompressionUtils::zig_zag_decode(d_delta));
+            *current = current.wrapping_add_signed(*delta);
+            *x = *current;
+        }
+    }
+
+    /// Encodes the double deltas of `values`, continuing from `delta` and `previous`
+    pub fn encode_deltas(
+        values: &[u64; V3_BLOCK_SIZE],
+        delta: &mut i64,
+        previous: u64,
+        out: &mut Vec<u8>,
+    ) {
+        let mut d_deltas = [0u64; V3_BLOCK_SIZE];
+        let mut previous = previous;
+        for (d_delta, value) in d_deltas.iter_mut().zip(values) {
+            let curr_delta = value.wrapping_sub(previous) as i64;
+            *d_delta = IntCompressionUtils::zig_zag_encode(curr_delta.wrapping_sub(*delta));
+            *delta = curr_delta;
+            previous = *value;
+        }
+        Self::encode_stream(&d_deltas, out);
+    }
+
+    /// Encodes a value stream of `values`, continuing from `delta` and `previous`: their
+    /// double deltas, or their runs or dictionary if either is smaller
+    pub fn encode_column(
+        values: &[u64; V3_BLOCK_SIZE],
+        delta: &mut i64,
+        previous: u64,
+        out: &mut Vec<u8>,
+    ) {
+        let start = out.len();
+        Self::encode_deltas(values, delta, previous, out);
+        Self::encode_values(values, previous, start, out);
+    }
+
+    /// Decodes a value stream, continuing from `delta` and `current`
+    pub fn decode_column(
+        buf: &[u8],
+        pos: &mut usize,
+        delta: &mut i64,
+        current: &mut u64,
+        out: &mut [u64; V3_BLOCK_SIZE],
+    ) {
+        match buf[*pos] {
+            V3_RUNS | V3_DICTIONARY => {
+                if buf[*pos] == V3_RUNS {
+                    Self::decode_runs(buf, pos, current, out);
+                } else {
+                    Self::decode_dictionary(buf, pos, out);
+                }
+                *current = out[V3_BLOCK_SIZE - 1];
+                *delta = out[V3_BLOCK_SIZE - 1].wrapping_sub(out[V3_BLOCK_SIZE - 2]) as i64;
+            }
+            _ => Self::decode_entries(buf, pos, delta, current, out),
+        }
+    }
+
+    /// Generates entries `step` apart, each independently of the others
+    #[inline(always)]
+    fn fill_run(out: &mut [u64], step: i64, current: &mut u64) {
+        for (k, x) in out.iter_mut().enumerate() {
+            *x = current.wrapping_add((k as u64 + 1).wrapping_mul(step as u64));
+        }
+        *current = current.wrapping_add((out.len() as u64).wrapping_mul(step as u64));
+    }
+
+    /// Replaces the value stream written to `out` from `start` with the runs or the dictionary
+    /// of `values` if either is smaller. `previous` is the last value of the previous block.
+    fn encode_values(
+        values: &[u64; V3_BLOCK_SIZE],
+        previous: u64,
+        start: usize,
+        out: &mut Vec<u8>,
+    ) {
+        let num_runs = 1 + values.windows(2).filter(|pair| pair[0] != pair[1]).count();
+        let dictionary = Self::dictionary(values);
+
+        let mut best_size = out.len() - start;
+        for encoding in [V3_RUNS, V3_DICTIONARY] {
+            // Each run and dictionary value takes at least 2 and 1 bytes
+            if (encoding == V3_RUNS && 2 + 2 * num_runs >= best_size)
+                || (encoding == V3_DICTIONARY && dictionary.is_none())
+            {
+                continue;
+            }
+
+            let end = out.len();
+            match encoding {
+                V3_RUNS => Self::encode_runs(values, previous, num_runs, out),
+                _ => Self::encode_dictionary(values, dictionary.as_ref().unwrap(), out),
+            }
+
+            let size = out.len() - end;
+            if size < best_size {
+                out.copy_within(end.., start);
+                best_size = size;
+            }
+            out.truncate(start + best_size);
+        }
+    }
+
+    fn encode_runs(
+        values: &[u64; V3_BLOCK_SIZE],
+        mut previous: u64,
+        num_runs: usize,
+        out: &mut Vec<u8>,
+    ) {
+        out.push(V3_RUNS);
+        out.push((num_runs - 1) as u8);
+
+        let mut i = 0;
+        while i < V3_BLOCK_SIZE {
+            let value = values[i];
+            let len = values[i..].iter().take_while(|x| **x == value).count();
+            Self::write_leb128(
+                IntCompressionUtils::zig_zag_encode(value.wrapping_sub(previous) as i64),
+                out,
+            );
+            out.push((len - 1) as u8);
+
+            previous = value;
+            i += len;
+        }
+    }
+
+    fn decode_runs(buf: &[u8], pos: &mut usize, current: &mut u64, out: &mut [u64; V3_BLOCK_SIZE]) {
+        let num_runs = buf[*pos + 1] as usize + 1;
+        *pos += 2;
+
+        let mut i = 0;
+        for _ in 0..num_runs {
+            let difference = IntCompressionUtils::zig_zag_decode(Self::read_leb128(buf, pos));
+            *current = current.wrapping_add_signed(difference);
+            let len = buf[*pos] as usize + 1;
+            *pos += 1;
+
+            out[i..i + len].fill(*current);
+            i += len;
+        }
+    }
+
+    /// Gets the distinct values in ascending order if there are at most V3_MAX_DICTIONARY_SIZE
+    fn dictionary(values: &[u64; V3_BLOCK_SIZE]) -> Option<Vec<u64>> {
+        let mut dictionary = Vec::with_capacity(V3_MAX_DICTIONARY_SIZE + 1);
+        for value in values {
+            if let Err(i) = dictionary.binary_search(value) {
+                if dictionary.len() == V3_MAX_DICTIONARY_SIZE {
+                    return None;
+                }
+                dictionary.insert(i, *value);
+            }
+        }
+        Some(dictionary)
+    }
+
+    fn encode_dictionary(values: &[u64; V3_BLOCK_SIZE], dictionary: &[u64], out: &mut Vec<u8>) {
+        out.push(V3_DICTIONARY);
+        out.push((dictionary.len() - 1) as u8);
+
+        let mut previous = 0;
+        for value in dictionary {
+            Self::write_leb128(value - previous, out);
+            previous = *value;
+        }
+
+        let bit_width = IntCompressionUtils::bits_needed_u64(dictionary.len() as u64 - 1) as usize;
+        let indices = values.map(|value| dictionary.binary_search(&value).unwrap() as u64);
+        Self::pack(indices, bit_width, out);
+    }
+
+    fn decode_dictionary(buf: &[u8], pos: &mut usize, out: &mut [u64; V3_BLOCK_SIZE]) {
+        let size = buf[*pos + 1] as usize + 1;
+        *pos += 2;
+
+        let mut dictionary = [0u64; V3_MAX_DICTIONARY_SIZE];
+        let mut previous = 0;
+        for value in dictionary[..size].iter_mut() {
+            *value = previous + Self::read_leb128(buf, pos);
+            previous = *value;
+        }
+
+        let bit_width = IntCompressionUtils::bits_needed_u64(size as u64 - 1) as usize;
+        Self::unpack(buf, pos, bit_width, out);
+        for x in out.iter_mut() {
+            *x = dictionary[*x as usize];
+        }
+    }
+}
+
+/// Unpacks V3_BLOCK_SIZE offsets of `BITS` bits each.
+/// The width is a constant, so every lane has a fixed word and shift, and the loop is fully
+/// unrolled into vector shifts and masks.
+#[inline(always)]
+fn unpack<const BITS: usize>(words: &[u64; V3_BLOCK_SIZE], out: &mut [u64; V3_BLOCK_SIZE]) {
+    if BITS == 0 {
+        out.fill(0);
+        return;
+    }
+
+    let mask = u64::MAX >> (64 - BITS);
+    for (i, x) in out.iter_mut().enumerate() {
+        let bit = i * BITS;
+        let mut offset = words[bit / 64] >> (bit % 64);
+        if bit % 64 + BITS > 64 {
+            offset |= words[bit / 64 + 1] << (64 - bit % 64);
+        }
+        *x = offset & mask;
+    }
+}
+
+macro_rules! unpackers {
+    ($($bits: literal)*) => {
+        [$(unpack::<$bits>),*]
+    };
+}
+
+#[allow(clippy::type_complexity)]
+const V3_UNPACKERS: [fn(&[u64; V3_BLOCK_SIZE], &mut [u64; V3_BLOCK_SIZE]); 65] = unpackers!(
+    0 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19 20 21 22 23 24 25 26 27 28 29 30 31 32
+    33 34 35 36 37 38 39 40 41 42 43 44 45 46 47 48 49 50 51 52 53 54 55 56 57 58 59 60 61 62 63
+    64
+);
+
+pub struct CompressionEngineV3<T: Write> {
+    writer: T,
+    last_timestamp: Timestamp,
+    last_value: PhysicalType,
+    last_deltas: (i64, i64),
+
+    ts_d_deltas: [u64; V3_BLOCK_SIZE],
+    v_d_deltas: [u64; V3_BLOCK_SIZE],
+    values: [PhysicalType; V3_BLOCK_SIZE],
+    /// Last value before the current block
+    block_start_value: PhysicalType,
+    buffer_idx: usize,
+
+    result: Vec<u8>,
+}
+
+impl<T: Write> CompressionEngine<T> for CompressionEngineV3<T> {
+    type PhysicalType = u64;
+
+    fn new(writer: T, header: &Header) -> Self {
+        Self {
+            writer,
+            last_timestamp: header.min_timestamp,
+            last_value: header.first_value.get_uinteger64(),
+            last_deltas: (0, 0),
+
+            ts_d_deltas: [0; V3_BLOCK_SIZE],
+            v_d_deltas: [0; V3_BLOCK_SIZE],
+            values: [0; V3_BLOCK_SIZE],
+            block_start_value: header.first_value.get_uinteger64(),
+            buffer_idx: 0,
+
+            result: Vec::with_capacity(4 + 2 * V3_MAX_STREAM_SIZE),
+        }
+    }
+
+    fn new_from_partial(writer: T, data_file: TimeDataFile) -> Self {
+        let num_entries = data_file.num_entries();
+        Self {
+            last_timestamp: data_file.timestamps[num_entries - 1],
+            last_value: data_file.values[num_entries - 1].get_uinteger64(),
+            block_start_value: data_file.values[num_entries - 1].get_uinteger64(),
+            last_deltas: if num_entries < 2 {
+                (0, 0)
+            } else {
+                (
+                    (data_file.timestamps[num_entries - 1] as i64)
+                        .wrapping_sub(data_file.timestamps[num_entries - 2] as i64),
+                    data_file.values[num_entries - 1]
+                        .get_integer64()
+                        .wrapping_sub(data_file.values[num_entries - 2].get_integer64()),
+                )
+            },
+            ..Self::new(writer, &data_file.header)
+        }
+    }
+
+    fn new_from_state(writer: T, header: &Header, state: &DecoderState) -> Self {
+        Self {
+            last_timestamp: state.timestamp,
+            last_value: state.value,
+            block_start_value: state.value,
+            last_deltas: state.deltas,
+            ..Self::new(writer, header)
+        }
+    }
+
+    fn consume(&mut self, timestamp: Timestamp, value: PhysicalType) -> usize {
+        let curr_deltas = (
+            (timestamp.wrapping_sub(self.last_timestamp)) as i64,
+            (value.wrapping_sub(self.last_value)) as i64,
+        );
+
+        self.ts_d_deltas[self.buffer_idx] =
+            IntCompressionUtils::zig_zag_encode(curr_deltas.0.wrapping_sub(self.last_deltas.0));
+        self.v_d_deltas[self.buffer_idx] =
+            IntCompressionUtils::zig_zag_encode(curr_deltas.1.wrapping_sub(self.last_deltas.1));
+        self.values[self.buffer_idx] = value;
+
+        self.last_timestamp = timestamp;
+        self.last_value = value;
+        self.last_deltas = curr_deltas;
+
+        self.buffer_idx += 1;
+        if self.buffer_idx >= V3_BLOCK_SIZE {
+            self.flush()
+        } else {
+            0
+        }
+    }
+
+    fn flush_all(&mut self) -> usize {
+        self.flush()
+    }
+
+    fn restart_state(&self) -> Option<DecoderState> {
+        // Every block can be decoded on its own from the state before it
+        if self.buffer_idx != 0 {
+            return None;
+        }
+
+        Some(DecoderState {
+            timestamp: self.last_timestamp,
+            value: self.last_value,
+            deltas: self.last_deltas,
+        })
+    }
+}
+
+impl<T: Write> CompressionEngineV3<T> {
+    fn flush(&mut self) -> usize {
+        if self.buffer_idx == 0 {
+            return 0;
+        }
+
+        // Handle partially-filled blocks
+        self.ts_d_deltas[self.buffer_idx..].fill(0);
+        self.v_d_deltas[self.buffer_idx..].fill(0);
+        self.values[self.buffer_idx..].fill(self.last_value);
+
+        self.result.clear();
+        self.result.extend_from_slice(&[0, 0, 0, 0]);
+        V3Utils::encode_stream(&self.ts_d_deltas, &mut self.result);
+        let values_start = self.result.len();
+        let ts_length = (values_start - 4) as u16;
+        self.result[2..4].copy_from_slice(&ts_length.to_le_bytes());
+        V3Utils::encode_stream(&self.v_d_deltas, &mut self.result);
+        V3Utils::encode_values(
+            &self.values,
+            self.block_start_value,
+            values_start,
+            &mut self.result,
+        );
+        self.block_start_value = self.last_value;
+        let body_length = (self.result.len() - 2) as u16;
+        self.result[..2].copy_from_slice(&body_length.to_le_bytes());
+
+        self.writer.write_all(&self.result).unwrap();
+        self.buffer_idx = 0;
+        self.result.len()
+    }
+}
+
+pub struct DecompressionEngineV3<T: Read> {
+    reader: T,
+
+    buffer_idx: usize,
+    body: Vec<u8>,
+
+    current_timestamp: Timestamp,
+    current_value: PhysicalType,
+    last_deltas: (i64, i64),
+
+    /// Decoded entries of the current block
+    timestamps: [Timestamp; V3_BLOCK_SIZE],
+    values: [PhysicalType; V3_BLOCK_SIZE],
+}
+
+impl<T: Read> DecompressionEngine<T> for DecompressionEngineV3<T> {
+    type PhysicalType = PhysicalType;
+
+    fn new(reader: T, header: &Header) -> Self {
+        Self::new_from_state(
+            reader,
+            header,
+            &DecoderState {
+                timestamp: header.min_timestamp,
+                value: header.first_value.get_uinteger64(),
+                deltas: (0, 0),
+            },
+        )
+    }
+
+    fn new_from_state(reader: T, _: &Header, state: &DecoderState) -> Self {
+        Self {
+            reader,
+
+            buffer_idx: V3_BLOCK_SIZE,
+            body: Vec::with_capacity(2 + 2 * V3_MAX_STREAM_SIZE),
+
+            current_timestamp: state.timestamp,
+            current_value: state.value,
+            last_deltas: state.deltas,
+
+            timestamps: [0; V3_BLOCK_SIZE],
+            values: [0; V3_BLOCK_SIZE],
+        }
+    }
+
+    fn next(&mut self) -> (Timestamp, PhysicalType) {
+        if self.buffer_idx >= V3_BLOCK_SIZE {
+            self.decode_block();
+        }
+
+        let entry = (
+            self.timestamps[self.buffer_idx],
+            self.values[self.buffer_idx],
+        );
+        self.buffer_idx += 1;
+
+        entry
+    }
+
+    fn next_batch(&mut self, timestamps: &mut [Timestamp], values: &mut [PhysicalType]) -> usize {
+        let len = timestamps.len().min(values.len());
+        let mut num_decoded = 0;
+        while num_decoded < len {
+            if self.buffer_idx >= V3_BLOCK_SIZE {
+                self.decode_block();
+            }
+
+            let idx = self.buffer_idx;
+            let num_copied = (V3_BLOCK_SIZE - idx).min(len - num_decoded);
+            timestamps[num_decoded..num_decoded + num_copied]
+                .copy_from_slice(&self.timestamps[idx..idx + num_copied]);
+            values[num_decoded..num_decoded + num_copied]
+                .copy_from_slice(&self.values[idx..idx + num_copied]);
+
+            self.buffer_idx += num_copied;
+            num_decoded += num_copied;
+        }
+
+        len
+    }
+
+    fn next_run(&mut self, max_len: usize, end: Timestamp) -> (Timestamp, PhysicalType, usize) {
+        if self.buffer_idx >= V3_BLOCK_SIZE {
+            self.decode_block();
+        }
+
+        let idx = self.buffer_idx;
+        let limit = idx + (V3_BLOCK_SIZE - idx).min(max_len);
+        let len = run_length(&self.timestamps[idx..limit], &self.values[idx..limit], end);
+        self.buffer_idx += len;
+
+        (self.timestamps[idx + len - 1], self.values[idx], len)
+    }
+
+    fn next_values(&mut self, values: &mut [PhysicalType]) -> usize {
+        let mut num_decoded = 0;
+        while num_decoded < values.len() {
+            if self.buffer_idx >= V3_BLOCK_SIZE {
+                self.decode_block_values();
+            }
+
+            let idx = self.buffer_idx;
+            let num_copied = (V3_BLOCK_SIZE - idx).min(values.len() - num_decoded);
+            values[num_decoded..num_decoded + num_copied]
+                .copy_from_slice(&self.values[idx..idx + num_copied]);
+
+            self.buffer_idx += num_copied;
+            num_decoded += num_copied;
+        }
+
+        values.len()
+    }
+}
+
+impl<T: Read> DecompressionEngineV3<T> {
+    /// Reads the next block with two reads and decodes all of its entries at once
+    fn decode_block(&mut self) {
+        self.read_block();
+
+        let mut pos = 2;
+        V3Utils::decode_entries(
+            &self.body,
+            &mut pos,
+            &mut self.last_deltas.0,
+            &mut self.current_timestamp,
+            &mut self.timestamps,
+        );
+        V3Utils::decode_column(
+            &self.body,
+            &mut pos,
+            &mut self.last_deltas.1,
+            &mut self.current_value,
+            &mut self.values,
+        );
+
+        self.buffer_idx = 0;
+    }
+
+    /// Reads the next block and decodes only its values, skipping over the timestamp stream.
+    /// The current timestamp is left behind, so the timestamps of the block are not valid.
+    fn decode_block_values(&mut self) {
+        self.read_block();
+
+        let ts_length = u16::from_le_bytes([self.body[0], self.body[1]]) as usize;
+        let mut pos = 2 + ts_length;
+        V3Utils::decode_column(
+            &self.body,
+            &mut pos,
+            &mut self.last_deltas.1,
+            &mut self.current_value,
+            &mut self.values,
+        );
+
+        self.buffer_idx = 0;
+    }
+
+    fn read_block(&mut self) {
+        let mut length = [0u8; 2];
+        self.reader.read_exact(&mut length).unwrap();
+        self.body.resize(u16::from_le_bytes(length) as usize, 0);
+        self.reader.read_exact(&mut self.body).unwrap();
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::{
+        CompressionEngine, CompressionEngineV3, DecompressionEngine, DecompressionEngineV3,
+        V3Utils, V3_BLOCK_SIZE, V3_DICTIONARY, V3_RUNS,
+    };
+    use crate::storage::compression::int::v2::CompressionEngineV2;
+    use crate::storage::file::Header;
+    use crate::{StreamId, ValueType, Version};
+
+    #[test]
+    fn test_stream_round_trip() {
+        for bits in [0, 1, 5, 11, 33, 64] {
+            let mut values = [0u64; V3_BLOCK_SIZE];
+            for (i, value) in values.iter_mut().enumerate() {
+                *value = 1000 + (i as u64 * 2654435761) % (1u64 << bits.min(63));
+            }
+            // Outliers that become exceptions
+            values[3] = u64::MAX;
+            values[100] = 1u64 << 40;
+
+            let mut encoded = Vec::new();
+            V3Utils::encode_stream(&values, &mut encoded);
+
+            let mut decoded = [0u64; V3_BLOCK_SIZE];
+            let mut pos = 0;
+            V3Utils::decode_stream(&encoded, &mut pos, &mut decoded);
+            assert_eq!(pos, encoded.len());
+            assert_eq!(decoded, values);
+        }
+    }
+
+    #[test]
+    fn test_exceptions_keep_width() {
+        let mut values = [5u64; V3_BLOCK_SIZE];
+        for (i, value) in values.iter_mut().enumerate() {
+            *value += i as u64 % 32;
+        }
+        values[7] = 1 << 50;
+
+        let mut encoded = Vec::new();
+        V3Utils::encode_stream(&values, &mut encoded);
+        assert_eq!(encoded[0], 5);
+        assert_eq!(encoded[1], 1);
+    }
+
+    #[test]
+    fn test_compression_v3_read_back() {
+        let header = Header {
+            min_timestamp: 1,
+            first_value: 34u64.into(),
+            ..Header::new(Version(0), StreamId(0), ValueType::UInteger64)
+        };
+
+        let mut timestamps = Vec::new();
+        let mut values = Vec::new();
+        for i in 0..1000u64 {
+            timestamps.push(2 + i * 1000 + (i * 7919) % 23);
+            values.push(match i {
+                500 => u64::MAX,
+                501 => 0,
+                _ => 230_000 + (i * 104729) % 97,
+            });
+        }
+
+        let mut res: Vec<u8> = Vec::new();
+        let mut engine = CompressionEngineV3::<&mut Vec<u8>>::new(&mut res, &header);
+        let mut bytes_written = 0;
+        for (t, v) in timestamps.iter().zip(&values) {
+            bytes_written += engine.consume(*t, *v);
+        }
+        bytes_written += engine.flush_all();
+        assert_eq!(bytes_written, res.len());
+
+        let mut decomp = DecompressionEngineV3::<&[u8]>::new(&res, &header);
+        for (t, v) in timestamps.iter().zip(&values).take(300) {
+            assert_eq!(decomp.next(), (*t, *v));
+        }
+        let mut batch_timestamps = vec![0; 700];
+        let mut batch_values = vec![0; 700];
+        assert_eq!(
+            decomp.next_batch(&mut batch_timestamps, &mut batch_values),
+            700
+        );
+        assert_eq!(&batch_timestamps[..], &timestamps[300..]);
+        assert_eq!(&batch_values[..], &values[300..]);
+
+        // Values alone, skipping the timestamp streams
+        let mut decomp = DecompressionEngineV3::<&[u8]>::new(&res, &header);
+        for (t, v) in timestamps.iter().zip(&values).take(50) {
+            assert_eq!(decomp.next(), (*t, *v));
+        }
+        let mut batch_values = vec![0; 950];
+        assert_eq!(decomp.next_values(&mut batch_values), 950);
+        assert_eq!(&batch_values[..], &values[50..]);
+
+        // Smaller than V2, which has to round the value deltas up to a byte
+        let mut v2_res: Vec<u8> = Vec::new();
+        let mut v2_engine = CompressionEngineV2::<&mut Vec<u8>>::new(&mut v2_res, &header);
+        for (t, v) in timestamps.iter().zip(&values) {
+            v2_engine.consume(*t, *v);
+        }
+        v2_engine.flush_all();
+        assert!(res.len() < v2_res.len());
+    }
+
+    #[test]
+    fn test_compression_v3_restart_state() {
+        let header = Header {
+            min_timestamp: 0,
+            first_value: 0u64.into(),
+            ..Header::new(Version(0), StreamId(0), ValueType::UInteger64)
+        };
+
+        let mut res: Vec<u8> = Vec::new();
+        let mut engine = CompressionEngineV3::<&mut Vec<u8>>::new(&mut res, &header);
+        let mut bytes_written = 0;
+        let mut restart = None;
+        for i in 1..(3 * V3_BLOCK_SIZE as u64) {
+            bytes_written += engine.consume(i * 10, i * i);
+            if i as usize == V3_BLOCK_SIZE {
+                restart = Some((bytes_written, engine.restart_state().unwrap()));
+            } else if i as usize % V3_BLOCK_SIZE != 0 {
+                assert!(engine.restart_state().is_none());
+            }
+        }
+        engine.flush_all();
+
+        let (offset, state) = restart.unwrap();
+        let mut decomp =
+            DecompressionEngineV3::<&[u8]>::new_from_state(&res[offset..], &header, &state);
+        for i in (V3_BLOCK_SIZE as u64 + 1)..(3 * V3_BLOCK_SIZE as u64) {
+            assert_eq!(decomp.next(), (i * 10, i * i));
+        }
+    }
+
+    #[test]
+    fn test_compression_v3_fixed_interval() {
+        let header = Header {
+            min_timestamp: 1_000_000,
+            first_value: 7u64.into(),
+            ..Header::new(Version(0), StreamId(0), ValueType::UInteger64)
+        };
+
+        // Scraped every 15s, with a missed scrape, a late one and an hour long outage
+        let mut timestamps = Vec::new();
+        let mut timestamp = 1_000_000;
+        for i in 1..(4 * V3_BLOCK_SIZE as u64) {
+            timestamp += match i {
+                40 => 30,
+                41 => 16,
+                42 => 14,
+                300 => 3600,
+                _ => 15,
+            };
+            timestamps.push(timestamp);
+        }
+        let values: Vec<u64> = (0..timestamps.len() as u64).map(|i| 7 + i % 2).collect();
+
+        let mut res: Vec<u8> = Vec::new();
+        let mut engine = CompressionEngineV3::<&mut Vec<u8>>::new(&mut res, &header);
+        for (t, v) in timestamps.iter().zip(&values) {
+            engine.consume(*t, *v);
+        }
+        engine.flush_all();
+
+        // The timestamp stream of the first block is its 3 header bytes and 5 exceptions: the
+        // first step and the late scrapes. The second block is fully regular.
+        let mut pos = 4;
+        let mut d_deltas = [0u64; V3_BLOCK_SIZE];
+        V3Utils::decode_stream(&res, &mut pos, &mut d_deltas);
+        assert_eq!(pos, 4 + 3 + 5 * (1 + 1));
+        assert_eq!(u16::from_le_bytes([res[2], res[3]]) as usize, pos - 4);
+        let second_block = 2 + u16::from_le_bytes([res[0], res[1]]) as usize;
+        assert_eq!(&res[second_block + 4..second_block + 7], &[0, 0, 0]);
+
+        let mut decomp = DecompressionEngineV3::<&[u8]>::new(&res, &header);
+        for (t, v) in timestamps.iter().zip(&values) {
+            assert_eq!(decomp.next(), (*t, *v));
+        }
+    }
+
+    #[test]
+    fn test_compression_v3_runs_and_dictionary() {
+        let header = Header {
+            min_timestamp: 0,
+            first_value: 3u64.into(),
+            ..Header::new(Version(0), StreamId(0), ValueType::UInteger64)
+        };
+
+        // Idle counter, status flags and an enum-like gauge alternating between a few states
+        let values: Vec<u64> = (0..(3 * V3_BLOCK_SIZE + 17))
+            .map(|i| match i / V3_BLOCK_SIZE {
+                0 => 3,
+                1 => (i as u64 / 40) % 2,
+                _ => [10, 1 << 40, 7, 10_000][i * 7919 % 4],
+            })
+            .collect();
+
+        let mut res: Vec<u8> = Vec::new();
+        let mut engine = CompressionEngineV3::<&mut Vec<u8>>::new(&mut res, &header);
+        let mut block_sizes = Vec::new();
+        for (i, v) in values.iter().enumerate() {
+            let bytes = engine.consume(i as u64 + 1, *v);
+            if bytes > 0 {
+                block_sizes.push(bytes);
+            }
+        }
+        block_sizes.push(engine.flush_all());
+
+        // After the timestamp stream, the constant block is a run of steps of 0, the flags are
+        // runs and the gauge is a dictionary. Only the first timestamp stream has an exception.
+        assert_eq!(block_sizes[0], 4 + (3 + 2) + 3);
+        assert_eq!(res[block_sizes[0] + 4 + 3], V3_RUNS);
+        assert_eq!(block_sizes[1], 4 + 3 + 2 + 4 * 2);
+        assert_eq!(res[block_sizes[0] + block_sizes[1] + 4 + 3], V3_DICTIONARY);
+        assert!(block_sizes[2] <= 4 + 3 + 2 + 10 + V3_BLOCK_SIZE * 2 / 8);
+
+        let mut decomp = DecompressionEngineV3::<&[u8]>::new(&res, &header);
+        for (i, v) in values.iter().enumerate() {
+            assert_eq!(decomp.next(), (i as u64 + 1, *v));
+        }
+
+        // Runs are cut at the end of the range and at the end of a block
+        let mut decomp = DecompressionEngineV3::<&[u8]>::new(&res, &header);
+        assert_eq!(decomp.next_run(usize::MAX, 100), (100, 3, 100));
+        assert_eq!(decomp.next_run(usize::MAX, 1000), (128, 3, 28));
+        assert_eq!(decomp.next_run(5, 1000), (133, 1, 5));
+        assert_eq!(decomp.next_run(usize::MAX, 1000), (160, 1, 27));
+        assert_eq!(decomp.next_run(usize::MAX, 10), (161, 0, 1));
+    }
+}
@@ -1,28 +1,412 @@
-use std::io::{Read, Write};
+use std::io::{self, Read, Write};
 
-use crate::Timestamp;
+use crate::{Timestamp, ValueType};
 
 use super::file::{Header, TimeDataFile};
 
 pub mod float;
 pub mod int;
 
+/// Compression engine used for the stream of a file
+#[derive(Clone, Copy, PartialEq, Eq, Debug)]
+#[repr(u8)]
+pub enum Codec {
+    IntV2,
+    FloatV1,
+    IntV3,
+    IntGoogle,
+    FloatAlp,
+}
+
+impl Codec {
+    /// Gets the default codec for streams of the given value type.
+    pub fn for_value_type(value_type: ValueType) -> Self {
+        match value_type {
+            ValueType::Integer64 | ValueType::UInteger64 => Self::IntV3,
+            ValueType::Float64 => Self::FloatV1,
+        }
+    }
+
+    /// Gets the default codec for the file with the given header.
+    /// Quantized floats are encoded as integer multiples of the quantization step.
+    pub fn for_header(header: &Header) -> Self {
+        if header.is_quantized() {
+            Self::IntV3
+        } else {
+            Self::for_value_type(header.value_type)
+        }
+    }
+
+    fn is_int(self) -> bool {
+        matches!(self, Self::IntV2 | Self::IntV3 | Self::IntGoogle)
+    }
+
+    /// Gets the codecs that can encode streams of the given value type.
+    /// Integer codecs take the raw bits of floats, which suits gauges that rarely change.
+    /// The deprecated V1 integer engine has no codec, as it only hands its output to the writer
+    /// when flushed and so has no restart points.
+    pub fn candidates(value_type: ValueType) -> &'static [Self] {
+        match value_type {
+            ValueType::Integer64 | ValueType::UInteger64 => {
+                &[Self::IntV3, Self::IntV2, Self::IntGoogle]
+            }
+            ValueType::Float64 => &[
+                Self::FloatV1,
+                Self::FloatAlp,
+                Self::IntV3,
+                Self::IntV2,
+                Self::IntGoogle,
+            ],
+        }
+    }
+
+    /// Relative cost of decoding an entry, lowest first.
+    fn decode_cost(self) -> u8 {
+        match self {
+            Self::IntV3 => 0,
+            Self::FloatAlp => 1,
+            Self::IntV2 => 2,
+            Self::FloatV1 => 3,
+            Self::IntGoogle => 4,
+        }
+    }
+
+    /// Chooses the codec for a file by trial encoding its first entries with every candidate.
+    pub fn choose(
+        policy: CodecPolicy,
+        header: &Header,
+        timestamps: &[Timestamp],
+        values: &[u64],
+    ) -> Self {
+        if policy == CodecPolicy::Default || timestamps.is_empty() {
+            return Self::for_header(header);
+        }
+
+        let sizes: Vec<(Self, usize)> = Self::candidates(header.value_type)
+            .iter()
+            .filter(|codec| codec.is_int() || !header.is_quantized())
+            .map(|&codec| {
+                let trial_header = Header {
+                    codec,
+                    ..header.clone()
+                };
+                let mut compressor = Compressor::new(io::sink(), &trial_header);
+                let mut size = 0;
+                for (&timestamp, &value) in timestamps.iter().zip(values) {
+                    size += compressor.consume(timestamp, value);
+                }
+                (codec, size + compressor.flush_all())
+            })
+            .collect();
+
+        let smallest = sizes.iter().map(|&(_, size)| size).min().unwrap();
+        let (codec, _) = match policy {
+            CodecPolicy::Smallest => sizes
+                .iter()
+                .min_by_key(|&&(codec, size)| (size, codec.decode_cost())),
+            // Fastest to decode among the codecs within 25% of the smallest encoding
+            _ => sizes
+                .iter()
+                .filter(|&&(_, size)| size * 4 <= smallest * 5)
+                .min_by_key(|&&(codec, size)| (codec.decode_cost(), size)),
+        }
+        .unwrap();
+        *codec
+    }
+}
+
+impl TryFrom<u8> for Codec {
+    type Error = ();
+
+    fn try_from(value: u8) -> Result<Self, Self::Error> {
+        match value {
+            0 => Ok(Self::IntV2),
+            1 => Ok(Self::FloatV1),
+            2 => Ok(Self::IntV3),
+            3 => Ok(Self::IntGoogle),
+            4 => Ok(Self::FloatAlp),
+            _ => Err(()),
+        }
+    }
+}
+
+/// How the writer picks the codec of a new file.
+#[derive(Clone, Copy, PartialEq, Eq, Debug, Default)]
+#[repr(C)]
+pub enum CodecPolicy {
+    /// Always use the default codec for the value type. No trial is run, so the first blocks
+    /// of a file are written without waiting for the entries of a trial and files keep the
+    /// codec they had before codecs were chosen; opt into a trial per stream or connection.
+    #[default]
+    Default,
+    /// Use the codec with the smallest encoding of the file's first entries
+    Smallest,
+    /// Use the fastest codec to decode whose encoding is close to the smallest
+    Fastest,
+}
+
+impl TryFrom<u8> for CodecPolicy {
+    type Error = ();
+
+    fn try_from(value: u8) -> Result<Self, Self::Error> {
+        match value {
+            0 => Ok(Self::Default),
+            1 => Ok(Self::Smallest),
+            2 => Ok(Self::Fastest),
+            _ => Err(()),
+        }
+    }
+}
+
+/// Decoder state at a point in a compressed stream from which decompression can resume.
+#[derive(Clone, Copy, Debug, Default, PartialEq, Eq)]
+pub struct DecoderState {
+    pub timestamp: Timestamp,
+    pub value: u64,
+    pub deltas: (i64, i64),
+}
+
 pub trait CompressionEngine<W: Write> {
     type PhysicalType;
     fn new(writer: W, header: &Header) -> Self
     where
         Self: Sized;
     fn new_from_partial(writer: W, data_file: TimeDataFile) -> Self
+    where
+        Self: Sized;
+    /// Continues a stream from a state returned by `restart_state`.
+    /// Precondition: `writer` appends at the byte offset where `state` was captured
+    fn new_from_state(writer: W, header: &Header, state: &DecoderState) -> Self
     where
         Self: Sized;
     fn consume(&mut self, timestamp: Timestamp, value: Self::PhysicalType) -> usize;
     fn flush_all(&mut self) -> usize;
+
+    /// Returns the decoder state if everything consumed so far has been handed to the writer
+    /// and the next byte written starts a unit the decompressor can resume from.
+    fn restart_state(&self) -> Option<DecoderState> {
+        None
+    }
 }
 
 pub trait DecompressionEngine<R: Read> {
     type PhysicalType;
     fn new(reader: R, header: &Header) -> Self
+    where
+        Self: Sized;
+    /// Precondition: `reader` is positioned at the byte offset where `state` was captured
+    fn new_from_state(reader: R, header: &Header, state: &DecoderState) -> Self
     where
         Self: Sized;
     fn next(&mut self) -> (Timestamp, Self::PhysicalType);
+
+    /// Decodes the next entries into `timestamps` and `values` until either is full, and
+    /// returns the number of entries decoded.
+    /// Precondition: The stream has at least that many entries left
+    fn next_batch(
+        &mut self,
+        timestamps: &mut [Timestamp],
+        values: &mut [Self::PhysicalType],
+    ) -> usize {
+        for (timestamp, value) in timestamps.iter_mut().zip(values.iter_mut()) {
+            (*timestamp, *value) = self.next();
+        }
+        timestamps.len().min(values.len())
+    }
+
+    /// Decodes the next entries that have the same value as the next one, up to `max_len`
+    /// entries and stopping before timestamps past `end`. Returns the timestamp of the last
+    /// entry decoded, the value and the number of entries decoded, which is at least 1 even if
+    /// the next timestamp is past `end`.
+    /// Precondition: The stream has at least `max_len` entries left, and `max_len` > 0
+    fn next_run(
+        &mut self,
+        _max_len: usize,
+        _end: Timestamp,
+    ) -> (Timestamp, Self::PhysicalType, usize) {
+        let (timestamp, value) = self.next();
+        (timestamp, value, 1)
+    }
+
+    /// Decodes the values of the next entries into `values` until it is full, and returns the
+    /// number of entries decoded. Engines that store timestamps and values in separate sections
+    /// skip over the timestamps, so the decompressor must not be used again afterwards unless
+    /// the entries end at a restart point, where it is recreated from the seek table.
+    /// Precondition: The stream has at least that many entries left
+    fn next_values(&mut self, values: &mut [Self::PhysicalType]) -> usize {
+        let mut timestamps = vec![0; values.len()];
+        self.next_batch(&mut timestamps, values)
+    }
+}
+
+/// Gets the length of the run of entries at the start of `values` that have the same value and
+/// a timestamp of at most `end`, or 1 if the first timestamp is past `end`
+pub fn run_length(timestamps: &[Timestamp], values: &[u64], end: Timestamp) -> usize {
+    let len = values
+        .iter()
+        .take_while(|value| **value == values[0])
+        .count();
+    timestamps[..len]
+        .partition_point(|timestamp| *timestamp <= end)
+        .max(1)
+}
+
+/// Compressor for the codec recorded in a file's header.
+/// Values are passed as the raw 64 bits of a `Value`.
+#[allow(clippy::large_enum_variant)]
+pub enum Compressor<W: Write> {
+    Int(int::IntCompressor<W>),
+    Float(float::FloatCompressor<W>),
+}
+
+impl<W: Write> CompressionEngine<W> for Compressor<W> {
+    type PhysicalType = u64;
+
+    fn new(writer: W, header: &Header) -> Self {
+        match header.codec {
+            _ if header.is_quantized() => Self::Float(float::FloatCompressor::new(writer, header)),
+            Codec::IntV2 | Codec::IntV3 | Codec::IntGoogle => {
+                Self::Int(int::IntCompressor::new(writer, header))
+            }
+            Codec::FloatV1 | Codec::FloatAlp => {
+                Self::Float(float::FloatCompressor::new(writer, header))
+            }
+        }
+    }
+
+    fn new_from_partial(writer: W, data_file: TimeDataFile) -> Self {
+        match data_file.header.codec {
+            _ if data_file.header.is_quantized() => {
+                Self::Float(float::FloatCompressor::new_from_partial(writer, data_file))
+            }
+            Codec::IntV2 | Codec::IntV3 | Codec::IntGoogle => {
+                Self::Int(int::IntCompressor::new_from_partial(writer, data_file))
+            }
+            Codec::FloatV1 | Codec::FloatAlp => {
+                Self::Float(float::FloatCompressor::new_from_partial(writer, data_file))
+            }
+        }
+    }
+
+    fn new_from_state(writer: W, header: &Header, state: &DecoderState) -> Self {
+        match header.codec {
+            _ if header.is_quantized() => Self::Float(float::FloatCompressor::new_from_state(
+                writer, header, state,
+            )),
+            Codec::IntV2 | Codec::IntV3 | Codec::IntGoogle => {
+                Self::Int(int::IntCompressor::new_from_state(writer, header, state))
+            }
+            Codec::FloatV1 | Codec::FloatAlp => Self::Float(
+                float::FloatCompressor::new_from_state(writer, header, state),
+            ),
+        }
+    }
+
+    fn consume(&mut self, timestamp: Timestamp, value: Self::PhysicalType) -> usize {
+        match self {
+            Self::Int(engine) => engine.consume(timestamp, value),
+            Self::Float(engine) => engine.consume(timestamp, f64::from_bits(value)),
+        }
+    }
+
+    fn flush_all(&mut self) -> usize {
+        match self {
+            Self::Int(engine) => engine.flush_all(),
+            Self::Float(engine) => engine.flush_all(),
+        }
+    }
+
+    fn restart_state(&self) -> Option<DecoderState> {
+        match self {
+            Self::Int(engine) => engine.restart_state(),
+            Self::Float(engine) => engine.restart_state(),
+        }
+    }
+}
+
+/// Decompressor for the codec recorded in a file's header.
+/// Values are returned as the raw 64 bits of a `Value`.
+#[allow(clippy::large_enum_variant)]
+pub enum Decompressor<R: Read> {
+    Int(int::IntDecompressor<R>),
+    Float(float::FloatDecompressor<R>),
+}
+
+impl<R: Read> DecompressionEngine<R> for Decompressor<R> {
+    type PhysicalType = u64;
+
+    fn new(reader: R, header: &Header) -> Self {
+        match header.codec {
+            _ if header.is_quantized() => {
+                Self::Float(float::FloatDecompressor::new(reader, header))
+            }
+            Codec::IntV2 | Codec::IntV3 | Codec::IntGoogle => {
+                Self::Int(int::IntDecompressor::new(reader, header))
+            }
+            Codec::FloatV1 | Codec::FloatAlp => {
+                Self::Float(float::FloatDecompressor::new(reader, header))
+            }
+        }
+    }
+
+    fn new_from_state(reader: R, header: &Header, state: &DecoderState) -> Self {
+        match header.codec {
+            _ if header.is_quantized() => Self::Float(float::FloatDecompressor::new_from_state(
+                reader, header, state,
+            )),
+            Codec::IntV2 | Codec::IntV3 | Codec::IntGoogle => {
+                Self::Int(int::IntDecompressor::new_from_state(reader, header, state))
+            }
+            Codec::FloatV1 | Codec::FloatAlp => Self::Float(
+                float::FloatDecompressor::new_from_state(reader, header, state),
+            ),
+        }
+    }
+
+    fn next(&mut self) -> (Timestamp, Self::PhysicalType) {
+        match self {
+            Self::Int(engine) => engine.next(),
+            Self::Float(engine) => {
+                let (timestamp, value) = engine.next();
+                (timestamp, value.to_bits())
+            }
+        }
+    }
+
+    fn next_batch(&mut self, timestamps: &mut [Timestamp], values: &mut [u64]) -> usize {
+        match self {
+            Self::Int(engine) => engine.next_batch(timestamps, values),
+            Self::Float(engine) => {
+                for (timestamp, value) in timestamps.iter_mut().zip(values.iter_mut()) {
+                    let (next_timestamp, next_value) = engine.next();
+                    (*timestamp, *value) = (next_timestamp, next_value.to_bits());
+                }
+                timestamps.len().min(values.len())
+            }
+        }
+    }
+
+    fn next_run(&mut self, max_len: usize, end: Timestamp) -> (Timestamp, u64, usize) {
+        match self {
+            Self::Int(engine) => engine.next_run(max_len, end),
+            Self::Float(engine) => {
+                let (timestamp, value, len) = engine.next_run(max_len, end);
+                (timestamp, value.to_bits(), len)
+            }
+        }
+    }
+
+    fn next_values(&mut self, values: &mut [u64]) -> usize {
+        match self {
+            Self::Int(engine) => engine.next_values(values),
+            Self::Float(engine) => {
+                let mut decoded = vec![0f64; values.len()];
+                let len = engine.next_values(&mut decoded);
+                for (value, decoded) in values.iter_mut().zip(decoded) {
+                    *value = decoded.to_bits();
+                }
+                len
+            }
+        }
+    }
 }
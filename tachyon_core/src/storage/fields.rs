@@ -0,0 +1,671 @@
+/*
+    Multi-field files:
+--------------------------------------------------------
+    A multi-field stream has several named value columns, each with its own value type and
+    codec, that share one timestamp column. Its files hold every column:
+
+    | magic | header | blocks |
+
+    The header describes the file and every column:
+
+    | version (u16) | stream id (u128) | min timestamp (u64) | max timestamp (u64) |
+    | count (u32) | number of fields (u8) | fields |
+
+    Each field is:
+
+    | value type (u8) | codec (u8) | value sum | min value | max value |
+    | name length (u8) | name |
+
+    Entries are encoded in blocks of V3_BLOCK_SIZE entries:
+
+    | body length (u32 LE) | timestamp stream | column 0 | column 1 | ... |
+
+    The timestamp stream is a V3 stream of the zig-zag encoded double deltas of the block.
+    Each column is its stream length (u16 LE) followed by the value stream of its codec:
+
+    - IntV3: a V3 value stream of the raw bits of the values
+    - FloatAlp: an ALP value stream
+
+    Every block starts from a timestamp, value and step of 0, so blocks and columns can be
+    skipped without decoding them. A partially filled last block is padded with its last entry.
+
+    Blocks are appended as they fill up and the header is only written when the file is
+    sealed, so a file is indexed once it is sealed.
+*/
+
+use super::compression::float::AlpUtils;
+use super::compression::int::{V3Utils, V3_BLOCK_SIZE};
+use super::compression::Codec;
+use super::page_cache::{immutable_file_read, FileRead, PageCache, ReadMode};
+use super::FileReaderUtils;
+use crate::{StreamId, Timestamp, Value, ValueType, Version};
+use std::fs::File;
+use std::io::{self, Read, Seek, Write};
+use std::path::{Path, PathBuf};
+use std::sync::Arc;
+
+const MAGIC_SIZE: usize = 4;
+const MAGIC: [u8; MAGIC_SIZE] = [b'T', b'a', b'c', b'f'];
+
+const HEADER_FIXED_SIZE: usize = 39;
+const FIELD_FIXED_SIZE: usize = 27;
+
+/// Named value column of a multi-field stream
+#[derive(Clone, Debug, PartialEq)]
+pub struct Field {
+    pub name: String,
+    pub value_type: ValueType,
+    pub codec: Codec,
+}
+
+impl Field {
+    /// Creates a field with the default codec for its value type
+    pub fn new(name: impl Into<String>, value_type: ValueType) -> Self {
+        let codec = match value_type {
+            ValueType::Integer64 | ValueType::UInteger64 => Codec::IntV3,
+            ValueType::Float64 => Codec::FloatAlp,
+        };
+        Self::with_codec(name, value_type, codec)
+    }
+
+    /// Creates a field encoded with `codec`, which must be `IntV3` or, for `Float64` fields,
+    /// `FloatAlp`, the codecs with a value stream of their own
+    pub fn with_codec(name: impl Into<String>, value_type: ValueType, codec: Codec) -> Self {
+        let name = name.into();
+        if name.is_empty() || name.len() > u8::MAX as usize {
+            panic!("Field names must be between 1 and 255 bytes long!");
+        }
+        if !(codec == Codec::IntV3
+            || (codec == Codec::FloatAlp && value_type == ValueType::Float64))
+        {
+            panic!("Field {} cannot be encoded with {:?}!", name, codec);
+        }
+
+        Self {
+            name,
+            value_type,
+            codec,
+        }
+    }
+}
+
+/// Field of a file with the aggregates of its values
+#[derive(Clone)]
+pub struct Column {
+    pub field: Field,
+    pub value_sum: Value,
+    pub min_value: Value,
+    pub max_value: Value,
+}
+
+#[derive(Clone)]
+pub struct FieldHeader {
+    pub version: Version,
+    pub stream_id: StreamId,
+
+    pub min_timestamp: Timestamp,
+    pub max_timestamp: Timestamp,
+
+    pub count: u32,
+    pub columns: Vec<Column>,
+}
+
+impl FieldHeader {
+    pub fn new(version: Version, stream_id: StreamId, fields: &[Field]) -> Self {
+        if fields.is_empty() || fields.len() > u8::MAX as usize {
+            panic!("Multi-field streams must have between 1 and 255 fields!");
+        }
+
+        Self {
+            version,
+            stream_id,
+            min_timestamp: Timestamp::default(),
+            max_timestamp: Timestamp::default(),
+            count: 0,
+            columns: fields
+                .iter()
+                .map(|field| Column {
+                    field: field.clone(),
+                    value_sum: Value::get_default(field.value_type),
+                    min_value: Value::get_default(field.value_type),
+                    max_value: Value::get_default(field.value_type),
+                })
+                .collect(),
+        }
+    }
+
+    pub fn fields(&self) -> impl Iterator<Item = &Field> {
+        self.columns.iter().map(|column| &column.field)
+    }
+
+    fn size(&self) -> usize {
+        MAGIC_SIZE
+            + HEADER_FIXED_SIZE
+            + self
+                .columns
+                .iter()
+                .map(|column| FIELD_FIXED_SIZE + column.field.name.len())
+                .sum::<usize>()
+    }
+
+    fn update(&mut self, timestamp: Timestamp, values: &[Value]) {
+        if self.count == 0 {
+            self.min_timestamp = timestamp;
+            self.max_timestamp = timestamp;
+            for (column, value) in self.columns.iter_mut().zip(values) {
+                column.min_value = *value;
+                column.max_value = *value;
+            }
+        }
+        self.count += 1;
+
+        self.min_timestamp = Timestamp::min(self.min_timestamp, timestamp);
+        self.max_timestamp = Timestamp::max(self.max_timestamp, timestamp);
+        for (column, value) in self.columns.iter_mut().zip(values) {
+            let value_type = column.field.value_type;
+            column.value_sum = column.value_sum.add_same(value_type, value);
+            column.min_value = column.min_value.min_same(value_type, value);
+            column.max_value = column.max_value.max_same(value_type, value);
+        }
+    }
+
+    /// Reads the header of a sealed file
+    pub fn read(path: &Path) -> io::Result<Self> {
+        Self::parse(&mut File::open(path)?)
+    }
+
+    fn parse(reader: &mut impl Read) -> io::Result<Self> {
+        let mut magic = [0u8; MAGIC_SIZE];
+        reader.read_exact(&mut magic)?;
+        if magic != MAGIC {
+            panic!("Corrupted file - invalid magic for multi-field .ty file!");
+        }
+
+        let mut buffer = [0u8; HEADER_FIXED_SIZE];
+        reader.read_exact(&mut buffer)?;
+        let mut header = Self {
+            version: Version(
+                FileReaderUtils::read_u64_2(&buffer[0..2])
+                    .try_into()
+                    .unwrap(),
+            ),
+            stream_id: StreamId(FileReaderUtils::read_u128_16(&buffer[2..18])),
+            min_timestamp: FileReaderUtils::read_u64_8(&buffer[18..26]),
+            max_timestamp: FileReaderUtils::read_u64_8(&buffer[26..34]),
+            count: FileReaderUtils::read_u64_4(&buffer[34..38])
+                .try_into()
+                .unwrap(),
+            columns: Vec::with_capacity(buffer[38] as usize),
+        };
+
+        for _ in 0..buffer[38] {
+            let mut buffer = [0u8; FIELD_FIXED_SIZE];
+            reader.read_exact(&mut buffer)?;
+            let mut name = vec![0u8; buffer[26] as usize];
+            reader.read_exact(&mut name)?;
+
+            let value = |buf: &[u8]| Value {
+                uinteger64: FileReaderUtils::read_u64_8(buf),
+            };
+            header.columns.push(Column {
+                field: Field {
+                    name: String::from_utf8(name).expect("Field name is not valid UTF-8"),
+                    value_type: buffer[0].try_into().unwrap(),
+                    codec: buffer[1].try_into().unwrap(),
+                },
+                value_sum: value(&buffer[2..10]),
+                min_value: value(&buffer[10..18]),
+                max_value: value(&buffer[18..26]),
+            });
+        }
+
+        Ok(header)
+    }
+
+    fn write(&self, file: &mut File) -> Result<usize, io::Error> {
+        let mut buffer = Vec::with_capacity(self.size());
+        buffer.extend_from_slice(&MAGIC);
+
+        buffer.extend_from_slice(&self.version.0.to_le_bytes());
+        buffer.extend_from_slice(&self.stream_id.0.to_le_bytes());
+
+        buffer.extend_from_slice(&self.min_timestamp.to_le_bytes());
+        buffer.extend_from_slice(&self.max_timestamp.to_le_bytes());
+
+        buffer.extend_from_slice(&self.count.to_le_bytes());
+        buffer.push(self.columns.len() as u8);
+
+        for column in &self.columns {
+            buffer.push(column.field.value_type as u8);
+            buffer.push(column.field.codec as u8);
+            // Values are stored as their raw bits, which are little-endian for every type
+            for value in [column.value_sum, column.min_value, column.max_value] {
+                buffer.extend_from_slice(&value.get_uinteger64().to_le_bytes());
+            }
+            buffer.push(column.field.name.len() as u8);
+            buffer.extend_from_slice(column.field.name.as_bytes());
+        }
+
+        file.write_all(&buffer)?;
+        Ok(buffer.len())
+    }
+}
+
+/// Multi-field file being written. Blocks are appended as they fill up.
+pub struct FieldFile {
+    pub header: FieldHeader,
+    pub path: PathBuf,
+    file: File,
+
+    timestamps: [Timestamp; V3_BLOCK_SIZE],
+    values: Vec<[u64; V3_BLOCK_SIZE]>,
+    buffer_idx: usize,
+
+    result: Vec<u8>,
+}
+
+impl FieldFile {
+    pub fn new(
+        version: Version,
+        stream_id: StreamId,
+        fields: &[Field],
+        path: PathBuf,
+    ) -> Result<Self, io::Error> {
+        let header = FieldHeader::new(version, stream_id, fields);
+        let mut file = File::create(&path)?;
+        // The header is rewritten with its final values when the file is sealed
+        header.write(&mut file)?;
+
+        Ok(Self {
+            values: vec![[0; V3_BLOCK_SIZE]; fields.len()],
+            header,
+            path,
+            file,
+
+            timestamps: [0; V3_BLOCK_SIZE],
+            buffer_idx: 0,
+
+            result: Vec::new(),
+        })
+    }
+
+    /// Precondition: `values` has a value of the right type for every field, in order
+    pub fn write(&mut self, timestamp: Timestamp, values: &[Value]) -> Result<(), io::Error> {
+        assert_eq!(values.len(), self.header.columns.len());
+        self.header.update(timestamp, values);
+
+        self.timestamps[self.buffer_idx] = timestamp;
+        for (column, value) in self.values.iter_mut().zip(values) {
+            column[self.buffer_idx] = value.get_uinteger64();
+        }
+
+        self.buffer_idx += 1;
+        if self.buffer_idx == V3_BLOCK_SIZE {
+            self.flush_block()?;
+        }
+        Ok(())
+    }
+
+    /// Writes the buffered entries and the header
+    pub fn seal(&mut self) -> Result<(), io::Error> {
+        self.flush_block()?;
+        self.file.seek(io::SeekFrom::Start(0))?;
+        self.header.write(&mut self.file)?;
+        self.file.flush()
+    }
+
+    pub fn num_entries(&self) -> usize {
+        self.header.count as usize
+    }
+
+    fn flush_block(&mut self) -> Result<(), io::Error> {
+        if self.buffer_idx == 0 {
+            return Ok(());
+        }
+
+        // Handle partially-filled blocks
+        let last = self.buffer_idx - 1;
+        let last_timestamp = self.timestamps[last];
+        self.timestamps[self.buffer_idx..].fill(last_timestamp);
+        for column in self.values.iter_mut() {
+            let last_value = column[last];
+            column[self.buffer_idx..].fill(last_value);
+        }
+
+        self.result.clear();
+        self.result.extend_from_slice(&[0; 4]);
+        V3Utils::encode_deltas(&self.timestamps, &mut 0, 0, &mut self.result);
+        for (column, values) in self.header.columns.iter().zip(&self.values) {
+            let start = self.result.len();
+            self.result.extend_from_slice(&[0; 2]);
+            match column.field.codec {
+                Codec::FloatAlp => {
+                    AlpUtils::encode_stream(&values.map(f64::from_bits), &mut self.result)
+                }
+                _ => V3Utils::encode_column(values, &mut 0, 0, &mut self.result),
+            }
+            let stream_length = (self.result.len() - start - 2) as u16;
+            self.result[start..start + 2].copy_from_slice(&stream_length.to_le_bytes());
+        }
+        let body_length = (self.result.len() - 4) as u32;
+        self.result[..4].copy_from_slice(&body_length.to_le_bytes());
+
+        self.file.write_all(&self.result)?;
+        self.buffer_idx = 0;
+        Ok(())
+    }
+}
+
+/// Cursor over the entries of a multi-field stream in a time range, decoding only the
+/// selected fields
+pub struct FieldCursor {
+    file_paths: Vec<PathBuf>,
+    file_index: usize,
+    /// Indices of the selected fields in the current file
+    columns: Vec<usize>,
+    names: Vec<String>,
+
+    start: Timestamp,
+    end: Timestamp,
+
+    page_cache: Arc<PageCache>,
+    read_mode: ReadMode,
+    header: FieldHeader,
+    reader: FileRead,
+    entries_left: usize,
+
+    body: Vec<u8>,
+    timestamps: [Timestamp; V3_BLOCK_SIZE],
+    values: Vec<[u64; V3_BLOCK_SIZE]>,
+    block_len: usize,
+    buffer_idx: usize,
+
+    row: Vec<Value>,
+}
+
+impl FieldCursor {
+    /// Precondition: `file_paths` are the files of one stream in ascending time order
+    pub fn new(
+        file_paths: Vec<PathBuf>,
+        fields: &[impl AsRef<str>],
+        start: Timestamp,
+        end: Timestamp,
+        page_cache: Arc<PageCache>,
+    ) -> Result<Self, io::Error> {
+        assert!(!file_paths.is_empty());
+        assert!(start <= end);
+
+        // Queries over several files are long sequential reads that should not evict hot pages
+        let read_mode = if file_paths.len() > 1 {
+            ReadMode::Scan
+        } else {
+            ReadMode::Normal
+        };
+        let (header, reader) = Self::open(&page_cache, &file_paths[0], read_mode)?;
+
+        let mut cursor = Self {
+            file_paths,
+            file_index: 0,
+            columns: Vec::new(),
+            names: fields
+                .iter()
+                .map(|name| name.as_ref().to_string())
+                .collect(),
+
+            start,
+            end,
+
+            page_cache,
+            read_mode,
+            entries_left: header.count as usize,
+            header,
+            reader,
+
+            body: Vec::new(),
+            timestamps: [0; V3_BLOCK_SIZE],
+            values: vec![[0; V3_BLOCK_SIZE]; fields.len()],
+            block_len: 0,
+            buffer_idx: 0,
+
+            row: Vec::with_capacity(fields.len()),
+        };
+        cursor.select_columns()?;
+        Ok(cursor)
+    }
+
+    fn open(
+        page_cache: &Arc<PageCache>,
+        path: &PathBuf,
+        read_mode: ReadMode,
+    ) -> Result<(FieldHeader, FileRead), io::Error> {
+        let file_id = page_cache.register_or_get_file_id(path);
+        let mut reader = immutable_file_read(page_cache.clone(), file_id, 0, read_mode);
+        let header = FieldHeader::parse(&mut reader)?;
+        Ok((header, reader))
+    }
+
+    fn select_columns(&mut self) -> Result<(), io::Error> {
+        self.columns.clear();
+        for name in &self.names {
+            let index = self
+                .header
+                .fields()
+                .position(|field| field.name == *name)
+                .ok_or_else(|| {
+                    io::Error::new(io::ErrorKind::NotFound, format!("No field named {}", name))
+                })?;
+            self.columns.push(index);
+        }
+        Ok(())
+    }
+
+    /// Gets the selected fields, in the order of the values of each row
+    pub fn fields(&self) -> Vec<Field> {
+        self.columns
+            .iter()
+            .map(|&index| self.header.columns[index].field.clone())
+            .collect()
+    }
+
+    /// Gets the next entry in the time range with the values of the selected fields
+    pub fn next_row(&mut self) -> Option<(Timestamp, &[Value])> {
+        if self.buffer_idx >= self.block_len && !self.next_block() {
+            return None;
+        }
+
+        let timestamp = self.timestamps[self.buffer_idx];
+        if timestamp > self.end {
+            self.block_len = 0;
+            self.entries_left = 0;
+            self.file_index = self.file_paths.len();
+            return None;
+        }
+
+        self.row.clear();
+        for (values, &index) in self.values.iter().zip(&self.columns) {
+            let value = values[self.buffer_idx];
+            self.row.push(match self.header.columns[index].field.codec {
+                Codec::FloatAlp => Value {
+                    float64: f64::from_bits(value),
+                },
+                _ => Value { uinteger64: value },
+            });
+        }
+        self.buffer_idx += 1;
+
+        Some((timestamp, &self.row))
+    }
+
+    /// Decodes the next block with entries at or after start, moving to the next files as
+    /// needed. Returns false if there are none.
+    fn next_block(&mut self) -> bool {
+        loop {
+            while self.entries_left == 0 {
+                self.file_index += 1;
+                if self.file_index >= self.file_paths.len() {
+                    return false;
+                }
+                let (header, reader) = Self::open(
+                    &self.page_cache,
+                    &self.file_paths[self.file_index],
+                    self.read_mode,
+                )
+                .unwrap();
+                (self.header, self.reader) = (header, reader);
+                self.entries_left = self.header.count as usize;
+                self.select_columns().unwrap();
+            }
+
+            let mut length = [0u8; 4];
+            self.reader.read_exact(&mut length).unwrap();
+            self.body.resize(u32::from_le_bytes(length) as usize, 0);
+            self.reader.read_exact(&mut self.body).unwrap();
+
+            self.block_len = self.entries_left.min(V3_BLOCK_SIZE);
+            self.entries_left -= self.block_len;
+
+            let mut pos = 0;
+            V3Utils::decode_entries(&self.body, &mut pos, &mut 0, &mut 0, &mut self.timestamps);
+            if self.timestamps[self.block_len - 1] < self.start {
+                continue;
+            }
+            self.buffer_idx =
+                self.timestamps[..self.block_len].partition_point(|t| *t < self.start);
+
+            // Columns that are not selected are skipped without decoding them
+            for (index, column) in self.header.columns.iter().enumerate() {
+                let stream_length =
+                    u16::from_le_bytes([self.body[pos], self.body[pos + 1]]) as usize;
+                pos += 2;
+
+                for (values, _) in self
+                    .values
+                    .iter_mut()
+                    .zip(&self.columns)
+                    .filter(|(_, selected)| **selected == index)
+                {
+                    let mut column_pos = pos;
+                    match column.field.codec {
+                        Codec::FloatAlp => {
+                            let mut floats = [0f64; V3_BLOCK_SIZE];
+                            AlpUtils::decode_stream(&self.body, &mut column_pos, &mut floats);
+                            *values = floats.map(f64::to_bits);
+                        }
+                        _ => V3Utils::decode_column(
+                            &self.body,
+                            &mut column_pos,
+                            &mut 0,
+                            &mut 0,
+                            values,
+                        ),
+                    }
+                }
+                pos += stream_length;
+            }
+
+            return true;
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::utils::test::*;
+
+    fn fields() -> Vec<Field> {
+        vec![
+            Field::new("temperature", ValueType::Float64),
+            Field::new("errors", ValueType::UInteger64),
+            Field::with_codec("voltage", ValueType::Float64, Codec::IntV3),
+            Field::new("offset", ValueType::Integer64),
+        ]
+    }
+
+    fn row(i: u64) -> [Value; 4] {
+        [
+            (20.0 + (i % 100) as f64 / 10.0).into(),
+            (i / 500).into(),
+            (3.3 + (i as f64).sin()).into(),
+            (-(i as i64) * 3).into(),
+        ]
+    }
+
+    #[test]
+    fn test_field_file_read_back() {
+        set_up_files!(paths, "1.ty", "2.ty");
+        let mut timestamp = 1000;
+        for path in &paths {
+            let mut file =
+                FieldFile::new(Version(0), StreamId(0), &fields(), path.clone()).unwrap();
+            for _ in 0..1000 {
+                file.write(timestamp, &row(timestamp)).unwrap();
+                timestamp += 10;
+            }
+            file.seal().unwrap();
+        }
+
+        let page_cache = Arc::new(PageCache::new(100));
+        let mut cursor = FieldCursor::new(
+            paths.clone(),
+            &["offset", "temperature", "voltage", "errors"],
+            1005,
+            20_000,
+            page_cache.clone(),
+        )
+        .unwrap();
+        assert_eq!(cursor.fields()[0].name, "offset");
+
+        let mut expected = 1010;
+        while let Some((timestamp, values)) = cursor.next_row() {
+            assert_eq!(timestamp, expected);
+            let row = row(timestamp);
+            for (value, (field, expected)) in values.iter().zip([
+                (ValueType::Integer64, row[3]),
+                (ValueType::Float64, row[0]),
+                (ValueType::Float64, row[2]),
+                (ValueType::UInteger64, row[1]),
+            ]) {
+                assert!(value.eq_same(field, &expected));
+            }
+            expected += 10;
+        }
+        assert_eq!(expected, 20_010);
+
+        // A single field, starting in the second file
+        let mut cursor =
+            FieldCursor::new(paths.clone(), &["errors"], 15_000, u64::MAX, page_cache).unwrap();
+        let mut expected = 15_000;
+        while let Some((timestamp, values)) = cursor.next_row() {
+            assert_eq!(timestamp, expected);
+            assert_eq!(values.len(), 1);
+            assert_eq!(
+                values[0].get_uinteger64(),
+                row(timestamp)[1].get_uinteger64()
+            );
+            expected += 10;
+        }
+        assert_eq!(expected, 21_000);
+    }
+
+    #[test]
+    fn test_field_header() {
+        set_up_files!(paths, "1.ty");
+        let mut file =
+            FieldFile::new(Version(0), StreamId(7), &fields(), paths[0].clone()).unwrap();
+        for i in 0..300 {
+            file.write(i, &row(i)).unwrap();
+        }
+        file.seal().unwrap();
+
+        let page_cache = Arc::new(PageCache::new(10));
+        let (header, _) = FieldCursor::open(&page_cache, &paths[0], ReadMode::Normal).unwrap();
+        assert_eq!(header.stream_id, StreamId(7));
+        assert_eq!(header.count, 300);
+        assert_eq!((header.min_timestamp, header.max_timestamp), (0, 299));
+        assert_eq!(header.fields().cloned().collect::<Vec<_>>(), fields());
+        assert_eq!(header.columns[1].value_sum.get_uinteger64(), 0);
+        assert_eq!(header.columns[3].min_value.get_integer64(), -897);
+        assert!(FieldCursor::new(paths, &["missing"], 0, 10, page_cache).is_err());
+    }
+}
@@ -1,21 +1,42 @@
-use super::compression::int::{IntCompressor, IntDecompressor};
-use super::compression::CompressionEngine;
-use super::page_cache::{FileId, PageCache, SeqPageRead};
+use super::chunk_cache::DecodedChunk;
+use super::compression::{
+    run_length, Codec, CodecPolicy, CompressionEngine, Compressor, DecoderState, Decompressor,
+};
+use super::page_cache::{immutable_file_read, FileId, FileRead, PageCache, ReadMode};
 use super::{FileReaderUtils, MAX_NUM_ENTRIES};
 use crate::storage::compression::DecompressionEngine;
 use crate::storage::page_cache::page_cache_sequential_read;
 use crate::{StreamId, Timestamp, Value, ValueType, Vector, Version};
 use std::cell::RefCell;
 use std::fmt::Debug;
-use std::fs::{File, OpenOptions};
-use std::io::{self, Seek, Write};
+use std::fs::{self, File, OpenOptions};
+use std::io::{self, Read, Seek, Write};
 use std::path::PathBuf;
 use std::rc::Rc;
+use std::sync::Arc;
 
 const MAGIC_SIZE: usize = 4;
 const MAGIC: [u8; MAGIC_SIZE] = [b'T', b'a', b'c', b'h'];
 
-const HEADER_SIZE: usize = 71;
+/// Size of the header fields and the checkpoint after them
+const HEADER_SIZE: usize = 84 + RESUME_POINT_SIZE;
+/// Size of the header of files older than SEEK_TABLE_VERSION, which ends after first_value
+const LEGACY_HEADER_SIZE: usize = 71;
+
+/// First version whose header has the seek table offset, the codec and the tolerance. Older
+/// files have no seek table, use the codec they were written with and store values exactly.
+const SEEK_TABLE_VERSION: Version = Version(3);
+
+/// Minimum number of entries between two seek table entries
+const SEEK_INTERVAL: u32 = 1024;
+const SEEK_ENTRY_SIZE: usize = 64;
+const RESUME_POINT_SIZE: usize = 64;
+
+/// Number of entries a new file buffers to trial encode before choosing its codec
+const CODEC_TRIAL_ENTRIES: usize = SEEK_INTERVAL as usize;
+
+/// Largest number of quantization steps from 0 that an f64 holds exactly
+const MAX_QUANTIZED_STEPS: f64 = (1u64 << 53) as f64;
 
 #[derive(Clone)]
 pub struct Header {
@@ -33,6 +54,14 @@ pub struct Header {
     pub max_value: Value,
 
     pub first_value: Value,
+
+    /// Offset of the seek table trailer, 0 if the file has not been sealed
+    pub seek_table_offset: u32,
+
+    pub codec: Codec,
+
+    /// Maximum absolute error of the quantized float values, 0 if values are stored exactly
+    pub tolerance: f64,
 }
 
 impl PartialEq for Header {
@@ -49,6 +78,9 @@ impl PartialEq for Header {
             && self
                 .first_value
                 .eq_same(self.value_type, &other.first_value)
+            && self.seek_table_offset == other.seek_table_offset
+            && self.codec == other.codec
+            && self.tolerance == other.tolerance
     }
 }
 
@@ -65,6 +97,9 @@ impl Debug for Header {
             .field("min_value", &self.min_value.get_output(self.value_type))
             .field("max_value", &self.max_value.get_output(self.value_type))
             .field("first_value", &self.first_value.get_output(self.value_type))
+            .field("seek_table_offset", &self.seek_table_offset)
+            .field("codec", &self.codec)
+            .field("tolerance", &self.tolerance)
             .finish()
     }
 }
@@ -86,6 +121,67 @@ impl Header {
             max_value: Value::get_default(value_type),
 
             first_value: Value::get_default(value_type),
+
+            seek_table_offset: 0,
+
+            codec: Codec::for_value_type(value_type),
+
+            tolerance: 0.0,
+        }
+    }
+
+    /// Quantizes the float values of the file to within `tolerance` of the values written,
+    /// which lets an integer codec encode the multiples of the quantization step
+    pub fn set_tolerance(&mut self, tolerance: f64) {
+        self.tolerance = tolerance;
+        self.codec = Codec::for_header(self);
+    }
+
+    /// Gets the offset of the compressed stream, after the magic and the header
+    fn data_start(&self) -> usize {
+        if self.version < SEEK_TABLE_VERSION {
+            MAGIC_SIZE + LEGACY_HEADER_SIZE
+        } else {
+            MAGIC_SIZE + HEADER_SIZE
+        }
+    }
+
+    /// Whether the header describes every entry of the file. Files older than
+    /// SEEK_TABLE_VERSION rewrote their header on every write and are never continued, so they
+    /// count as sealed even without a seek table.
+    pub fn is_sealed(&self) -> bool {
+        self.seek_table_offset != 0 || self.version < SEEK_TABLE_VERSION
+    }
+
+    pub fn is_quantized(&self) -> bool {
+        self.value_type == ValueType::Float64 && self.tolerance > 0.0
+    }
+
+    /// Whether a float value is stored within `tolerance` once quantized. Non-finite values
+    /// and values further than 2^53 steps from 0 are not, as their steps are not exact.
+    pub fn can_quantize(tolerance: f64, value: f64) -> bool {
+        tolerance == 0.0 || (value / (2.0 * tolerance)).round().abs() <= MAX_QUANTIZED_STEPS
+    }
+
+    /// Gets the number of quantization steps closest to `value`, as the bits of an i64.
+    /// Precondition: `Header::can_quantize(self.tolerance, value)`, which `Inserter` and
+    /// `insert_bulk` check before writing
+    pub fn to_steps(&self, value: f64) -> u64 {
+        let steps = (value / (2.0 * self.tolerance)).round();
+        (steps.clamp(-MAX_QUANTIZED_STEPS, MAX_QUANTIZED_STEPS) as i64) as u64
+    }
+
+    pub fn from_steps(&self, steps: u64) -> f64 {
+        (steps as i64) as f64 * (2.0 * self.tolerance)
+    }
+
+    /// Gets the value stored for `value` once quantized
+    pub fn quantize(&self, value: Value) -> Value {
+        if !self.is_quantized() {
+            return value;
+        }
+        Value {
+            float64: self.from_steps(self.to_steps(value.get_float64())),
         }
     }
 
@@ -103,7 +199,7 @@ impl Header {
         }
     }
 
-    fn parse(file_id: FileId, page_cache: &mut PageCache) -> Self {
+    fn parse(file_id: FileId, page_cache: &PageCache) -> Self {
         let mut buffer = [0x00u8; MAGIC_SIZE + HEADER_SIZE];
         page_cache.read(file_id, 0, &mut buffer);
         if buffer[0..MAGIC_SIZE] != MAGIC {
@@ -111,15 +207,20 @@ impl Header {
         }
         let buffer = &buffer[MAGIC_SIZE..];
 
+        let version = Version(
+            FileReaderUtils::read_u64_2(&buffer[0..2])
+                .try_into()
+                .unwrap(),
+        );
         let value_type = (FileReaderUtils::read_u64_1(&buffer[38..39]) as u8)
             .try_into()
             .unwrap();
+        if version < SEEK_TABLE_VERSION {
+            return Self::parse_legacy(version, value_type, buffer);
+        }
+
         Self {
-            version: Version(
-                FileReaderUtils::read_u64_2(&buffer[0..2])
-                    .try_into()
-                    .unwrap(),
-            ),
+            version,
             stream_id: StreamId(FileReaderUtils::read_u128_16(&buffer[2..18])),
             min_timestamp: FileReaderUtils::read_u64_8(&buffer[18..26]),
             max_timestamp: FileReaderUtils::read_u64_8(&buffer[26..34]),
@@ -131,40 +232,487 @@ impl Header {
             min_value: Self::parse_value(value_type, &buffer[47..55]),
             max_value: Self::parse_value(value_type, &buffer[55..63]),
             first_value: Self::parse_value(value_type, &buffer[63..71]),
+            seek_table_offset: FileReaderUtils::read_u64_4(&buffer[71..75])
+                .try_into()
+                .unwrap(),
+            codec: (FileReaderUtils::read_u64_1(&buffer[75..76]) as u8)
+                .try_into()
+                .unwrap(),
+            tolerance: FileReaderUtils::read_f64_8(&buffer[76..84]),
+        }
+    }
+
+    /// Parses the header of a file older than SEEK_TABLE_VERSION, whose integers were always
+    /// written with IntV2 and floats with FloatV1
+    fn parse_legacy(version: Version, value_type: ValueType, buffer: &[u8]) -> Self {
+        Self {
+            version,
+            stream_id: StreamId(FileReaderUtils::read_u128_16(&buffer[2..18])),
+            min_timestamp: FileReaderUtils::read_u64_8(&buffer[18..26]),
+            max_timestamp: FileReaderUtils::read_u64_8(&buffer[26..34]),
+            count: FileReaderUtils::read_u64_4(&buffer[34..38])
+                .try_into()
+                .unwrap(),
+            value_type,
+            value_sum: Self::parse_value(value_type, &buffer[39..47]),
+            min_value: Self::parse_value(value_type, &buffer[47..55]),
+            max_value: Self::parse_value(value_type, &buffer[55..63]),
+            first_value: Self::parse_value(value_type, &buffer[63..71]),
+            seek_table_offset: 0,
+            codec: Self::legacy_codec(value_type),
+            tolerance: 0.0,
+        }
+    }
+
+    fn legacy_codec(value_type: ValueType) -> Codec {
+        match value_type {
+            ValueType::Integer64 | ValueType::UInteger64 => Codec::IntV2,
+            ValueType::Float64 => Codec::FloatV1,
         }
     }
 
-    fn write_value(&self, file: &mut File, value: Value) -> Result<usize, io::Error> {
+    /// Rebuilds the header of a file that was not sealed. Its header describes the entries
+    /// before its checkpoint, which its writer updates on every commit, so only the blocks
+    /// written after the checkpoint are decoded, and their end is found by encoding the decoded
+    /// entries again. Entries still buffered by the compressor are not recovered.
+    /// Precondition: The file is not sealed
+    fn recover(self, file_id: FileId, page_cache: &PageCache, path: &PathBuf) -> Self {
+        let checkpoint = ResumePoint::parse_checkpoint(file_id, page_cache);
+        let tail_start = self.data_start() + checkpoint.offset as usize;
+
+        let mut file = File::open(path).unwrap();
+        if (file.metadata().unwrap().len() as usize) < tail_start {
+            // The header was stored before the blocks it describes when the system crashed
+            return TimeDataFile::recover_data_file(path.clone()).header;
+        }
+        let mut tail = Vec::new();
+        file.seek(io::SeekFrom::Start(tail_start as u64)).unwrap();
+        file.read_to_end(&mut tail).unwrap();
+
+        // Decoders may read ahead past the last block
+        let mut decomp_engine = Decompressor::new_from_state(
+            tail.as_slice().chain(io::repeat(0)),
+            &self,
+            &checkpoint.state,
+        );
+        let mut comp_engine = Compressor::new_from_state(io::sink(), &self, &checkpoint.state);
+
+        let mut header = self;
+        let mut zone_map = ZoneMap::from_header(&header);
+        let mut bytes = 0;
+        while bytes < tail.len() {
+            let (timestamp, value) = decomp_engine.next();
+            bytes += comp_engine.consume(timestamp, value);
+            header.count += 1;
+            header.max_timestamp = timestamp;
+            zone_map.update(header.value_type, value.into());
+        }
+
+        Self {
+            value_sum: zone_map.value_sum,
+            min_value: zone_map.min_value,
+            max_value: zone_map.max_value,
+            ..header
+        }
+    }
+
+    fn write_value(&self, buf: &mut Vec<u8>, value: Value) {
         match self.value_type {
-            ValueType::Integer64 => file.write_all(&value.get_integer64().to_le_bytes())?,
-            ValueType::UInteger64 => file.write_all(&value.get_uinteger64().to_le_bytes())?,
-            ValueType::Float64 => file.write_all(&value.get_float64().to_le_bytes())?,
+            ValueType::Integer64 => buf.extend_from_slice(&value.get_integer64().to_le_bytes()),
+            ValueType::UInteger64 => buf.extend_from_slice(&value.get_uinteger64().to_le_bytes()),
+            ValueType::Float64 => buf.extend_from_slice(&value.get_float64().to_le_bytes()),
         }
-        Ok(8)
     }
 
-    fn write(&self, file: &mut File) -> Result<usize, io::Error> {
-        file.write_all(&MAGIC)?;
+    /// Gets the header of the entries stored before `checkpoint`
+    fn at_checkpoint(&self, checkpoint: &ResumePoint) -> Self {
+        Self {
+            max_timestamp: checkpoint.state.timestamp,
+            count: checkpoint.index,
+            value_sum: checkpoint.zone_map.value_sum,
+            min_value: checkpoint.zone_map.min_value,
+            max_value: checkpoint.zone_map.max_value,
+            ..self.clone()
+        }
+    }
+
+    /// Writes the magic, the header and `checkpoint` with a single write. The header of a file
+    /// that is not sealed is written for the entries before `checkpoint`, a restart point
+    /// whose blocks are all written, so that readers only decode the blocks after it.
+    /// Precondition: The version is at least SEEK_TABLE_VERSION
+    fn write(&self, checkpoint: &ResumePoint, file: &mut File) -> Result<usize, io::Error> {
+        debug_assert!(self.version >= SEEK_TABLE_VERSION);
+        if !self.is_sealed() {
+            return self
+                .at_checkpoint(checkpoint)
+                .write_fields(checkpoint, file);
+        }
+        self.write_fields(checkpoint, file)
+    }
+
+    fn write_fields(&self, checkpoint: &ResumePoint, file: &mut File) -> Result<usize, io::Error> {
+        let mut buf = Vec::with_capacity(MAGIC_SIZE + HEADER_SIZE);
+        buf.extend_from_slice(&MAGIC);
 
-        file.write_all(&self.version.0.to_le_bytes())?;
-        file.write_all(&self.stream_id.0.to_le_bytes())?;
+        buf.extend_from_slice(&self.version.0.to_le_bytes());
+        buf.extend_from_slice(&self.stream_id.0.to_le_bytes());
 
-        file.write_all(&self.min_timestamp.to_le_bytes())?;
-        file.write_all(&self.max_timestamp.to_le_bytes())?;
+        buf.extend_from_slice(&self.min_timestamp.to_le_bytes());
+        buf.extend_from_slice(&self.max_timestamp.to_le_bytes());
 
-        file.write_all(&self.count.to_le_bytes())?;
-        file.write_all(&(self.value_type as u8).to_le_bytes())?;
+        buf.extend_from_slice(&self.count.to_le_bytes());
+        buf.extend_from_slice(&(self.value_type as u8).to_le_bytes());
 
-        self.write_value(file, self.value_sum).unwrap();
-        self.write_value(file, self.min_value).unwrap();
-        self.write_value(file, self.max_value).unwrap();
+        self.write_value(&mut buf, self.value_sum);
+        self.write_value(&mut buf, self.min_value);
+        self.write_value(&mut buf, self.max_value);
 
-        self.write_value(file, self.first_value).unwrap();
+        self.write_value(&mut buf, self.first_value);
 
+        buf.extend_from_slice(&self.seek_table_offset.to_le_bytes());
+        buf.extend_from_slice(&(self.codec as u8).to_le_bytes());
+        buf.extend_from_slice(&self.tolerance.to_le_bytes());
+        checkpoint.write(&mut buf);
+        debug_assert_eq!(buf.len(), MAGIC_SIZE + HEADER_SIZE);
+
+        file.write_all(&buf)?;
         Ok(HEADER_SIZE + MAGIC_SIZE)
     }
 }
 
+/// Aggregates over the entries of a seek table block
+#[derive(Clone, Copy)]
+struct ZoneMap {
+    value_sum: Value,
+    min_value: Value,
+    max_value: Value,
+}
+
+impl ZoneMap {
+    fn new(value_type: ValueType) -> Self {
+        Self {
+            value_sum: Value::get_default(value_type),
+            min_value: Value::get_default(value_type),
+            max_value: Value::get_default(value_type),
+        }
+    }
+
+    fn from_value(value: Value) -> Self {
+        Self {
+            value_sum: value,
+            min_value: value,
+            max_value: value,
+        }
+    }
+
+    fn from_header(header: &Header) -> Self {
+        Self {
+            value_sum: header.value_sum,
+            min_value: header.min_value,
+            max_value: header.max_value,
+        }
+    }
+
+    /// Aggregates a batch of values with one loop per aggregate over the primitive type, which
+    /// the compiler can vectorize, instead of dispatching on the value type for every value.
+    /// Precondition: `values` is not empty
+    fn from_values(value_type: ValueType, values: &[Value]) -> Self {
+        match value_type {
+            ValueType::Integer64 => {
+                let values = || values.iter().map(Value::get_integer64);
+                Self {
+                    value_sum: values().sum::<i64>().into(),
+                    min_value: values().min().unwrap().into(),
+                    max_value: values().max().unwrap().into(),
+                }
+            }
+            ValueType::UInteger64 => {
+                let values = || values.iter().map(Value::get_uinteger64);
+                Self {
+                    value_sum: values().sum::<u64>().into(),
+                    min_value: values().min().unwrap().into(),
+                    max_value: values().max().unwrap().into(),
+                }
+            }
+            ValueType::Float64 => {
+                let values = || values.iter().map(Value::get_float64);
+                Self {
+                    value_sum: values().sum::<f64>().into(),
+                    min_value: values().fold(f64::INFINITY, f64::min).into(),
+                    max_value: values().fold(f64::NEG_INFINITY, f64::max).into(),
+                }
+            }
+        }
+    }
+
+    fn update(&mut self, value_type: ValueType, value: Value) {
+        self.value_sum = self.value_sum.add_same(value_type, &value);
+        self.min_value = self.min_value.min_same(value_type, &value);
+        self.max_value = self.max_value.max_same(value_type, &value);
+    }
+
+    fn merge(&mut self, value_type: ValueType, other: &ZoneMap) {
+        self.value_sum = self.value_sum.add_same(value_type, &other.value_sum);
+        self.min_value = self.min_value.min_same(value_type, &other.min_value);
+        self.max_value = self.max_value.max_same(value_type, &other.max_value);
+    }
+}
+
+/// Restart point inside the compressed stream of a file. The entry also describes the block
+/// of entries stored between this restart point and the next one.
+#[derive(Clone, Copy)]
+struct SeekEntry {
+    /// Offset relative to the start of the compressed stream
+    offset: u32,
+    /// Number of entries (including the header's first value) stored before this point
+    index: u32,
+    state: DecoderState,
+    zone_map: ZoneMap,
+}
+
+/// Last compressor restart point of a file, stored after the seek table entries so that a
+/// reopened file continues from it instead of decoding all of its entries again. The header
+/// stores one as its checkpoint, which a file that is not sealed is read back from.
+#[derive(Clone, Copy)]
+struct ResumePoint {
+    /// Offset relative to the start of the compressed stream
+    offset: u32,
+    /// Number of entries (including the header's first value) stored before this point
+    index: u32,
+    state: DecoderState,
+    /// Aggregates over the entries stored before this point
+    zone_map: ZoneMap,
+}
+
+impl ResumePoint {
+    /// Precondition: The header contains the first entry of the file
+    fn start(header: &Header) -> Self {
+        Self {
+            offset: 0,
+            index: 1,
+            state: DecoderState {
+                timestamp: header.min_timestamp,
+                value: header.first_value.get_uinteger64(),
+                deltas: (0, 0),
+            },
+            zone_map: ZoneMap::from_value(header.first_value),
+        }
+    }
+
+    fn write(&self, buffer: &mut Vec<u8>) {
+        buffer.extend_from_slice(&self.offset.to_le_bytes());
+        buffer.extend_from_slice(&self.index.to_le_bytes());
+        buffer.extend_from_slice(&self.state.timestamp.to_le_bytes());
+        buffer.extend_from_slice(&self.state.value.to_le_bytes());
+        buffer.extend_from_slice(&self.state.deltas.0.to_le_bytes());
+        buffer.extend_from_slice(&self.state.deltas.1.to_le_bytes());
+        buffer.extend_from_slice(&self.zone_map.value_sum.get_uinteger64().to_le_bytes());
+        buffer.extend_from_slice(&self.zone_map.min_value.get_uinteger64().to_le_bytes());
+        buffer.extend_from_slice(&self.zone_map.max_value.get_uinteger64().to_le_bytes());
+    }
+
+    fn parse(buf: &[u8]) -> Self {
+        Self {
+            offset: FileReaderUtils::read_u64_4(&buf[0..4]) as u32,
+            index: FileReaderUtils::read_u64_4(&buf[4..8]) as u32,
+            state: DecoderState {
+                timestamp: FileReaderUtils::read_u64_8(&buf[8..16]),
+                value: FileReaderUtils::read_u64_8(&buf[16..24]),
+                deltas: (
+                    FileReaderUtils::read_i64_8(&buf[24..32]),
+                    FileReaderUtils::read_i64_8(&buf[32..40]),
+                ),
+            },
+            zone_map: ZoneMap {
+                value_sum: FileReaderUtils::read_u64_8(&buf[40..48]).into(),
+                min_value: FileReaderUtils::read_u64_8(&buf[48..56]).into(),
+                max_value: FileReaderUtils::read_u64_8(&buf[56..64]).into(),
+            },
+        }
+    }
+
+    /// Parses the checkpoint stored at the end of the header.
+    /// Precondition: The version of the file is at least SEEK_TABLE_VERSION
+    fn parse_checkpoint(file_id: FileId, page_cache: &PageCache) -> Self {
+        let mut buffer = [0x00u8; RESUME_POINT_SIZE];
+        page_cache.read(
+            file_id,
+            MAGIC_SIZE + HEADER_SIZE - RESUME_POINT_SIZE,
+            &mut buffer,
+        );
+        Self::parse(&buffer)
+    }
+}
+
+/// Sparse seek index of a file, stored as a trailer when the file is sealed:
+///
+/// | number of entries (u32) | entries | resume point |
+///
+/// The first entry is the start of the compressed stream. Later entries are recorded at the
+/// first compressor restart point every SEEK_INTERVAL entries.
+struct SeekTable {
+    value_type: ValueType,
+    entries: Vec<SeekEntry>,
+    next_index: u32,
+    data_size: usize,
+    resume_point: ResumePoint,
+    /// Aggregates over the entries stored before the last entry
+    closed_zone_map: ZoneMap,
+}
+
+impl SeekTable {
+    /// Precondition: The header contains the first entry of the file
+    fn new(header: &Header) -> Self {
+        let start = ResumePoint::start(header);
+        Self {
+            value_type: header.value_type,
+            entries: vec![SeekEntry {
+                offset: start.offset,
+                index: start.index,
+                state: start.state,
+                zone_map: ZoneMap::new(header.value_type),
+            }],
+            next_index: 1 + SEEK_INTERVAL,
+            data_size: 0,
+            resume_point: start,
+            closed_zone_map: start.zone_map,
+        }
+    }
+
+    /// Continues the seek table of a sealed file from its resume point.
+    /// The entries stored after the resume point are already part of the last entry's zone map.
+    fn resume(header: &Header, entries: Vec<SeekEntry>, resume_point: ResumePoint) -> Self {
+        // Only the last entry's block can be empty
+        let mut closed_zone_map = ZoneMap::from_value(header.first_value);
+        for entry in &entries[..entries.len() - 1] {
+            closed_zone_map.merge(header.value_type, &entry.zone_map);
+        }
+
+        Self {
+            value_type: header.value_type,
+            next_index: entries.last().unwrap().index + SEEK_INTERVAL,
+            entries,
+            data_size: resume_point.offset as usize,
+            resume_point,
+            closed_zone_map,
+        }
+    }
+
+    /// Builds the seek table of an already written compressed stream by replaying it
+    fn rebuild(data_file: &TimeDataFile) -> Self {
+        let mut seek_table = Self::new(&data_file.header);
+        let mut comp_engine = Compressor::new(io::sink(), &data_file.header);
+
+        for i in 1..data_file.num_entries() {
+            let bytes = comp_engine.consume(
+                data_file.timestamps[i],
+                data_file.values[i].get_uinteger64(),
+            );
+            seek_table.record(&comp_engine, bytes, (i + 1) as u32, data_file.values[i]);
+        }
+
+        seek_table
+    }
+
+    /// Records the entry passed to the last `consume` and the number of bytes it wrote.
+    /// Adds a seek table entry if one is due.
+    fn record<W: Write>(
+        &mut self,
+        comp_engine: &Compressor<W>,
+        bytes: usize,
+        count: u32,
+        value: Value,
+    ) {
+        self.data_size += bytes;
+
+        let last = self.entries.last_mut().unwrap();
+        if last.index + 1 == count {
+            last.zone_map = ZoneMap::from_value(value);
+        } else {
+            last.zone_map.update(self.value_type, value);
+        }
+
+        let Some(state) = comp_engine.restart_state() else {
+            return;
+        };
+        let mut zone_map = self.closed_zone_map;
+        zone_map.merge(self.value_type, &last.zone_map);
+        self.resume_point = ResumePoint {
+            offset: self.data_size as u32,
+            index: count,
+            state,
+            zone_map,
+        };
+
+        if count >= self.next_index {
+            self.closed_zone_map = zone_map;
+            self.entries.push(SeekEntry {
+                offset: self.data_size as u32,
+                index: count,
+                state,
+                zone_map: ZoneMap::new(self.value_type),
+            });
+            self.next_index = count + SEEK_INTERVAL;
+        }
+    }
+
+    fn write(&self, file: &mut File) -> Result<usize, io::Error> {
+        let mut buffer =
+            Vec::with_capacity(4 + self.entries.len() * SEEK_ENTRY_SIZE + RESUME_POINT_SIZE);
+        buffer.extend_from_slice(&(self.entries.len() as u32).to_le_bytes());
+        for entry in &self.entries {
+            buffer.extend_from_slice(&entry.offset.to_le_bytes());
+            buffer.extend_from_slice(&entry.index.to_le_bytes());
+            buffer.extend_from_slice(&entry.state.timestamp.to_le_bytes());
+            buffer.extend_from_slice(&entry.state.value.to_le_bytes());
+            buffer.extend_from_slice(&entry.state.deltas.0.to_le_bytes());
+            buffer.extend_from_slice(&entry.state.deltas.1.to_le_bytes());
+            buffer.extend_from_slice(&entry.zone_map.value_sum.get_uinteger64().to_le_bytes());
+            buffer.extend_from_slice(&entry.zone_map.min_value.get_uinteger64().to_le_bytes());
+            buffer.extend_from_slice(&entry.zone_map.max_value.get_uinteger64().to_le_bytes());
+        }
+        self.resume_point.write(&mut buffer);
+        file.write_all(&buffer)?;
+
+        Ok(buffer.len())
+    }
+
+    fn parse(file_id: FileId, page_cache: &PageCache, header: &Header) -> Vec<SeekEntry> {
+        if header.seek_table_offset == 0 {
+            return Vec::new();
+        }
+
+        let offset = header.seek_table_offset as usize;
+        let mut buffer = [0x00u8; 4];
+        page_cache.read(file_id, offset, &mut buffer);
+        let num_entries = FileReaderUtils::read_u64_4(&buffer) as usize;
+
+        let mut buffer = vec![0x00u8; num_entries * SEEK_ENTRY_SIZE];
+        page_cache.read(file_id, offset + 4, &mut buffer);
+
+        buffer
+            .chunks_exact(SEEK_ENTRY_SIZE)
+            .map(|buf| SeekEntry {
+                offset: FileReaderUtils::read_u64_4(&buf[0..4]) as u32,
+                index: FileReaderUtils::read_u64_4(&buf[4..8]) as u32,
+                state: DecoderState {
+                    timestamp: FileReaderUtils::read_u64_8(&buf[8..16]),
+                    value: FileReaderUtils::read_u64_8(&buf[16..24]),
+                    deltas: (
+                        FileReaderUtils::read_i64_8(&buf[24..32]),
+                        FileReaderUtils::read_i64_8(&buf[32..40]),
+                    ),
+                },
+                zone_map: ZoneMap {
+                    value_sum: FileReaderUtils::read_u64_8(&buf[40..48]).into(),
+                    min_value: FileReaderUtils::read_u64_8(&buf[48..56]).into(),
+                    max_value: FileReaderUtils::read_u64_8(&buf[56..64]).into(),
+                },
+            })
+            .collect()
+    }
+}
+
 #[derive(Clone, Copy, PartialEq, Eq)]
 pub enum ScanHint {
     None,
@@ -185,9 +733,25 @@ pub struct Cursor {
     values_read: u64,
 
     file_paths: Vec<PathBuf>,
-
-    page_cache: Rc<RefCell<PageCache>>,
-    decomp_engine: IntDecompressor<SeqPageRead>,
+    /// File of the stream that is still open in the indexer, which its writer may continue
+    open_file: Option<PathBuf>,
+    /// Whether the current file is never modified again, which is once it is sealed and
+    /// closed in the indexer
+    is_immutable: bool,
+
+    page_cache: Arc<PageCache>,
+    read_mode: ReadMode,
+    decomp_engine: Decompressor<FileRead>,
+
+    seek_table: Vec<SeekEntry>,
+    next_block: usize,
+    /// Restart point the decompressor has to be moved to before decoding the next entry
+    pending_seek: Option<SeekEntry>,
+    /// Block the decompressor is positioned at the start of
+    decoder_block: Option<usize>,
+    /// Decoded block entries are read from instead of the decompressor, and the position of
+    /// the next entry in it
+    chunk: Option<(Arc<DecodedChunk>, usize)>,
 
     scan_hint: ScanHint,
 
@@ -200,39 +764,100 @@ impl Cursor {
         file_paths: Vec<PathBuf>,
         start: Timestamp,
         end: Timestamp,
-        page_cache: Rc<RefCell<PageCache>>,
+        page_cache: Arc<PageCache>,
+        scan_hint: ScanHint,
+    ) -> Result<Self, io::Error> {
+        Self::new_with_open_file(file_paths, None, start, end, page_cache, scan_hint)
+    }
+
+    /// Creates a cursor where `open_file` is the file of the stream that is still open in the
+    /// indexer, if any. A writer may continue that file even once it has a seek table, so it
+    /// is never read through a mapping or the chunk cache.
+    /// Precondition: file_paths\[0] contains at least one timestamp t such that start <= t
+    pub fn new_with_open_file(
+        file_paths: Vec<PathBuf>,
+        open_file: Option<PathBuf>,
+        start: Timestamp,
+        end: Timestamp,
+        page_cache: Arc<PageCache>,
         scan_hint: ScanHint,
     ) -> Result<Self, io::Error> {
         assert!(!file_paths.is_empty());
         assert!(start <= end);
 
-        let mut page_cache_ref = page_cache.borrow_mut();
+        let file_id = page_cache.register_or_get_file_id(&file_paths[0]);
+        let is_open = open_file.as_ref() == Some(&file_paths[0]);
+        page_cache.refresh_file(file_id, !is_open);
+        let header = Self::parse_header(file_id, &page_cache, &file_paths[0]);
+        let is_immutable = !is_open && header.is_sealed();
+
+        let seek_table = if start > header.min_timestamp
+            || scan_hint != ScanHint::None
+            || page_cache.chunk_cache().is_enabled()
+        {
+            SeekTable::parse(file_id, &page_cache, &header)
+        } else {
+            Vec::new()
+        };
 
-        let file_id = page_cache_ref.register_or_get_file_id(&file_paths[0]);
-        let header = Header::parse(file_id, &mut page_cache_ref);
+        // Jump to the last restart point before start
+        let mut next_block = 0;
+        let mut seek_entry = None;
+        if start > header.min_timestamp {
+            next_block = seek_table
+                .partition_point(|entry| entry.state.timestamp < start)
+                .saturating_sub(1);
+            seek_entry = seek_table.get(next_block).copied();
+        }
 
-        drop(page_cache_ref);
+        // Queries over several files are long sequential reads that should not evict hot pages
+        let read_mode = if file_paths.len() > 1 {
+            ReadMode::Scan
+        } else {
+            ReadMode::Normal
+        };
 
-        let decomp_engine = IntDecompressor::new(
-            page_cache_sequential_read(page_cache.clone(), file_id, MAGIC_SIZE + HEADER_SIZE),
+        let decomp_engine = Self::create_decompressor(
+            page_cache.clone(),
+            file_id,
             &header,
+            is_immutable,
+            seek_entry,
+            read_mode,
         );
+        let (current_timestamp, value, values_read) = match seek_entry {
+            Some(entry) => (
+                entry.state.timestamp,
+                entry.state.value.into(),
+                entry.index as u64,
+            ),
+            None => (header.min_timestamp, header.first_value, 1),
+        };
 
         let mut cursor = Self {
             file_id,
             file_index: 0,
-            current_timestamp: header.min_timestamp,
-            value: header.first_value,
+            current_timestamp,
+            value,
             header,
             start,
             end,
-            values_read: 1,
+            values_read,
 
             file_paths,
+            open_file,
+            is_immutable,
 
             page_cache,
+            read_mode,
             decomp_engine,
 
+            seek_table,
+            next_block,
+            pending_seek: None,
+            decoder_block: Some(next_block),
+            chunk: None,
+
             scan_hint,
 
             is_done: false,
@@ -245,7 +870,12 @@ impl Cursor {
             && start <= cursor.header.min_timestamp
             && cursor.header.max_timestamp <= end
         {
-            cursor.use_query_hint();
+            cursor.use_query_hint(
+                cursor.header.max_timestamp,
+                cursor.header.count,
+                ZoneMap::from_header(&cursor.header),
+            );
+            cursor.values_read = cursor.header.count as u64;
         }
 
         while cursor.current_timestamp < start {
@@ -260,34 +890,203 @@ impl Cursor {
         Ok(cursor)
     }
 
-    // Use the query hint
-    fn use_query_hint(&mut self) {
-        self.current_timestamp = self.header.max_timestamp;
+    /// Parses the header of a file. The header of a file that was not sealed only describes
+    /// the entries before its checkpoint, so it is rebuilt from the blocks written since.
+    fn parse_header(file_id: FileId, page_cache: &PageCache, path: &PathBuf) -> Header {
+        let header = Header::parse(file_id, page_cache);
+        if !header.is_sealed() {
+            return header.recover(file_id, page_cache, path);
+        }
+        header
+    }
+
+    /// Whether decoded blocks of the current file are read from the chunk cache
+    fn uses_chunk_cache(&self) -> bool {
+        self.is_immutable && self.page_cache.chunk_cache().is_enabled()
+    }
+
+    /// Creates a decompressor positioned at the restart point `seek_entry`, or at the start of
+    /// the compressed stream if there is none.
+    /// Immutable files may be read through a mapping.
+    fn create_decompressor(
+        page_cache: Arc<PageCache>,
+        file_id: FileId,
+        header: &Header,
+        is_immutable: bool,
+        seek_entry: Option<SeekEntry>,
+        read_mode: ReadMode,
+    ) -> Decompressor<FileRead> {
+        let offset = header.data_start() + seek_entry.map_or(0, |entry| entry.offset as usize);
+        let reader = if is_immutable {
+            immutable_file_read(page_cache, file_id, offset, read_mode)
+        } else {
+            FileRead::Page(page_cache_sequential_read(
+                page_cache, file_id, offset, read_mode,
+            ))
+        };
+
+        match seek_entry {
+            Some(entry) => Decompressor::new_from_state(reader, header, &entry.state),
+            None => Decompressor::new(reader, header),
+        }
+    }
+
+    fn count_value(&self, count: u64) -> Value {
+        match self.header.value_type {
+            ValueType::UInteger64 => count.into(),
+            ValueType::Integer64 => (count as i64).into(),
+            ValueType::Float64 => (count as f64).into(),
+        }
+    }
+
+    // Use the query hint for `count` entries ending at `max_timestamp`
+    fn use_query_hint(&mut self, max_timestamp: Timestamp, count: u32, zone_map: ZoneMap) {
+        self.current_timestamp = max_timestamp;
         self.value = match self.scan_hint {
-            ScanHint::Sum => self.header.value_sum,
-            ScanHint::Count => match self.header.value_type {
-                ValueType::UInteger64 => (self.header.count as u64).into(),
-                ValueType::Integer64 => (self.header.count as i64).into(),
-                ValueType::Float64 => (self.header.count as f64).into(),
-            },
-            ScanHint::Min => self.header.min_value,
-            ScanHint::Max => self.header.max_value,
+            ScanHint::Sum => zone_map.value_sum,
+            ScanHint::Count => self.count_value(count as u64),
+            ScanHint::Min => zone_map.min_value,
+            ScanHint::Max => zone_map.max_value,
             ScanHint::None => unreachable!(),
         };
-        self.values_read = self.header.count as u64;
+    }
+
+    /// Answers the block of the seek table entry at `block` from its zone map if the whole block
+    /// lies within the query range
+    fn use_query_hint_for_block(&mut self, block: usize) -> bool {
+        if self.scan_hint == ScanHint::None || self.current_timestamp < self.start {
+            return false;
+        }
+
+        let entry = self.seek_table[block];
+        let next_entry = self.seek_table.get(block + 1).copied();
+        let (end_index, max_timestamp) = match next_entry {
+            Some(next_entry) => (next_entry.index, next_entry.state.timestamp),
+            None => (self.header.count, self.header.max_timestamp),
+        };
+
+        if max_timestamp > self.end {
+            return false;
+        }
+
+        self.use_query_hint(max_timestamp, end_index - entry.index, entry.zone_map);
+        self.values_read = end_index as u64;
+        self.pending_seek = next_entry;
+        true
+    }
+
+    /// Answers the entries left before the next file or block boundary at once if they all lie
+    /// within the query range, which happens after starting inside a block and in files without
+    /// a seek table. Only their values are decoded, and none at all for counts.
+    fn use_query_hint_up_to_boundary(&mut self) -> bool {
+        if !self.aggregates_runs() || self.chunk.is_some() {
+            return false;
+        }
+
+        let next_entry = self.seek_table.get(self.next_block).copied();
+        let (end_index, max_timestamp) = match next_entry {
+            Some(next_entry) => (next_entry.index as u64, next_entry.state.timestamp),
+            None => (self.header.count as u64, self.header.max_timestamp),
+        };
+
+        if max_timestamp > self.end || end_index <= self.values_read {
+            return false;
+        }
+
+        let len = end_index - self.values_read;
+        let zone_map = if self.scan_hint == ScanHint::Count {
+            ZoneMap::new(self.header.value_type)
+        } else {
+            if let Some(entry) = self.pending_seek.take() {
+                self.decomp_engine = Self::create_decompressor(
+                    self.page_cache.clone(),
+                    self.file_id,
+                    &self.header,
+                    self.is_immutable,
+                    Some(entry),
+                    self.read_mode,
+                );
+            }
+            let mut values = vec![0; len as usize];
+            self.decomp_engine.next_values(&mut values);
+
+            let mut zone_map = ZoneMap::from_value(values[0].into());
+            for value in &values[1..] {
+                zone_map.update(self.header.value_type, (*value).into());
+            }
+            zone_map
+        };
+
+        // The timestamps were skipped, so the decompressor resumes from the next restart point
+        self.use_query_hint(max_timestamp, len as u32, zone_map);
+        self.values_read = end_index;
+        self.pending_seek = next_entry;
+        self.decoder_block = None;
+        true
+    }
+
+    /// Gets the decoded entries of the block at `block` from the chunk cache, decoding and caching
+    /// them on a miss
+    fn load_chunk(&mut self, block: usize) -> Arc<DecodedChunk> {
+        if let Some(chunk) = self
+            .page_cache
+            .chunk_cache()
+            .get(self.file_id, block as u32)
+        {
+            return chunk;
+        }
+
+        let entry = self.seek_table[block];
+        if self.decoder_block != Some(block) {
+            self.decomp_engine = Self::create_decompressor(
+                self.page_cache.clone(),
+                self.file_id,
+                &self.header,
+                self.is_immutable,
+                Some(entry),
+                self.read_mode,
+            );
+        }
+        self.pending_seek = None;
+
+        let end_index = self
+            .seek_table
+            .get(block + 1)
+            .map_or(self.header.count, |next_entry| next_entry.index);
+        let len = (end_index - entry.index) as usize;
+        let mut timestamps = vec![0; len];
+        let mut values = vec![0; len];
+        self.decomp_engine.next_batch(&mut timestamps, &mut values);
+        self.decoder_block = Some(block + 1);
+
+        let chunk = Arc::new(DecodedChunk { timestamps, values });
+        self.page_cache
+            .chunk_cache()
+            .insert(self.file_id, block as u32, chunk.clone());
+        chunk
     }
 
     fn use_query_hint_for_value(&mut self, value: Value) {
+        self.use_query_hint_for_run(value, 1);
+    }
+
+    /// Use the query hint for a run of `len` entries that all have `value`
+    fn use_query_hint_for_run(&mut self, value: Value, len: usize) {
         self.value = match self.scan_hint {
-            ScanHint::Count => match self.header.value_type {
-                ValueType::UInteger64 => 1u64.into(),
-                ValueType::Integer64 => 1i64.into(),
-                ValueType::Float64 => 1f64.into(),
-            },
+            ScanHint::Sum if len > 1 => {
+                value.mul_same(self.header.value_type, &self.count_value(len as u64))
+            }
+            ScanHint::Count => self.count_value(len as u64),
             _ => value,
         };
     }
 
+    /// Whether the next entries can be aggregated by runs of equal values, which is once the
+    /// cursor is past the start of the range
+    fn aggregates_runs(&self) -> bool {
+        self.scan_hint != ScanHint::None && self.current_timestamp >= self.start
+    }
+
     fn load_next_file(&mut self) -> Option<()> {
         self.file_index += 1;
 
@@ -296,9 +1095,16 @@ impl Cursor {
         }
         self.file_id = self
             .page_cache
-            .borrow_mut()
             .register_or_get_file_id(&self.file_paths[self.file_index]);
-        self.header = Header::parse(self.file_id, &mut self.page_cache.borrow_mut());
+        let is_open = self.open_file.as_ref() == Some(&self.file_paths[self.file_index]);
+        self.page_cache.refresh_file(self.file_id, !is_open);
+        self.header = Self::parse_header(
+            self.file_id,
+            &self.page_cache,
+            &self.file_paths[self.file_index],
+        );
+        // Files are only closed in the indexer once they are sealed
+        self.is_immutable = !is_open && self.header.is_sealed();
 
         if self.header.min_timestamp > self.end {
             return None;
@@ -307,21 +1113,34 @@ impl Cursor {
         self.current_timestamp = self.header.min_timestamp;
         self.value = self.header.first_value;
         self.values_read = 1;
-        self.decomp_engine = IntDecompressor::new(
-            page_cache_sequential_read(
-                self.page_cache.clone(),
-                self.file_id,
-                MAGIC_SIZE + HEADER_SIZE,
-            ),
+        self.decomp_engine = Self::create_decompressor(
+            self.page_cache.clone(),
+            self.file_id,
             &self.header,
+            self.is_immutable,
+            None,
+            self.read_mode,
         );
+        self.seek_table = Vec::new();
+        self.next_block = 0;
+        self.pending_seek = None;
+        self.decoder_block = Some(0);
+        self.chunk = None;
 
-        // Use the query hint if applicable on the next file
         if self.scan_hint != ScanHint::None
             && self.start <= self.header.min_timestamp
             && self.header.max_timestamp <= self.end
         {
-            self.use_query_hint();
+            // Use the query hint if applicable on the next file
+            self.use_query_hint(
+                self.header.max_timestamp,
+                self.header.count,
+                ZoneMap::from_header(&self.header),
+            );
+            self.values_read = self.header.count as u64;
+        } else if self.scan_hint != ScanHint::None || self.uses_chunk_cache() {
+            // Otherwise use the zone maps or cached decoded entries of the blocks
+            self.seek_table = SeekTable::parse(self.file_id, &self.page_cache, &self.header);
         }
         Some(())
     }
@@ -348,16 +1167,67 @@ impl Cursor {
             });
         }
 
-        let current = self.decomp_engine.next();
-        self.current_timestamp = current.0;
-        self.value = current.1.into();
-        self.use_query_hint_for_value(self.value);
+        if self.next_block < self.seek_table.len()
+            && self.values_read == self.seek_table[self.next_block].index as u64
+        {
+            self.next_block += 1;
+            if self.use_query_hint_for_block(self.next_block - 1) {
+                return Some(Vector {
+                    timestamp: self.current_timestamp,
+                    value: self.value,
+                });
+            }
+            if self.uses_chunk_cache() {
+                self.chunk = Some((self.load_chunk(self.next_block - 1), 0));
+            }
+        }
+
+        if self.use_query_hint_up_to_boundary() {
+            return Some(Vector {
+                timestamp: self.current_timestamp,
+                value: self.value,
+            });
+        }
+
+        // Aggregates take a run of equal values at once
+        let max_len = if self.aggregates_runs() {
+            self.entries_before_boundary()
+        } else {
+            1
+        };
+        let (timestamp, value, len) = if let Some((chunk, pos)) = &mut self.chunk {
+            let len = run_length(
+                &chunk.timestamps[*pos..*pos + max_len],
+                &chunk.values[*pos..*pos + max_len],
+                self.end,
+            );
+            let current = (chunk.timestamps[*pos + len - 1], chunk.values[*pos], len);
+            *pos += len;
+            if *pos == chunk.len() {
+                self.chunk = None;
+            }
+            current
+        } else {
+            if let Some(entry) = self.pending_seek.take() {
+                self.decomp_engine = Self::create_decompressor(
+                    self.page_cache.clone(),
+                    self.file_id,
+                    &self.header,
+                    self.is_immutable,
+                    Some(entry),
+                    self.read_mode,
+                );
+            }
+            self.decomp_engine.next_run(max_len, self.end)
+        };
+        self.current_timestamp = timestamp;
+        self.use_query_hint_for_run(value.into(), len);
 
         if self.current_timestamp > self.end {
             self.is_done = true;
             return None;
         }
-        self.values_read += 1;
+        self.values_read += len as u64;
 
         Some(Vector {
             timestamp: self.current_timestamp,
@@ -365,6 +1235,84 @@ impl Cursor {
         })
     }
 
+    /// Reads the entries `next_vector` would return next into `timestamps` and `values` (as the
+    /// raw 64 bits of each `Value`), moving on to the next files as needed, until either is full
+    /// or the cursor is done. Returns the number of entries read.
+    pub fn next_batch(&mut self, timestamps: &mut [Timestamp], values: &mut [u64]) -> usize {
+        let len = timestamps.len().min(values.len());
+        let mut num_read = 0;
+
+        while num_read < len && !self.is_done {
+            let num_batched = self.batchable_entries().min(len - num_read);
+            if num_batched == 0 {
+                // File and block boundaries, and scan hints, go through the per-entry path
+                let Some(Vector { timestamp, value }) = self.next_vector() else {
+                    break;
+                };
+                timestamps[num_read] = timestamp;
+                values[num_read] = value.get_uinteger64();
+                num_read += 1;
+                continue;
+            }
+
+            let batch_timestamps = &mut timestamps[num_read..num_read + num_batched];
+            let batch_values = &mut values[num_read..num_read + num_batched];
+            match &mut self.chunk {
+                Some((chunk, pos)) => {
+                    batch_timestamps.copy_from_slice(&chunk.timestamps[*pos..*pos + num_batched]);
+                    batch_values.copy_from_slice(&chunk.values[*pos..*pos + num_batched]);
+                    *pos += num_batched;
+                    if *pos == chunk.len() {
+                        self.chunk = None;
+                    }
+                }
+                None => {
+                    self.decomp_engine
+                        .next_batch(batch_timestamps, batch_values);
+                }
+            }
+
+            // Timestamps are increasing, so only a suffix of the batch can be past the end
+            let num_in_range = batch_timestamps.partition_point(|timestamp| *timestamp <= self.end);
+            if num_in_range > 0 {
+                self.current_timestamp = batch_timestamps[num_in_range - 1];
+                self.value = batch_values[num_in_range - 1].into();
+            }
+            self.values_read += num_in_range as u64;
+            num_read += num_in_range;
+
+            if num_in_range < num_batched {
+                self.is_done = true;
+            }
+        }
+
+        num_read
+    }
+
+    /// Number of entries that can be decoded in bulk before the cursor has to handle a file or
+    /// block boundary
+    fn batchable_entries(&self) -> usize {
+        if self.scan_hint != ScanHint::None || self.pending_seek.is_some() {
+            return 0;
+        }
+
+        self.entries_before_boundary()
+    }
+
+    /// Number of entries left before the next file or block boundary, or in the decoded block
+    fn entries_before_boundary(&self) -> usize {
+        let mut end_index = self.header.count as u64;
+        if let Some(entry) = self.seek_table.get(self.next_block) {
+            end_index = end_index.min(entry.index as u64);
+        }
+        let mut num_entries = end_index.saturating_sub(self.values_read) as usize;
+        if let Some((chunk, pos)) = &self.chunk {
+            num_entries = num_entries.min(chunk.len() - pos);
+        }
+
+        num_entries
+    }
+
     /// Precondition: Not valid after next returns none
     pub fn fetch(&self) -> Vector {
         Vector {
@@ -406,16 +1354,8 @@ impl TimeDataFile {
     }
 
     pub fn read_data_file(path: PathBuf) -> Self {
-        let page_cache = PageCache::new(100);
-
-        let mut cursor = Cursor::new(
-            vec![path],
-            0,
-            u64::MAX,
-            Rc::new(RefCell::new(page_cache)),
-            ScanHint::None,
-        )
-        .unwrap();
+        let page_cache = Arc::new(PageCache::new(100));
+        let mut cursor = Cursor::new(vec![path], 0, u64::MAX, page_cache, ScanHint::None).unwrap();
 
         let mut timestamps = Vec::new();
         let mut values = Vec::new();
@@ -425,37 +1365,112 @@ impl TimeDataFile {
             timestamps.push(timestamp);
             values.push(value);
 
-            if cursor.next().is_none() {
-                break;
-            }
+            if cursor.next().is_none() {
+                break;
+            }
+        }
+
+        Self {
+            header: cursor.header,
+            timestamps,
+            values,
+        }
+    }
+
+    /// Whether a writer can continue the file. Files older than SEEK_TABLE_VERSION cannot be,
+    /// as their header has no room for the fields written when a file is sealed.
+    pub fn is_resumable(path: &PathBuf) -> bool {
+        let page_cache = PageCache::new(1);
+        let file_id = page_cache.register_or_get_file_id(path);
+        Header::parse(file_id, &page_cache).version >= SEEK_TABLE_VERSION
+    }
+
+    /// Reads the header of a file, rebuilding it if the file was not sealed
+    pub fn read_header(path: PathBuf) -> Header {
+        let page_cache = PageCache::new(1);
+        let file_id = page_cache.register_or_get_file_id(&path);
+        let header = Header::parse(file_id, &page_cache);
+        if !header.is_sealed() {
+            return header.recover(file_id, &page_cache, &path);
+        }
+
+        header
+    }
+
+    /// Reads back all the entries of a file that was not sealed, rebuilding its header from
+    /// them. The end of the blocks written is found by encoding the decoded entries again.
+    /// Entries still buffered by the compressor when the file was left are not recovered.
+    pub fn recover_data_file(path: PathBuf) -> Self {
+        let page_cache = PageCache::new(100);
+        let file_id = page_cache.register_or_get_file_id(&path);
+        let header = Header::parse(file_id, &page_cache);
+        let data_end = match header.seek_table_offset {
+            0 => fs::metadata(&path).unwrap().len() as usize,
+            seek_table_offset => seek_table_offset as usize,
+        };
+        let data_size = data_end - header.data_start();
+
+        let mut data_file = Self {
+            header: Header {
+                codec: header.codec,
+                tolerance: header.tolerance,
+                ..Header::new(header.version, header.stream_id, header.value_type)
+            },
+            timestamps: Vec::new(),
+            values: Vec::new(),
+        };
+        data_file.write_data_to_file_in_mem(header.min_timestamp, header.first_value);
+
+        let mut file = File::open(&path).unwrap();
+        file.seek(io::SeekFrom::Start(header.data_start() as u64))
+            .unwrap();
+        // Decoders may read ahead past the last block
+        let reader = io::BufReader::new(file).chain(io::repeat(0));
+        let mut decomp_engine = Decompressor::new(reader, &header);
+        let mut comp_engine = Compressor::new(io::sink(), &header);
+
+        let mut bytes = 0;
+        while bytes < data_size {
+            let (timestamp, value) = decomp_engine.next();
+            bytes += comp_engine.consume(timestamp, value);
+            data_file.write_data_to_file_in_mem(timestamp, value.into());
         }
 
-        Self {
-            header: cursor.header,
-            timestamps,
-            values,
-        }
+        data_file
     }
 
     pub fn write(&self, path: PathBuf) -> usize {
         let mut file = File::create(path).unwrap();
 
-        let header_bytes = self.header.write(&mut file).unwrap();
-        let mut comp_engine = IntCompressor::new(file, &self.header);
-
-        let mut compressed_bytes = 0;
+        let header_bytes = self
+            .header
+            .write(&ResumePoint::start(&self.header), &mut file)
+            .unwrap();
+        let mut comp_engine = Compressor::new(&mut file, &self.header);
+        let mut seek_table = SeekTable::new(&self.header);
 
         for i in 1usize..(self.header.count as usize) {
-            compressed_bytes +=
-                comp_engine.consume(self.timestamps[i], self.values[i].get_uinteger64());
+            let bytes = comp_engine.consume(self.timestamps[i], self.values[i].get_uinteger64());
+            seek_table.record(&comp_engine, bytes, (i + 1) as u32, self.values[i]);
         }
 
-        compressed_bytes += comp_engine.flush_all();
-        header_bytes + compressed_bytes
+        seek_table.data_size += comp_engine.flush_all();
+        drop(comp_engine);
+
+        let header = Header {
+            seek_table_offset: (header_bytes + seek_table.data_size) as u32,
+            ..self.header.clone()
+        };
+        let trailer_bytes = seek_table.write(&mut file).unwrap();
+        file.seek(io::SeekFrom::Start(0)).unwrap();
+        header.write(&seek_table.resume_point, &mut file).unwrap();
+
+        header_bytes + seek_table.data_size + trailer_bytes
     }
 
     /// Precondition: The ValueType of value must be the same as self.header.value_type
     pub fn write_data_to_file_in_mem(&mut self, timestamp: Timestamp, value: Value) {
+        let value = self.header.quantize(value);
         if self.header.count == 0 {
             self.header.first_value = value;
             self.header.min_timestamp = timestamp;
@@ -511,7 +1526,14 @@ impl TimeDataFile {
 pub struct PartiallyPersistentDataFile {
     pub header: Rc<RefCell<Header>>,
     pub path: PathBuf,
-    compressor: Option<IntCompressor<PartiallyPersistentDataFileWriter>>,
+    compressor: Option<Compressor<PartiallyPersistentDataFileWriter>>,
+    seek_table: Option<SeekTable>,
+
+    codec_policy: CodecPolicy,
+    /// Entries after the first one, buffered until the codec is chosen
+    pending: Option<Vec<(Timestamp, Value)>>,
+    /// Index of the checkpoint stored in the header, 0 if it is not known
+    checkpoint_index: u32,
 }
 
 impl PartiallyPersistentDataFile {
@@ -527,28 +1549,150 @@ impl PartiallyPersistentDataFile {
             header,
             path,
             compressor: None,
+            seek_table: None,
+            codec_policy: CodecPolicy::Default,
+            pending: None,
+            checkpoint_index: 0,
         }
     }
 
-    pub fn lazy_init(mut self, ts: Timestamp, v: Value) -> Self {
+    /// Quantizes the float values of the file to within `tolerance`, 0 stores them exactly.
+    /// Precondition: The file has not been initialized
+    pub fn with_tolerance(self, tolerance: f64) -> Self {
+        self.header.borrow_mut().set_tolerance(tolerance);
+        self
+    }
+
+    /// Starts a new file. Unless `codec_policy` is the default, the first entries are buffered
+    /// and trial encoded to choose the file's codec. The file is created with its header
+    /// either way, as it is indexed and may be read before the codec is chosen.
+    pub fn lazy_init(mut self, ts: Timestamp, v: Value, codec_policy: CodecPolicy) -> Self {
+        let v = self.header.borrow().quantize(v);
         self.update_header(ts, v);
-        let writer = PartiallyPersistentDataFileWriter::new(self.header.clone(), &(self.path));
-        self.compressor = Option::Some(IntCompressor::new(writer, &self.header.borrow().clone()));
+        self.codec_policy = codec_policy;
+        if codec_policy == CodecPolicy::Default {
+            self.init_compressor();
+        } else {
+            PartiallyPersistentDataFileWriter::new(&self.header.borrow(), &self.path);
+            self.pending = Some(Vec::with_capacity(CODEC_TRIAL_ENTRIES));
+        }
 
         self
     }
 
-    pub fn partial_init(mut self, ts: Timestamp, v: Value) -> Self {
-        let data_file = TimeDataFile::read_data_file(self.path.clone());
-        self.header = Rc::new(RefCell::new(data_file.header.clone()));
+    /// Chooses the codec from the buffered entries, then compresses them
+    fn init_compressor(&mut self) {
+        let pending = self.pending.take().unwrap_or_default();
+        let (timestamps, values): (Vec<Timestamp>, Vec<u64>) = pending
+            .iter()
+            .map(|&(ts, v)| (ts, v.get_uinteger64()))
+            .unzip();
+        let codec = Codec::choose(
+            self.codec_policy,
+            &self.header.borrow(),
+            &timestamps,
+            &values,
+        );
+        self.header.borrow_mut().codec = codec;
+
+        let writer = PartiallyPersistentDataFileWriter::new(&self.header.borrow(), &(self.path));
+        let mut compressor = Compressor::new(writer, &self.header.borrow().clone());
+        let mut seek_table = SeekTable::new(&self.header.borrow());
+        for (i, &(ts, v)) in pending.iter().enumerate() {
+            let bytes = compressor.consume(ts, v.get_uinteger64());
+            seek_table.record(&compressor, bytes, (i + 2) as u32, v);
+        }
+
+        self.compressor = Some(compressor);
+        self.seek_table = Some(seek_table);
+        // The writer stores the header with the start of the stream as its checkpoint
+        self.checkpoint_index = 1;
+    }
 
-        let writer = PartiallyPersistentDataFileWriter::new(self.header.clone(), &(self.path));
-        self.compressor = Option::Some(IntCompressor::new_from_partial(writer, data_file));
+    /// Reopens a file to continue writing it. A sealed file continues from its resume point,
+    /// while a file that was not sealed is recovered by decoding all of its entries.
+    pub fn partial_init(mut self, ts: Timestamp, v: Value) -> Self {
+        let page_cache = PageCache::new(1);
+        let file_id = page_cache.register_or_get_file_id(&self.path);
+        let header = Header::parse(file_id, &page_cache);
+
+        if header.seek_table_offset != 0 {
+            let entries = SeekTable::parse(file_id, &page_cache, &header);
+            drop(page_cache);
+            self.resume(header, entries).unwrap();
+        } else {
+            let data_file = TimeDataFile::recover_data_file(self.path.clone());
+            self.header = Rc::new(RefCell::new(data_file.header.clone()));
+            self.seek_table = Some(SeekTable::rebuild(&data_file));
+
+            let writer =
+                PartiallyPersistentDataFileWriter::new(&self.header.borrow(), &(self.path));
+            self.compressor = Option::Some(Compressor::new_from_partial(writer, data_file));
+        }
 
         self.write(ts, v).unwrap();
         self
     }
 
+    /// Unseals a file to continue writing it from its resume point. Only the entries stored
+    /// after the resume point are decoded, to encode them again once the trailer and the
+    /// compressor's final flush are cut off.
+    /// Precondition: The file is sealed
+    fn resume(&mut self, header: Header, entries: Vec<SeekEntry>) -> Result<(), io::Error> {
+        let mut file = OpenOptions::new().read(true).write(true).open(&self.path)?;
+
+        let resume_point_offset =
+            header.seek_table_offset as usize + 4 + entries.len() * SEEK_ENTRY_SIZE;
+        let resume_point =
+            if file.metadata()?.len() as usize >= resume_point_offset + RESUME_POINT_SIZE {
+                let mut buffer = [0x00u8; RESUME_POINT_SIZE];
+                file.seek(io::SeekFrom::Start(resume_point_offset as u64))?;
+                file.read_exact(&mut buffer)?;
+                ResumePoint::parse(&buffer)
+            } else {
+                // Files sealed before resume points were stored continue from the stream's start
+                ResumePoint::start(&header)
+            };
+
+        let data_start = header.data_start() + resume_point.offset as usize;
+        let mut data = vec![0x00u8; header.seek_table_offset as usize - data_start];
+        file.seek(io::SeekFrom::Start(data_start as u64))?;
+        file.read_exact(&mut data)?;
+
+        // Decoders may read ahead past the last block
+        let mut decomp_engine = Decompressor::new_from_state(
+            data.as_slice().chain(io::repeat(0)),
+            &header,
+            &resume_point.state,
+        );
+        let tail: Vec<(Timestamp, u64)> = (resume_point.index..header.count)
+            .map(|_| decomp_engine.next())
+            .collect();
+
+        let header = Header {
+            seek_table_offset: 0,
+            ..header
+        };
+        file.set_len(data_start as u64)?;
+        file.seek(io::SeekFrom::Start(0))?;
+        header.write(&resume_point, &mut file)?;
+        drop(file);
+
+        let writer = PartiallyPersistentDataFileWriter::new(&header, &self.path);
+        let mut compressor = Compressor::new_from_state(writer, &header, &resume_point.state);
+        let mut seek_table = SeekTable::resume(&header, entries, resume_point);
+        // The header and the zone maps already include these entries
+        for (timestamp, value) in tail {
+            seek_table.data_size += compressor.consume(timestamp, value);
+        }
+
+        self.header = Rc::new(RefCell::new(header));
+        self.compressor = Some(compressor);
+        self.seek_table = Some(seek_table);
+        self.checkpoint_index = resume_point.index;
+        Ok(())
+    }
+
     fn update_header(&mut self, timestamp: Timestamp, value: Value) {
         let mut header = self.header.borrow_mut();
 
@@ -572,26 +1716,154 @@ impl PartiallyPersistentDataFile {
         header.min_value = header.min_value.min_same(header.value_type, &value);
     }
 
+    /// Updates the header with a batch of entries at once.
+    /// Precondition: `timestamps` and `values` have the same non-zero length
+    fn update_header_batch(&mut self, timestamps: &[Timestamp], values: &[Value]) {
+        let mut header = self.header.borrow_mut();
+        let zone_map = ZoneMap::from_values(header.value_type, values);
+
+        if header.count == 0 {
+            header.first_value = values[0];
+            header.min_timestamp = timestamps[0];
+            header.max_timestamp = timestamps[0];
+            header.min_value = zone_map.min_value;
+            header.max_value = zone_map.max_value;
+        }
+
+        header.count += timestamps.len() as u32;
+
+        header.max_timestamp =
+            Timestamp::max(header.max_timestamp, *timestamps.iter().max().unwrap());
+        header.min_timestamp =
+            Timestamp::min(header.min_timestamp, *timestamps.iter().min().unwrap());
+
+        header.value_sum = header
+            .value_sum
+            .add_same(header.value_type, &zone_map.value_sum);
+        header.max_value = header
+            .max_value
+            .max_same(header.value_type, &zone_map.max_value);
+        header.min_value = header
+            .min_value
+            .min_same(header.value_type, &zone_map.min_value);
+    }
+
+    /// Writes a batch of entries until the file holds MAX_NUM_ENTRIES, and returns the number
+    /// of entries written. The header is updated once for the whole batch.
+    /// Precondition: `timestamps` and `values` have the same length
+    pub fn write_batch(
+        &mut self,
+        timestamps: &[Timestamp],
+        values: &[Value],
+    ) -> Result<usize, String> {
+        let n = usize::min(MAX_NUM_ENTRIES - self.num_entries(), timestamps.len());
+
+        // Entries buffered to choose the codec are written one by one
+        let mut written = 0;
+        while self.pending.is_some() && written < n {
+            self.write(timestamps[written], values[written])?;
+            written += 1;
+        }
+        if written == n {
+            return Ok(n);
+        }
+
+        let timestamps = &timestamps[written..n];
+        let quantized: Vec<Value>;
+        let values = if self.header.borrow().is_quantized() {
+            let header = self.header.borrow();
+            quantized = values[written..n]
+                .iter()
+                .map(|v| header.quantize(*v))
+                .collect();
+            &quantized
+        } else {
+            &values[written..n]
+        };
+
+        let (Some(compressor), Some(seek_table)) = (&mut self.compressor, &mut self.seek_table)
+        else {
+            return Err("Compressor not initialized".to_string());
+        };
+        let count = self.header.borrow().count;
+        for (i, (&ts, &v)) in timestamps.iter().zip(values).enumerate() {
+            let bytes = compressor.consume(ts, v.get_uinteger64());
+            seek_table.record(compressor, bytes, count + 1 + i as u32, v);
+        }
+        self.update_header_batch(timestamps, values);
+
+        Ok(n)
+    }
+
     pub fn write(&mut self, ts: Timestamp, v: Value) -> Result<(), String> {
+        let v = self.header.borrow().quantize(v);
         self.update_header(ts, v);
 
-        match self.compressor {
-            Some(ref mut compressor) => {
-                compressor.consume(ts, v.get_uinteger64());
+        if let Some(pending) = &mut self.pending {
+            pending.push((ts, v));
+            if pending.len() >= CODEC_TRIAL_ENTRIES {
+                self.init_compressor();
+            }
+            return Ok(());
+        }
+
+        match (&mut self.compressor, &mut self.seek_table) {
+            (Some(compressor), Some(seek_table)) => {
+                let bytes = compressor.consume(ts, v.get_uinteger64());
+                let count = self.header.borrow().count;
+                seek_table.record(compressor, bytes, count, v);
                 Ok(())
             }
-            None => Err("Compressor not initialized".to_string()),
+            _ => Err("Compressor not initialized".to_string()),
         }
     }
 
+    /// Flushes all buffered entries and seals the file by appending its seek table
     pub fn flush(&mut self) -> Result<(), String> {
-        match self.compressor {
-            Some(ref mut compressor) => {
-                compressor.flush_all();
-                Ok(())
+        if self.pending.is_some() {
+            self.init_compressor();
+        }
+
+        match (&mut self.compressor, &mut self.seek_table) {
+            (Some(compressor), Some(seek_table)) => {
+                seek_table.data_size += compressor.flush_all();
+                self.write_seek_table().map_err(|err| err.to_string())
             }
-            None => Err("Compressor not initialized".to_string()),
+            _ => Err("Compressor not initialized".to_string()),
+        }
+    }
+
+    fn write_seek_table(&mut self) -> Result<(), io::Error> {
+        let seek_table = self.seek_table.as_ref().unwrap();
+        let mut header = self.header.borrow_mut();
+        header.seek_table_offset = (header.data_start() + seek_table.data_size) as u32;
+
+        let mut file = OpenOptions::new().write(true).open(&self.path)?;
+        file.seek(io::SeekFrom::Start(header.seek_table_offset as u64))?;
+        seek_table.write(&mut file)?;
+        file.seek(io::SeekFrom::Start(0))?;
+        header.write(&seek_table.resume_point, &mut file)?;
+
+        Ok(())
+    }
+
+    /// Rewrites the header for the entries before the last restart point, its checkpoint, so
+    /// that readers of the file only decode the blocks written after it. The header is only
+    /// written if the checkpoint moved.
+    pub fn checkpoint(&mut self) -> Result<(), io::Error> {
+        let Some(seek_table) = &self.seek_table else {
+            // Nothing is written while the codec is chosen
+            return Ok(());
+        };
+        let resume_point = seek_table.resume_point;
+        if resume_point.index == self.checkpoint_index {
+            return Ok(());
         }
+
+        let mut file = OpenOptions::new().write(true).open(&self.path)?;
+        self.header.borrow().write(&resume_point, &mut file)?;
+        self.checkpoint_index = resume_point.index;
+        Ok(())
     }
 
     pub fn num_entries(&self) -> usize {
@@ -599,32 +1871,35 @@ impl PartiallyPersistentDataFile {
     }
 }
 
+/// Appends the compressed stream of a file. The header is written when the writer is created
+/// while the file has no blocks yet, which rewrites it once the codec of the file is chosen.
+/// After the first block is written, the header is only rewritten by
+/// `PartiallyPersistentDataFile::checkpoint` and when the file is sealed.
 struct PartiallyPersistentDataFileWriter {
-    header: Rc<RefCell<Header>>,
     file: File,
-    path: PathBuf,
 }
 
 impl PartiallyPersistentDataFileWriter {
-    pub fn new(header: Rc<RefCell<Header>>, path: &PathBuf) -> Self {
-        Self {
-            header,
-            file: OpenOptions::new()
-                .create(true)
-                .truncate(false)
-                .write(true)
-                .open(path)
-                .unwrap(),
-            path: path.clone(),
+    pub fn new(header: &Header, path: &PathBuf) -> Self {
+        let mut file = OpenOptions::new()
+            .create(true)
+            .truncate(false)
+            .write(true)
+            .open(path)
+            .unwrap();
+        if file.metadata().unwrap().len() <= header.data_start() as u64 {
+            header
+                .write(&ResumePoint::start(header), &mut file)
+                .unwrap();
         }
+        file.seek(io::SeekFrom::End(0)).unwrap();
+
+        Self { file }
     }
 }
 
 impl Write for PartiallyPersistentDataFileWriter {
     fn write(&mut self, buf: &[u8]) -> io::Result<usize> {
-        self.file.seek(io::SeekFrom::Start(0)).unwrap();
-        self.header.borrow().write(self.file.by_ref()).unwrap();
-        self.file.seek(io::SeekFrom::End(0)).unwrap();
         self.file.write(buf)
     }
 
@@ -633,21 +1908,196 @@ impl Write for PartiallyPersistentDataFileWriter {
     }
 }
 
+#[cfg(test)]
+impl TimeDataFile {
+    /// Writes the file like versions older than SEEK_TABLE_VERSION did, with the short header
+    /// and without a seek table
+    pub fn write_legacy(&self, path: PathBuf, version: Version) {
+        let data_file = Self {
+            header: Header {
+                codec: Header::legacy_codec(self.header.value_type),
+                ..self.header.clone()
+            },
+            timestamps: self.timestamps.clone(),
+            values: self.values.clone(),
+        };
+        data_file.write(path.clone());
+
+        let page_cache = PageCache::new(1);
+        let file_id = page_cache.register_or_get_file_id(&path);
+        let header = Header::parse(file_id, &page_cache);
+        drop(page_cache);
+
+        let bytes = fs::read(&path).unwrap();
+        let mut legacy = bytes[..MAGIC_SIZE + LEGACY_HEADER_SIZE].to_vec();
+        legacy[MAGIC_SIZE..MAGIC_SIZE + 2].copy_from_slice(&version.0.to_le_bytes());
+        legacy.extend_from_slice(&bytes[header.data_start()..header.seek_table_offset as usize]);
+        fs::write(&path, legacy).unwrap();
+    }
+}
+
 #[cfg(test)]
 mod tests {
     use super::*;
     use crate::utils::test::*;
+    use crate::CURRENT_VERSION;
 
     #[test]
     fn test_write() {
         set_up_files!(paths, "cool.ty");
-        let mut model = TimeDataFile::new(Version(0), StreamId(0), ValueType::UInteger64);
+        let mut model = TimeDataFile::new(CURRENT_VERSION, StreamId(0), ValueType::UInteger64);
         for i in 0..10u64 {
             model.write_data_to_file_in_mem(i, (i + 10).into());
         }
         model.write(paths[0].clone());
     }
 
+    #[test]
+    fn test_read_legacy_file() {
+        set_up_files!(paths, "legacy.ty");
+        let mut model = TimeDataFile::new(CURRENT_VERSION, StreamId(0), ValueType::UInteger64);
+        for i in 0..5000u64 {
+            model.write_data_to_file_in_mem(10 * i, (i * i % 1013).into());
+        }
+        model.write_legacy(paths[0].clone(), Version(2));
+
+        // Files of older versions have no seek table and keep the codec they were written with
+        let data_file = TimeDataFile::read_data_file(paths[0].clone());
+        assert_eq!(data_file.header.version, Version(2));
+        assert_eq!(data_file.header.codec, Codec::IntV2);
+        assert_eq!(data_file.header.seek_table_offset, 0);
+        assert_eq!(data_file.header.count, model.header.count);
+        assert_eq!(data_file.timestamps, model.timestamps);
+        for (value, expected) in data_file.values.iter().zip(&model.values) {
+            assert!(value.eq_same(ValueType::UInteger64, expected));
+        }
+
+        let page_cache = Arc::new(PageCache::new(10));
+        let cursor = Cursor::new(
+            vec![paths[0].clone()],
+            20005,
+            30000,
+            page_cache,
+            ScanHint::None,
+        )
+        .unwrap();
+        assert_eq!(cursor.fetch().timestamp, 20010);
+        assert_eq!(cursor.count(), 999);
+    }
+
+    #[test]
+    fn test_recover_unsealed_file() {
+        set_up_files!(paths, "1.ty");
+        let timestamps: Vec<u64> = (0..1000u64).map(|i| 10 * i + i % 3).collect();
+        let values: Vec<Value> = (0..1000u64).map(|i| (i * i % 1013).into()).collect();
+
+        let mut file = PartiallyPersistentDataFile::new(
+            CURRENT_VERSION,
+            StreamId(0),
+            ValueType::UInteger64,
+            paths[0].clone(),
+        )
+        .lazy_init(timestamps[0], values[0], CodecPolicy::Default);
+        for i in 1..500 {
+            file.write(timestamps[i], values[i]).unwrap();
+        }
+        // Left without being sealed, so only the header written on creation is on disk
+        drop(file);
+        let page_cache = PageCache::new(10);
+        let file_id = page_cache.register_or_get_file_id(&paths[0]);
+        assert_eq!(Header::parse(file_id, &page_cache).count, 1);
+
+        // The entries of the blocks written are recovered, the buffered ones are lost
+        let recovered = TimeDataFile::recover_data_file(paths[0].clone());
+        let num_recovered = 1 + 3 * 128;
+        assert_eq!(recovered.header.count as usize, num_recovered);
+        assert_eq!(recovered.timestamps, timestamps[..num_recovered]);
+        assert_eq!(
+            recovered.header.max_timestamp,
+            timestamps[num_recovered - 1]
+        );
+
+        let mut file = PartiallyPersistentDataFile::new(
+            CURRENT_VERSION,
+            StreamId(0),
+            ValueType::UInteger64,
+            paths[0].clone(),
+        )
+        .partial_init(timestamps[500], values[500]);
+        for i in 501..1000 {
+            file.write(timestamps[i], values[i]).unwrap();
+        }
+        file.flush().unwrap();
+
+        let data_file = TimeDataFile::read_data_file(paths[0].clone());
+        let expected: Vec<u64> = timestamps[..num_recovered]
+            .iter()
+            .chain(&timestamps[500..])
+            .copied()
+            .collect();
+        assert_eq!(data_file.timestamps, expected);
+        assert_eq!(data_file.header.count as usize, expected.len());
+        assert_eq!(
+            data_file.values.last().unwrap().get_uinteger64(),
+            values[999].get_uinteger64()
+        );
+    }
+
+    #[test]
+    fn test_checkpoint_resumed_file() {
+        set_up_files!(paths, "1.ty");
+        let timestamps: Vec<u64> = (0..6000u64).map(|i| 10 * i + i % 3).collect();
+        let values: Vec<Value> = (0..6000u64).map(|i| (i * i % 1013).into()).collect();
+
+        let mut file = PartiallyPersistentDataFile::new(
+            CURRENT_VERSION,
+            StreamId(0),
+            ValueType::UInteger64,
+            paths[0].clone(),
+        )
+        .lazy_init(timestamps[0], values[0], CodecPolicy::Default);
+        for i in 1..3000 {
+            file.write(timestamps[i], values[i]).unwrap();
+        }
+        file.flush().unwrap();
+
+        let mut file = PartiallyPersistentDataFile::new(
+            CURRENT_VERSION,
+            StreamId(0),
+            ValueType::UInteger64,
+            paths[0].clone(),
+        )
+        .partial_init(timestamps[3000], values[3000]);
+        for i in 3001..5000 {
+            file.write(timestamps[i], values[i]).unwrap();
+        }
+        file.checkpoint().unwrap();
+        for i in 5000..6000 {
+            file.write(timestamps[i], values[i]).unwrap();
+        }
+        drop(file);
+
+        // The header stores the aggregates of the entries before the checkpoint, including the
+        // ones of the file before it was continued
+        let page_cache = PageCache::new(10);
+        let file_id = page_cache.register_or_get_file_id(&paths[0]);
+        let stored = Header::parse(file_id, &page_cache);
+        assert!(stored.count > 3000 && stored.count <= 5000);
+        let expected = values[..stored.count as usize]
+            .iter()
+            .map(Value::get_uinteger64)
+            .sum::<u64>();
+        assert_eq!(stored.value_sum.get_uinteger64(), expected);
+        drop(page_cache);
+
+        let recovered = TimeDataFile::recover_data_file(paths[0].clone());
+        assert_eq!(
+            TimeDataFile::read_header(paths[0].clone()),
+            recovered.header
+        );
+        assert!(recovered.header.count >= 5000);
+    }
+
     #[test]
     fn test_header_write_parse() {
         set_up_files!(paths, "temp_file.ty");
@@ -656,22 +2106,54 @@ mod tests {
         let t_header = Header {
             count: 11,
             value_sum: 101u64.into(),
-            ..Header::new(Version(0), StreamId(0), ValueType::UInteger64)
+            ..Header::new(CURRENT_VERSION, StreamId(0), ValueType::UInteger64)
         };
 
-        t_header.write(&mut temp_file).unwrap();
+        let checkpoint = ResumePoint {
+            offset: 40,
+            index: 5,
+            state: DecoderState {
+                timestamp: 9,
+                value: 3,
+                deltas: (2, -1),
+            },
+            zone_map: ZoneMap {
+                value_sum: 17u64.into(),
+                min_value: 1u64.into(),
+                max_value: 6u64.into(),
+            },
+        };
+        t_header.write(&checkpoint, &mut temp_file).unwrap();
 
         let _temp_file: File = File::open(&paths[0]).unwrap();
-        let mut page_cache = PageCache::new(100);
+        let page_cache = PageCache::new(100);
+        let file_id = page_cache.register_or_get_file_id(&paths[0]);
+        let parsed_header = Header::parse(file_id, &page_cache);
+        // The header of a file that is not sealed describes the entries before its checkpoint
+        assert!(t_header.at_checkpoint(&checkpoint) == parsed_header);
+        assert_eq!(parsed_header.count, 5);
+        assert_eq!(parsed_header.max_timestamp, 9);
+        let parsed_checkpoint = ResumePoint::parse_checkpoint(file_id, &page_cache);
+        assert_eq!(parsed_checkpoint.offset, 40);
+        assert_eq!(parsed_checkpoint.state.deltas, (2, -1));
+        assert_eq!(parsed_checkpoint.zone_map.value_sum.get_uinteger64(), 17);
+        drop(page_cache);
+
+        let t_header = Header {
+            seek_table_offset: 1000,
+            ..t_header
+        };
+        let mut temp_file: File = File::create(&paths[0]).unwrap();
+        t_header.write(&checkpoint, &mut temp_file).unwrap();
+        let page_cache = PageCache::new(100);
         let file_id = page_cache.register_or_get_file_id(&paths[0]);
-        let parsed_header = Header::parse(file_id, &mut page_cache);
-        assert!(t_header == parsed_header);
+        assert!(t_header == Header::parse(file_id, &page_cache));
     }
 
     #[test]
     fn test_cursor() {
         set_up_files!(paths, "1.ty");
-        let mut model = TimeDataFile::new(Version(0), StreamId(0), ValueType::UInteger64);
+        let mut model = TimeDataFile::new(CURRENT_VERSION, StreamId(0), ValueType::UInteger64);
         for i in 0..10u64 {
             model.write_data_to_file_in_mem(i, (i + 10).into());
         }
@@ -682,7 +2164,7 @@ mod tests {
             vec![paths[0].clone()],
             0,
             100,
-            Rc::new(RefCell::new(page_cache)),
+            Arc::new(page_cache),
             ScanHint::None,
         );
         assert!(cursor.is_ok());
@@ -705,13 +2187,13 @@ mod tests {
         set_up_files!(paths, "1.ty");
         generate_ty_file(paths[0].clone(), &[1], &[2u64.into()]);
 
-        let mut page_cache = PageCache::new(10);
+        let page_cache = PageCache::new(10);
         page_cache.register_or_get_file_id(&paths[0]);
         let mut cursor = Cursor::new(
             vec![paths[0].clone()],
             0,
             100,
-            Rc::new(RefCell::new(page_cache)),
+            Arc::new(page_cache),
             ScanHint::None,
         )
         .unwrap();
@@ -751,13 +2233,7 @@ mod tests {
 
         let page_cache = PageCache::new(10);
 
-        let cursor = Cursor::new(
-            file_paths,
-            0,
-            100,
-            Rc::new(RefCell::new(page_cache)),
-            ScanHint::None,
-        );
+        let cursor = Cursor::new(file_paths, 0, 100, Arc::new(page_cache), ScanHint::None);
         assert!(cursor.is_ok());
 
         let mut cursor = cursor.unwrap();
@@ -797,13 +2273,7 @@ mod tests {
         }
 
         let page_cache = PageCache::new(10);
-        let cursor = Cursor::new(
-            file_paths,
-            5,
-            23,
-            Rc::new(RefCell::new(page_cache)),
-            ScanHint::None,
-        );
+        let cursor = Cursor::new(file_paths, 5, 23, Arc::new(page_cache), ScanHint::None);
         assert!(cursor.is_ok());
 
         let mut cursor = cursor.unwrap();
@@ -835,14 +2305,8 @@ mod tests {
         generate_ty_file(paths[0].clone(), &timestamps, &values);
 
         let page_cache = PageCache::new(100);
-        let mut cursor = Cursor::new(
-            paths,
-            1,
-            100000,
-            Rc::new(RefCell::new(page_cache)),
-            ScanHint::None,
-        )
-        .unwrap();
+        let mut cursor =
+            Cursor::new(paths, 1, 100000, Arc::new(page_cache), ScanHint::None).unwrap();
 
         let mut i = 0;
         loop {
@@ -873,7 +2337,7 @@ mod tests {
             paths,
             1,
             timestamps[timestamps.len() - 1],
-            Rc::new(RefCell::new(page_cache)),
+            Arc::new(page_cache),
             ScanHint::None,
         )
         .unwrap();
@@ -920,7 +2384,7 @@ mod tests {
             paths,
             1,
             timestamps[timestamps.len() - 1],
-            Rc::new(RefCell::new(page_cache)),
+            Arc::new(page_cache),
             ScanHint::None,
         )
         .unwrap();
@@ -960,7 +2424,7 @@ mod tests {
             values.append(&mut local_values);
         }
 
-        let page_cache = Rc::new(RefCell::new(PageCache::new(10)));
+        let page_cache = Arc::new(PageCache::new(10));
 
         let get_value = |start: Timestamp, end: Timestamp, hint: ScanHint| -> (Value, i32) {
             let mut cursor =
@@ -985,7 +2449,8 @@ mod tests {
 
         let (res, i) = get_value(5, 28, ScanHint::Sum);
         assert!(res.eq_same(ValueType::UInteger64, &420u64.into()));
-        assert_eq!(i, 15);
+        // The start entry, the rest of the first file, the second file and the last 9 entries
+        assert_eq!(i, 12);
 
         let (res, _) = get_value(0, 9, ScanHint::Sum);
         assert!(res.eq_same(ValueType::UInteger64, &55u64.into()));
@@ -1013,7 +2478,7 @@ mod tests {
             values.append(&mut local_values);
         }
 
-        let page_cache = Rc::new(RefCell::new(PageCache::new(10)));
+        let page_cache = Arc::new(PageCache::new(10));
 
         let get_value = |start: Timestamp, end: Timestamp, hint: ScanHint| -> (Value, i32) {
             let mut cursor =
@@ -1039,9 +2504,471 @@ mod tests {
 
         let (res, i) = get_value(5, 28, ScanHint::Min);
         assert!(res.eq_same(ValueType::UInteger64, &6u64.into()));
-        assert_eq!(i, 15);
+        assert_eq!(i, 12);
 
         let (res, _) = get_value(2, 9, ScanHint::Min);
         assert!(res.eq_same(ValueType::UInteger64, &3u64.into()));
     }
+
+    #[test]
+    fn test_cursor_seek_table() {
+        set_up_files!(paths, "1.ty");
+        let timestamps: Vec<u64> = (0..10000u64).map(|i| 3 * i + (i % 3)).collect();
+        let values: Vec<Value> = (0..10000u64).map(|i| (i * i % 1013).into()).collect();
+        generate_ty_file(paths[0].clone(), &timestamps, &values);
+
+        let page_cache = Arc::new(PageCache::new(10));
+        let file_id = page_cache.register_or_get_file_id(&paths[0]);
+        let header = Header::parse(file_id, &page_cache);
+        let seek_table = SeekTable::parse(file_id, &page_cache, &header);
+        assert_eq!(seek_table.len(), 10);
+
+        for (start, end) in [
+            (0, 40),
+            (3070, 3200),
+            (3072, 3075),
+            (20000, 29999),
+            (29990, 40000),
+        ] {
+            let mut cursor = Cursor::new(
+                paths.clone(),
+                start,
+                end,
+                page_cache.clone(),
+                ScanHint::None,
+            )
+            .unwrap();
+
+            let mut i = timestamps.partition_point(|ts| *ts < start);
+            loop {
+                let Vector { timestamp, value } = cursor.fetch();
+                assert_eq!(timestamp, timestamps[i]);
+                assert!(value.eq_same(ValueType::UInteger64, &values[i]));
+                i += 1;
+                if cursor.next().is_none() {
+                    break;
+                }
+            }
+            assert_eq!(i, timestamps.partition_point(|ts| *ts <= end));
+        }
+    }
+
+    #[test]
+    fn test_cursor_zone_maps() {
+        set_up_files!(paths, "1.ty");
+        let timestamps: Vec<u64> = (0..10000u64).map(|i| 3 * i + (i % 3)).collect();
+        let values: Vec<Value> = (0..10000u64).map(|i| (i * i % 1013).into()).collect();
+        generate_ty_file(paths[0].clone(), &timestamps, &values);
+
+        let page_cache = Arc::new(PageCache::new(10));
+
+        let max_timestamp = *timestamps.last().unwrap();
+        for (start, end) in [
+            (0, 29000),
+            (100, 29990),
+            (5000, 20000),
+            (3072, 3075),
+            (4000, max_timestamp),
+        ] {
+            let lo = timestamps.partition_point(|ts| *ts < start);
+            let hi = timestamps.partition_point(|ts| *ts <= end);
+            let expected = &values[lo..hi];
+
+            for hint in [ScanHint::Sum, ScanHint::Count, ScanHint::Min, ScanHint::Max] {
+                let mut cursor =
+                    Cursor::new(paths.clone(), start, end, page_cache.clone(), hint).unwrap();
+
+                let mut results = Vec::new();
+                loop {
+                    let Vector { timestamp, value } = cursor.fetch();
+                    assert!(timestamp <= end);
+                    results.push(value.get_uinteger64());
+                    if cursor.next().is_none() {
+                        break;
+                    }
+                }
+
+                let expected_values = expected.iter().map(|v| v.get_uinteger64());
+                match hint {
+                    ScanHint::Sum => {
+                        assert_eq!(results.iter().sum::<u64>(), expected_values.sum::<u64>());
+                    }
+                    ScanHint::Count => {
+                        assert_eq!(results.iter().sum::<u64>(), expected.len() as u64);
+                    }
+                    ScanHint::Min => {
+                        assert_eq!(results.iter().min(), expected_values.min().as_ref());
+                    }
+                    ScanHint::Max => {
+                        assert_eq!(results.iter().max(), expected_values.max().as_ref());
+                    }
+                    ScanHint::None => unreachable!(),
+                }
+
+                if expected.len() > 2 * SEEK_INTERVAL as usize {
+                    assert!(results.len() < expected.len() / 2);
+                }
+                // The rest of the block the range starts in is answered at once too
+                if end == max_timestamp {
+                    assert!(results.len() <= expected.len() / SEEK_INTERVAL as usize + 2);
+                }
+            }
+        }
+    }
+
+    #[test]
+    fn test_cursor_runs() {
+        set_up_files!(paths, "1.ty");
+        // A status flag that changes every 300 entries
+        let timestamps: Vec<u64> = (0..10000u64).map(|i| 3 * i + (i % 3)).collect();
+        let values: Vec<Value> = (0..10000u64).map(|i| (i / 300 % 3).into()).collect();
+        generate_ty_file(paths[0].clone(), &timestamps, &values);
+
+        let page_cache = Arc::new(PageCache::new(10));
+
+        for (start, end) in [(10, 2900), (1000, 5000), (3072, 3075)] {
+            let lo = timestamps.partition_point(|ts| *ts < start);
+            let hi = timestamps.partition_point(|ts| *ts <= end);
+            let expected: Vec<u64> = values[lo..hi].iter().map(|v| v.get_uinteger64()).collect();
+
+            for hint in [ScanHint::Sum, ScanHint::Count, ScanHint::Min, ScanHint::Max] {
+                let cursor =
+                    Cursor::new(paths.clone(), start, end, page_cache.clone(), hint).unwrap();
+
+                let mut results = vec![cursor.fetch().value.get_uinteger64()];
+                results.extend(cursor.map(|vector| vector.value.get_uinteger64()));
+
+                match hint {
+                    ScanHint::Sum => {
+                        assert_eq!(results.iter().sum::<u64>(), expected.iter().sum::<u64>());
+                    }
+                    ScanHint::Count => {
+                        assert_eq!(results.iter().sum::<u64>(), expected.len() as u64);
+                    }
+                    ScanHint::Min => assert_eq!(results.iter().min(), expected.iter().min()),
+                    ScanHint::Max => assert_eq!(results.iter().max(), expected.iter().max()),
+                    ScanHint::None => unreachable!(),
+                }
+
+                // One result per run within each block of the seek table
+                assert!(results.len() <= 3 * (expected.len() / 300 + 2));
+            }
+        }
+    }
+
+    #[test]
+    fn test_float_file() {
+        set_up_files!(paths, "1.ty", "2.ty");
+        let timestamps: Vec<u64> = (0..10000u64).map(|i| 3 * i + (i % 3)).collect();
+        let values: Vec<Value> = (0..10000u64)
+            .map(|i| (230.0 + (i % 50) as f64 * 0.25).into())
+            .collect();
+
+        let mut model = TimeDataFile::new(CURRENT_VERSION, StreamId(0), ValueType::Float64);
+        for i in 0..timestamps.len() {
+            model.write_data_to_file_in_mem(timestamps[i], values[i]);
+        }
+        let float_size = model.write(paths[0].clone());
+        model.header.codec = Codec::IntV2;
+        let int_size = model.write(paths[1].clone());
+        assert!(float_size < int_size);
+
+        let page_cache = Arc::new(PageCache::new(10));
+        for (start, end) in [(0, 40000), (3070, 3200), (20000, 29999)] {
+            let mut cursor = Cursor::new(
+                vec![paths[0].clone()],
+                start,
+                end,
+                page_cache.clone(),
+                ScanHint::None,
+            )
+            .unwrap();
+            assert_eq!(cursor.header.codec, Codec::FloatV1);
+
+            let mut i = timestamps.partition_point(|ts| *ts < start);
+            loop {
+                let Vector { timestamp, value } = cursor.fetch();
+                assert_eq!(timestamp, timestamps[i]);
+                assert!(value.eq_same(ValueType::Float64, &values[i]));
+                i += 1;
+                if cursor.next().is_none() {
+                    break;
+                }
+            }
+            assert_eq!(i, timestamps.partition_point(|ts| *ts <= end));
+        }
+    }
+
+    #[test]
+    fn test_cursor_mmap_reads() {
+        set_up_files!(paths, "1.ty");
+        let timestamps: Vec<u64> = (0..10000u64).map(|i| 3 * i + (i % 3)).collect();
+        let values: Vec<Value> = (0..10000u64).map(|i| (i * i % 1013).into()).collect();
+        generate_ty_file(paths[0].clone(), &timestamps, &values);
+
+        let read_all = |mmap_reads: bool, start: Timestamp, end: Timestamp| -> Vec<Vector> {
+            let page_cache = PageCache::new(10);
+            page_cache.set_mmap_reads(mmap_reads);
+            let mut cursor = Cursor::new(
+                paths.clone(),
+                start,
+                end,
+                Arc::new(page_cache),
+                ScanHint::None,
+            )
+            .unwrap();
+
+            let mut results = vec![cursor.fetch()];
+            results.extend(cursor.by_ref());
+            results
+        };
+
+        for (start, end) in [(0, 40000), (3070, 3200)] {
+            let mmap_results = read_all(true, start, end);
+            let page_results = read_all(false, start, end);
+            assert_eq!(mmap_results.len(), page_results.len());
+            for (a, b) in mmap_results.iter().zip(&page_results) {
+                assert_eq!(a.timestamp, b.timestamp);
+                assert!(a.value.eq_same(ValueType::UInteger64, &b.value));
+            }
+            assert_eq!(
+                mmap_results.len(),
+                timestamps.partition_point(|ts| *ts <= end)
+                    - timestamps.partition_point(|ts| *ts < start)
+            );
+        }
+    }
+
+    #[test]
+    fn test_cursor_chunk_cache() {
+        set_up_files!(paths, "1.ty", "2.ty");
+        let timestamps: Vec<u64> = (0..20000u64).map(|i| 3 * i + (i % 3)).collect();
+        let values: Vec<Value> = (0..20000u64).map(|i| (i * i % 1013).into()).collect();
+        generate_ty_file(paths[0].clone(), &timestamps[..10000], &values[..10000]);
+        generate_ty_file(paths[1].clone(), &timestamps[10000..], &values[10000..]);
+
+        let page_cache = Arc::new(PageCache::new(10));
+        page_cache.set_chunk_cache_bytes(1 << 20);
+
+        for _ in 0..2 {
+            for (start, end) in [(0, 60000), (3070, 3200), (20000, 40000), (29999, 30002)] {
+                let lo = timestamps.partition_point(|ts| *ts < start);
+                let hi = timestamps.partition_point(|ts| *ts <= end);
+
+                let mut cursor = Cursor::new(
+                    paths.clone(),
+                    start,
+                    end,
+                    page_cache.clone(),
+                    ScanHint::None,
+                )
+                .unwrap();
+                let mut results = vec![cursor.fetch()];
+                results.extend(cursor.by_ref());
+
+                assert_eq!(results.len(), hi - lo);
+                for (i, Vector { timestamp, value }) in results.into_iter().enumerate() {
+                    assert_eq!(timestamp, timestamps[lo + i]);
+                    assert!(value.eq_same(ValueType::UInteger64, &values[lo + i]));
+                }
+            }
+        }
+        assert!(page_cache.chunk_cache().len() >= 2 * (10000 / SEEK_INTERVAL as usize));
+
+        // Blocks answered from zone maps mix with blocks read from the chunk cache
+        let cursor =
+            Cursor::new(paths.clone(), 100, 50000, page_cache.clone(), ScanHint::Sum).unwrap();
+        let mut sum = cursor.fetch().value.get_uinteger64();
+        sum += cursor.map(|v| v.value.get_uinteger64()).sum::<u64>();
+        let lo = timestamps.partition_point(|ts| *ts < 100);
+        let hi = timestamps.partition_point(|ts| *ts <= 50000);
+        assert_eq!(
+            sum,
+            values[lo..hi]
+                .iter()
+                .map(|v| v.get_uinteger64())
+                .sum::<u64>()
+        );
+    }
+
+    #[test]
+    fn test_cursor_next_batch() {
+        set_up_files!(paths, "1.ty", "2.ty");
+        let timestamps: Vec<u64> = (0..20000u64).map(|i| 3 * i + (i % 3)).collect();
+        let values: Vec<Value> = (0..20000u64).map(|i| (i * i % 1013).into()).collect();
+        generate_ty_file(paths[0].clone(), &timestamps[..10000], &values[..10000]);
+        generate_ty_file(paths[1].clone(), &timestamps[10000..], &values[10000..]);
+
+        for chunk_cache_bytes in [0, 1 << 20] {
+            let page_cache = Arc::new(PageCache::new(10));
+            page_cache.set_chunk_cache_bytes(chunk_cache_bytes);
+
+            for (start, end) in [(0, 60000), (3070, 3200), (20000, 40000), (29999, 30002)] {
+                let lo = timestamps.partition_point(|ts| *ts < start);
+                let hi = timestamps.partition_point(|ts| *ts <= end);
+
+                for batch_size in [7, 1000] {
+                    let mut cursor = Cursor::new(
+                        paths.clone(),
+                        start,
+                        end,
+                        page_cache.clone(),
+                        ScanHint::None,
+                    )
+                    .unwrap();
+
+                    let mut batch_timestamps = vec![cursor.fetch().timestamp];
+                    let mut batch_values = vec![cursor.fetch().value.get_uinteger64()];
+                    loop {
+                        let offset = batch_timestamps.len();
+                        batch_timestamps.resize(offset + batch_size, 0);
+                        batch_values.resize(offset + batch_size, 0);
+                        let num_read = cursor.next_batch(
+                            &mut batch_timestamps[offset..],
+                            &mut batch_values[offset..],
+                        );
+                        batch_timestamps.truncate(offset + num_read);
+                        batch_values.truncate(offset + num_read);
+                        if num_read < batch_size {
+                            break;
+                        }
+                    }
+
+                    assert!(cursor.next_vector().is_none());
+                    assert_eq!(&batch_timestamps[..], &timestamps[lo..hi]);
+                    for (value, expected) in batch_values.iter().zip(&values[lo..hi]) {
+                        assert_eq!(*value, expected.get_uinteger64());
+                    }
+                }
+            }
+        }
+    }
+
+    #[test]
+    fn test_int_codecs() {
+        set_up_files!(paths, "v2.ty", "v3.ty");
+        let timestamps: Vec<u64> = (0..10000u64).map(|i| 3 * i + (i % 3)).collect();
+        let values: Vec<Value> = (0..10000u64).map(|i| (i * i % 1013).into()).collect();
+
+        let mut model = TimeDataFile::new(CURRENT_VERSION, StreamId(0), ValueType::UInteger64);
+        assert_eq!(model.header.codec, Codec::IntV3);
+        for i in 0..timestamps.len() {
+            model.write_data_to_file_in_mem(timestamps[i], values[i]);
+        }
+        model.header.codec = Codec::IntV2;
+        let v2_size = model.write(paths[0].clone());
+        model.header.codec = Codec::IntV3;
+        let v3_size = model.write(paths[1].clone());
+        assert!(v3_size < v2_size);
+
+        // Files written with the previous codec stay readable
+        let page_cache = Arc::new(PageCache::new(10));
+        for (path, codec) in [(&paths[0], Codec::IntV2), (&paths[1], Codec::IntV3)] {
+            let mut cursor = Cursor::new(
+                vec![path.clone()],
+                3000,
+                u64::MAX,
+                page_cache.clone(),
+                ScanHint::None,
+            )
+            .unwrap();
+            assert_eq!(cursor.header.codec, codec);
+
+            let lo = timestamps.partition_point(|ts| *ts < 3000);
+            let mut results = vec![cursor.fetch()];
+            results.extend(cursor.by_ref());
+            assert_eq!(results.len(), timestamps.len() - lo);
+            for (i, Vector { timestamp, value }) in results.into_iter().enumerate() {
+                assert_eq!(timestamp, timestamps[lo + i]);
+                assert!(value.eq_same(ValueType::UInteger64, &values[lo + i]));
+            }
+        }
+    }
+
+    #[test]
+    fn test_codec_choice() {
+        set_up_files!(paths, "default.ty", "smallest.ty", "fastest.ty", "short.ty");
+
+        // Sparse events: a rare spike on a slowly drifting counter
+        let timestamps: Vec<u64> = (0..5000u64).map(|i| 1000 * i + (i * 7919) % 13).collect();
+        let values: Vec<Value> = (0..5000u64)
+            .map(|i| (if i % 1000 == 999 { 1 << 40 } else { i / 100 }).into())
+            .collect();
+
+        let header = Header {
+            min_timestamp: timestamps[0],
+            first_value: values[0],
+            ..Header::new(CURRENT_VERSION, StreamId(0), ValueType::UInteger64)
+        };
+        let raw_values: Vec<u64> = values.iter().map(|v| v.get_uinteger64()).collect();
+        assert_eq!(
+            Codec::choose(
+                CodecPolicy::Default,
+                &header,
+                &timestamps[1..],
+                &raw_values[1..]
+            ),
+            Codec::IntV3
+        );
+
+        let mut sizes = Vec::new();
+        for (path, policy) in paths.iter().zip([
+            CodecPolicy::Default,
+            CodecPolicy::Smallest,
+            CodecPolicy::Fastest,
+        ]) {
+            let mut file = PartiallyPersistentDataFile::new(
+                CURRENT_VERSION,
+                StreamId(0),
+                ValueType::UInteger64,
+                path.clone(),
+            )
+            .lazy_init(timestamps[0], values[0], policy);
+            for i in 1..timestamps.len() {
+                file.write(timestamps[i], values[i]).unwrap();
+            }
+            file.flush().unwrap();
+
+            let data_file = TimeDataFile::read_data_file(path.clone());
+            assert_eq!(data_file.timestamps, timestamps);
+            for i in 0..values.len() {
+                assert!(data_file.values[i].eq_same(ValueType::UInteger64, &values[i]));
+            }
+            sizes.push((
+                data_file.header.codec,
+                std::fs::metadata(path).unwrap().len(),
+            ));
+        }
+
+        assert!(sizes[1].1 <= sizes[0].1);
+        assert!(sizes[2].1 * 4 <= sizes[1].1 * 5 + 4 * HEADER_SIZE as u64);
+
+        // Files shorter than the trial still choose a codec when sealed
+        let mut file = PartiallyPersistentDataFile::new(
+            CURRENT_VERSION,
+            StreamId(0),
+            ValueType::Float64,
+            paths[3].clone(),
+        )
+        .lazy_init(0, 1.5.into(), CodecPolicy::Smallest);
+        file.write(10, 1.5.into()).unwrap();
+        file.flush().unwrap();
+        let data_file = TimeDataFile::read_data_file(paths[3].clone());
+        assert_eq!(data_file.timestamps, [0, 10]);
+        assert!(data_file.values[1].eq_same(ValueType::Float64, &1.5.into()));
+
+        // Decimal floats are stored as integers
+        let header = Header {
+            first_value: 21.5.into(),
+            ..Header::new(CURRENT_VERSION, StreamId(0), ValueType::Float64)
+        };
+        let values: Vec<u64> = (1..1000)
+            .map(|i| ((2150 + (i * 7919) % 300) as f64 / 100.0).to_bits())
+            .collect();
+        let timestamps: Vec<u64> = (1..1000).collect();
+        assert_eq!(
+            Codec::choose(CodecPolicy::Smallest, &header, &timestamps, &values),
+            Codec::FloatAlp
+        );
+    }
 }
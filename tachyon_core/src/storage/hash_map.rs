@@ -1,106 +1,168 @@
-use std::ptr;
+/// Key that marks an empty slot
+const EMPTY: u64 = u64::MAX;
 
-/// Not safe to clone unless next is null
-#[derive(Clone)]
-struct Node<V> {
+const MIN_CAPACITY: usize = 16;
+
+#[derive(Clone, Copy)]
+struct Slot<V> {
     key: u64,
     val: V,
-    next: *mut Node<V>,
 }
 
-pub struct IDLookup<V: Copy> {
+/// Open-addressing hash table from ids to small values.
+/// Keys and values are stored inline in a single array and collisions are resolved by linear
+/// probing, so a lookup usually touches one cache line. Removals shift the following entries
+/// back instead of leaving tombstones, and the table doubles once it is 3/4 full.
+/// Precondition: `u64::MAX` is never used as a key
+pub struct IDLookup<V: Copy + Default> {
     size: usize,
-    table: Vec<*mut Node<V>>,
+    slots: Vec<Slot<V>>,
 }
 
-impl<V: Copy> IDLookup<V> {
+impl<V: Copy + Default> IDLookup<V> {
+    pub fn new() -> Self {
+        Self::new_with_capacity(0)
+    }
+
+    /// Creates a table that holds `capacity` entries without growing
     pub fn new_with_capacity(capacity: usize) -> Self {
+        let num_slots = (capacity + capacity / 3 + 1)
+            .next_power_of_two()
+            .max(MIN_CAPACITY);
+
         IDLookup {
             size: 0,
-            table: vec![ptr::null_mut(); capacity],
+            slots: vec![
+                Slot {
+                    key: EMPTY,
+                    val: V::default(),
+                };
+                num_slots
+            ],
         }
     }
 
-    pub fn get(&self, key: &u64) -> Option<V> {
-        let idx = (*key as usize) % self.table.len();
-        let mut cur = self.table[idx];
-        unsafe {
-            while !cur.is_null() && (*cur).key != *key {
-                cur = (*cur).next;
+    pub fn len(&self) -> usize {
+        self.size
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.size == 0
+    }
+
+    fn mask(&self) -> usize {
+        self.slots.len() - 1
+    }
+
+    /// Gets the slot a key is placed in when there are no collisions.
+    /// The key is mixed with the MurmurHash3 finalizer, as page keys only differ in a few bits.
+    fn home(&self, key: u64) -> usize {
+        let mut hash = key;
+        hash ^= hash >> 33;
+        hash = hash.wrapping_mul(0xff51afd7ed558ccd);
+        hash ^= hash >> 33;
+        hash = hash.wrapping_mul(0xc4ceb9fe1a85ec53);
+        hash ^= hash >> 33;
+        (hash as usize) & self.mask()
+    }
+
+    /// Returns the slot holding `key`, or the empty slot that ends its probe sequence.
+    /// The table is never full, so the probe always terminates.
+    fn find(&self, key: u64) -> Result<usize, usize> {
+        let mut idx = self.home(key);
+        loop {
+            match self.slots[idx].key {
+                slot_key if slot_key == key => return Ok(idx),
+                EMPTY => return Err(idx),
+                _ => idx = (idx + 1) & self.mask(),
             }
         }
-        if cur.is_null() {
+    }
+
+    pub fn get(&self, key: &u64) -> Option<V> {
+        if *key == EMPTY {
             return None;
         }
-        let val = unsafe { (*cur).val };
-        Some(val)
+
+        self.find(*key).ok().map(|idx| self.slots[idx].val)
     }
 
     pub fn insert(&mut self, key: u64, value: V) {
-        let idx = (key as usize) % self.table.len();
-        let mut cur = self.table[idx];
-        unsafe {
-            while !cur.is_null() && (*cur).key != key {
-                cur = (*cur).next;
-            }
-        }
-        if cur.is_null() {
-            self.table[idx] = Box::into_raw(Box::new(Node {
-                key,
-                val: value,
-                next: self.table[idx],
-            }));
-            self.size += 1;
-        } else {
-            unsafe {
-                (*cur).val = value;
+        assert_ne!(key, EMPTY, "Cannot use the empty key!");
+
+        match self.find(key) {
+            Ok(idx) => self.slots[idx].val = value,
+            Err(idx) => {
+                if 4 * (self.size + 1) > 3 * self.slots.len() {
+                    self.grow();
+                    self.insert(key, value);
+                    return;
+                }
+
+                self.slots[idx] = Slot { key, val: value };
+                self.size += 1;
             }
         }
     }
 
     pub fn remove(&mut self, key: &u64) {
-        let idx = (*key as usize) % self.table.len();
-        let mut cur = self.table[idx];
-        let mut prev = ptr::null_mut();
-        unsafe {
-            while !cur.is_null() && (*cur).key != *key {
-                prev = cur;
-                cur = (*cur).next;
-            }
+        if *key == EMPTY {
+            return;
         }
+        let Ok(mut hole) = self.find(*key) else {
+            return;
+        };
 
-        if !cur.is_null() {
-            if prev.is_null() {
-                self.table[idx] = unsafe { (*cur).next };
-            } else {
-                unsafe {
-                    (*prev).next = (*cur).next;
-                }
+        // Shift back entries whose probe sequence passes through the hole, until the run ends
+        let mut idx = hole;
+        loop {
+            idx = (idx + 1) & self.mask();
+            let slot = self.slots[idx];
+            if slot.key == EMPTY {
+                break;
             }
 
-            unsafe {
-                drop(Box::from_raw(cur));
+            let home = self.home(slot.key);
+            if (idx.wrapping_sub(home) & self.mask()) >= (idx.wrapping_sub(hole) & self.mask()) {
+                self.slots[hole] = slot;
+                hole = idx;
             }
         }
+
+        self.slots[hole].key = EMPTY;
         self.size -= 1;
     }
-}
 
-impl<V: Copy> Drop for IDLookup<V> {
-    fn drop(&mut self) {
-        while let Some(mut item) = self.table.pop() {
-            while !item.is_null() {
-                let next = unsafe { (*item).next };
-                unsafe { drop(Box::from_raw(item)) };
-                item = next;
-            }
+    fn grow(&mut self) {
+        let num_slots = 2 * self.slots.len();
+        let old_slots = std::mem::replace(
+            &mut self.slots,
+            vec![
+                Slot {
+                    key: EMPTY,
+                    val: V::default(),
+                };
+                num_slots
+            ],
+        );
+
+        for slot in old_slots.into_iter().filter(|slot| slot.key != EMPTY) {
+            let (Ok(idx) | Err(idx)) = self.find(slot.key);
+            self.slots[idx] = slot;
         }
     }
 }
 
+impl<V: Copy + Default> Default for IDLookup<V> {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
 #[cfg(test)]
 mod tests {
     use super::*;
+    use rustc_hash::FxHashMap;
 
     #[test]
     fn test_get() {
@@ -128,7 +190,8 @@ mod tests {
         let mut hm = IDLookup::<u64>::new_with_capacity(10);
         hm.insert(4, 5);
 
-        // will all get inserted into same bucket
+        // keys that collide probe into the neighbouring slots, so removals have to shift back
+        // the entries after them for these to stay reachable
         hm.insert(14, 3);
         hm.insert(24, 5);
         hm.insert(34, 8);
@@ -138,18 +201,18 @@ mod tests {
         assert_eq!(hm.get(&44), Some(9));
         assert_eq!(hm.size, 5);
 
-        // remove head
+        // remove first inserted
         hm.remove(&4);
         assert_eq!(hm.get(&4), None);
         assert_eq!(hm.get(&14), Some(3));
 
-        // remove tail
+        // remove last inserted
         hm.remove(&44);
         assert_eq!(hm.get(&44), None);
         assert_eq!(hm.get(&14), Some(3));
         assert_eq!(hm.get(&34), Some(8));
 
-        // remove middle
+        // remove one in between
         hm.remove(&24);
         assert_eq!(hm.get(&24), None);
         assert_eq!(hm.get(&14), Some(3));
@@ -176,4 +239,51 @@ mod tests {
 
         assert_eq!(hm.size, 0);
     }
+
+    #[test]
+    fn test_grow() {
+        let mut hm = IDLookup::<usize>::new();
+        let keys = |i: u64| (i % 7) << 32 | (i / 7);
+
+        for i in 0..10000 {
+            hm.insert(keys(i), i as usize);
+        }
+        assert_eq!(hm.len(), 10000);
+        assert!(hm.slots.len() >= 10000 * 4 / 3);
+
+        for i in 0..10000 {
+            assert_eq!(hm.get(&keys(i)), Some(i as usize));
+        }
+        assert_eq!(hm.get(&keys(10000)), None);
+    }
+
+    #[test]
+    fn test_matches_std() {
+        let mut hm = IDLookup::<u64>::new_with_capacity(64);
+        let mut expected = FxHashMap::<u64, u64>::default();
+
+        // Small key range so that runs collide, wrap around and get removed from the middle
+        let mut rng = 12345u64;
+        for i in 0..100000 {
+            rng ^= rng << 13;
+            rng ^= rng >> 7;
+            rng ^= rng << 17;
+            let key = rng % 200;
+
+            if rng % 3 == 0 {
+                hm.remove(&key);
+                expected.remove(&key);
+            } else {
+                hm.insert(key, i);
+                expected.insert(key, i);
+            }
+
+            assert_eq!(hm.get(&key), expected.get(&key).copied());
+            assert_eq!(hm.len(), expected.len());
+        }
+
+        for key in 0..200 {
+            assert_eq!(hm.get(&key), expected.get(&key).copied());
+        }
+    }
 }
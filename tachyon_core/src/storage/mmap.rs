@@ -0,0 +1,194 @@
+use std::fs::File;
+use std::io::{self, Read};
+use std::os::fd::AsRawFd;
+use std::sync::Arc;
+use std::{ptr, slice};
+
+/// Read-only mapping of a whole file.
+/// Precondition: The file is not modified while it is mapped
+pub struct Mmap {
+    ptr: *mut libc::c_void,
+    len: usize,
+}
+
+impl Mmap {
+    pub fn map(file: &File) -> io::Result<Self> {
+        let len = file.metadata()?.len() as usize;
+        if len == 0 {
+            return Err(io::Error::new(
+                io::ErrorKind::InvalidInput,
+                "Cannot map an empty file",
+            ));
+        }
+
+        // SAFETY: The mapping is private and read-only, and it is unmapped exactly once on drop
+        let ptr = unsafe {
+            libc::mmap(
+                ptr::null_mut(),
+                len,
+                libc::PROT_READ,
+                libc::MAP_PRIVATE,
+                file.as_raw_fd(),
+                0,
+            )
+        };
+        if ptr == libc::MAP_FAILED {
+            return Err(io::Error::last_os_error());
+        }
+
+        // Files are mostly scanned front to back, so let the kernel read ahead aggressively
+        // SAFETY: ptr and len describe the mapping created above
+        unsafe {
+            libc::madvise(ptr, len, libc::MADV_SEQUENTIAL);
+        }
+
+        Ok(Self { ptr, len })
+    }
+
+    pub fn as_slice(&self) -> &[u8] {
+        // SAFETY: The mapping is valid for len bytes for the lifetime of self
+        unsafe { slice::from_raw_parts(self.ptr as *const u8, self.len) }
+    }
+}
+
+// SAFETY: The mapping is read-only, so it can be shared and sent between threads
+unsafe impl Send for Mmap {}
+unsafe impl Sync for Mmap {}
+
+impl Drop for Mmap {
+    fn drop(&mut self) {
+        // SAFETY: ptr and len describe a live mapping owned by self
+        unsafe {
+            libc::munmap(self.ptr, self.len);
+        }
+    }
+}
+
+/// Private anonymous read-write mapping. It starts zero-filled and memory is only committed
+/// for the parts that are touched.
+pub struct AnonymousMmap {
+    ptr: *mut libc::c_void,
+    len: usize,
+}
+
+impl AnonymousMmap {
+    pub fn new(len: usize) -> io::Result<Self> {
+        // SAFETY: The mapping is private and not backed by a file, and it is unmapped exactly
+        // once on drop
+        let ptr = unsafe {
+            libc::mmap(
+                ptr::null_mut(),
+                len,
+                libc::PROT_READ | libc::PROT_WRITE,
+                libc::MAP_PRIVATE | libc::MAP_ANONYMOUS,
+                -1,
+                0,
+            )
+        };
+        if ptr == libc::MAP_FAILED {
+            return Err(io::Error::last_os_error());
+        }
+
+        // Large mappings are randomly accessed, so back them with transparent huge pages where
+        // available to reduce TLB misses. Failing to do so is harmless.
+        #[cfg(target_os = "linux")]
+        // SAFETY: ptr and len describe the mapping created above
+        unsafe {
+            libc::madvise(ptr, len, libc::MADV_HUGEPAGE);
+        }
+
+        Ok(Self { ptr, len })
+    }
+
+    pub fn as_slice(&self) -> &[u8] {
+        // SAFETY: The mapping is valid for len bytes for the lifetime of self
+        unsafe { slice::from_raw_parts(self.ptr as *const u8, self.len) }
+    }
+
+    pub fn as_mut_slice(&mut self) -> &mut [u8] {
+        // SAFETY: The mapping is valid for len bytes for the lifetime of self and only reachable
+        // through self
+        unsafe { slice::from_raw_parts_mut(self.ptr as *mut u8, self.len) }
+    }
+}
+
+// SAFETY: The mapping is owned exclusively by self, so it follows the usual borrowing rules
+unsafe impl Send for AnonymousMmap {}
+unsafe impl Sync for AnonymousMmap {}
+
+impl Drop for AnonymousMmap {
+    fn drop(&mut self) {
+        // SAFETY: ptr and len describe a live mapping owned by self
+        unsafe {
+            libc::munmap(self.ptr, self.len);
+        }
+    }
+}
+
+/// Sequential reader that decodes straight out of a mapping, without going through
+/// page cache frames.
+pub struct MmapRead {
+    mmap: Arc<Mmap>,
+    offset: usize,
+}
+
+impl MmapRead {
+    pub fn new(mmap: Arc<Mmap>, offset: usize) -> Self {
+        Self { mmap, offset }
+    }
+}
+
+impl Read for MmapRead {
+    fn read(&mut self, buf: &mut [u8]) -> io::Result<usize> {
+        let data = self.mmap.as_slice().get(self.offset..).unwrap_or_default();
+        let num_bytes = data.len().min(buf.len());
+        buf[..num_bytes].copy_from_slice(&data[..num_bytes]);
+        self.offset += num_bytes;
+
+        Ok(num_bytes)
+    }
+
+    fn read_exact(&mut self, buf: &mut [u8]) -> io::Result<()> {
+        let data = self
+            .mmap
+            .as_slice()
+            .get(self.offset..self.offset + buf.len())
+            .ok_or(io::ErrorKind::UnexpectedEof)?;
+        buf.copy_from_slice(data);
+        self.offset += buf.len();
+
+        Ok(())
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::{Mmap, MmapRead};
+    use crate::utils::test::*;
+    use std::fs::File;
+    use std::io::{Read, Write};
+    use std::sync::Arc;
+
+    #[test]
+    fn test_mmap_read() {
+        set_up_files!(file_paths, "test.ty");
+
+        let expected: Vec<u8> = (0..10000u32).map(|i| (i * 7 % 251) as u8).collect();
+        File::create(&file_paths[0])
+            .unwrap()
+            .write_all(&expected)
+            .unwrap();
+
+        let mmap = Arc::new(Mmap::map(&File::open(&file_paths[0]).unwrap()).unwrap());
+        assert_eq!(mmap.as_slice(), &expected[..]);
+
+        let mut reader = MmapRead::new(mmap, 4000);
+        let mut buffer = [0u8; 5000];
+        reader.read_exact(&mut buffer).unwrap();
+        assert_eq!(&buffer[..], &expected[4000..9000]);
+
+        assert_eq!(reader.read(&mut buffer).unwrap(), 1000);
+        assert_eq!(&buffer[..1000], &expected[9000..]);
+        assert!(reader.read_exact(&mut buffer[..1]).is_err());
+    }
+}
@@ -1,8 +1,12 @@
-mod compression;
+mod chunk_cache;
 mod hash_map;
+mod mmap;
 
+pub mod compression;
+pub mod fields;
 pub mod file;
 pub mod page_cache;
+pub mod wal;
 pub mod writer;
 
 const MAX_NUM_ENTRIES: usize = 62500;
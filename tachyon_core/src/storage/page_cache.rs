@@ -1,13 +1,15 @@
+use super::chunk_cache::ChunkCache;
 use super::hash_map::IDLookup;
+use super::mmap::{AnonymousMmap, Mmap, MmapRead};
 use rustc_hash::FxHashMap;
-use std::cell::RefCell;
-use std::collections::HashMap;
+use std::collections::{BTreeMap, HashMap, HashSet, VecDeque};
 use std::fs::File;
 use std::hash::{BuildHasherDefault, Hasher};
 use std::io::{self, Read};
 use std::os::unix::fs::FileExt;
 use std::path::PathBuf;
-use std::rc::Rc;
+use std::sync::atomic::{AtomicBool, Ordering};
+use std::sync::{Arc, Mutex, RwLock};
 
 pub type FileId = u32;
 
@@ -15,18 +17,115 @@ type PageId = u32;
 type FrameId = usize;
 
 const FILE_SIZE: usize = 1_000_000;
-const PAGE_SIZE: usize = 4_096;
+pub const PAGE_SIZE: usize = 4_096;
 
+const NIL: FrameId = FrameId::MAX;
+
+/// File id of the frames whose page was invalidated
+const INVALID_FILE_ID: FileId = FileId::MAX;
+
+/// Smallest number of frames per shard, so that small caches keep a single 2Q instance
+const MIN_FRAMES_PER_SHARD: usize = 64;
+const MAX_NUM_SHARDS: usize = 16;
+
+/// Number of file mappings kept for reuse, well below the kernel's default limit of mappings
+const MAX_MMAPS: usize = 1024;
+
+/// Page held by a frame
+#[derive(Clone, Copy)]
 struct PageInfo {
     file_id: FileId,
     page_id: PageId,
-    data: [u8; PAGE_SIZE],
 }
 
-#[allow(clippy::large_enum_variant)]
-enum Frame {
-    Empty,
-    Page(PageInfo),
+/// How the pages of a read are expected to be used
+#[derive(Clone, Copy, PartialEq, Eq, Debug)]
+pub enum ReadMode {
+    Normal,
+    /// Pages are read once in a large sequential read. They never displace frequently used
+    /// pages and are not remembered once evicted.
+    Scan,
+}
+
+/// Counters of page cache accesses
+#[derive(Clone, Copy, Debug, Default, PartialEq, Eq)]
+pub struct PageCacheStats {
+    pub hits: u64,
+    pub misses: u64,
+    pub evictions: u64,
+}
+
+/// Queue of the 2Q replacement policy holding a frame
+#[derive(Clone, Copy, PartialEq, Eq)]
+enum Queue {
+    None,
+    /// FIFO of pages referenced once recently
+    A1In,
+    /// LRU of pages referenced again after being evicted from A1In
+    Am,
+}
+
+#[derive(Clone, Copy)]
+struct FrameLinks {
+    prev: FrameId,
+    next: FrameId,
+    queue: Queue,
+    mode: ReadMode,
+}
+
+/// Doubly linked list of frames, threaded through `FrameLinks`
+struct FrameList {
+    head: FrameId,
+    tail: FrameId,
+    len: usize,
+}
+
+impl FrameList {
+    fn new() -> Self {
+        Self {
+            head: NIL,
+            tail: NIL,
+            len: 0,
+        }
+    }
+
+    fn push_back(&mut self, links: &mut [FrameLinks], frame_id: FrameId) {
+        links[frame_id].prev = self.tail;
+        links[frame_id].next = NIL;
+        if self.tail == NIL {
+            self.head = frame_id;
+        } else {
+            links[self.tail].next = frame_id;
+        }
+        self.tail = frame_id;
+        self.len += 1;
+    }
+
+    fn remove(&mut self, links: &mut [FrameLinks], frame_id: FrameId) {
+        let FrameLinks { prev, next, .. } = links[frame_id];
+        if prev == NIL {
+            self.head = next;
+        } else {
+            links[prev].next = next;
+        }
+        if next == NIL {
+            self.tail = prev;
+        } else {
+            links[next].prev = prev;
+        }
+        self.len -= 1;
+    }
+
+    fn pop_front(&mut self, links: &mut [FrameLinks]) -> FrameId {
+        let frame_id = self.head;
+        self.remove(links, frame_id);
+        frame_id
+    }
+}
+
+#[inline]
+fn page_key(file_id: FileId, page_id: PageId) -> u64 {
+    ((file_id as u64) << 32) | (page_id as u64)
 }
 
 #[derive(Clone, Copy, Default)]
@@ -52,43 +151,40 @@ impl Hasher for FastNoHash {
 }
 
 pub struct SeqPageRead {
-    page_cache: Rc<RefCell<PageCache>>,
+    page_cache: Arc<PageCache>,
     file_id: FileId,
     cur_page_id: PageId,
     frame_id: FrameId,
     offset: usize,
+    mode: ReadMode,
 }
 
 impl Read for SeqPageRead {
     fn read(&mut self, buf: &mut [u8]) -> io::Result<usize> {
-        let mut page_cache = self.page_cache.borrow_mut();
-
         let mut bytes_copied = 0;
         while bytes_copied < buf.len() {
+            let mut shard = self.page_cache.lock_shard(self.file_id, self.cur_page_id);
+
             // Make sure correct page is in the frame (not evicted)
-            if let Frame::Page(PageInfo {
-                file_id, page_id, ..
-            }) = &page_cache.frames[self.frame_id]
-            {
-                if self.file_id != *file_id || self.cur_page_id != *page_id {
-                    self.frame_id = page_cache.load_page(self.file_id, self.cur_page_id);
-                }
-            } else {
-                self.frame_id = page_cache.load_page(self.file_id, self.cur_page_id);
+            if !shard.holds_page(self.frame_id, self.file_id, self.cur_page_id) {
+                self.frame_id = self.page_cache.load_page(
+                    &mut shard,
+                    self.file_id,
+                    self.cur_page_id,
+                    self.mode,
+                );
             }
 
-            if let Frame::Page(PageInfo { data, .. }) = &page_cache.frames[self.frame_id] {
-                let num_bytes =
-                    (PAGE_SIZE - (self.offset % PAGE_SIZE)).min(buf.len() - bytes_copied);
-                let data_to_copy =
-                    &data[(self.offset % PAGE_SIZE)..(self.offset % PAGE_SIZE) + num_bytes];
-                self.offset += num_bytes;
-                buf[bytes_copied..bytes_copied + num_bytes].copy_from_slice(data_to_copy);
-                bytes_copied += num_bytes;
-
-                if self.offset % PAGE_SIZE == 0 {
-                    self.cur_page_id += 1;
-                }
+            let data = shard.frame(self.frame_id);
+            let num_bytes = (PAGE_SIZE - (self.offset % PAGE_SIZE)).min(buf.len() - bytes_copied);
+            let data_to_copy =
+                &data[(self.offset % PAGE_SIZE)..(self.offset % PAGE_SIZE) + num_bytes];
+            self.offset += num_bytes;
+            buf[bytes_copied..bytes_copied + num_bytes].copy_from_slice(data_to_copy);
+            bytes_copied += num_bytes;
+
+            if self.offset % PAGE_SIZE == 0 {
+                self.cur_page_id += 1;
             }
         }
 
@@ -96,124 +192,478 @@ impl Read for SeqPageRead {
     }
 }
 
-pub struct PageCache {
-    frames: Vec<Frame>,
+/// Sequential reader over a file, either through page cache frames or through a mapping of
+/// the whole file
+pub enum FileRead {
+    Page(SeqPageRead),
+    Mmap(MmapRead),
+}
+
+impl Read for FileRead {
+    fn read(&mut self, buf: &mut [u8]) -> io::Result<usize> {
+        match self {
+            Self::Page(reader) => reader.read(buf),
+            Self::Mmap(reader) => reader.read(buf),
+        }
+    }
+
+    fn read_exact(&mut self, buf: &mut [u8]) -> io::Result<()> {
+        match self {
+            Self::Page(reader) => reader.read_exact(buf),
+            Self::Mmap(reader) => reader.read_exact(buf),
+        }
+    }
+}
+
+/// Part of the page cache with its own frames and 2Q replacement: pages enter a small FIFO
+/// (A1In) and are only admitted to the main LRU (Am) if they are referenced again shortly after
+/// being evicted, which is tracked by a queue of evicted page keys (A1Out). A single large scan
+/// therefore only cycles through A1In and cannot evict the frequently used pages in Am.
+struct PageCacheShard {
+    /// Page-aligned frames of max_frames pages. Frames are handed out in order, and the memory
+    /// of a frame is only committed once it is first used.
+    arena: AnonymousMmap,
+    pages: Vec<PageInfo>,
+    max_frames: usize,
+
+    links: Vec<FrameLinks>,
+    a1_in: FrameList,
+    am: FrameList,
+    a1_in_target: usize,
+
+    a1_out: VecDeque<(u64, u64)>,
+    a1_out_lookup: FxHashMap<u64, u64>,
+    a1_out_capacity: usize,
+    a1_out_seq: u64,
+
+    stats: PageCacheStats,
 
     mapping: IDLookup<FrameId>,
-    open_files: HashMap<FileId, File, BuildHasherDefault<FastNoHash>>,
+}
+
+impl PageCacheShard {
+    fn new(num_frames: usize) -> Self {
+        Self {
+            arena: AnonymousMmap::new(num_frames * PAGE_SIZE).unwrap(),
+            pages: Vec::new(),
+            max_frames: num_frames,
+            links: Vec::new(),
+            a1_in: FrameList::new(),
+            am: FrameList::new(),
+            a1_in_target: (num_frames / 4).max(1),
+            a1_out: VecDeque::new(),
+            a1_out_lookup: FxHashMap::default(),
+            a1_out_capacity: (num_frames / 2).max(1),
+            a1_out_seq: 0,
+            stats: PageCacheStats::default(),
+            mapping: IDLookup::new(),
+        }
+    }
+
+    fn holds_page(&self, frame_id: FrameId, file_id: FileId, page_id: PageId) -> bool {
+        self.pages
+            .get(frame_id)
+            .is_some_and(|info| info.file_id == file_id && info.page_id == page_id)
+    }
+
+    fn frame(&self, frame_id: FrameId) -> &[u8] {
+        &self.arena.as_slice()[frame_id * PAGE_SIZE..(frame_id + 1) * PAGE_SIZE]
+    }
+
+    /// Finds a frame for a new page, allocating a frame while under budget and evicting a page
+    /// otherwise
+    fn allocate_frame(&mut self) -> FrameId {
+        if self.pages.len() < self.max_frames {
+            self.pages.push(PageInfo {
+                file_id: 0,
+                page_id: 0,
+            });
+            self.links.push(FrameLinks {
+                prev: NIL,
+                next: NIL,
+                queue: Queue::None,
+                mode: ReadMode::Normal,
+            });
+            return self.pages.len() - 1;
+        }
+
+        let frame_id = if self.a1_in.len > self.a1_in_target || self.am.len == 0 {
+            self.a1_in.pop_front(&mut self.links)
+        } else {
+            self.am.pop_front(&mut self.links)
+        };
+
+        let info = self.pages[frame_id];
+        let key = page_key(info.file_id, info.page_id);
+        self.mapping.remove(&key);
+
+        // Remember pages that were only referenced once so a second reference admits them to Am
+        let links = self.links[frame_id];
+        if links.queue == Queue::A1In && links.mode == ReadMode::Normal {
+            if self.a1_out.len() >= self.a1_out_capacity {
+                let (old_key, seq) = self.a1_out.pop_front().unwrap();
+                if self.a1_out_lookup.get(&old_key) == Some(&seq) {
+                    self.a1_out_lookup.remove(&old_key);
+                }
+            }
+            self.a1_out_seq += 1;
+            self.a1_out.push_back((key, self.a1_out_seq));
+            self.a1_out_lookup.insert(key, self.a1_out_seq);
+        }
+        self.links[frame_id].queue = Queue::None;
+        self.stats.evictions += 1;
+
+        frame_id
+    }
+
+    /// Drops the pages of a file from the mapping, so that they are read again. Their frames
+    /// are reused once they are evicted.
+    fn invalidate_file(&mut self, file_id: FileId) {
+        for (frame_id, info) in self.pages.iter_mut().enumerate() {
+            let key = page_key(info.file_id, info.page_id);
+            if info.file_id == file_id && self.mapping.get(&key) == Some(frame_id) {
+                self.mapping.remove(&key);
+                *info = PageInfo {
+                    file_id: INVALID_FILE_ID,
+                    page_id: 0,
+                };
+            }
+        }
+    }
+
+    /// Returns the frame holding the page if it is cached
+    fn get_page(&mut self, file_id: FileId, page_id: PageId, mode: ReadMode) -> Option<FrameId> {
+        let frame_id = self.mapping.get(&page_key(file_id, page_id))?;
+
+        self.stats.hits += 1;
+        if mode == ReadMode::Normal {
+            self.links[frame_id].mode = ReadMode::Normal;
+            if self.links[frame_id].queue == Queue::Am {
+                self.am.remove(&mut self.links, frame_id);
+                self.am.push_back(&mut self.links, frame_id);
+            }
+        }
+        Some(frame_id)
+    }
+
+    fn insert_page(
+        &mut self,
+        file: &File,
+        file_id: FileId,
+        page_id: PageId,
+        mode: ReadMode,
+    ) -> FrameId {
+        let key = page_key(file_id, page_id);
+        self.stats.misses += 1;
+
+        let frame_id = self.allocate_frame();
+
+        self.pages[frame_id] = PageInfo { file_id, page_id };
+
+        // Read straight into the frame, which reads as zeros past the end of the file
+        let data = &mut self.arena.as_mut_slice()[frame_id * PAGE_SIZE..(frame_id + 1) * PAGE_SIZE];
+        let page_offset = (PAGE_SIZE as u64) * (page_id as u64);
+        let mut num_read = 0;
+        while num_read < PAGE_SIZE {
+            match file
+                .read_at(&mut data[num_read..], page_offset + num_read as u64)
+                .unwrap()
+            {
+                0 => break,
+                num_bytes => num_read += num_bytes,
+            }
+        }
+        data[num_read..].fill(0);
+
+        let admit = mode == ReadMode::Normal && self.a1_out_lookup.remove(&key).is_some();
+        if admit {
+            self.links[frame_id].queue = Queue::Am;
+            self.am.push_back(&mut self.links, frame_id);
+        } else {
+            self.links[frame_id].queue = Queue::A1In;
+            self.a1_in.push_back(&mut self.links, frame_id);
+        }
+        self.links[frame_id].mode = mode;
+
+        self.mapping.insert(key, frame_id);
+
+        frame_id
+    }
+}
+
+/// LRU cache of the mappings of immutable files. Dropping a mapping from the cache only unmaps it
+/// once the readers still using it are done.
+struct MmapCache {
+    capacity: usize,
+
+    /// Mapping and the sequence number of its last use
+    mmaps: HashMap<FileId, (Arc<Mmap>, u64), BuildHasherDefault<FastNoHash>>,
+    /// Files by the sequence number of their mapping's last use, least recently used first
+    lru: BTreeMap<u64, FileId>,
+    seq: u64,
+}
+
+impl MmapCache {
+    fn new(capacity: usize) -> Self {
+        Self {
+            capacity,
+            mmaps: HashMap::default(),
+            lru: BTreeMap::new(),
+            seq: 0,
+        }
+    }
 
+    fn get(&mut self, file_id: FileId) -> Option<Arc<Mmap>> {
+        self.seq += 1;
+        let (mmap, last_use) = self.mmaps.get_mut(&file_id)?;
+        let mmap = mmap.clone();
+        let old_seq = std::mem::replace(last_use, self.seq);
+        self.lru.remove(&old_seq);
+        self.lru.insert(self.seq, file_id);
+        Some(mmap)
+    }
+
+    fn insert(&mut self, file_id: FileId, mmap: Arc<Mmap>) {
+        self.seq += 1;
+        if let Some((_, old_seq)) = self.mmaps.insert(file_id, (mmap, self.seq)) {
+            self.lru.remove(&old_seq);
+        }
+        self.lru.insert(self.seq, file_id);
+
+        while self.mmaps.len() > self.capacity {
+            let (_, evicted) = self.lru.pop_first().unwrap();
+            self.mmaps.remove(&evicted);
+        }
+    }
+
+    fn remove(&mut self, file_id: FileId) {
+        if let Some((_, seq)) = self.mmaps.remove(&file_id) {
+            self.lru.remove(&seq);
+        }
+    }
+
+    fn clear(&mut self) {
+        self.mmaps.clear();
+        self.lru.clear();
+    }
+}
+
+struct FileRegistry {
+    open_files: HashMap<FileId, Arc<File>, BuildHasherDefault<FastNoHash>>,
     file_path_to_id: FxHashMap<PathBuf, FileId>,
     file_id_to_path: HashMap<FileId, PathBuf, BuildHasherDefault<FastNoHash>>,
     cur_file_id: FileId,
+}
+
+/// Page cache that can be shared by connections and threads through an `Arc`.
+/// Pages are spread over independently locked shards by their file and page id.
+pub struct PageCache {
+    shards: Box<[Mutex<PageCacheShard>]>,
+    files: RwLock<FileRegistry>,
 
-    root_free: usize,
+    mmap_reads: AtomicBool,
+    mmaps: Mutex<MmapCache>,
+
+    /// Files whose pages were read while they could still be modified
+    mutable_files: Mutex<HashSet<FileId, BuildHasherDefault<FastNoHash>>>,
+
+    chunk_cache: ChunkCache,
 }
 
 impl PageCache {
+    /// Creates a page cache that holds up to `num_frames` pages.
+    /// Memory for the frames is only allocated once they are first used.
     pub fn new(num_frames: usize) -> Self {
-        let mut frames = Vec::with_capacity(num_frames);
-        for _ in 0..num_frames {
-            frames.push(Frame::Empty);
-        }
+        assert!(num_frames > 0);
+
+        let num_shards = (num_frames / MIN_FRAMES_PER_SHARD).clamp(1, MAX_NUM_SHARDS);
+        let shards = (0..num_shards)
+            .map(|i| {
+                let shard_frames =
+                    num_frames / num_shards + usize::from(i < num_frames % num_shards);
+                Mutex::new(PageCacheShard::new(shard_frames))
+            })
+            .collect();
 
         Self {
-            frames,
-            mapping: IDLookup::new_with_capacity(2 * num_frames),
-            open_files: HashMap::with_capacity_and_hasher(
-                2,
-                BuildHasherDefault::<FastNoHash>::default(),
-            ),
-            file_path_to_id: FxHashMap::default(),
-            file_id_to_path: HashMap::with_capacity_and_hasher(
-                2,
-                BuildHasherDefault::<FastNoHash>::default(),
-            ),
-            cur_file_id: 0,
-            root_free: 0,
-        }
-    }
-
-    pub fn register_or_get_file_id(&mut self, path: &PathBuf) -> FileId {
-        if let Some(id) = self.file_path_to_id.get(path) {
+            shards,
+            files: RwLock::new(FileRegistry {
+                open_files: HashMap::with_capacity_and_hasher(
+                    2,
+                    BuildHasherDefault::<FastNoHash>::default(),
+                ),
+                file_path_to_id: FxHashMap::default(),
+                file_id_to_path: HashMap::with_capacity_and_hasher(
+                    2,
+                    BuildHasherDefault::<FastNoHash>::default(),
+                ),
+                cur_file_id: 0,
+            }),
+            mmap_reads: AtomicBool::new(true),
+            mmaps: Mutex::new(MmapCache::new(MAX_MMAPS)),
+            mutable_files: Mutex::new(HashSet::default()),
+            chunk_cache: ChunkCache::new(0),
+        }
+    }
+
+    pub fn register_or_get_file_id(&self, path: &PathBuf) -> FileId {
+        if let Some(id) = self.files.read().unwrap().file_path_to_id.get(path) {
             return *id;
         }
 
-        self.file_path_to_id.insert(path.clone(), self.cur_file_id);
-        self.file_id_to_path.insert(self.cur_file_id, path.clone());
-        self.cur_file_id += 1;
+        let mut files = self.files.write().unwrap();
+        if let Some(id) = files.file_path_to_id.get(path) {
+            return *id;
+        }
 
-        self.cur_file_id - 1
+        let file_id = files.cur_file_id;
+        files.file_path_to_id.insert(path.clone(), file_id);
+        files.file_id_to_path.insert(file_id, path.clone());
+        files.cur_file_id += 1;
+
+        file_id
     }
 
-    fn load_page(&mut self, file_id: FileId, page_id: PageId) -> FrameId {
-        let frame_id;
-        // 1st - check that page_id is loaded in memory
-        if let Some(frame) = self
-            .mapping
-            .get(&(((file_id as u64) << 32) | (page_id as u64)))
-        {
-            frame_id = frame;
-        } else {
-            // Check that file is open
-            if let std::collections::hash_map::Entry::Vacant(e) = self.open_files.entry(file_id) {
-                let path = self.file_id_to_path.get(&file_id).unwrap();
-                e.insert(File::open(path).unwrap());
-            }
+    fn open_file(&self, file_id: FileId) -> Arc<File> {
+        if let Some(file) = self.files.read().unwrap().open_files.get(&file_id) {
+            return file.clone();
+        }
+
+        let mut files = self.files.write().unwrap();
+        if let Some(file) = files.open_files.get(&file_id) {
+            return file.clone();
+        }
 
-            // Find next available frame
-            // TODO: Change eviction scheme
-            frame_id = self.root_free;
-            self.root_free = (self.root_free + 1) % self.frames.len();
+        let path = files.file_id_to_path.get(&file_id).unwrap();
+        let file = Arc::new(File::open(path).unwrap());
+        files.open_files.insert(file_id, file.clone());
+        file
+    }
 
-            // If there was a page there, remove it from mapping
-            if let Frame::Page(info) = &self.frames[frame_id] {
-                // evict
-                self.mapping
-                    .remove(&(((info.file_id as u64) << 32) | (info.page_id as u64)));
+    /// Drops the cached pages of a file before it is read if they may be outdated, which is
+    /// when the file may still be modified, or when it is immutable now but was read before
+    /// it was
+    pub fn refresh_file(&self, file_id: FileId, is_immutable: bool) {
+        let was_mutable = {
+            let mut mutable_files = self.mutable_files.lock().unwrap();
+            if is_immutable {
+                mutable_files.remove(&file_id)
+            } else {
+                mutable_files.insert(file_id);
+                true
             }
+        };
 
-            let mut new_page_info = PageInfo {
-                file_id,
-                page_id,
-                data: [0; PAGE_SIZE],
-            };
+        if was_mutable {
+            for shard in self.shards.iter() {
+                shard.lock().unwrap().invalidate_file(file_id);
+            }
+            self.mmaps.lock().unwrap().remove(file_id);
+        }
+    }
 
-            self.open_files
-                .get_mut(&file_id)
-                .unwrap()
-                .read_at(
-                    &mut new_page_info.data,
-                    ((PAGE_SIZE as PageId) * page_id) as u64,
-                )
-                .unwrap();
+    /// Sets whether immutable files are read through a mapping instead of page cache frames
+    pub fn set_mmap_reads(&self, enabled: bool) {
+        self.mmap_reads.store(enabled, Ordering::Relaxed);
+        if !enabled {
+            self.mmaps.lock().unwrap().clear();
+        }
+    }
+
+    /// Sets the memory budget for decoded blocks of immutable files, 0 to disable caching them
+    pub fn set_chunk_cache_bytes(&self, capacity_bytes: usize) {
+        self.chunk_cache.set_capacity(capacity_bytes);
+    }
+
+    pub fn chunk_cache(&self) -> &ChunkCache {
+        &self.chunk_cache
+    }
 
-            self.mapping
-                .insert(((file_id as u64) << 32) | (page_id as u64), frame_id);
-            self.frames[frame_id] = Frame::Page(new_page_info);
+    /// Returns a mapping of the file, or None if mapped reads are disabled or the file cannot
+    /// be mapped.
+    /// Precondition: The file is never modified again
+    fn mmap(&self, file_id: FileId) -> Option<Arc<Mmap>> {
+        if !self.mmap_reads.load(Ordering::Relaxed) {
+            return None;
         }
 
-        frame_id
+        let mut mmaps = self.mmaps.lock().unwrap();
+        if let Some(mmap) = mmaps.get(file_id) {
+            return Some(mmap);
+        }
+
+        let mmap = Arc::new(Mmap::map(&self.open_file(file_id)).ok()?);
+        mmaps.insert(file_id, mmap.clone());
+        Some(mmap)
+    }
+
+    pub fn stats(&self) -> PageCacheStats {
+        self.shards
+            .iter()
+            .map(|shard| shard.lock().unwrap().stats)
+            .fold(PageCacheStats::default(), |total, stats| PageCacheStats {
+                hits: total.hits + stats.hits,
+                misses: total.misses + stats.misses,
+                evictions: total.evictions + stats.evictions,
+            })
     }
 
-    pub fn read(&mut self, file_id: FileId, mut offset: usize, buffer: &mut [u8]) -> usize {
+    pub fn reset_stats(&self) {
+        for shard in self.shards.iter() {
+            shard.lock().unwrap().stats = PageCacheStats::default();
+        }
+    }
+
+    /// Maximum number of pages held by the cache
+    pub fn capacity(&self) -> usize {
+        self.shards
+            .iter()
+            .map(|shard| shard.lock().unwrap().max_frames)
+            .sum()
+    }
+
+    fn lock_shard(
+        &self,
+        file_id: FileId,
+        page_id: PageId,
+    ) -> std::sync::MutexGuard<'_, PageCacheShard> {
+        // Fibonacci hashing, so that consecutive pages of a file land on different shards
+        let hash = page_key(file_id, page_id).wrapping_mul(0x9E37_79B9_7F4A_7C15);
+        let shard_id = ((hash >> 32) as usize) % self.shards.len();
+        self.shards[shard_id].lock().unwrap()
+    }
+
+    /// Precondition: `shard` is the locked shard of the page
+    fn load_page(
+        &self,
+        shard: &mut PageCacheShard,
+        file_id: FileId,
+        page_id: PageId,
+        mode: ReadMode,
+    ) -> FrameId {
+        match shard.get_page(file_id, page_id, mode) {
+            Some(frame_id) => frame_id,
+            None => shard.insert_page(&self.open_file(file_id), file_id, page_id, mode),
+        }
+    }
+
+    pub fn read(&self, file_id: FileId, mut offset: usize, buffer: &mut [u8]) -> usize {
         let last_offset = offset + buffer.len();
         let first_page_id = (offset / PAGE_SIZE) as PageId;
         let last_page_id = (last_offset / PAGE_SIZE) as PageId;
         let mut bytes_copied = 0;
 
         for page_id in first_page_id..=last_page_id {
-            let frame_id = self.load_page(file_id, page_id);
+            let mut shard = self.lock_shard(file_id, page_id);
+            let frame_id = self.load_page(&mut shard, file_id, page_id, ReadMode::Normal);
 
             // Page is now guaranteed to be loaded
-            if let Frame::Page(PageInfo { data, .. }) = &self.frames[frame_id] {
-                let num_bytes = (PAGE_SIZE - (offset % PAGE_SIZE)).min(buffer.len() - bytes_copied);
-                let data_to_copy = &data[(offset % PAGE_SIZE)..(offset % PAGE_SIZE) + num_bytes];
-                offset += num_bytes;
-                buffer[bytes_copied..bytes_copied + num_bytes].copy_from_slice(data_to_copy);
-                bytes_copied += num_bytes;
-            } else {
-                panic!("Expected page to be loaded!");
-            }
+            let data = shard.frame(frame_id);
+            let num_bytes = (PAGE_SIZE - (offset % PAGE_SIZE)).min(buffer.len() - bytes_copied);
+            let data_to_copy = &data[(offset % PAGE_SIZE)..(offset % PAGE_SIZE) + num_bytes];
+            offset += num_bytes;
+            buffer[bytes_copied..bytes_copied + num_bytes].copy_from_slice(data_to_copy);
+            bytes_copied += num_bytes;
         }
 
         bytes_copied
@@ -221,12 +671,16 @@ impl PageCache {
 }
 
 pub fn page_cache_sequential_read(
-    page_cache: Rc<RefCell<PageCache>>,
+    page_cache: Arc<PageCache>,
     file_id: FileId,
     start_offset: usize,
+    mode: ReadMode,
 ) -> SeqPageRead {
     let page_id = (start_offset / PAGE_SIZE) as PageId;
-    let frame_id = page_cache.borrow_mut().load_page(file_id, page_id);
+    let frame_id = {
+        let mut shard = page_cache.lock_shard(file_id, page_id);
+        page_cache.load_page(&mut shard, file_id, page_id, mode)
+    };
 
     SeqPageRead {
         file_id,
@@ -234,26 +688,46 @@ pub fn page_cache_sequential_read(
         frame_id,
         page_cache,
         offset: start_offset,
+        mode,
+    }
+}
+
+/// Reads an immutable file from `start_offset` through a mapping if possible, and through the
+/// page cache otherwise
+pub fn immutable_file_read(
+    page_cache: Arc<PageCache>,
+    file_id: FileId,
+    start_offset: usize,
+    mode: ReadMode,
+) -> FileRead {
+    match page_cache.mmap(file_id) {
+        Some(mmap) => FileRead::Mmap(MmapRead::new(mmap, start_offset)),
+        None => FileRead::Page(page_cache_sequential_read(
+            page_cache,
+            file_id,
+            start_offset,
+            mode,
+        )),
     }
 }
 
 #[cfg(test)]
 mod tests {
-    use super::{page_cache_sequential_read, PageCache};
+    use super::{page_cache_sequential_read, PageCache, PageCacheStats, ReadMode, PAGE_SIZE};
     use crate::storage::file::TimeDataFile;
     use crate::utils::test::*;
-    use crate::{StreamId, Timestamp, ValueType, Version};
-    use std::cell::RefCell;
+    use crate::{StreamId, Timestamp, ValueType, CURRENT_VERSION};
     use std::fs::File;
     use std::io::{Read, Write};
-    use std::rc::Rc;
+    use std::sync::Arc;
+    use std::thread;
 
     #[test]
     fn test_read_whole_file() {
         set_up_files!(file_paths, "test.ty", "expected.ty");
 
-        let mut page_cache = PageCache::new(10);
-        let mut model = TimeDataFile::new(Version(0), StreamId(0), ValueType::UInteger64);
+        let page_cache = PageCache::new(10);
+        let mut model = TimeDataFile::new(CURRENT_VERSION, StreamId(0), ValueType::UInteger64);
         for i in 0..100000u64 {
             model.write_data_to_file_in_mem(i, (i + 10).into());
         }
@@ -281,8 +755,8 @@ mod tests {
     fn test_read_sequential_whole_file() {
         set_up_files!(file_paths, "test.ty", "expected.ty");
 
-        let mut page_cache = PageCache::new(10);
-        let mut model = TimeDataFile::new(Version(0), StreamId(0), ValueType::UInteger64);
+        let page_cache = PageCache::new(10);
+        let mut model = TimeDataFile::new(CURRENT_VERSION, StreamId(0), ValueType::UInteger64);
         for i in 0..100000u64 {
             model.write_data_to_file_in_mem(i, (i + 10).into());
         }
@@ -292,7 +766,7 @@ mod tests {
         assert_eq!(file_id, 0);
 
         let mut seq_read =
-            page_cache_sequential_read(Rc::new(RefCell::new(page_cache)), file_id, 0);
+            page_cache_sequential_read(Arc::new(page_cache), file_id, 0, ReadMode::Normal);
 
         let mut buffer = vec![0; file_size];
         let mut bytes_read = 0;
@@ -315,4 +789,200 @@ mod tests {
             assert!(data_file.values[i].eq_same(ValueType::UInteger64, &((i + 10) as u64).into()));
         }
     }
+
+    #[test]
+    fn test_scan_resistant_eviction() {
+        set_up_files!(file_paths, "test.ty");
+
+        let data: Vec<u8> = (0..64 * PAGE_SIZE).map(|i| (i / PAGE_SIZE) as u8).collect();
+        File::create(&file_paths[0])
+            .unwrap()
+            .write_all(&data)
+            .unwrap();
+
+        let page_cache = Arc::new(PageCache::new(8));
+        let file_id = page_cache.register_or_get_file_id(&file_paths[0]);
+        let mut buffer = [0u8; 1];
+        let mut read_page = |page_cache: &PageCache, page_id: usize| {
+            page_cache.read(file_id, page_id * PAGE_SIZE, &mut buffer);
+            assert_eq!(buffer[0], page_id as u8);
+        };
+
+        // Pages 0 and 1 are referenced again after being evicted, which makes them hot
+        for page_id in [0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 0, 1] {
+            read_page(&page_cache, page_id);
+        }
+        assert_eq!(
+            page_cache.stats(),
+            PageCacheStats {
+                hits: 0,
+                misses: 12,
+                evictions: 4,
+            }
+        );
+
+        // A long sequential scan must not evict them
+        let mut seq_read =
+            page_cache_sequential_read(page_cache.clone(), file_id, 16 * PAGE_SIZE, ReadMode::Scan);
+        let mut scan_buffer = vec![0u8; 48 * PAGE_SIZE];
+        seq_read.read_exact(&mut scan_buffer).unwrap();
+        assert_eq!(&scan_buffer[..], &data[16 * PAGE_SIZE..]);
+
+        page_cache.reset_stats();
+        read_page(&page_cache, 0);
+        read_page(&page_cache, 1);
+        assert_eq!(page_cache.stats().hits, 2);
+        assert_eq!(page_cache.stats().misses, 0);
+    }
+
+    #[test]
+    fn test_shared_between_threads() {
+        set_up_files!(file_paths, "test.ty");
+
+        let data: Vec<u8> = (0..256 * PAGE_SIZE).map(|i| (i % 251) as u8).collect();
+        File::create(&file_paths[0])
+            .unwrap()
+            .write_all(&data)
+            .unwrap();
+
+        let page_cache = Arc::new(PageCache::new(128));
+        assert!(page_cache.shards.len() > 1);
+        assert_eq!(page_cache.capacity(), 128);
+
+        let threads: Vec<_> = (0..4)
+            .map(|i| {
+                let page_cache = page_cache.clone();
+                let path = file_paths[0].clone();
+                let data = data.clone();
+                thread::spawn(move || {
+                    let file_id = page_cache.register_or_get_file_id(&path);
+                    let start = i * 13 * PAGE_SIZE + 7;
+                    let mut seq_read = page_cache_sequential_read(
+                        page_cache.clone(),
+                        file_id,
+                        start,
+                        ReadMode::Normal,
+                    );
+                    let mut buffer = vec![0u8; data.len() - start];
+                    seq_read.read_exact(&mut buffer).unwrap();
+                    assert_eq!(&buffer[..], &data[start..]);
+                })
+            })
+            .collect();
+
+        for thread in threads {
+            thread.join().unwrap();
+        }
+
+        let stats = page_cache.stats();
+        assert!(stats.misses >= 256);
+        assert!(stats.evictions > 0);
+    }
+
+    #[test]
+    fn test_frames_reused_across_files() {
+        set_up_files!(file_paths, "full.ty", "short.ty");
+
+        File::create(&file_paths[0])
+            .unwrap()
+            .write_all(&[0xFF; 2 * PAGE_SIZE])
+            .unwrap();
+        File::create(&file_paths[1])
+            .unwrap()
+            .write_all(&[7; 10])
+            .unwrap();
+
+        let page_cache = PageCache::new(1);
+        let full_id = page_cache.register_or_get_file_id(&file_paths[0]);
+        let short_id = page_cache.register_or_get_file_id(&file_paths[1]);
+
+        let mut buffer = vec![0u8; PAGE_SIZE];
+        page_cache.read(full_id, PAGE_SIZE, &mut buffer[..PAGE_SIZE - 1]);
+        assert!(buffer[..PAGE_SIZE - 1].iter().all(|byte| *byte == 0xFF));
+
+        // The only frame is reused, and must not keep bytes of the evicted page past the end
+        page_cache.read(short_id, 0, &mut buffer[..PAGE_SIZE - 1]);
+        assert_eq!(&buffer[..10], &[7; 10]);
+        assert!(buffer[10..PAGE_SIZE - 1].iter().all(|byte| *byte == 0));
+
+        let shard = page_cache.shards[0].lock().unwrap();
+        assert_eq!(shard.frame(0).as_ptr() as usize % PAGE_SIZE, 0);
+    }
+
+    #[test]
+    fn test_refresh_file() {
+        set_up_files!(file_paths, "test.ty");
+        File::create(&file_paths[0])
+            .unwrap()
+            .write_all(&[1; PAGE_SIZE])
+            .unwrap();
+
+        let page_cache = PageCache::new(10);
+        let file_id = page_cache.register_or_get_file_id(&file_paths[0]);
+        let mut buffer = [0; 4];
+        page_cache.refresh_file(file_id, false);
+        page_cache.read(file_id, 0, &mut buffer);
+        assert_eq!(buffer, [1; 4]);
+
+        // Pages of a file that may be modified are read again
+        File::create(&file_paths[0])
+            .unwrap()
+            .write_all(&[2; PAGE_SIZE])
+            .unwrap();
+        page_cache.read(file_id, 0, &mut buffer);
+        assert_eq!(buffer, [1; 4]);
+        page_cache.refresh_file(file_id, false);
+        page_cache.read(file_id, 0, &mut buffer);
+        assert_eq!(buffer, [2; 4]);
+
+        // and once more when it has become immutable, but not after that
+        File::create(&file_paths[0])
+            .unwrap()
+            .write_all(&[3; PAGE_SIZE])
+            .unwrap();
+        page_cache.refresh_file(file_id, true);
+        page_cache.read(file_id, 0, &mut buffer);
+        assert_eq!(buffer, [3; 4]);
+        let misses = page_cache.stats().misses;
+        page_cache.refresh_file(file_id, true);
+        page_cache.read(file_id, 0, &mut buffer);
+        assert_eq!(page_cache.stats().misses, misses);
+    }
+
+    #[test]
+    fn test_mmap_eviction() {
+        set_up_files!(file_paths, "a.ty", "b.ty", "c.ty");
+        let page_cache = PageCache::new(10);
+        page_cache.mmaps.lock().unwrap().capacity = 2;
+
+        let file_ids: Vec<_> = file_paths
+            .iter()
+            .map(|path| {
+                File::create(path).unwrap().write_all(&[1; 10]).unwrap();
+                page_cache.register_or_get_file_id(path)
+            })
+            .collect();
+
+        let mmap = page_cache.mmap(file_ids[0]).unwrap();
+        page_cache.mmap(file_ids[1]).unwrap();
+        page_cache.mmap(file_ids[0]).unwrap();
+        page_cache.mmap(file_ids[2]).unwrap();
+
+        // The least recently used mapping is dropped, but stays valid while it is read
+        let mmaps = page_cache.mmaps.lock().unwrap();
+        assert_eq!(mmaps.mmaps.len(), 2);
+        assert!(mmaps.mmaps.contains_key(&file_ids[0]));
+        assert!(!mmaps.mmaps.contains_key(&file_ids[1]));
+        assert_eq!(mmap.as_slice(), &[1; 10]);
+        drop(mmaps);
+
+        // A file that may be modified again is mapped again
+        page_cache.refresh_file(file_ids[0], false);
+        assert!(!page_cache
+            .mmaps
+            .lock()
+            .unwrap()
+            .mmaps
+            .contains_key(&file_ids[0]));
+    }
 }
@@ -0,0 +1,556 @@
+/*
+    Write-ahead log of the entries written since the data files were last all sealed:
+
+    | stream id (u128 LE) | timestamp (u64 LE) | value (u64 LE) | value type (u8) | checksum (u32 LE) |
+
+    Records are buffered and appended in groups with a single write, and synced to disk
+    according to the sync policy, so that many inserts share the cost of one sync. The
+    checksum is the FNV-1a hash of the rest of the record, and reading stops at the first
+    record that does not match, which is the tail a crash left partially written.
+
+    An entry of a multi-field stream is a record per field value, in the order of the fields.
+    The value type of these records has FIELD_FLAG set, and MORE_FLAG on all but the last
+    one, so an entry whose last record is missing is dropped as part of the torn tail.
+
+    The log is emptied once every file holding its entries is sealed and synced. Under
+    continuous ingest it is compacted instead, once it has doubled since it was last
+    compacted: the records of entries whose files are sealed are dropped and the rest are
+    written to a new log that replaces it. A lock file next to the log is locked while it is
+    open, so only one writer at a time replays, appends to and empties it.
+*/
+
+use std::fs::{self, File, OpenOptions};
+use std::io::{self, Write};
+use std::os::fd::AsRawFd;
+use std::path::{Path, PathBuf};
+use std::time::{Duration, Instant};
+
+use uuid::Uuid;
+
+use super::fields::Field;
+use crate::{Timestamp, Value, ValueType};
+
+pub const WAL_FILE_NAME: &str = "wal.log";
+
+const RECORD_SIZE: usize = 16 + 8 + 8 + 1 + 4;
+
+/// Set in the value type of the records of a multi-field entry
+const FIELD_FLAG: u8 = 0x40;
+/// Set in the value type of the records of a multi-field entry that more records follow
+const MORE_FLAG: u8 = 0x80;
+
+/// Number of buffered bytes after which records are appended to the log
+const WAL_BUFFER_SIZE: usize = 64 * 1024;
+
+/// Smallest size of the log in bytes at which it is compacted
+const WAL_COMPACTION_SIZE: u64 = 64 * 1024 * 1024;
+
+/// When the entries appended to the write-ahead log are synced to disk
+#[derive(Clone, Copy, PartialEq, Eq, Debug, Default)]
+#[repr(C)]
+pub enum SyncPolicy {
+    /// Sync on every commit, such as `Inserter::commit`, so committed entries survive a crash.
+    /// Entries that are not committed are only appended and synced once 64 KiB of them are
+    /// buffered, so a crash can lose them.
+    #[default]
+    PerBatch,
+    /// Sync on the first append or commit after the interval has passed, and when the log is
+    /// closed. There is no timer, so the entries written before the writer goes idle are synced
+    /// on its next write or when it is closed.
+    Interval,
+    /// Leave syncing to the operating system, which only survives process crashes
+    None,
+}
+
+pub enum WalRecord {
+    /// Entry of a single-value stream
+    Entry {
+        stream_id: Uuid,
+        timestamp: Timestamp,
+        value: Value,
+        value_type: ValueType,
+    },
+    /// Entry of a multi-field stream, with a value for every field in order
+    Fields {
+        stream_id: Uuid,
+        timestamp: Timestamp,
+        values: Vec<Value>,
+    },
+}
+
+impl WalRecord {
+    pub fn stream_id(&self) -> Uuid {
+        match self {
+            Self::Entry { stream_id, .. } | Self::Fields { stream_id, .. } => *stream_id,
+        }
+    }
+
+    pub fn timestamp(&self) -> Timestamp {
+        match self {
+            Self::Entry { timestamp, .. } | Self::Fields { timestamp, .. } => *timestamp,
+        }
+    }
+}
+
+pub struct Wal {
+    file: File,
+    path: PathBuf,
+    /// Holds the lock of the log, which stays with the lock file when the log is replaced
+    _lock: File,
+    buffer: Vec<u8>,
+
+    sync_policy: SyncPolicy,
+    sync_interval: Duration,
+    last_sync: Instant,
+    /// Whether records were appended since the last sync
+    is_dirty: bool,
+
+    /// Number of bytes in the log
+    len: u64,
+    /// Size of the log at which it is compacted next
+    compaction_len: u64,
+    compaction_size: u64,
+}
+
+impl Wal {
+    /// Opens the log and locks it, failing if another writer holds it
+    pub fn open(path: impl AsRef<Path>) -> Result<Self, io::Error> {
+        let lock = OpenOptions::new()
+            .create(true)
+            .truncate(false)
+            .write(true)
+            .open(path.as_ref().with_extension("lock"))?;
+        // SAFETY: The descriptor is valid for the lifetime of lock, which releases the lock
+        // when it is closed
+        if unsafe { libc::flock(lock.as_raw_fd(), libc::LOCK_EX | libc::LOCK_NB) } != 0 {
+            return Err(io::Error::last_os_error());
+        }
+
+        // A log a compaction did not finish writing was never used
+        let _ = fs::remove_file(Self::compaction_path(path.as_ref()));
+
+        let file = OpenOptions::new()
+            .create(true)
+            .append(true)
+            .open(path.as_ref())?;
+        let len = file.metadata()?.len();
+
+        Ok(Self {
+            file,
+            path: path.as_ref().to_path_buf(),
+            _lock: lock,
+            buffer: Vec::with_capacity(WAL_BUFFER_SIZE + RECORD_SIZE),
+
+            sync_policy: SyncPolicy::default(),
+            sync_interval: Duration::ZERO,
+            last_sync: Instant::now(),
+            is_dirty: false,
+
+            len,
+            compaction_len: WAL_COMPACTION_SIZE.max(2 * len),
+            compaction_size: WAL_COMPACTION_SIZE,
+        })
+    }
+
+    fn compaction_path(path: &Path) -> PathBuf {
+        path.with_extension("compact")
+    }
+
+    /// Sets when appended records are synced, `interval` is only used by `SyncPolicy::Interval`
+    pub fn set_sync_policy(&mut self, sync_policy: SyncPolicy, interval: Duration) {
+        self.sync_policy = sync_policy;
+        self.sync_interval = interval;
+    }
+
+    fn checksum(bytes: &[u8]) -> u32 {
+        bytes.iter().fold(0x811c9dc5, |hash, byte| {
+            (hash ^ *byte as u32).wrapping_mul(0x01000193)
+        })
+    }
+
+    fn push_record(&mut self, stream_id: Uuid, timestamp: Timestamp, value: Value, value_type: u8) {
+        let start = self.buffer.len();
+        self.buffer
+            .extend_from_slice(&stream_id.as_u128().to_le_bytes());
+        self.buffer.extend_from_slice(&timestamp.to_le_bytes());
+        self.buffer
+            .extend_from_slice(&value.get_uinteger64().to_le_bytes());
+        self.buffer.push(value_type);
+        let checksum = Self::checksum(&self.buffer[start..]);
+        self.buffer.extend_from_slice(&checksum.to_le_bytes());
+    }
+
+    /// Commits the buffered records once there are enough of them or, with
+    /// `SyncPolicy::Interval`, once the interval has passed
+    fn commit_if_due(&mut self) -> Result<(), io::Error> {
+        if self.buffer.len() >= WAL_BUFFER_SIZE
+            || (self.sync_policy == SyncPolicy::Interval
+                && self.last_sync.elapsed() >= self.sync_interval)
+        {
+            self.commit()?;
+        }
+        Ok(())
+    }
+
+    /// Buffers a record, committing the buffered records once there are enough of them or,
+    /// with `SyncPolicy::Interval`, once the interval has passed
+    pub fn append(
+        &mut self,
+        stream_id: Uuid,
+        timestamp: Timestamp,
+        value: Value,
+        value_type: ValueType,
+    ) -> Result<(), io::Error> {
+        self.push_record(stream_id, timestamp, value, value_type as u8);
+        self.commit_if_due()
+    }
+
+    /// Buffers the records of an entry of a multi-field stream, like `append`.
+    /// Precondition: `values` has a value for every field, in order
+    pub fn append_fields(
+        &mut self,
+        stream_id: Uuid,
+        timestamp: Timestamp,
+        values: &[Value],
+        fields: &[Field],
+    ) -> Result<(), io::Error> {
+        for (i, (value, field)) in values.iter().zip(fields).enumerate() {
+            let more = if i + 1 < values.len() { MORE_FLAG } else { 0 };
+            self.push_record(
+                stream_id,
+                timestamp,
+                *value,
+                field.value_type as u8 | FIELD_FLAG | more,
+            );
+        }
+        self.commit_if_due()
+    }
+
+    /// Appends the buffered records with a single write and syncs them as the policy requires
+    pub fn commit(&mut self) -> Result<(), io::Error> {
+        if !self.buffer.is_empty() {
+            self.file.write_all(&self.buffer)?;
+            self.len += self.buffer.len() as u64;
+            self.buffer.clear();
+            self.is_dirty = true;
+        }
+
+        let is_due = match self.sync_policy {
+            SyncPolicy::PerBatch => true,
+            SyncPolicy::Interval => self.last_sync.elapsed() >= self.sync_interval,
+            SyncPolicy::None => false,
+        };
+        if is_due {
+            self.sync()?;
+        }
+        Ok(())
+    }
+
+    /// Syncs the records appended since the last sync
+    fn sync(&mut self) -> Result<(), io::Error> {
+        if self.is_dirty {
+            self.file.sync_data()?;
+            self.last_sync = Instant::now();
+            self.is_dirty = false;
+        }
+        Ok(())
+    }
+
+    /// Parses the records of `bytes` with the offset each one ends at, up to the first one
+    /// that is incomplete or corrupted
+    fn parse_records(bytes: &[u8]) -> Vec<(WalRecord, usize)> {
+        let mut records = Vec::with_capacity(bytes.len() / RECORD_SIZE);
+        let mut field_values = Vec::new();
+        for (i, record) in bytes.chunks_exact(RECORD_SIZE).enumerate() {
+            let checksum = u32::from_le_bytes(record[RECORD_SIZE - 4..].try_into().unwrap());
+            let flags = record[32] & (FIELD_FLAG | MORE_FLAG);
+            let Ok(value_type) = ValueType::try_from(record[32] & !flags) else {
+                break;
+            };
+            if checksum != Self::checksum(&record[..RECORD_SIZE - 4]) {
+                break;
+            }
+
+            let stream_id = Uuid::from_u128(u128::from_le_bytes(record[..16].try_into().unwrap()));
+            let timestamp = u64::from_le_bytes(record[16..24].try_into().unwrap());
+            let value = u64::from_le_bytes(record[24..32].try_into().unwrap()).into();
+            let end = (i + 1) * RECORD_SIZE;
+
+            if flags & FIELD_FLAG == 0 {
+                // Records of an entry are appended together, so they are never interleaved
+                if !field_values.is_empty() {
+                    break;
+                }
+                records.push((
+                    WalRecord::Entry {
+                        stream_id,
+                        timestamp,
+                        value,
+                        value_type,
+                    },
+                    end,
+                ));
+            } else {
+                field_values.push(value);
+                if flags & MORE_FLAG == 0 {
+                    records.push((
+                        WalRecord::Fields {
+                            stream_id,
+                            timestamp,
+                            values: std::mem::take(&mut field_values),
+                        },
+                        end,
+                    ));
+                }
+            }
+        }
+
+        records
+    }
+
+    /// Reads the records of the log up to the first one that is incomplete or corrupted
+    pub fn read_records(&self) -> Result<Vec<WalRecord>, io::Error> {
+        let bytes = fs::read(&self.path)?;
+        Ok(Self::parse_records(&bytes)
+            .into_iter()
+            .map(|(record, _)| record)
+            .collect())
+    }
+
+    fn sync_sealed_files(&self, sealed_files: &[PathBuf]) -> Result<(), io::Error> {
+        if self.sync_policy != SyncPolicy::None {
+            for path in sealed_files {
+                File::open(path)?.sync_all()?;
+            }
+        }
+        Ok(())
+    }
+
+    /// Empties the log once the files holding its entries are sealed, syncing them first
+    /// unless the policy leaves syncing to the operating system
+    pub fn checkpoint(&mut self, sealed_files: &[PathBuf]) -> Result<(), io::Error> {
+        self.buffer.clear();
+        if self.len == 0 {
+            return Ok(());
+        }
+
+        self.sync_sealed_files(sealed_files)?;
+        self.file.set_len(0)?;
+        if self.sync_policy != SyncPolicy::None {
+            self.file.sync_all()?;
+        }
+        self.last_sync = Instant::now();
+        self.is_dirty = false;
+        self.len = 0;
+        self.compaction_len = self.compaction_size;
+        Ok(())
+    }
+
+    /// Whether the log has grown enough since it was last compacted to be compacted
+    pub fn needs_compaction(&self) -> bool {
+        self.len + self.buffer.len() as u64 >= self.compaction_len
+    }
+
+    /// Replaces the log with one holding only the records `keep` selects, once the files
+    /// holding the other records are sealed, syncing them first unless the policy leaves
+    /// syncing to the operating system. A crash leaves either the old or the new log.
+    pub fn compact(
+        &mut self,
+        sealed_files: &[PathBuf],
+        keep: impl Fn(&WalRecord) -> bool,
+    ) -> Result<(), io::Error> {
+        self.commit()?;
+        self.sync_sealed_files(sealed_files)?;
+
+        let bytes = fs::read(&self.path)?;
+        let mut kept = Vec::new();
+        let mut start = 0;
+        for (record, end) in Self::parse_records(&bytes) {
+            if keep(&record) {
+                kept.extend_from_slice(&bytes[start..end]);
+            }
+            start = end;
+        }
+
+        let compaction_path = Self::compaction_path(&self.path);
+        let mut file = File::create(&compaction_path)?;
+        file.write_all(&kept)?;
+        if self.sync_policy != SyncPolicy::None {
+            file.sync_all()?;
+        }
+        fs::rename(&compaction_path, &self.path)?;
+        if self.sync_policy != SyncPolicy::None {
+            if let Some(dir) = self.path.parent() {
+                File::open(dir)?.sync_all()?;
+            }
+        }
+
+        self.file = OpenOptions::new().append(true).open(&self.path)?;
+        self.last_sync = Instant::now();
+        self.is_dirty = false;
+        self.len = kept.len() as u64;
+        self.compaction_len = self.compaction_size.max(2 * self.len);
+        Ok(())
+    }
+}
+
+#[cfg(test)]
+impl Wal {
+    /// Closes the log as a crash would, losing the records that were not committed
+    pub fn crash(mut self) {
+        self.buffer.clear();
+    }
+
+    /// Sets the smallest size of the log in bytes at which it is compacted
+    pub fn set_compaction_size(&mut self, compaction_size: u64) {
+        self.compaction_size = compaction_size;
+        self.compaction_len = compaction_size.max(2 * self.len);
+    }
+}
+
+impl Drop for Wal {
+    /// Commits the buffered records and syncs them unless the policy leaves syncing to the
+    /// operating system, also when the interval of `SyncPolicy::Interval` has not passed
+    fn drop(&mut self) {
+        let _ = self.commit();
+        if self.sync_policy != SyncPolicy::None {
+            let _ = self.sync();
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::utils::test::*;
+
+    #[test]
+    fn test_wal_read_back() {
+        set_up_dirs!(dirs, "db");
+        let path = dirs[0].join(WAL_FILE_NAME);
+        let stream_id = Uuid::new_v4();
+
+        let mut wal = Wal::open(&path).unwrap();
+        for i in 0..10000u64 {
+            wal.append(stream_id, i, (i * 3).into(), ValueType::UInteger64)
+                .unwrap();
+        }
+        // Records are written in groups
+        assert!(fs::metadata(&path).unwrap().len() < 10000 * RECORD_SIZE as u64);
+        wal.commit().unwrap();
+        assert_eq!(
+            fs::metadata(&path).unwrap().len(),
+            10000 * RECORD_SIZE as u64
+        );
+        drop(wal);
+
+        // A torn record at the end is ignored
+        let mut file = OpenOptions::new().append(true).open(&path).unwrap();
+        file.write_all(&[1, 2, 3]).unwrap();
+
+        let mut wal = Wal::open(&path).unwrap();
+        let records = wal.read_records().unwrap();
+        assert_eq!(records.len(), 10000);
+        for (i, record) in records.iter().enumerate() {
+            let WalRecord::Entry {
+                stream_id: record_stream_id,
+                timestamp,
+                value,
+                value_type,
+            } = record
+            else {
+                panic!("Expected an entry of a single-value stream!");
+            };
+            assert_eq!(*record_stream_id, stream_id);
+            assert_eq!(*timestamp, i as u64);
+            assert_eq!(value.get_uinteger64(), i as u64 * 3);
+            assert_eq!(*value_type, ValueType::UInteger64);
+        }
+
+        wal.checkpoint(&[]).unwrap();
+        assert_eq!(fs::metadata(&path).unwrap().len(), 0);
+        assert!(wal.read_records().unwrap().is_empty());
+    }
+
+    #[test]
+    fn test_wal_single_writer() {
+        set_up_dirs!(dirs, "db");
+        let path = dirs[0].join(WAL_FILE_NAME);
+
+        let wal = Wal::open(&path).unwrap();
+        assert!(Wal::open(&path).is_err());
+        drop(wal);
+        assert!(Wal::open(&path).is_ok());
+    }
+
+    #[test]
+    fn test_wal_fields_and_compaction() {
+        set_up_dirs!(dirs, "db");
+        let path = dirs[0].join(WAL_FILE_NAME);
+        let (stream_id, field_stream_id) = (Uuid::new_v4(), Uuid::new_v4());
+        let fields = [
+            Field::new("requests", ValueType::UInteger64),
+            Field::new("latency", ValueType::Float64),
+        ];
+
+        let mut wal = Wal::open(&path).unwrap();
+        for i in 0..100u64 {
+            wal.append(stream_id, i, i.into(), ValueType::UInteger64)
+                .unwrap();
+            wal.append_fields(field_stream_id, i, &[i.into(), (i as f64).into()], &fields)
+                .unwrap();
+        }
+        wal.append_fields(
+            field_stream_id,
+            100,
+            &[100u64.into(), 100.0.into()],
+            &fields,
+        )
+        .unwrap();
+        wal.commit().unwrap();
+
+        // An entry missing its last field value is ignored
+        let len = fs::metadata(&path).unwrap().len();
+        OpenOptions::new()
+            .write(true)
+            .open(&path)
+            .unwrap()
+            .set_len(len - RECORD_SIZE as u64)
+            .unwrap();
+        let records = wal.read_records().unwrap();
+        assert_eq!(records.len(), 200);
+
+        // Only the entries of the field stream from 50 are kept
+        wal.compact(&[], |record| {
+            record.stream_id() == field_stream_id && record.timestamp() >= 50
+        })
+        .unwrap();
+        assert_eq!(
+            fs::metadata(&path).unwrap().len(),
+            50 * 2 * RECORD_SIZE as u64
+        );
+
+        let records = wal.read_records().unwrap();
+        assert_eq!(records.len(), 50);
+        for (i, record) in (50..100u64).zip(&records) {
+            let WalRecord::Fields {
+                stream_id,
+                timestamp,
+                values,
+            } = record
+            else {
+                panic!("Expected an entry of a multi-field stream!");
+            };
+            assert_eq!(*stream_id, field_stream_id);
+            assert_eq!(*timestamp, i);
+            assert_eq!(values[0].get_uinteger64(), i);
+            assert_eq!(values[1].get_float64(), i as f64);
+        }
+
+        // Records are appended to the compacted log
+        wal.append(stream_id, 100, 100u64.into(), ValueType::UInteger64)
+            .unwrap();
+        wal.commit().unwrap();
+        assert_eq!(wal.read_records().unwrap().len(), 51);
+    }
+}
@@ -135,6 +135,7 @@ impl Drop for InMemoryWriter {
 mod tests {
     use super::*;
     use crate::utils::test::*;
+    use crate::CURRENT_VERSION;
     use std::fs;
 
     // Gets all files from directory sorted from smallest to highest file name suffix
@@ -185,7 +186,7 @@ mod tests {
         let indexer = Rc::new(RefCell::new(Indexer::new(dirs[0].clone()).unwrap()));
         indexer.borrow_mut().create_store().unwrap();
 
-        let mut writer = InMemoryWriter::new(dirs[0].clone(), indexer, Version(0));
+        let mut writer = InMemoryWriter::new(dirs[0].clone(), indexer, CURRENT_VERSION);
         let mut timestamps = Vec::<Timestamp>::new();
         let mut values = Vec::<Value>::new();
 
@@ -220,7 +221,7 @@ mod tests {
 
         let indexer = Rc::new(RefCell::new(Indexer::new(dirs[0].clone()).unwrap()));
         indexer.borrow_mut().create_store().unwrap();
-        let mut writer = InMemoryWriter::new(dirs[0].clone(), indexer, Version(0));
+        let mut writer = InMemoryWriter::new(dirs[0].clone(), indexer, CURRENT_VERSION);
 
         let mut timestamps = [Vec::<Timestamp>::new(), Vec::<Timestamp>::new()];
         let mut values = [Vec::<Value>::new(), Vec::<Value>::new()];
@@ -259,7 +260,7 @@ mod tests {
         let mut base: usize = 0;
 
         let indexer = Rc::new(RefCell::new(Indexer::new(dirs[0].clone()).unwrap()));
-        let mut writer = InMemoryWriter::new(dirs[0].clone(), indexer, Version(0));
+        let mut writer = InMemoryWriter::new(dirs[0].clone(), indexer, CURRENT_VERSION);
         let mut timestamps_per_file = [
             Vec::<Timestamp>::new(),
             Vec::<Timestamp>::new(),
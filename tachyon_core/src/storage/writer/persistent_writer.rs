@@ -1,4 +1,7 @@
-use super::super::file::PartiallyPersistentDataFile;
+use super::super::compression::CodecPolicy;
+use super::super::fields::{Field, FieldFile, FieldHeader};
+use super::super::file::{PartiallyPersistentDataFile, TimeDataFile};
+use super::super::wal::{SyncPolicy, Wal, WalRecord, WAL_FILE_NAME};
 use super::super::MAX_NUM_ENTRIES;
 use super::Writer;
 use crate::query::indexer::Indexer;
@@ -6,8 +9,10 @@ use crate::{StreamId, Timestamp, Value, ValueType, Version, FILE_EXTENSION};
 use std::cell::RefCell;
 use std::collections::HashMap;
 use std::fs;
+use std::io;
 use std::path::{Path, PathBuf};
 use std::rc::Rc;
+use std::time::Duration;
 use uuid::Uuid;
 
 pub struct PersistentWriter {
@@ -15,9 +20,244 @@ pub struct PersistentWriter {
     root: PathBuf,
     indexer: Rc<RefCell<Indexer>>,
     version: Version,
+
+    default_codec_policy: CodecPolicy, // Policy of streams without one in the indexer
+
+    open_field_files: HashMap<Uuid, FieldFile>, // Multi-field stream ID to file being written
+
+    wal: Option<Wal>,           // None if the writer is read-only
+    sealed_files: Vec<PathBuf>, // Files sealed since the WAL was last emptied
 }
 
 impl PersistentWriter {
+    /// Creates a writer that logs its entries to the WAL of `root`, failing if another writer
+    /// holds the WAL
+    pub fn open(
+        root: impl AsRef<Path>,
+        indexer: Rc<RefCell<Indexer>>,
+        version: Version,
+    ) -> Result<Self, io::Error> {
+        let wal = Wal::open(root.as_ref().join(WAL_FILE_NAME))?;
+        Ok(Self::with_wal(root, indexer, version, Some(wal)))
+    }
+
+    /// Creates a writer that cannot write, which never touches the WAL so that it can be
+    /// used while another writer holds it
+    pub fn new_read_only(
+        root: impl AsRef<Path>,
+        indexer: Rc<RefCell<Indexer>>,
+        version: Version,
+    ) -> Self {
+        Self::with_wal(root, indexer, version, None)
+    }
+
+    fn with_wal(
+        root: impl AsRef<Path>,
+        indexer: Rc<RefCell<Indexer>>,
+        version: Version,
+        wal: Option<Wal>,
+    ) -> Self {
+        PersistentWriter {
+            open_data_files: HashMap::new(),
+            root: root.as_ref().to_path_buf(),
+            indexer,
+            version,
+            default_codec_policy: CodecPolicy::Default,
+
+            open_field_files: HashMap::new(),
+
+            wal,
+            sealed_files: Vec::new(),
+        }
+    }
+
+    fn wal(&mut self) -> &mut Wal {
+        self.wal
+            .as_mut()
+            .expect("Cannot write through a read-only connection!")
+    }
+
+    /// Sets how new files of streams without their own policy choose their codec
+    pub fn set_codec_policy(&mut self, policy: CodecPolicy) {
+        self.default_codec_policy = policy;
+    }
+
+    /// Sets when the entries logged to the WAL are synced, `interval` is only used by
+    /// `SyncPolicy::Interval`
+    pub fn set_sync_policy(&mut self, policy: SyncPolicy, interval: Duration) {
+        if let Some(wal) = &mut self.wal {
+            wal.set_sync_policy(policy, interval);
+        }
+    }
+
+    /// Makes the entries written so far durable as the sync policy allows, without sealing
+    /// their files. The headers of the open files are checkpointed, so that queries of them only
+    /// decode the blocks written since the last commit.
+    pub fn commit(&mut self) {
+        self.wal().commit().unwrap();
+        for file in self.open_data_files.values_mut() {
+            file.checkpoint().unwrap();
+        }
+    }
+
+    /// Writes the entries of the WAL that are not stored yet, which a previous writer logged
+    /// but did not seal, then seals every file and empties the WAL. A read-only writer leaves
+    /// the WAL to the writer holding it.
+    pub fn replay_wal(&mut self) {
+        let Some(wal) = &self.wal else {
+            return;
+        };
+        let records = wal.read_records().unwrap();
+        if records.is_empty() {
+            return;
+        }
+
+        // Stream ID to the last timestamp stored and the fields of a multi-field stream
+        let mut streams = HashMap::new();
+        for record in records {
+            let (last_timestamp, fields) = streams.entry(record.stream_id()).or_insert_with(|| {
+                let fields = self.indexer.borrow().get_stream_fields(record.stream_id());
+                let last_timestamp =
+                    self.last_stored_timestamp(record.stream_id(), fields.is_some());
+                (last_timestamp, fields)
+            });
+            if last_timestamp.is_some_and(|last_timestamp| record.timestamp() <= last_timestamp) {
+                continue;
+            }
+
+            match record {
+                WalRecord::Entry {
+                    stream_id,
+                    timestamp,
+                    value,
+                    value_type,
+                } => self.write_entry(stream_id, timestamp, value, value_type),
+                WalRecord::Fields {
+                    stream_id,
+                    timestamp,
+                    values,
+                } => {
+                    // The entries of a multi-field stream deleted since are dropped
+                    if let Some(fields) = fields {
+                        self.write_field_entry(stream_id, timestamp, &values, fields);
+                    }
+                }
+            }
+        }
+
+        self.flush_all();
+    }
+
+    /// Gets the last timestamp stored in the files of a stream, including a data file that was
+    /// not sealed. Multi-field files are only indexed once they are sealed.
+    fn last_stored_timestamp(&self, stream_id: Uuid, is_field_stream: bool) -> Option<Timestamp> {
+        let files = self
+            .indexer
+            .borrow()
+            .get_required_files(stream_id, 0, Timestamp::MAX)
+            .unwrap();
+
+        let path = files.iter().rev().find(|path| path.exists())?;
+        Some(if is_field_stream {
+            FieldHeader::read(path).unwrap().max_timestamp
+        } else {
+            TimeDataFile::read_header(path.clone()).max_timestamp
+        })
+    }
+
+    fn codec_policy(&self, stream_id: Uuid) -> CodecPolicy {
+        self.indexer
+            .borrow()
+            .get_stream_codec_policy(stream_id)
+            .unwrap_or(self.default_codec_policy)
+    }
+
+    /// Writes an entry of a multi-field stream, with a value for every field in order.
+    /// Its files are only indexed once they are sealed, when full or on flush.
+    pub fn write_fields(
+        &mut self,
+        stream_id: Uuid,
+        ts: Timestamp,
+        values: &[Value],
+        fields: &[Field],
+    ) {
+        self.wal()
+            .append_fields(stream_id, ts, values, fields)
+            .unwrap();
+        self.write_field_entry(stream_id, ts, values, fields);
+        self.compact_wal();
+    }
+
+    fn write_field_entry(
+        &mut self,
+        stream_id: Uuid,
+        ts: Timestamp,
+        values: &[Value],
+        fields: &[Field],
+    ) {
+        let file = self.open_field_files.entry(stream_id).or_insert_with(|| {
+            FieldFile::new(
+                self.version,
+                StreamId(stream_id.as_u128()),
+                fields,
+                PersistentWriter::derive_file_path(&self.root, stream_id, ts),
+            )
+            .unwrap()
+        });
+
+        file.write(ts, values).unwrap();
+        if file.num_entries() >= MAX_NUM_ENTRIES {
+            let mut file = self.open_field_files.remove(&stream_id).unwrap();
+            self.seal_field_file(stream_id, &mut file).unwrap();
+        }
+    }
+
+    fn seal_field_file(&mut self, stream_id: Uuid, file: &mut FieldFile) -> Result<(), io::Error> {
+        file.seal()?;
+        self.indexer
+            .borrow_mut()
+            .insert_or_replace_file(
+                stream_id,
+                &file.path,
+                file.header.min_timestamp,
+                file.header.max_timestamp,
+            )
+            .unwrap();
+        self.sealed_files.push(file.path.clone());
+        Ok(())
+    }
+
+    /// Compacts the WAL once it has grown enough, dropping the entries of sealed files. The
+    /// entries of a stream are kept from the first entry of its open file.
+    /// Precondition: Every entry logged is written to its file
+    fn compact_wal(&mut self) {
+        let Some(wal) = &mut self.wal else {
+            return;
+        };
+        if !wal.needs_compaction() {
+            return;
+        }
+
+        let mut min_timestamps: HashMap<Uuid, Timestamp> = self
+            .open_data_files
+            .iter()
+            .map(|(stream_id, file)| (*stream_id, file.header.borrow().min_timestamp))
+            .collect();
+        min_timestamps.extend(
+            self.open_field_files
+                .iter()
+                .map(|(stream_id, file)| (*stream_id, file.header.min_timestamp)),
+        );
+
+        wal.compact(&self.sealed_files, |record| {
+            min_timestamps
+                .get(&record.stream_id())
+                .is_some_and(|min_timestamp| record.timestamp() >= *min_timestamp)
+        })
+        .unwrap();
+        self.sealed_files.clear();
+    }
+
     fn derive_file_path(root: impl AsRef<Path>, stream_id: Uuid, ts: Timestamp) -> PathBuf {
         root.as_ref()
             .join(format!("{}/{}.{}", stream_id, ts, FILE_EXTENSION))
@@ -36,59 +276,64 @@ impl PersistentWriter {
             .get_open_files_for_stream_id(stream_id)
             .unwrap();
 
-        if open_file.len() == 1 {
-            let file_path = &open_file[0];
-            PartiallyPersistentDataFile::new(
-                self.version,
-                StreamId(stream_id.as_u128()),
-                value_type,
-                file_path.clone(),
-            )
-            .partial_init(ts, v)
+        let mut open_file = (open_file.len() == 1).then(|| open_file[0].clone());
+        if let Some(file_path) = &open_file {
+            if file_path.exists() && !TimeDataFile::is_resumable(file_path) {
+                // Files of older versions are closed as they are and the stream continues in a
+                // new file
+                let header = TimeDataFile::read_header(file_path.clone());
+                self.indexer
+                    .borrow_mut()
+                    .insert_or_replace_file(
+                        stream_id,
+                        file_path,
+                        header.min_timestamp,
+                        header.max_timestamp,
+                    )
+                    .unwrap();
+                open_file = None;
+            }
+        }
+
+        let file_path = if let Some(file_path) = open_file {
+            if file_path.exists() {
+                return PartiallyPersistentDataFile::new(
+                    self.version,
+                    StreamId(stream_id.as_u128()),
+                    value_type,
+                    file_path,
+                )
+                .partial_init(ts, v);
+            }
+
+            // The file was left while its first entries were buffered to choose its codec, so
+            // nothing was written and it starts again from the WAL
+            file_path
         } else {
             let file_path = PersistentWriter::derive_file_path(&self.root, stream_id, ts);
             self.indexer
                 .borrow_mut()
                 .insert_new_file(stream_id, &file_path, ts, None)
                 .unwrap();
+            file_path
+        };
 
-            PartiallyPersistentDataFile::new(
-                self.version,
-                StreamId(stream_id.as_u128()),
-                value_type,
-                file_path.clone(),
-            )
-            .lazy_init(ts, v)
-        }
-    }
-}
-
-impl Writer for PersistentWriter {
-    fn new(root: impl AsRef<Path>, indexer: Rc<RefCell<Indexer>>, version: Version) -> Self {
-        PersistentWriter {
-            open_data_files: HashMap::new(),
-            root: root.as_ref().to_path_buf(),
-            indexer,
-            version,
-        }
+        PartiallyPersistentDataFile::new(
+            self.version,
+            StreamId(stream_id.as_u128()),
+            value_type,
+            file_path,
+        )
+        .with_tolerance(self.indexer.borrow().get_stream_tolerance(stream_id))
+        .lazy_init(ts, v, self.codec_policy(stream_id))
     }
 
-    fn write(&mut self, stream_id: Uuid, ts: Timestamp, v: Value, value_type: ValueType) {
+    fn write_entry(&mut self, stream_id: Uuid, ts: Timestamp, v: Value, value_type: ValueType) {
         if let Some(file) = self.open_data_files.get_mut(&stream_id) {
             // Use the existing file if available
             file.write(ts, v).unwrap();
             if file.num_entries() >= MAX_NUM_ENTRIES {
-                file.flush().unwrap();
-                self.indexer
-                    .borrow_mut()
-                    .insert_or_replace_file(
-                        stream_id,
-                        &file.path,
-                        file.header.borrow().min_timestamp,
-                        file.header.borrow().max_timestamp,
-                    )
-                    .unwrap();
-                self.open_data_files.remove_entry(&stream_id);
+                self.seal_data_file(stream_id);
             }
         } else {
             let file: PartiallyPersistentDataFile =
@@ -97,6 +342,86 @@ impl Writer for PersistentWriter {
         }
     }
 
+    /// Writes a batch of entries of a stream, looking its open file up once per file rather
+    /// than once per entry.
+    /// Precondition: `timestamps` and `values` have the same length
+    pub fn write_batch(
+        &mut self,
+        stream_id: Uuid,
+        timestamps: &[Timestamp],
+        values: &[Value],
+        value_type: ValueType,
+    ) {
+        let wal = self.wal();
+        for (&ts, &v) in timestamps.iter().zip(values) {
+            wal.append(stream_id, ts, v, value_type).unwrap();
+        }
+
+        let mut written = 0;
+        while written < timestamps.len() {
+            let Some(file) = self.open_data_files.get_mut(&stream_id) else {
+                self.write_entry(stream_id, timestamps[written], values[written], value_type);
+                written += 1;
+                continue;
+            };
+
+            written += file
+                .write_batch(&timestamps[written..], &values[written..])
+                .unwrap();
+            if file.num_entries() >= MAX_NUM_ENTRIES {
+                self.seal_data_file(stream_id);
+            }
+        }
+        self.compact_wal();
+    }
+
+    /// Seals the open file of a stream and closes it in the indexer
+    fn seal_data_file(&mut self, stream_id: Uuid) {
+        let mut file = self.open_data_files.remove(&stream_id).unwrap();
+        file.flush().unwrap();
+        self.indexer
+            .borrow_mut()
+            .insert_or_replace_file(
+                stream_id,
+                &file.path,
+                file.header.borrow().min_timestamp,
+                file.header.borrow().max_timestamp,
+            )
+            .unwrap();
+        self.sealed_files.push(file.path);
+    }
+}
+
+#[cfg(test)]
+impl PersistentWriter {
+    /// Stops the writer as a crash would, leaving its files unsealed and releasing the WAL
+    /// with only the committed entries
+    pub fn crash(&mut self) {
+        std::mem::forget(std::mem::take(&mut self.open_data_files));
+        std::mem::forget(std::mem::take(&mut self.open_field_files));
+        self.sealed_files.clear();
+        if let Some(wal) = self.wal.take() {
+            wal.crash();
+        }
+    }
+
+    /// Sets the smallest size of the WAL in bytes at which it is compacted
+    pub fn set_wal_compaction_size(&mut self, compaction_size: u64) {
+        self.wal().set_compaction_size(compaction_size);
+    }
+}
+
+impl Writer for PersistentWriter {
+    fn new(root: impl AsRef<Path>, indexer: Rc<RefCell<Indexer>>, version: Version) -> Self {
+        Self::open(root, indexer, version).unwrap()
+    }
+
+    fn write(&mut self, stream_id: Uuid, ts: Timestamp, v: Value, value_type: ValueType) {
+        self.wal().append(stream_id, ts, v, value_type).unwrap();
+        self.write_entry(stream_id, ts, v, value_type);
+        self.compact_wal();
+    }
+
     fn flush_all(&mut self) {
         for (stream_id, file) in self.open_data_files.iter_mut() {
             file.flush().unwrap();
@@ -111,8 +436,18 @@ impl Writer for PersistentWriter {
                     file.header.borrow().max_timestamp,
                 )
                 .unwrap();
+            self.sealed_files.push(file.path.clone());
         }
         self.open_data_files.clear();
+
+        for (stream_id, mut file) in std::mem::take(&mut self.open_field_files) {
+            self.seal_field_file(stream_id, &mut file).unwrap();
+        }
+
+        if let Some(wal) = &mut self.wal {
+            wal.checkpoint(&self.sealed_files).unwrap();
+        }
+        self.sealed_files.clear();
     }
 
     fn create_stream(&self, stream_id: Uuid) {
@@ -123,12 +458,39 @@ impl Writer for PersistentWriter {
     }
 }
 
+impl Drop for PersistentWriter {
+    /// Seals the open files with their resume point but leaves them open in the indexer, so
+    /// the next writer continues them without decoding their entries. Multi-field files cannot
+    /// be continued, so they are sealed and indexed. Then empties the WAL.
+    fn drop(&mut self) {
+        for file in self.open_data_files.values_mut() {
+            if file.flush().is_err() {
+                return;
+            }
+            self.sealed_files.push(file.path.clone());
+        }
+        for (stream_id, mut file) in std::mem::take(&mut self.open_field_files) {
+            if self.seal_field_file(stream_id, &mut file).is_err() {
+                return;
+            }
+        }
+        if let Some(wal) = &mut self.wal {
+            let _ = wal.checkpoint(&self.sealed_files);
+        }
+    }
+}
+
 #[cfg(test)]
 mod tests {
-    use super::super::super::file::TimeDataFile;
+    use super::super::super::compression::Codec;
+    use super::super::super::fields::FieldCursor;
+    use super::super::super::file::{Cursor, ScanHint, TimeDataFile};
+    use super::super::super::page_cache::PageCache;
     use super::*;
     use crate::utils::test::*;
+    use crate::{Vector, CURRENT_VERSION};
     use std::fs;
+    use std::sync::Arc;
 
     // Gets all files from directory sorted from smallest to highest file name suffix
     fn get_files(dir: &Path) -> Vec<TimeDataFile> {
@@ -178,7 +540,7 @@ mod tests {
         let indexer = Rc::new(RefCell::new(Indexer::new(dirs[0].clone()).unwrap()));
         indexer.borrow_mut().create_store().unwrap();
 
-        let mut writer = PersistentWriter::new(dirs[0].clone(), indexer, Version(0));
+        let mut writer = PersistentWriter::new(dirs[0].clone(), indexer, CURRENT_VERSION);
         let mut timestamps = Vec::<Timestamp>::new();
         let mut values = Vec::<Value>::new();
 
@@ -220,7 +582,8 @@ mod tests {
         let batch_size = 12801; // a multiple 128 + 1 to match the compression engine.
 
         {
-            let mut writer = PersistentWriter::new(dirs[0].clone(), indexer.clone(), Version(0));
+            let mut writer =
+                PersistentWriter::new(dirs[0].clone(), indexer.clone(), CURRENT_VERSION);
             writer.create_stream(stream_id);
 
             for i in 0..batch_size {
@@ -246,7 +609,8 @@ mod tests {
         }
 
         {
-            let mut writer = PersistentWriter::new(dirs[0].clone(), indexer.clone(), Version(0));
+            let mut writer =
+                PersistentWriter::new(dirs[0].clone(), indexer.clone(), CURRENT_VERSION);
             writer.create_stream(stream_id);
 
             for i in batch_size..MAX_NUM_ENTRIES as u64 {
@@ -279,7 +643,7 @@ mod tests {
 
         let indexer = Rc::new(RefCell::new(Indexer::new(dirs[0].clone()).unwrap()));
         indexer.borrow_mut().create_store().unwrap();
-        let mut writer = PersistentWriter::new(dirs[0].clone(), indexer, Version(0));
+        let mut writer = PersistentWriter::new(dirs[0].clone(), indexer, CURRENT_VERSION);
 
         let mut timestamps = [Vec::<Timestamp>::new(), Vec::<Timestamp>::new()];
         let mut values = [Vec::<Value>::new(), Vec::<Value>::new()];
@@ -322,7 +686,7 @@ mod tests {
 
         let indexer = Rc::new(RefCell::new(Indexer::new(dirs[0].clone()).unwrap()));
         indexer.borrow_mut().create_store().unwrap();
-        let mut writer = PersistentWriter::new(dirs[0].clone(), indexer, Version(0));
+        let mut writer = PersistentWriter::new(dirs[0].clone(), indexer, CURRENT_VERSION);
         let mut timestamps_per_file = [
             Vec::<Timestamp>::new(),
             Vec::<Timestamp>::new(),
@@ -380,4 +744,604 @@ mod tests {
             }
         }
     }
+
+    #[test]
+    fn test_write_batch_persistent() {
+        set_up_dirs!(dirs, "db");
+        let stream_id = Uuid::new_v4();
+
+        let indexer = Rc::new(RefCell::new(Indexer::new(dirs[0].clone()).unwrap()));
+        indexer.borrow_mut().create_store().unwrap();
+
+        let mut writer = PersistentWriter::new(dirs[0].clone(), indexer, CURRENT_VERSION);
+        writer.create_stream(stream_id);
+
+        let n = (2.5 * MAX_NUM_ENTRIES as f32).round() as usize;
+        let timestamps: Vec<Timestamp> = (0..n as Timestamp).collect();
+        let values: Vec<Value> = (0..n as i64)
+            .map(|i| ((i % 1000) * (i % 7 - 3)).into())
+            .collect();
+
+        // Batches that start files, fill them and cross into the next one
+        for (ts, vs) in timestamps.chunks(10007).zip(values.chunks(10007)) {
+            writer.write_batch(stream_id, ts, vs, ValueType::Integer64);
+        }
+        writer.flush_all();
+
+        let files = get_files(&dirs[0].join(stream_id.to_string()));
+        assert_eq!(files.len(), 3);
+
+        let mut start = 0;
+        for file in &files {
+            let end = start + file.num_entries();
+            assert_eq!(file.timestamps, timestamps[start..end]);
+            let expected: Vec<i64> = values[start..end]
+                .iter()
+                .map(Value::get_integer64)
+                .collect();
+            let actual: Vec<i64> = file.values.iter().map(Value::get_integer64).collect();
+            assert_eq!(actual, expected);
+
+            assert_eq!(file.header.min_timestamp, timestamps[start]);
+            assert_eq!(file.header.max_timestamp, timestamps[end - 1]);
+            assert_eq!(
+                file.header.value_sum.get_integer64(),
+                expected.iter().sum::<i64>()
+            );
+            assert_eq!(
+                file.header.min_value.get_integer64(),
+                *expected.iter().min().unwrap()
+            );
+            assert_eq!(
+                file.header.max_value.get_integer64(),
+                *expected.iter().max().unwrap()
+            );
+            start = end;
+        }
+        assert_eq!(start, n);
+    }
+
+    #[test]
+    fn test_write_single_complete_float_file_persistent_in_steps() {
+        set_up_dirs!(dirs, "db");
+        let stream_id = Uuid::new_v4();
+
+        let indexer = Rc::new(RefCell::new(Indexer::new(dirs[0].clone()).unwrap()));
+        indexer.borrow_mut().create_store().unwrap();
+
+        let mut timestamps = Vec::<Timestamp>::new();
+        let mut values = Vec::<Value>::new();
+
+        let batch_size = 12801; // a multiple of 8 + 1 to match the compression engine.
+
+        for range in [0..batch_size, batch_size..MAX_NUM_ENTRIES as u64] {
+            let mut writer =
+                PersistentWriter::new(dirs[0].clone(), indexer.clone(), CURRENT_VERSION);
+            writer.create_stream(stream_id);
+
+            for i in range {
+                let ts = i as Timestamp;
+                let v = (230.0 + (i % 50) as f64 * 0.25).into();
+                writer.write(stream_id, ts, v, ValueType::Float64);
+                timestamps.push(ts);
+                values.push(v);
+            }
+        } // writer drops
+
+        let files = get_files(&dirs[0].join(stream_id.to_string()));
+
+        assert_eq!(files.len(), 1);
+        assert_eq!(files[0].header.codec, Codec::FloatV1);
+        assert_eq!(files[0].timestamps, timestamps);
+        assert_eq!(files[0].values.len(), values.len());
+        #[allow(clippy::needless_range_loop)]
+        for i in 0..values.len() {
+            assert!(files[0].values[i].eq_same(ValueType::Float64, &values[i]));
+        }
+    }
+
+    #[test]
+    fn test_write_quantized_float_file_persistent_in_steps() {
+        set_up_dirs!(dirs, "db");
+        let stream_id = Uuid::new_v4();
+
+        let indexer = Rc::new(RefCell::new(Indexer::new(dirs[0].clone()).unwrap()));
+        indexer.borrow_mut().create_store().unwrap();
+        indexer
+            .borrow_mut()
+            .insert_stream_tolerance(stream_id, 0.01)
+            .unwrap();
+
+        let mut timestamps = Vec::<Timestamp>::new();
+        let mut values = Vec::<f64>::new();
+
+        let batch_size = 12801;
+
+        for range in [0..batch_size, batch_size..MAX_NUM_ENTRIES as u64] {
+            let mut writer =
+                PersistentWriter::new(dirs[0].clone(), indexer.clone(), CURRENT_VERSION);
+            writer.create_stream(stream_id);
+
+            for i in range {
+                let ts = i as Timestamp;
+                let v = 230.0 + (i as f64 / 100.0).sin() * 7.3;
+                writer.write(stream_id, ts, v.into(), ValueType::Float64);
+                timestamps.push(ts);
+                values.push(v);
+            }
+        } // writer drops
+
+        let files = get_files(&dirs[0].join(stream_id.to_string()));
+
+        assert_eq!(files.len(), 1);
+        assert_eq!(files[0].header.codec, Codec::IntV3);
+        assert_eq!(files[0].header.tolerance, 0.01);
+        assert_eq!(files[0].timestamps, timestamps);
+        assert_eq!(files[0].values.len(), values.len());
+        let mut sum = 0.0;
+        for (value, expected) in files[0].values.iter().zip(&values) {
+            assert!((value.get_float64() - expected).abs() <= 0.01 + 1e-9);
+            sum += expected;
+        }
+        let error = (files[0].header.value_sum.get_float64() - sum).abs();
+        assert!(error <= 0.01 * values.len() as f64);
+    }
+
+    #[test]
+    fn test_write_fields_persistent() {
+        set_up_dirs!(dirs, "db");
+        let stream_id = Uuid::new_v4();
+
+        let indexer = Rc::new(RefCell::new(Indexer::new(dirs[0].clone()).unwrap()));
+        indexer.borrow_mut().create_store().unwrap();
+
+        let fields = [
+            Field::new("load", ValueType::Float64),
+            Field::new("requests", ValueType::UInteger64),
+        ];
+        let num_entries = MAX_NUM_ENTRIES as u64 + 100;
+        {
+            let mut writer =
+                PersistentWriter::new(dirs[0].clone(), indexer.clone(), CURRENT_VERSION);
+            writer.create_stream(stream_id);
+            for i in 0..num_entries {
+                let values = [((i % 100) as f64 / 100.0).into(), (i * 3).into()];
+                writer.write_fields(stream_id, i, &values, &fields);
+            }
+            writer.flush_all();
+        }
+
+        let file_paths = indexer
+            .borrow()
+            .get_required_files(stream_id, 0, num_entries)
+            .unwrap();
+        assert_eq!(file_paths.len(), 2);
+
+        let page_cache = Arc::new(PageCache::new(100));
+        let mut cursor =
+            FieldCursor::new(file_paths, &["requests"], 0, num_entries, page_cache).unwrap();
+        let mut i = 0;
+        while let Some((timestamp, values)) = cursor.next_row() {
+            assert_eq!(timestamp, i);
+            assert_eq!(values[0].get_uinteger64(), i * 3);
+            i += 1;
+        }
+        assert_eq!(i, num_entries);
+    }
+
+    #[test]
+    fn test_replay_wal_fields() {
+        set_up_dirs!(dirs, "db");
+        let stream_id = Uuid::new_v4();
+
+        let indexer = Rc::new(RefCell::new(Indexer::new(dirs[0].clone()).unwrap()));
+        indexer.borrow_mut().create_store().unwrap();
+
+        let fields = [
+            Field::new("load", ValueType::Float64),
+            Field::new("requests", ValueType::UInteger64),
+        ];
+        indexer
+            .borrow_mut()
+            .insert_stream_fields(stream_id, &fields)
+            .unwrap();
+        let num_entries = MAX_NUM_ENTRIES as u64 + 100;
+        {
+            let mut writer =
+                PersistentWriter::new(dirs[0].clone(), indexer.clone(), CURRENT_VERSION);
+            writer.create_stream(stream_id);
+            for i in 0..num_entries {
+                let values = [((i % 100) as f64 / 100.0).into(), (i * 3).into()];
+                writer.write_fields(stream_id, i, &values, &fields);
+            }
+            writer.commit();
+            // The writer crashes with the last entries in a file that is not sealed
+            writer.crash();
+        }
+        {
+            let mut writer =
+                PersistentWriter::new(dirs[0].clone(), indexer.clone(), CURRENT_VERSION);
+            writer.replay_wal();
+        }
+
+        let file_paths = indexer
+            .borrow()
+            .get_required_files(stream_id, 0, num_entries)
+            .unwrap();
+        assert_eq!(file_paths.len(), 2);
+
+        let page_cache = Arc::new(PageCache::new(100));
+        let mut cursor =
+            FieldCursor::new(file_paths, &["requests"], 0, num_entries, page_cache).unwrap();
+        let mut i = 0;
+        while let Some((timestamp, values)) = cursor.next_row() {
+            assert_eq!(timestamp, i);
+            assert_eq!(values[0].get_uinteger64(), i * 3);
+            i += 1;
+        }
+        assert_eq!(i, num_entries);
+    }
+
+    #[test]
+    fn test_compact_wal() {
+        set_up_dirs!(dirs, "db");
+        let stream_id = Uuid::new_v4();
+
+        let indexer = Rc::new(RefCell::new(Indexer::new(dirs[0].clone()).unwrap()));
+        indexer.borrow_mut().create_store().unwrap();
+
+        let timestamps: Vec<Timestamp> = (0..2 * MAX_NUM_ENTRIES as u64 + 1000).collect();
+        let wal_path = dirs[0].join(WAL_FILE_NAME);
+        {
+            let mut writer =
+                PersistentWriter::new(dirs[0].clone(), indexer.clone(), CURRENT_VERSION);
+            writer.set_wal_compaction_size(64 * 1024);
+            writer.create_stream(stream_id);
+            for ts in &timestamps {
+                writer.write(stream_id, *ts, (ts * 7).into(), ValueType::UInteger64);
+            }
+            writer.commit();
+
+            // The WAL is at most twice as large as the entries of the open file were when it
+            // was last compacted
+            let wal_len = fs::metadata(&wal_path).unwrap().len();
+            assert!(wal_len <= 2 * MAX_NUM_ENTRIES as u64 * 37);
+            writer.crash();
+        }
+        {
+            let mut writer =
+                PersistentWriter::new(dirs[0].clone(), indexer.clone(), CURRENT_VERSION);
+            writer.replay_wal();
+        }
+
+        let files = get_files(&dirs[0].join(stream_id.to_string()));
+        assert_eq!(files.len(), 3);
+        let stored: Vec<Timestamp> = files
+            .iter()
+            .flat_map(|file| file.timestamps.iter().copied())
+            .collect();
+        assert_eq!(stored, timestamps);
+    }
+
+    #[test]
+    fn test_replay_wal() {
+        set_up_dirs!(dirs, "db");
+        let stream_id = Uuid::new_v4();
+
+        let indexer = Rc::new(RefCell::new(Indexer::new(dirs[0].clone()).unwrap()));
+        indexer.borrow_mut().create_store().unwrap();
+
+        let timestamps: Vec<Timestamp> = (0..1000).collect();
+        let mut writer = PersistentWriter::new(dirs[0].clone(), indexer.clone(), CURRENT_VERSION);
+        writer.create_stream(stream_id);
+        for ts in &timestamps {
+            writer.write(stream_id, *ts, (ts * 7).into(), ValueType::UInteger64);
+        }
+        writer.commit();
+        // The writer crashes without sealing, the last entries are only in the WAL
+        writer.crash();
+        drop(writer);
+
+        let wal_path = dirs[0].join(WAL_FILE_NAME);
+        assert!(fs::metadata(&wal_path).unwrap().len() > 0);
+        {
+            let mut writer =
+                PersistentWriter::new(dirs[0].clone(), indexer.clone(), CURRENT_VERSION);
+            writer.replay_wal();
+        }
+        assert_eq!(fs::metadata(&wal_path).unwrap().len(), 0);
+
+        let files = get_files(&dirs[0].join(stream_id.to_string()));
+        assert_eq!(files.len(), 1);
+        assert_ne!(files[0].header.seek_table_offset, 0);
+        assert_eq!(files[0].timestamps, timestamps);
+        for (ts, value) in timestamps.iter().zip(&files[0].values) {
+            assert_eq!(value.get_uinteger64(), ts * 7);
+        }
+    }
+
+    #[test]
+    fn test_read_only_writer() {
+        set_up_dirs!(dirs, "db");
+        let stream_id = Uuid::new_v4();
+
+        let indexer = Rc::new(RefCell::new(Indexer::new(dirs[0].clone()).unwrap()));
+        indexer.borrow_mut().create_store().unwrap();
+
+        let mut writer = PersistentWriter::new(dirs[0].clone(), indexer.clone(), CURRENT_VERSION);
+        writer.create_stream(stream_id);
+        for ts in 0..100 {
+            writer.write(stream_id, ts, ts.into(), ValueType::UInteger64);
+        }
+        writer.commit();
+
+        // Only one writer holds the WAL, and a read-only writer leaves it to that writer
+        assert!(PersistentWriter::open(dirs[0].clone(), indexer.clone(), CURRENT_VERSION).is_err());
+        let wal_path = dirs[0].join(WAL_FILE_NAME);
+        let wal_len = fs::metadata(&wal_path).unwrap().len();
+        assert!(wal_len > 0);
+        {
+            let mut reader =
+                PersistentWriter::new_read_only(dirs[0].clone(), indexer.clone(), CURRENT_VERSION);
+            reader.replay_wal();
+            reader.flush_all();
+        }
+        assert_eq!(fs::metadata(&wal_path).unwrap().len(), wal_len);
+    }
+
+    #[test]
+    fn test_resume_suspended_file() {
+        set_up_dirs!(dirs, "db");
+        let stream_id = Uuid::new_v4();
+
+        let indexer = Rc::new(RefCell::new(Indexer::new(dirs[0].clone()).unwrap()));
+        indexer.borrow_mut().create_store().unwrap();
+
+        // Every session stops in the middle of a block
+        let timestamps: Vec<Timestamp> = (0..3000).collect();
+        for session in timestamps.chunks(777) {
+            let mut writer =
+                PersistentWriter::new(dirs[0].clone(), indexer.clone(), CURRENT_VERSION);
+            writer.create_stream(stream_id);
+            writer.replay_wal();
+            for ts in session {
+                writer.write(stream_id, *ts, (ts * ts).into(), ValueType::UInteger64);
+            }
+        }
+
+        let open_files = indexer
+            .borrow()
+            .get_open_files_for_stream_id(stream_id)
+            .unwrap();
+        assert_eq!(open_files.len(), 1);
+        assert_eq!(fs::metadata(dirs[0].join(WAL_FILE_NAME)).unwrap().len(), 0);
+
+        let files = get_files(&dirs[0].join(stream_id.to_string()));
+        assert_eq!(files.len(), 1);
+        assert_ne!(files[0].header.seek_table_offset, 0);
+        assert_eq!(files[0].header.count, 3000);
+        assert_eq!(files[0].timestamps, timestamps);
+        for (ts, value) in timestamps.iter().zip(&files[0].values) {
+            assert_eq!(value.get_uinteger64(), ts * ts);
+        }
+    }
+
+    #[test]
+    fn test_query_resumed_file() {
+        set_up_dirs!(dirs, "db");
+        let stream_id = Uuid::new_v4();
+
+        let indexer = Rc::new(RefCell::new(Indexer::new(dirs[0].clone()).unwrap()));
+        indexer.borrow_mut().create_store().unwrap();
+
+        // Blocks of immutable files are read through mappings and the chunk cache
+        let page_cache = Arc::new(PageCache::new(100));
+        page_cache.set_chunk_cache_bytes(1 << 20);
+        let query = |num_entries: u64| {
+            let indexer = indexer.borrow();
+            let file_paths = indexer
+                .get_required_files(stream_id, 0, Timestamp::MAX)
+                .unwrap();
+            let open_file = indexer
+                .get_open_files_for_stream_id(stream_id)
+                .unwrap()
+                .pop();
+            let mut cursor = Cursor::new_with_open_file(
+                file_paths,
+                open_file,
+                0,
+                Timestamp::MAX,
+                page_cache.clone(),
+                ScanHint::None,
+            )
+            .unwrap();
+
+            let mut ts = 0;
+            loop {
+                let Vector { timestamp, value } = cursor.fetch();
+                assert_eq!(timestamp, ts);
+                assert_eq!(value.get_uinteger64(), ts * 5);
+                ts += 1;
+                if cursor.next().is_none() {
+                    break;
+                }
+            }
+            assert_eq!(ts, num_entries);
+        };
+
+        // A suspended file is queried between the sessions that continue it
+        let timestamps: Vec<Timestamp> = (0..5000).collect();
+        for session in timestamps.chunks(1500) {
+            let mut writer =
+                PersistentWriter::new(dirs[0].clone(), indexer.clone(), CURRENT_VERSION);
+            writer.create_stream(stream_id);
+            for ts in session {
+                writer.write(stream_id, *ts, (ts * 5).into(), ValueType::UInteger64);
+            }
+            drop(writer);
+            query(session.last().unwrap() + 1);
+        }
+
+        // The file is closed once it is full
+        let mut writer = PersistentWriter::new(dirs[0].clone(), indexer.clone(), CURRENT_VERSION);
+        let num_entries = MAX_NUM_ENTRIES as u64;
+        for ts in timestamps.len() as u64..num_entries {
+            writer.write(stream_id, ts, (ts * 5).into(), ValueType::UInteger64);
+        }
+        drop(writer);
+        assert!(indexer
+            .borrow()
+            .get_open_files_for_stream_id(stream_id)
+            .unwrap()
+            .is_empty());
+        query(num_entries);
+    }
+
+    #[test]
+    fn test_query_unsealed_file() {
+        set_up_dirs!(dirs, "db");
+        let stream_id = Uuid::new_v4();
+
+        let indexer = Rc::new(RefCell::new(Indexer::new(dirs[0].clone()).unwrap()));
+        indexer.borrow_mut().create_store().unwrap();
+
+        let mut writer = PersistentWriter::new(dirs[0].clone(), indexer.clone(), CURRENT_VERSION);
+        writer.create_stream(stream_id);
+        for ts in 0..10000u64 {
+            writer.write(stream_id, ts, (ts * 5).into(), ValueType::UInteger64);
+        }
+        writer.commit();
+
+        // Every entry of the blocks written so far is read, not only the first one
+        let indexer = indexer.borrow();
+        let file_paths = indexer
+            .get_required_files(stream_id, 0, Timestamp::MAX)
+            .unwrap();
+        let open_file = indexer
+            .get_open_files_for_stream_id(stream_id)
+            .unwrap()
+            .pop();
+        drop(indexer);
+        let mut cursor = Cursor::new_with_open_file(
+            file_paths,
+            open_file.clone(),
+            0,
+            Timestamp::MAX,
+            Arc::new(PageCache::new(100)),
+            ScanHint::None,
+        )
+        .unwrap();
+
+        let mut ts = 0;
+        loop {
+            let Vector { timestamp, value } = cursor.fetch();
+            assert_eq!(timestamp, ts);
+            assert_eq!(value.get_uinteger64(), ts * 5);
+            ts += 1;
+            if cursor.next().is_none() {
+                break;
+            }
+        }
+        assert!(ts > 1 && ts <= 10000);
+
+        // The header is rebuilt from the checkpoint of the last commit and the blocks after it
+        for ts in 10000..20000u64 {
+            writer.write(stream_id, ts, (ts * 5).into(), ValueType::UInteger64);
+        }
+        let path = open_file.unwrap();
+        let header = TimeDataFile::read_header(path.clone());
+        assert_eq!(header, TimeDataFile::recover_data_file(path).header);
+        assert!(header.count > 10000);
+    }
+
+    #[test]
+    fn test_stream_codec_policy() {
+        set_up_dirs!(dirs, "db");
+        let stream_id = Uuid::new_v4();
+
+        let indexer = Rc::new(RefCell::new(Indexer::new(dirs[0].clone()).unwrap()));
+        indexer.borrow_mut().create_store().unwrap();
+        indexer
+            .borrow_mut()
+            .insert_stream_codec_policy(stream_id, CodecPolicy::Smallest)
+            .unwrap();
+
+        let mut writer = PersistentWriter::new(dirs[0].clone(), indexer.clone(), CURRENT_VERSION);
+        writer.create_stream(stream_id);
+        let values: Vec<f64> = (0..500)
+            .map(|i| (2150 + (i * 7919) % 300) as f64 / 100.0)
+            .collect();
+        for (ts, v) in values.iter().enumerate() {
+            writer.write(stream_id, ts as Timestamp, (*v).into(), ValueType::Float64);
+        }
+
+        // The file is indexed and readable while its entries are buffered for the trial
+        let open_file = indexer
+            .borrow()
+            .get_open_files_for_stream_id(stream_id)
+            .unwrap()
+            .pop()
+            .unwrap();
+        assert_eq!(TimeDataFile::read_data_file(open_file).timestamps, [0]);
+        drop(writer);
+
+        let files = get_files(&dirs[0].join(stream_id.to_string()));
+        assert_eq!(files.len(), 1);
+        assert_eq!(files[0].header.codec, Codec::FloatAlp);
+        assert_eq!(files[0].values.len(), values.len());
+        for (value, expected) in files[0].values.iter().zip(&values) {
+            assert_eq!(value.get_float64(), *expected);
+        }
+    }
+
+    #[test]
+    fn test_continue_legacy_file() {
+        set_up_dirs!(dirs, "db");
+        let stream_id = Uuid::new_v4();
+
+        let indexer = Rc::new(RefCell::new(Indexer::new(dirs[0].clone()).unwrap()));
+        indexer.borrow_mut().create_store().unwrap();
+
+        // A stream left open by a version without seek tables
+        let mut writer = PersistentWriter::new(dirs[0].clone(), indexer.clone(), CURRENT_VERSION);
+        writer.create_stream(stream_id);
+        let legacy_path = PersistentWriter::derive_file_path(&dirs[0], stream_id, 0);
+        let mut model = TimeDataFile::new(
+            CURRENT_VERSION,
+            StreamId(stream_id.as_u128()),
+            ValueType::UInteger64,
+        );
+        for ts in 0..1000u64 {
+            model.write_data_to_file_in_mem(ts, (ts * 5).into());
+        }
+        model.write_legacy(legacy_path.clone(), Version(2));
+        indexer
+            .borrow_mut()
+            .insert_new_file(stream_id, &legacy_path, 0, None)
+            .unwrap();
+
+        // The stream continues in a new file instead of appending to the old one
+        for ts in 1000..2000u64 {
+            writer.write(stream_id, ts, (ts * 5).into(), ValueType::UInteger64);
+        }
+        drop(writer);
+        let open_files = indexer
+            .borrow()
+            .get_open_files_for_stream_id(stream_id)
+            .unwrap();
+        assert_eq!(open_files.len(), 1);
+        assert_ne!(open_files[0], legacy_path);
+
+        let files = get_files(&dirs[0].join(stream_id.to_string()));
+        assert_eq!(files.len(), 2);
+        assert_eq!(files[0].header.version, Version(2));
+        assert_eq!(files[1].header.version, CURRENT_VERSION);
+        for (i, file) in files.iter().enumerate() {
+            let timestamps: Vec<u64> = (1000 * i as u64..1000 * (i as u64 + 1)).collect();
+            assert_eq!(file.timestamps, timestamps);
+            for (ts, value) in timestamps.iter().zip(&file.values) {
+                assert_eq!(value.get_uinteger64(), ts * 5);
+            }
+        }
+    }
 }
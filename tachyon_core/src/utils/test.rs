@@ -1,5 +1,5 @@
 use crate::storage::file::TimeDataFile;
-use crate::{StreamId, Timestamp, Value, ValueType, Version};
+use crate::{StreamId, Timestamp, Value, ValueType, CURRENT_VERSION};
 use std::fs;
 use std::path::{Path, PathBuf};
 
@@ -148,7 +148,7 @@ impl Drop for TestFile {
 
 pub fn generate_ty_file(path: PathBuf, timestamps: &[Timestamp], values: &[Value]) {
     assert!(timestamps.len() == values.len());
-    let mut model = TimeDataFile::new(Version(0), StreamId(0), ValueType::UInteger64);
+    let mut model = TimeDataFile::new(CURRENT_VERSION, StreamId(0), ValueType::UInteger64);
 
     for i in 0..timestamps.len() {
         model.write_data_to_file_in_mem(timestamps[i], values[i])
@@ -1,10 +1,12 @@
 use axum::{
+    extract::State,
     http::StatusCode,
     routing::{get, post},
     Json, Router,
 };
 use serde::{Deserialize, Serialize};
-use tachyon_core::{Connection, Timestamp, ValueType, Vector};
+use std::sync::Arc;
+use tachyon_core::{Connection, ConnectionOptions, PageCache, Timestamp, ValueType, Vector};
 use tower_http::{cors::CorsLayer, trace::TraceLayer};
 
 #[derive(Deserialize)]
@@ -25,10 +27,11 @@ struct PerformQueryResponse {
 }
 
 async fn perform_query(
+    State(page_cache): State<Arc<PageCache>>,
     Json(request): Json<PerformQueryRequest>,
 ) -> Result<Json<PerformQueryResponse>, (StatusCode, String)> {
-    let mut connection =
-        Connection::new(request.path).map_err(|err| (StatusCode::BAD_REQUEST, err.to_string()))?;
+    let mut connection = Connection::new_read_only_with_page_cache(request.path, page_cache)
+        .map_err(|err| (StatusCode::BAD_REQUEST, err.to_string()))?;
     let mut query = connection
         .prepare_query(request.query, request.start, request.end)
         .map_err(|err| (StatusCode::BAD_REQUEST, err.to_string()))?;
@@ -81,7 +84,15 @@ pub async fn main() {
         .route("/health", get(|| async {}))
         .route("/query", post(perform_query))
         .layer(CorsLayer::permissive())
-        .layer(TraceLayer::new_for_http());
+        .layer(TraceLayer::new_for_http())
+        .with_state(
+            ConnectionOptions {
+                // Dashboards query the same recent blocks over and over
+                chunk_cache_bytes: 64 * 1024 * 1024,
+                ..Default::default()
+            }
+            .create_page_cache(),
+        );
 
     let listener = tokio::net::TcpListener::bind("0.0.0.0:8080").await.unwrap();
     axum::serve(listener, app).await.unwrap();